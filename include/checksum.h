@@ -0,0 +1,30 @@
+#pragma once
+
+#include "simplefs.h"
+#include <cstdint>
+#include <cstddef>
+
+// CRC32C（Castagnoli多项式），crc为之前数据的结果，首次调用传0，可分段连续计算
+// x86-64上运行时检测SSE4.2/PCLMUL，使用硬件指令三路并行计算；否则使用查表实现
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+// 当前使用的实现名称，用于日志和基准测试
+const char* crc32c_implementation_name();
+
+inline bool has_metadata_csum(const SimpleFS_SuperBlock& sb) {
+    return (sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_METADATA_CSUM) != 0;
+}
+
+// 各类元数据的校验和，计算时校验和字段本身按零处理
+// 块组描述符、inode和目录块以各自的编号为种子，写错位置的块也能被发现
+uint32_t superblock_checksum(const SimpleFS_SuperBlock* sb);
+uint32_t group_desc_checksum(uint32_t group_idx, const SimpleFS_GroupDesc* gd);
+uint32_t bitmap_checksum(const void* bitmap, uint32_t block_size);
+uint32_t inode_checksum(uint32_t inode_num, const void* raw_inode, uint32_t inode_size);
+
+// 校验磁盘上的inode；从未写入过的全零inode视为有效
+bool verify_inode_checksum(uint32_t inode_num, const void* raw_inode, uint32_t inode_size);
+
+// 目录块尾部：块末尾的一个伪目录项（inode为0），保存整块的校验和
+// 目录项链在尾部之前结束，扫描目录的代码把它当作空目录项跳过
+void set_dir_block_checksum(uint32_t block_num, void* block, uint32_t block_size);
+bool verify_dir_block_checksum(uint32_t block_num, const void* block, uint32_t block_size);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "simplefs.h"
+#include "simplefs_context.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 透明压缩（compression特性）
+// 带SIMPLEFS_INODE_FL_COMPRESS标志的文件，写入一律经过延迟分配缓存，回写时按簇压缩后重新分配块；
+// 读取时整簇解压，解压结果保存在按LRU淘汰的簇缓存中。
+// 除LZ4编解码外，所有函数都要求调用者持有fs_mutex。
+
+// LZ4块格式（不带帧头）编解码，与liblz4的LZ4_compress_default/LZ4_decompress_safe互通
+// 压缩结果超过dst_capacity时返回0
+size_t lz4_compress_block(const void* src, size_t src_size, void* dst, size_t dst_capacity);
+// 返回解压得到的字节数，输入损坏或输出超过dst_capacity时返回-1
+long lz4_decompress_block(const void* src, size_t src_size, void* dst, size_t dst_capacity);
+
+inline bool inode_is_compressed(const SimpleFS_Inode* inode) {
+    return (inode->i_flags & SIMPLEFS_INODE_FL_COMPRESS) != 0;
+}
+
+// 逻辑块所在的簇是否按压缩格式存放
+bool compress_cluster_is_compressed(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx);
+
+// 读取逻辑块在磁盘上的内容（不含延迟分配缓存），空洞读为零，返回0或-EIO
+int compress_read_block(SimpleFS_Context& context, uint32_t inode_num, const SimpleFS_Inode* inode,
+                        uint32_t logical_block_idx, void* block_buffer);
+
+// 一个簇的回写：第一阶段（prepare）分配新块并写入数据，刷新屏障之后第二阶段（install）安装映射
+struct CompressClusterWrite {
+    uint32_t cluster_start = 0;
+    bool replace_cluster = false;   // 安装前释放整簇原有的映射
+    bool compressed = false;
+    std::vector<std::pair<uint32_t, uint32_t>> new_ptrs; // (逻辑块号, 块指针)，压缩簇包含标记
+    std::vector<uint32_t> new_blocks; // 新分配的块，放弃回写时归还
+};
+
+// cluster_data为簇内前valid_blocks个逻辑块的完整内容，dirty_slots标记其中被修改过的块
+// 能省下至少一个块时按压缩格式整簇重写；否则原来按原始格式存放的簇只就地覆盖修改过的块，
+// 原来压缩存放的簇整簇改为原始格式。goal_block为0时按inode选择分配目标
+int compress_prepare_cluster(SimpleFS_Context& context, uint32_t inode_num, const SimpleFS_Inode* inode,
+                             uint32_t cluster_start, const uint8_t* cluster_data, uint32_t valid_blocks,
+                             const std::vector<bool>& dirty_slots, uint32_t goal_block, CompressClusterWrite* plan);
+// 返回0或负的错误码；失败时未安装的新块已归还
+int compress_install_cluster(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode* inode,
+                             CompressClusterWrite& plan);
+void compress_abort_cluster(SimpleFS_Context& context, CompressClusterWrite& plan);
+
+// 释放 [start_lbn, end_lbn) 的块（截断、打洞）。压缩簇不能只释放一部分，
+// 部分落在区间内的压缩簇先把区间外的有效块（不超过i_size）放入延迟分配缓存，再整簇释放
+// 返回0或负的错误码（缓存预留失败时为-ENOSPC，此时不释放任何块）
+int compress_release_range(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode* inode,
+                           uint32_t start_lbn, uint32_t end_lbn);
+
+// 丢弃簇缓存：inode被释放时调用，之后同一inode号可能属于另一个文件
+void compress_cache_drop_inode(uint32_t inode_num);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "simplefs.h"
+#include "simplefs_context.h"
+#include "simplefs_ioctl.h"
+#include <mutex>
+
+// 在线碎片整理
+// 按块树统计文件的物理段数（按逻辑块顺序，相邻数据块物理上不连续处分段），
+// 为可迁移的块（不与其他文件共享的数据块）找一段连续的空闲空间并建立预留窗口，
+// 然后分片迁移：每片在fs_mutex下复制数据、替换块指针并释放原来的块，片间释放fs_mutex并按限速休眠，
+// 其他文件操作不会被长时间阻塞。间接块留在原处；启用快照时，被替换的块由最新快照保留。
+
+// 整理普通文件或目录，调用者已通过fs_lock持有fs_mutex，迁移的片间临时释放；返回0或负的错误码
+// 没有足够长的空闲段使段数减少时不迁移，args->extents_after等于extents_before
+int defrag_inode(SimpleFS_Context& context, std::unique_lock<std::mutex>& fs_lock, uint32_t inode_num,
+                 SimpleFS_DefragArgs* args);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "simplefs.h"
+#include "simplefs_context.h"
+#include <cstddef>
+#include <cstdint>
+
+// 延迟分配
+// 写入尚未映射的逻辑块时，数据先缓存在内存中并预留空闲块计数，
+// 回写（fsync、内存压力、定时器、卸载）时再按逻辑顺序一次性分配连续的物理块。
+// 除后台线程的启停外，所有函数都要求调用者持有fs_mutex。
+
+// 缓存一个未映射块的写入，返回0或-ENOSPC
+int delalloc_write_block(SimpleFS_Context& context, uint32_t inode_num, uint32_t logical_block_idx,
+                         uint32_t offset_in_block, const void* data, size_t length);
+
+// 若逻辑块有缓存数据则复制到block_buffer（整块，可为nullptr）并返回true
+bool delalloc_read_block(uint32_t inode_num, uint32_t logical_block_idx, void* block_buffer);
+
+// 返回 >= start_lbn 的第一个缓存块，没有则返回UINT32_MAX
+uint32_t delalloc_next_dirty_block(uint32_t inode_num, uint32_t start_lbn);
+
+// 返回从start_lbn开始的连续缓存块之后的第一个逻辑块号（start_lbn未缓存时返回start_lbn）
+uint32_t delalloc_dirty_run_end(uint32_t inode_num, uint32_t start_lbn);
+
+// 丢弃 [start_lbn, end_lbn) 内的缓存块（截断、打洞）
+void delalloc_discard_range(SimpleFS_Context& context, uint32_t inode_num, uint32_t start_lbn, uint32_t end_lbn);
+
+// 丢弃inode的全部缓存块（文件被删除）
+void delalloc_drop_inode(SimpleFS_Context& context, uint32_t inode_num);
+
+// 回写单个inode / 全部inode，返回0或负的错误码
+// 回写会读取并写回磁盘上的inode，调用者不应在之后写回自己手中的旧副本
+int delalloc_writeback_inode(SimpleFS_Context& context, uint32_t inode_num);
+int delalloc_writeback_all(SimpleFS_Context& context);
+
+// 缓存超过内存上限时回写全部数据
+void delalloc_writeback_if_over_limit(SimpleFS_Context& context);
+
+// 取出并清除inode上记录的回写错误
+int delalloc_take_error(uint32_t inode_num);
+
+// 定时回写线程
+void start_delalloc_flusher(SimpleFS_Context& context);
+void stop_delalloc_flusher();
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "simplefs.h"
+#include "simplefs_context.h"
+#include <cstdint>
+#include <mutex>
+#include <linux/fs.h> // struct fstrim_range, FITRIM
+
+// 在线discard
+// 释放的块在镜像文件中打洞（块设备上BLKDISCARD），稀疏镜像和精简配置的LUN随之收回空间。
+// 挂载选项 -o discard：释放块的路径把归还的区间加入队列（相邻区间合并），后台线程定期批量下发；
+// FITRIM（fstrim、simplefsctl trim）逐组扫描块位图，下发足够长的空闲段。
+// 下发之前先刷新设备，使释放这些块的元数据已经持久，崩溃后不会有文件指向已被discard的块；
+// 下发时持有fs_mutex并以块位图为准，期间被重新分配的块不受影响。
+
+// 块被归还到块位图后调用（调用者持有fs_mutex）
+void discard_note_freed(SimpleFS_Context& context, uint32_t start_block_num, uint32_t count);
+
+// FITRIM：range的起点和长度以字节为单位，跳过短于minlen的空闲段，返回时range->len为下发的字节数
+// 调用者已通过fs_lock持有fs_mutex，块组之间临时释放；返回0或负的错误码
+int discard_trim_range(SimpleFS_Context& context, std::unique_lock<std::mutex>& fs_lock, struct fstrim_range* range);
+
+// 后台下发线程（-o discard），停止时下发队列中剩余的区间
+void start_discard_worker(SimpleFS_Context& context);
+void stop_discard_worker();
@@ -6,6 +6,14 @@
 
 using DeviceFd = int;
 
+// 设备块大小（1K-64K的2的幂），所有块读写以此为单位
+void set_device_block_size(uint32_t block_size);
+uint32_t device_block_size();
+bool is_valid_block_size(uint32_t block_size);
+
+// 探测并读取超级块，成功时同时设置设备块大小
+int probe_superblock(DeviceFd fd, SimpleFS_SuperBlock* sb);
+
 // 读取单个块
 int read_block(DeviceFd fd, uint32_t block_num, void* buffer);
 
@@ -14,3 +22,24 @@ int write_block(DeviceFd fd, uint32_t block_num, const void* buffer);
 
 // 写入零块
 int write_zero_blocks(DeviceFd fd, uint32_t start_block_num, uint32_t count);
+
+// 读取连续多个块
+int read_blocks(DeviceFd fd, uint32_t start_block_num, uint32_t count, void* buffer);
+
+// 写入连续多个块
+int write_blocks(DeviceFd fd, uint32_t start_block_num, uint32_t count, const void* buffer);
+
+// 在设备内复制连续多个块，优先使用copy_file_range由内核/设备完成
+int copy_blocks(DeviceFd fd, uint32_t src_block_num, uint32_t dst_block_num, uint32_t count);
+
+// 丢弃连续多个块的内容（之后的内容不确定）：普通文件打洞并保持文件大小，块设备下发BLKDISCARD；
+// 其他类型或不支持时返回-1并设置errno（EOPNOTSUPP等）
+int discard_blocks(DeviceFd fd, uint32_t start_block_num, uint32_t count);
+
+// 快照（只由守护进程设置，工具程序不使用）
+// 写入钩子：每次写入设备块之前以将被覆盖的区间调用，返回0或错误码；非0时放弃写入，写入函数返回-1并以它设置errno
+using BlockWriteHook = int (*)(uint32_t start_block_num, uint32_t count);
+void set_block_write_hook(BlockWriteHook hook);
+// 读取重映射：设置后read_block/read_blocks逐块读取重映射得到的块，用于浏览快照
+using BlockReadRemap = uint32_t (*)(uint32_t block_num);
+void set_block_read_remap(BlockReadRemap remap);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "simplefs.h"
+#include "simplefs_context.h"
+#include <vector>
+
+// 块组空闲空间索引
+// 挂载时扫描各组块位图，记录每组的最长空闲段和各长度档的空闲段数量，
+// 并按最长空闲段对块组排序；修改块位图的路径用手中的位图刷新该组摘要
+
+// 扫描所有块位图建立索引（多线程并行读取，全空、全满或位图未修改过的组不读位图），失败返回-1
+int build_free_space_index(SimpleFS_Context& context);
+
+// 块组位图改变后刷新该组的摘要（bitmap为已修改的位图），并清除该组的BLOCK_UNINIT标志
+void update_group_free_summary(SimpleFS_Context& context, uint32_t group_idx, const std::vector<uint8_t>& bitmap);
+
+// 查找最长空闲段不短于min_run_blocks的块组：目标组满足时直接返回，
+// 否则返回满足条件的组中最长空闲段最短的一个（最佳适配），没有则返回UINT32_MAX
+uint32_t find_group_with_free_run(const SimpleFS_Context& context, uint32_t min_run_blocks, uint32_t goal_group);
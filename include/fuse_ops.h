@@ -16,10 +16,15 @@ int simplefs_mknod(const char *path, mode_t mode, dev_t rdev);
 int simplefs_mkdir(const char *path, mode_t mode);
 int simplefs_unlink(const char *path);
 int simplefs_rmdir(const char *path);
+int simplefs_rename(const char *from, const char *to);
 int simplefs_read(const char *path, char *buf, size_t size, off_t offset,
                   struct fuse_file_info *fi);
 int simplefs_write(const char *path, const char *buf, size_t size, off_t offset,
                    struct fuse_file_info *fi);
+int simplefs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+                      struct fuse_file_info *fi);
+int simplefs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                       struct fuse_file_info *fi);
 int simplefs_truncate(const char *path, off_t size);
 int simplefs_chmod(const char *path, mode_t mode);
 int simplefs_chown(const char *path, uid_t uid, gid_t gid);
@@ -28,6 +33,15 @@ int simplefs_access(const char *path, int mask);
 int simplefs_statfs(const char *path, struct statvfs *stbuf);
 int simplefs_symlink(const char *target, const char *linkpath);
 int simplefs_readlink(const char *path, char *buf, size_t size);
+int simplefs_open(const char *path, struct fuse_file_info *fi);
+int simplefs_release(const char *path, struct fuse_file_info *fi);
+int simplefs_fsync(const char *path, int datasync, struct fuse_file_info *fi);
+int simplefs_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi);
+int simplefs_flush(const char *path, struct fuse_file_info *fi);
+int simplefs_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi);
+int simplefs_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data);
+void* simplefs_init(struct fuse_conn_info *conn);
+void simplefs_destroy(void *private_data);
 
 // 初始化FUSE操作结构
 void init_fuse_operations(struct fuse_operations *ops);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "disk_io.h"
+
+// 分组提交
+// fsync/fsyncdir先在fs_mutex下把文件的脏数据和元数据写到设备，释放fs_mutex后再等待设备刷新。
+// 多个线程同时等待时只由一个线程执行fdatasync，覆盖在它开始之前写入的所有数据，
+// 其余线程等待这次刷新完成即可返回；刷新进行中到达的请求合并到下一次刷新。
+
+// 等待一次覆盖调用前所有已完成写入的设备刷新，返回0或负的错误码
+// fsync等调用者应先释放fs_mutex，使其他线程的写入可以并入同一次刷新；
+// ordered模式的数据屏障在fs_mutex下调用，同样正确，只是合并机会较少
+int group_commit_flush(DeviceFd fd);
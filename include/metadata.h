@@ -6,14 +6,69 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <time.h>
+
+// 内联数据：数据存放在inode内的文件没有块映射，块映射相关函数对其视为没有块
+inline bool inode_has_inline_data(const SimpleFS_Inode* inode) {
+    return (inode->i_flags & SIMPLEFS_INODE_FL_INLINE_DATA) != 0;
+}
+inline uint8_t* inode_inline_data(SimpleFS_Inode* inode) {
+    return reinterpret_cast<uint8_t*>(inode->i_block);
+}
+inline const uint8_t* inode_inline_data(const SimpleFS_Inode* inode) {
+    return reinterpret_cast<const uint8_t*>(inode->i_block);
+}
+
+// 内联数据区容量：启用元数据校验和时i_checksum不属于数据区
+uint32_t inode_inline_capacity(const SimpleFS_Context& context);
+
+// 元数据校验和（metadata_csum）：位图和目录块经由以下函数读写，启用时读取后校验、写入时更新校验和
+// 校验和不匹配时记录日志，返回-1并设置errno为EIO
+int read_block_bitmap(SimpleFS_Context& context, uint32_t group_idx, void* buffer);
+int write_block_bitmap(SimpleFS_Context& context, uint32_t group_idx, const void* buffer);
+// 只查看不写回的块位图读取，不为快照复制位图块
+int peek_block_bitmap(SimpleFS_Context& context, uint32_t group_idx, void* buffer);
+int read_inode_bitmap(SimpleFS_Context& context, uint32_t group_idx, void* buffer);
+int write_inode_bitmap(SimpleFS_Context& context, uint32_t group_idx, const void* buffer);
+int read_dir_block(SimpleFS_Context& context, uint32_t block_num, void* buffer);
+// 写入前在buffer中填写块尾部
+int write_dir_block(SimpleFS_Context& context, uint32_t block_num, void* buffer);
+// 目录项链的结束位置，启用元数据校验和时块末尾为尾部
+uint32_t dir_block_entries_end(const SimpleFS_Context& context);
+
+// inode时间戳：秒存放在基本字段，纳秒和创建时间只有大inode能保存到磁盘
+constexpr unsigned SIMPLEFS_TIME_ATIME = 0x1;
+constexpr unsigned SIMPLEFS_TIME_MTIME = 0x2;
+constexpr unsigned SIMPLEFS_TIME_CTIME = 0x4;
+constexpr unsigned SIMPLEFS_TIME_CRTIME = 0x8;
+constexpr unsigned SIMPLEFS_TIME_ALL = SIMPLEFS_TIME_ATIME | SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME | SIMPLEFS_TIME_CRTIME;
+struct timespec current_inode_time();
+void set_inode_time(SimpleFS_Inode* inode, unsigned which, const struct timespec& ts);
+// 将which选中的时间戳设为当前时间
+void touch_inode_times(SimpleFS_Inode* inode, unsigned which);
 
 // inode管理
-uint32_t alloc_inode(SimpleFS_Context& context, mode_t mode);
+uint32_t alloc_inode(SimpleFS_Context& context, mode_t mode, uint32_t parent_inode_num);
 void free_inode(SimpleFS_Context& context, uint32_t inode_num, mode_t mode_of_freed_inode);
 
 // 块管理
 uint32_t alloc_block(SimpleFS_Context& context, uint32_t preferred_group_for_inode = static_cast<uint32_t>(-1));
 void free_block(SimpleFS_Context& context, uint32_t block_num);
+void free_blocks(SimpleFS_Context& context, std::vector<uint32_t>& block_nums);
+uint32_t alloc_block_for_inode(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t inode_num, uint32_t logical_block_idx);
+// 按inode的预留窗口分配最多max_len块的连续段（延迟分配回写），返回起始块号，失败返回0并设置errno
+uint32_t alloc_blocks_for_inode(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t inode_num,
+                                uint32_t logical_block_idx, uint32_t goal_block, uint32_t max_len, uint32_t* allocated_len);
+uint32_t find_goal_block_for_inode(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t inode_num,
+                                   uint32_t logical_block_idx);
+// 批量分配 [min_len, max_len] 块的连续段，返回起始块号并通过allocated_len返回长度，失败返回0
+uint32_t alloc_blocks(SimpleFS_Context& context, uint32_t goal_block, uint32_t min_len, uint32_t max_len,
+                      uint32_t* allocated_len, uint32_t owner_inode_num = 0);
+// 与alloc_blocks相同的查找，但不分配，返回空闲段的起始块号并通过run_len返回可用长度
+uint32_t find_free_blocks(SimpleFS_Context& context, uint32_t goal_block, uint32_t min_len, uint32_t max_len,
+                          uint32_t* run_len, uint32_t owner_inode_num = 0);
+void set_reservation_window(SimpleFS_Context& context, uint32_t inode_num, uint32_t start_block, uint32_t end_block);
+void release_reservation_window(SimpleFS_Context& context, uint32_t inode_num);
 
 // inode读写
 int write_inode_to_disk(SimpleFS_Context& context, uint32_t inode_num, const SimpleFS_Inode* inode_data);
@@ -23,6 +78,18 @@ int read_inode_from_disk(SimpleFS_Context& context, uint32_t inode_num, SimpleFS
 int add_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, uint32_t parent_inode_num,
                   const std::string& entry_name, uint32_t child_inode_num, uint8_t file_type);
 int remove_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, uint32_t parent_inode_num, const std::string& entry_name_to_remove);
+// 在目录中查找名字（可以是"."或".."），返回inode号，找不到返回0并设置errno
+uint32_t lookup_dir_entry(SimpleFS_Context& context, const SimpleFS_Inode* dir_inode, const std::string& entry_name);
+// 原地改写已有目录项指向的inode（rename替换目标、交换以及修正".."）
+int set_dir_entry_inode(SimpleFS_Context& context, SimpleFS_Inode* dir_inode, uint32_t dir_inode_num,
+                        const std::string& entry_name, uint32_t new_inode_num, uint8_t file_type);
+// 按逻辑块读写目录：内联目录（inline_data）的目录项存放在inode的内联数据区，作为逻辑块0访问，
+// 目录项链在内联容量处结束；添加目录项放不下时转为块存储
+// 读取逻辑块到buffer（block_size字节），返回0；空洞返回1；失败返回-1并设置errno
+int read_dir_logical_block(SimpleFS_Context& context, const SimpleFS_Inode* dir_inode, uint32_t logical_block_idx,
+                           void* buffer, uint32_t* physical_block = nullptr);
+// 写回read_dir_logical_block读出的块；内联目录只更新inode中的数据区，由调用者写回inode
+int write_dir_logical_block(SimpleFS_Context& context, SimpleFS_Inode* dir_inode, uint32_t physical_block, void* buffer);
 
 // 路径解析
 void parse_path(const std::string& path, std::string& dirname, std::string& basename);
@@ -44,5 +111,17 @@ void free_all_inode_blocks(SimpleFS_Context& context, SimpleFS_Inode* inode);
 
 // 块映射
 uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_inode, uint32_t dir_inode_num, uint32_t logical_block_idx);
-uint32_t map_logical_to_physical_block(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx);
+uint32_t map_logical_to_physical_block(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx,
+                                       bool* p_unwritten = nullptr);
+// 在逻辑块区间内查找第一个数据块或空洞（SEEK_DATA/SEEK_HOLE），找不到返回end_lbn
+uint32_t find_data_or_hole_lbn(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t start_lbn, uint32_t end_lbn, bool want_data);
+int set_logical_block_ptr(SimpleFS_Context& context, SimpleFS_Inode* inode, uint32_t logical_block_idx, uint32_t block_ptr);
+// 逻辑块是否经由共享的数据块或间接块映射（reflink），共享的块不能就地写入
+bool logical_block_is_shared(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx);
+// 确保逻辑块已映射，返回物理块号；preallocated_block非0时用它作为数据块（已映射时由调用者释放）
+// 映射到共享的块时换成新块（未预分配时复制原内容），返回新块号
+uint32_t allocate_block_for_write(SimpleFS_Context& context, SimpleFS_Inode* inode, uint32_t inode_num,
+                                  uint32_t logical_block_idx, bool* p_was_newly_allocated, uint32_t data_ptr_flags = 0,
+                                  uint32_t preallocated_block = 0);
+// 释放 [start_lbn, end_lbn) 的块并清除指针，end_lbn 为 UINT32_MAX 表示到文件末尾
 void release_logical_block_range(SimpleFS_Context& context, SimpleFS_Inode* inode, uint32_t start_lbn, uint32_t end_lbn);
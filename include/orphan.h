@@ -0,0 +1,19 @@
+#pragma once
+
+#include "simplefs.h"
+#include "simplefs_context.h"
+
+// 孤儿inode管理
+// 链接数降为0但数据块尚未释放的inode挂在超级块的孤儿链表上，
+// 由后台回收线程分片释放，崩溃后重新挂载时继续回收
+
+// 判断删除时是否需要延迟释放（含间接块的大文件）
+bool inode_needs_deferred_free(const SimpleFS_Inode* inode);
+
+// 将inode加入孤儿链表（调用者持有fs_mutex，并负责写回inode和同步元数据）
+void orphan_list_add(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode* inode);
+
+// 后台回收线程
+void start_orphan_reclaimer(SimpleFS_Context& context);
+void stop_orphan_reclaimer();
+void wake_orphan_reclaimer();
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "simplefs.h"
+#include "simplefs_context.h"
+#include <cstdint>
+#include <vector>
+
+// 块引用计数（reflink特性）
+// 克隆的文件共享数据块和间接块，块的引用数等于指向它的块指针个数。
+// 引用计数表只记录被共享的块的额外引用数（引用数-1），持久化在保留inode SIMPLEFS_REFCOUNT_INODE_NUM
+// 的稀疏文件中：块b的计数是文件偏移b*4处的uint32_t，空洞表示未共享。挂载时整表读入内存。
+// 经由共享的间接块到达的块也是共享的：就地修改前先对路径上的间接块写时复制（见metadata.cpp）。
+// 除加载外，所有函数都要求调用者持有fs_mutex。
+
+inline bool has_reflink(const SimpleFS_SuperBlock& sb) {
+    return (sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_REFLINK) != 0;
+}
+
+// 挂载时读入引用计数表，返回0或-1（设置errno）
+int load_block_refcounts(SimpleFS_Context& context);
+
+// 块（可带未写入标志）是否被多个块指针引用
+inline bool block_is_shared(const SimpleFS_Context& context, uint32_t block_ptr) {
+    return !context.block_extra_refs.empty() &&
+           context.block_extra_refs.count(block_ptr & SIMPLEFS_BLOCK_PTR_MASK) != 0;
+}
+
+// 每个块增加一次引用（同一块可出现多次），引用计数表先于新的块指针写入磁盘
+// 返回0或负的错误码，失败时内存中的计数不变
+int block_refs_get(SimpleFS_Context& context, const std::vector<uint32_t>& block_nums);
+
+// 释放块之前调用：被共享的块减少一次引用并从列表中移除，列表中剩下的块才真正释放
+void block_refs_put(SimpleFS_Context& context, std::vector<uint32_t>& block_nums);
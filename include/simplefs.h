@@ -1,15 +1,25 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 #include <sys/types.h>
 
 #pragma pack(push, 1)
 
 // 文件系统常量定义
 constexpr uint16_t SIMPLEFS_MAGIC = 0x5350;
-constexpr uint32_t SIMPLEFS_BLOCK_SIZE = 4096;
+constexpr uint32_t SIMPLEFS_BLOCK_SIZE = 4096;      // 默认块大小，实际块大小由超级块的s_log_block_size决定
+constexpr uint32_t SIMPLEFS_MIN_BLOCK_SIZE = 1024;
+constexpr uint32_t SIMPLEFS_MAX_BLOCK_SIZE = 65536;
+constexpr uint32_t SIMPLEFS_MAX_BLOCKS_PER_GROUP = 32768; // bg_free_blocks_count为16位
+constexpr uint32_t SIMPLEFS_MAX_GROUPS_PER_FLEX = 65536;    // mkfs -G的上限
 constexpr uint32_t SIMPLEFS_ROOT_INODE_NUM = 2;
-constexpr uint32_t SIMPLEFS_INODE_SIZE = 128;
+constexpr uint32_t SIMPLEFS_REFCOUNT_INODE_NUM = 3; // 保留inode：块引用计数表（reflink特性）
+constexpr uint32_t SIMPLEFS_SNAPSHOT_DIR_INODE_NUM = 4; // 保留inode：快照目录，目录项为快照名 -> 快照inode（snapshot特性）
+constexpr uint32_t SIMPLEFS_MAX_SNAPSHOTS = 32;
+constexpr uint32_t SIMPLEFS_INODE_SIZE = 128;       // 默认（基本）inode大小
+constexpr uint32_t SIMPLEFS_INODE_SIZE_256 = 256;   // 基本字段 + 扩展字段 + 小型xattr区
+constexpr uint32_t SIMPLEFS_INODE_SIZE_MAX = 512;   // 最大inode大小，也是内存中inode结构的大小
 constexpr uint32_t SIMPLEFS_NUM_DIRECT_BLOCKS = 12;
 constexpr uint32_t SIMPLEFS_NUM_INDIRECT_BLOCKS = 1;
 constexpr uint32_t SIMPLEFS_NUM_D_INDIRECT_BLOCKS = 1;
@@ -21,6 +31,44 @@ constexpr uint32_t SIMPLEFS_INODE_BLOCK_PTRS = SIMPLEFS_NUM_DIRECT_BLOCKS + \
 
 constexpr uint32_t SIMPLEFS_MAX_FILENAME_LEN = 255;
 
+// 数据块指针最高位标记已预分配但未写入的块（fallocate），读取时返回零
+// 因此文件系统最多支持2^31个块
+constexpr uint32_t SIMPLEFS_BLOCK_UNWRITTEN = 0x80000000;
+constexpr uint32_t SIMPLEFS_BLOCK_PTR_MASK = 0x7FFFFFFF;
+constexpr uint32_t SIMPLEFS_MAX_BLOCKS_COUNT = SIMPLEFS_BLOCK_PTR_MASK;
+
+// 不兼容特性（s_feature_incompat），挂载时遇到不认识的位必须拒绝
+constexpr uint32_t SIMPLEFS_FEATURE_INCOMPAT_INLINE_DATA = 0x0001; // 小文件数据存放在inode内
+// 元数据校验和；不认识它的实现修改元数据时不会更新校验和，因此列为不兼容特性
+constexpr uint32_t SIMPLEFS_FEATURE_INCOMPAT_METADATA_CSUM = 0x0002;
+// 透明压缩：文件数据按簇压缩存放，块指针中出现压缩簇标记
+constexpr uint32_t SIMPLEFS_FEATURE_INCOMPAT_COMPRESSION = 0x0004;
+// 块共享（reflink）：块可以被多个文件引用；不认识它的实现会释放仍被引用的块
+constexpr uint32_t SIMPLEFS_FEATURE_INCOMPAT_REFLINK = 0x0008;
+// 快照：被快照引用的块在覆盖或释放前复制到快照中；不认识它的实现会直接覆盖快照依赖的块
+constexpr uint32_t SIMPLEFS_FEATURE_INCOMPAT_SNAPSHOT = 0x0010;
+constexpr uint32_t SIMPLEFS_FEATURE_INCOMPAT_SUPPORTED = SIMPLEFS_FEATURE_INCOMPAT_INLINE_DATA |
+                                                         SIMPLEFS_FEATURE_INCOMPAT_METADATA_CSUM |
+                                                         SIMPLEFS_FEATURE_INCOMPAT_COMPRESSION |
+                                                         SIMPLEFS_FEATURE_INCOMPAT_REFLINK |
+                                                         SIMPLEFS_FEATURE_INCOMPAT_SNAPSHOT;
+
+// inode标志（i_flags）
+constexpr uint32_t SIMPLEFS_INODE_FL_INLINE_DATA = 0x10000000; // 数据存放在inode的内联数据区中
+constexpr uint32_t SIMPLEFS_INODE_FL_COMPRESS = 0x00000004;    // 普通文件：数据按簇压缩；目录：新建的文件和子目录继承此标志
+
+// 压缩簇：文件按簇（2^s_log_cluster_blocks个逻辑块）压缩，压缩后至少省下一个块时才按压缩格式存放
+// 压缩格式的簇首个块指针为SIMPLEFS_BLOCK_COMPRESSED，其后依次是存放压缩数据的块，其余指针为0
+// 压缩数据以SimpleFS_CompressHeader开头，解压得到簇内有效块（不超过文件末尾）的原始数据
+constexpr uint32_t SIMPLEFS_BLOCK_COMPRESSED = 0x7FFFFFFF; // 不是有效块号（块号必须小于s_blocks_count）
+constexpr uint32_t SIMPLEFS_DEFAULT_CLUSTER_SIZE = 65536;
+constexpr uint32_t SIMPLEFS_MAX_CLUSTER_SIZE = 262144;
+
+// 内联数据区：i_block与紧随其后的i_padding、i_checksum
+// 启用元数据校验和时i_checksum保存inode校验和，内联数据区少4字节
+constexpr uint32_t SIMPLEFS_INLINE_DATA_MAX = SIMPLEFS_INODE_BLOCK_PTRS * sizeof(uint32_t) + 32;
+constexpr uint32_t SIMPLEFS_INLINE_DATA_MAX_CSUM = SIMPLEFS_INLINE_DATA_MAX - sizeof(uint32_t);
+
 // 文件类型常量
 #ifndef S_IFMT
 #define S_IFMT   0xF000 // 文件类型掩码
@@ -55,10 +103,21 @@ struct SimpleFS_SuperBlock {
     uint16_t s_inode_size;          // inode大小
     uint16_t s_block_group_nr;      // 块组号
     uint32_t s_root_inode;          // 根inode号
-    uint8_t  s_padding[962];        // 填充到1024字节
+    uint32_t s_last_orphan;         // 孤儿inode链表头（链表通过i_dtime串联）
+    uint32_t s_feature_incompat;    // 不兼容特性标志
+    uint8_t  s_log_groups_per_flex; // 每个flex组块组数的对数值（0表示每组元数据各自存放）
+    uint8_t  s_log_cluster_blocks;  // 压缩簇块数的对数值（compression特性）
+    uint32_t s_snapshot_count;      // 快照个数（snapshot特性）
+    uint32_t s_snapshot_inodes[SIMPLEFS_MAX_SNAPSHOTS]; // 快照inode号，按创建时间从旧到新
+    uint8_t  s_padding[816];        // 填充
+    uint32_t s_checksum;            // 超级块校验和（metadata_csum），覆盖之前的全部字节
 };
 static_assert(sizeof(SimpleFS_SuperBlock) == 1024, "超级块大小必须为1024字节");
 
+// 块组标志：块位图仍为mkfs写入的初始状态，已用块恰好是组首的一段连续前缀
+// 挂载时据此直接得出空闲空间摘要而不读位图，第一次修改位图时清除
+constexpr uint16_t SIMPLEFS_BG_BLOCK_UNINIT = 0x0001;
+
 // 块组描述符结构
 struct SimpleFS_GroupDesc {
     uint32_t bg_block_bitmap;       // 块位图块号
@@ -67,7 +126,10 @@ struct SimpleFS_GroupDesc {
     uint16_t bg_free_blocks_count;  // 空闲块数
     uint16_t bg_free_inodes_count;  // 空闲inode数
     uint16_t bg_used_dirs_count;    // 已使用目录数
-    uint8_t  bg_padding[14];        // 填充到32字节
+    uint16_t bg_flags;              // 块组标志
+    uint32_t bg_block_bitmap_csum;  // 块位图校验和（metadata_csum）
+    uint32_t bg_inode_bitmap_csum;  // inode位图校验和（metadata_csum）
+    uint32_t bg_checksum;           // 本描述符的校验和（metadata_csum）
 };
 static_assert(sizeof(SimpleFS_GroupDesc) == 32, "块组描述符大小必须为32字节");
 
@@ -85,9 +147,29 @@ struct SimpleFS_Inode {
     uint32_t i_blocks;              // 块数
     uint32_t i_flags;               // 标志
     uint32_t i_block[SIMPLEFS_INODE_BLOCK_PTRS]; // 块指针数组
-    uint8_t  i_padding[32];         // 填充到128字节
+    uint8_t  i_padding[28];         // 填充
+    uint32_t i_checksum;            // inode校验和（metadata_csum），未启用时属于内联数据区
+    // 以下为大inode（256/512字节）的扩展部分，128字节inode在磁盘上没有这些字段，读取时为零
+    uint16_t i_extra_isize;         // 扩展字段大小（不含xattr区），由write_inode_to_disk维护
+    uint16_t i_extra_pad;
+    uint32_t i_atime_nsec;          // 访问时间纳秒部分
+    uint32_t i_ctime_nsec;          // 状态变更时间纳秒部分
+    uint32_t i_mtime_nsec;          // 修改时间纳秒部分
+    uint32_t i_crtime;              // 创建时间
+    uint32_t i_crtime_nsec;         // 创建时间纳秒部分
+    uint32_t i_size_high;           // 文件大小高32位
+    uint32_t i_extra_reserved;
+    uint8_t  i_xattr_area[SIMPLEFS_INODE_SIZE_MAX - SIMPLEFS_INODE_SIZE - 32]; // inode内xattr区，实际大小随inode大小变化
 };
-static_assert(sizeof(SimpleFS_Inode) == 128, "inode大小必须为128字节");
+// 每种inode大小在磁盘上只保存结构的前s_inode_size字节
+static_assert(offsetof(SimpleFS_Inode, i_extra_isize) == SIMPLEFS_INODE_SIZE, "128字节inode只包含基本字段");
+static_assert(offsetof(SimpleFS_Inode, i_xattr_area) <= SIMPLEFS_INODE_SIZE_256, "256字节inode必须容纳全部扩展字段");
+static_assert(sizeof(SimpleFS_Inode) == SIMPLEFS_INODE_SIZE_MAX, "512字节inode即完整的inode结构");
+constexpr uint16_t SIMPLEFS_INODE_EXTRA_ISIZE = offsetof(SimpleFS_Inode, i_xattr_area) - SIMPLEFS_INODE_SIZE;
+static_assert(offsetof(SimpleFS_Inode, i_checksum) + sizeof(SimpleFS_Inode::i_checksum) -
+              offsetof(SimpleFS_Inode, i_block) == SIMPLEFS_INLINE_DATA_MAX, "内联数据区必须连续");
+static_assert(offsetof(SimpleFS_Inode, i_checksum) - offsetof(SimpleFS_Inode, i_block) == SIMPLEFS_INLINE_DATA_MAX_CSUM,
+              "i_checksum必须位于内联数据区末尾");
 
 // 目录项结构
 struct SimpleFS_DirEntry {
@@ -98,4 +180,25 @@ struct SimpleFS_DirEntry {
     char     name[SIMPLEFS_MAX_FILENAME_LEN + 1]; // 文件名
 };
 
+// 目录块尾部（metadata_csum）：占据块末尾12字节的伪目录项，inode为0，前一个目录项的rec_len止于它之前
+constexpr uint8_t SIMPLEFS_DIR_TAIL_FILE_TYPE = 0xDE;
+struct SimpleFS_DirEntryTail {
+    uint32_t det_reserved_zero1;    // 同inode字段，始终为0
+    uint16_t det_rec_len;           // 12
+    uint8_t  det_reserved_zero2;    // 同name_len字段，始终为0
+    uint8_t  det_reserved_ft;       // SIMPLEFS_DIR_TAIL_FILE_TYPE
+    uint32_t det_checksum;          // 块内尾部之前全部字节的校验和
+};
+static_assert(sizeof(SimpleFS_DirEntryTail) == 12, "目录块尾部大小必须为12字节");
+
+// 压缩簇数据头部，位于簇的第一个压缩数据块开头
+constexpr uint16_t SIMPLEFS_COMPRESS_LZ4 = 1;
+struct SimpleFS_CompressHeader {
+    uint32_t ch_compressed_size;    // 头部之后的压缩数据字节数
+    uint32_t ch_raw_size;           // 解压后的字节数
+    uint16_t ch_algorithm;          // 压缩算法（SIMPLEFS_COMPRESS_LZ4）
+    uint16_t ch_reserved;
+};
+static_assert(sizeof(SimpleFS_CompressHeader) == 12, "压缩簇头部大小必须为12字节");
+
 #pragma pack(pop)
@@ -4,10 +4,57 @@
 #include "disk_io.h"
 #include <vector>
 #include <string>
+#include <mutex>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+// 预留窗口大小范围（块数），窗口用尽后加倍
+constexpr uint32_t SIMPLEFS_RSV_WINDOW_MIN_BLOCKS = 64;
+constexpr uint32_t SIMPLEFS_RSV_WINDOW_MAX_BLOCKS = 1024;
+
+// inode的块预留窗口 [start_block, end_block)，只存在于内存中
+// 其他inode分配时避开该区间，使顺序增长的文件保持物理连续
+struct SimpleFS_ReservationWindow {
+    uint32_t start_block;
+    uint32_t end_block;
+    uint32_t next_goal;             // 窗口内下一次分配的目标块
+    uint32_t size;                  // 建立窗口时的目标大小
+};
+
+// 空闲段长度按2的幂分档：第k档为长度在 [2^k, 2^(k+1)) 内的空闲段，最后一档包含更长的段
+constexpr uint32_t SIMPLEFS_FREE_RUN_ORDERS = 16;
+
+// 块组空闲空间摘要，只存在于内存中，挂载时由块位图建立
+struct SimpleFS_GroupFreeSummary {
+    uint32_t largest_free_run = 0;  // 最长连续空闲段（块数）
+    uint32_t free_run_counts[SIMPLEFS_FREE_RUN_ORDERS] = {}; // 各档空闲段数量
+};
+
+// 持久化模式（挂载选项 -o durability=）
+// sync: 每个修改操作返回前回写缓存数据并刷新设备
+// ordered: 新分配块的数据先落盘（刷新屏障）再写入指向它的元数据，只在fsync时刷新设备
+// writeback: 数据和元数据不保证顺序，只在fsync和卸载时刷新设备
+constexpr uint32_t SIMPLEFS_DURABILITY_SYNC = 0;
+constexpr uint32_t SIMPLEFS_DURABILITY_ORDERED = 1;
+constexpr uint32_t SIMPLEFS_DURABILITY_WRITEBACK = 2;
 
 // 文件系统全局上下文
 struct SimpleFS_Context {
     DeviceFd device_fd;
     SimpleFS_SuperBlock sb;
+    uint32_t block_size = SIMPLEFS_BLOCK_SIZE; // 挂载时由超级块的s_log_block_size确定
     std::vector<SimpleFS_GroupDesc> gdt;
+    std::mutex fs_mutex;            // 元数据全局锁，FUSE线程与后台线程共用
+    uint32_t durability_mode = SIMPLEFS_DURABILITY_ORDERED; // 挂载时确定，之后只读
+    uint32_t compress_cluster_blocks = 0; // 压缩簇的块数，未启用compression特性时为0
+    bool compress_new_files = false; // 挂载选项 -o compress：新建的普通文件都压缩存放
+    bool discard_freed_blocks = false; // 挂载选项 -o discard：释放的块由后台线程批量discard
+    uint32_t delalloc_reserved_blocks = 0; // 延迟分配已预留但尚未分配的块数
+    std::unordered_map<uint32_t, SimpleFS_ReservationWindow> rsv_windows; // inode号 -> 预留窗口
+    std::map<uint32_t, uint32_t> rsv_window_starts; // 窗口起始块 -> inode号，按块号有序
+    std::unordered_map<uint32_t, uint32_t> open_file_counts; // inode号 -> 打开句柄数
+    std::vector<SimpleFS_GroupFreeSummary> group_free_summaries; // 各块组的空闲空间摘要
+    std::set<std::pair<uint32_t, uint32_t>> groups_by_largest_run; // (最长空闲段, 块组号)，按段长有序
+    std::unordered_map<uint32_t, uint32_t> block_extra_refs; // 块号 -> 额外引用数，只包含被共享的块（reflink）
 };
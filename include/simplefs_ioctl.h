@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <sys/ioctl.h>
+
+// SimpleFS专用ioctl
+// FUSE 2.9高层接口没有lseek和copy_file_range回调，rename回调也不带flags，SEEK_DATA/SEEK_HOLE、
+// 文件系统内复制、reflink克隆和带RENAME_NOREPLACE/RENAME_EXCHANGE语义的重命名通过ioctl提供给simplefsctl等工具使用；
+// 压缩标志、快照的创建和删除以及在线碎片整理同样通过ioctl进行
+
+constexpr uint32_t SIMPLEFS_IOC_PATH_MAX = 4096;
+
+// SEEK_DATA / SEEK_HOLE
+struct SimpleFS_SeekArgs {
+    uint64_t offset;                // 输入：起始偏移；输出：结果偏移
+    uint32_t whence;                // SEEK_DATA或SEEK_HOLE
+    uint32_t reserved;
+};
+
+// 文件系统内区间复制，ioctl作用于目标文件，源文件以挂载点内的绝对路径指定
+struct SimpleFS_CopyRangeArgs {
+    char     src_path[SIMPLEFS_IOC_PATH_MAX];
+    uint64_t src_offset;
+    uint64_t dst_offset;
+    uint64_t length;
+    uint64_t bytes_copied;          // 输出：实际复制的字节数
+};
+// reflink克隆（reflink特性）使用同一参数结构，目标区间与源区间共享数据块；偏移须按块对齐，
+// 长度不是块的整数倍时只能延伸到源文件末尾
+
+// 带flags的重命名，ioctl可作用于同一文件系统内任意已打开的文件或目录，两个路径都是挂载点内的绝对路径
+constexpr uint32_t SIMPLEFS_RENAME_NOREPLACE = 0x1; // 目标已存在时返回EEXIST（与Linux RENAME_NOREPLACE相同）
+constexpr uint32_t SIMPLEFS_RENAME_EXCHANGE = 0x2;  // 原子交换两个已存在的项（与Linux RENAME_EXCHANGE相同）
+struct SimpleFS_RenameArgs {
+    char     src_path[SIMPLEFS_IOC_PATH_MAX];
+    char     dst_path[SIMPLEFS_IOC_PATH_MAX];
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// 快照（snapshot特性），ioctl可作用于文件系统内任意已打开的文件或目录，只有root可以执行
+struct SimpleFS_SnapshotArgs {
+    char     name[256];             // 快照名，以/.snapshots/<名字>浏览
+};
+
+// 在线碎片整理，ioctl作用于要整理的普通文件或目录，只有所有者和root可以执行
+constexpr uint32_t SIMPLEFS_DEFRAG_DRY_RUN = 0x1;  // 只统计物理段数，不迁移
+struct SimpleFS_DefragArgs {
+    uint32_t flags;
+    uint32_t max_kb_per_sec;        // 迁移限速（KB/s），0表示不限速
+    uint32_t extents_before;        // 输出：整理前的物理段数
+    uint32_t extents_after;         // 输出：整理后的物理段数
+    uint32_t blocks_moved;          // 输出：迁移的块数
+    uint32_t reserved;
+};
+
+// 压缩标志（compression特性），参数为uint32_t，非0表示压缩存放
+// 目录的标志由之后在其中新建的文件和子目录继承；普通文件只能在没有数据时修改，已有数据不会被转换
+#define SIMPLEFS_IOC_MAGIC       0xF5
+#define SIMPLEFS_IOC_SEEK        _IOWR(SIMPLEFS_IOC_MAGIC, 1, struct SimpleFS_SeekArgs)
+#define SIMPLEFS_IOC_COPY_RANGE  _IOWR(SIMPLEFS_IOC_MAGIC, 2, struct SimpleFS_CopyRangeArgs)
+#define SIMPLEFS_IOC_RENAME      _IOW(SIMPLEFS_IOC_MAGIC, 3, struct SimpleFS_RenameArgs)
+#define SIMPLEFS_IOC_GET_COMPRESS _IOR(SIMPLEFS_IOC_MAGIC, 4, uint32_t)
+#define SIMPLEFS_IOC_SET_COMPRESS _IOW(SIMPLEFS_IOC_MAGIC, 5, uint32_t)
+#define SIMPLEFS_IOC_CLONE_RANGE _IOWR(SIMPLEFS_IOC_MAGIC, 6, struct SimpleFS_CopyRangeArgs)
+#define SIMPLEFS_IOC_SNAPSHOT_CREATE _IOW(SIMPLEFS_IOC_MAGIC, 7, struct SimpleFS_SnapshotArgs)
+#define SIMPLEFS_IOC_SNAPSHOT_DELETE _IOW(SIMPLEFS_IOC_MAGIC, 8, struct SimpleFS_SnapshotArgs)
+#define SIMPLEFS_IOC_DEFRAG      _IOWR(SIMPLEFS_IOC_MAGIC, 9, struct SimpleFS_DefragArgs)
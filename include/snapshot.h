@@ -0,0 +1,47 @@
+#pragma once
+
+#include "simplefs.h"
+#include "simplefs_context.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 快照（snapshot特性）
+// 快照是整个文件系统某一时刻的只读副本，经由虚拟目录 /.snapshots/<名字> 浏览。
+// 每个快照是一个保留目录SIMPLEFS_SNAPSHOT_DIR_INODE_NUM下的普通inode，它的稀疏块映射即写时复制存储：
+// 逻辑块b映射到设备块b在快照时刻的内容副本，空洞表示该块自快照以来未被修改。
+// 快照列表按创建时间保存在超级块中，只有最新的快照接收复制：最新快照时刻在用（块位图中标记）
+// 且尚未复制的块在就地覆盖前复制到它的存储中，释放时直接转入它的存储而不归还。
+// 较旧的快照读取块b时依次查找自己及之后各快照的存储，都没有时读取设备上的当前内容。
+// 创建快照只回写缓存并写入少量元数据，与文件系统大小无关；删除时把前一个快照仍需要的副本
+// 移交给它，其余块归还。所有函数都要求调用者持有fs_mutex。
+
+constexpr const char* SIMPLEFS_SNAPSHOT_DIR_PATH = "/.snapshots";
+
+inline bool has_snapshot(const SimpleFS_SuperBlock& sb) {
+    return (sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_SNAPSHOT) != 0;
+}
+
+// 路径是否为快照目录或位于其下（未启用snapshot特性时总是false）
+bool is_snapshot_path(const SimpleFS_Context& context, const char* path);
+
+// 挂载时读入快照列表并安装块写入钩子，返回0或-1（设置errno）
+int load_snapshots(SimpleFS_Context& context);
+
+// 创建/删除快照，返回0或负的错误码
+int snapshot_create(SimpleFS_Context& context, const std::string& name);
+int snapshot_delete(SimpleFS_Context& context, const std::string& name);
+
+// 快照名，按创建时间从旧到新
+std::vector<std::string> snapshot_names();
+
+// 即将就地覆盖 [start_block_num, start_block_num + count) 时调用，绕过disk_io写入设备之前（splice）
+// 以及读改写位图之前使用；返回0或负的错误码
+int snapshot_cow_blocks(SimpleFS_Context& context, uint32_t start_block_num, uint32_t count);
+
+// 释放块之前调用：最新快照仍需要的块转入快照存储并从列表中移除，列表中剩下的块才真正释放
+void snapshot_retain_freed_blocks(SimpleFS_Context& context, std::vector<uint32_t>& block_nums);
+
+// 浏览快照：begin之后的块读取都得到快照时刻的内容，直到end；快照不存在时返回-ENOENT
+int snapshot_view_begin(SimpleFS_Context& context, const std::string& name);
+void snapshot_view_end();
@@ -3,6 +3,7 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <type_traits>
 #include "simplefs.h"
 
 // 位图操作
@@ -10,6 +11,14 @@ void set_bitmap_bit(std::vector<uint8_t>& bitmap_data, uint32_t bit_index);
 void clear_bitmap_bit(std::vector<uint8_t>& bitmap_data, uint32_t bit_index);
 bool is_bitmap_bit_set(const std::vector<uint8_t>& bitmap_data, uint32_t bit_index);
 
+// 位图区间操作（整字节/整字批量处理），返回实际改变的位数
+uint32_t set_bitmap_range(std::vector<uint8_t>& bitmap_data, uint32_t start_bit, uint32_t count);
+uint32_t clear_bitmap_range(std::vector<uint8_t>& bitmap_data, uint32_t start_bit, uint32_t count);
+
+// 在 [from_bit, limit_bit) 中查找下一个为0/为1的位（按64位字扫描），找不到返回limit_bit
+uint32_t find_next_clear_bit(const std::vector<uint8_t>& bitmap_data, uint32_t from_bit, uint32_t limit_bit);
+uint32_t find_next_set_bit(const std::vector<uint8_t>& bitmap_data, uint32_t from_bit, uint32_t limit_bit);
+
 // 路径解析
 void parse_path(const std::string& path, std::string& dirname, std::string& basename);
 
@@ -19,6 +28,30 @@ inline uint16_t calculate_dir_entry_len(uint8_t name_len) {
     return (len + 3) & ~3U;
 }
 
+// 目录项rec_len为16位：64K块中跨越整块的目录项长度65536存为0xFFFF（合法长度都是4的倍数）
+constexpr uint16_t SIMPLEFS_MAX_REC_LEN = 0xFFFF;
+inline uint32_t dir_entry_rec_len(const SimpleFS_DirEntry* entry) {
+    return entry->rec_len == SIMPLEFS_MAX_REC_LEN ? SIMPLEFS_MAX_BLOCK_SIZE : entry->rec_len;
+}
+inline void set_dir_entry_rec_len(SimpleFS_DirEntry* entry, uint32_t rec_len) {
+    entry->rec_len = (rec_len >= SIMPLEFS_MAX_BLOCK_SIZE) ? SIMPLEFS_MAX_REC_LEN : static_cast<uint16_t>(rec_len);
+}
+
+// 按块大小分派：默认的4K块以编译期常量调用fn，使热路径中的除法和移位在编译时确定，其余块大小传入运行时值
+template <typename Fn>
+inline auto dispatch_block_size(uint32_t block_size, Fn&& fn) {
+    if (block_size == SIMPLEFS_BLOCK_SIZE) {
+        return fn(std::integral_constant<uint32_t, SIMPLEFS_BLOCK_SIZE>());
+    }
+    return fn(block_size);
+}
+
+// inode大小检查：支持128、256、512字节
+inline bool is_valid_inode_size(uint32_t inode_size) {
+    return inode_size == SIMPLEFS_INODE_SIZE || inode_size == SIMPLEFS_INODE_SIZE_256 ||
+           inode_size == SIMPLEFS_INODE_SIZE_MAX;
+}
+
 // 设备类型检查
 bool is_block_device(int fd);
 
@@ -0,0 +1,225 @@
+#include "checksum.h"
+
+#include <cstring>
+#include <cstddef>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// 反射表示的CRC32C多项式
+constexpr uint32_t CRC32C_POLY = 0x82F63B78;
+
+// 查表实现：每次处理8字节（slicing-by-8）
+struct Crc32cTables {
+    uint32_t table[8][256];
+    Crc32cTables() {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t crc = n;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            table[0][n] = crc;
+        }
+        for (uint32_t n = 0; n < 256; ++n) {
+            for (int k = 1; k < 8; ++k) {
+                table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xFF];
+            }
+        }
+    }
+};
+static const Crc32cTables crc32c_tables;
+
+// state为未取反的内部状态
+static uint32_t crc32c_portable(uint32_t state, const uint8_t* data, size_t length) {
+    const auto& t = crc32c_tables.table;
+    while (length > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+        state = t[0][(state ^ *data++) & 0xFF] ^ (state >> 8);
+        length--;
+    }
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        word ^= state;
+        state = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF] ^
+                t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+        data += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        state = t[0][(state ^ *data++) & 0xFF] ^ (state >> 8);
+        length--;
+    }
+    return state;
+}
+
+#if defined(__x86_64__)
+
+// 三路并行时每路的长度；三路结果用PCLMUL乘以x^(8*长度)合并
+constexpr size_t CRC32C_LANE_BYTES = 256;
+
+// GF(2)上模多项式的乘法（反射表示），只在初始化时计算合并常数
+static uint32_t multiply_mod_poly(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t mask = 1u << 31; mask != 0; mask >>= 1) {
+        if (a & mask) product ^= b;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+// x^n mod P（反射表示）
+static uint32_t x_power_mod_poly(uint64_t n) {
+    uint32_t result = 1u << 31; // x^0
+    uint32_t square = 1u << 30; // x^1
+    while (n != 0) {
+        if (n & 1) result = multiply_mod_poly(result, square);
+        square = multiply_mod_poly(square, square);
+        n >>= 1;
+    }
+    return result;
+}
+
+// 将状态后移lane_bytes字节：state * x^(8*lane_bytes) mod P
+// 乘数预先除以x^33，PCLMUL的64位乘积交给crc32指令完成取模（该指令再乘x^32，并补回乘积的1位偏移）
+static const uint32_t crc32c_shift_one_lane = x_power_mod_poly(8 * CRC32C_LANE_BYTES - 33);
+static const uint32_t crc32c_shift_two_lanes = x_power_mod_poly(16 * CRC32C_LANE_BYTES - 33);
+
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t crc32c_shift(uint32_t state, uint32_t shift_constant) {
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(state)),
+                                           _mm_cvtsi32_si128(static_cast<int>(shift_constant)), 0x00);
+    return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_hardware(uint32_t state, const uint8_t* data, size_t length) {
+    while (length > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+        state = _mm_crc32_u8(state, *data++);
+        length--;
+    }
+    // crc32指令延迟3个周期、吞吐1个周期，三路交错使执行单元保持忙碌
+    uint64_t state64 = state;
+    while (length >= 3 * CRC32C_LANE_BYTES) {
+        uint64_t state_b = 0;
+        uint64_t state_c = 0;
+        const uint8_t* lane_b = data + CRC32C_LANE_BYTES;
+        const uint8_t* lane_c = data + 2 * CRC32C_LANE_BYTES;
+        for (size_t offset = 0; offset < CRC32C_LANE_BYTES; offset += 8) {
+            uint64_t word_a, word_b, word_c;
+            std::memcpy(&word_a, data + offset, 8);
+            std::memcpy(&word_b, lane_b + offset, 8);
+            std::memcpy(&word_c, lane_c + offset, 8);
+            state64 = _mm_crc32_u64(state64, word_a);
+            state_b = _mm_crc32_u64(state_b, word_b);
+            state_c = _mm_crc32_u64(state_c, word_c);
+        }
+        state64 = crc32c_shift(static_cast<uint32_t>(state64), crc32c_shift_two_lanes) ^
+                  crc32c_shift(static_cast<uint32_t>(state_b), crc32c_shift_one_lane) ^ state_c;
+        data += 3 * CRC32C_LANE_BYTES;
+        length -= 3 * CRC32C_LANE_BYTES;
+    }
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        state64 = _mm_crc32_u64(state64, word);
+        data += 8;
+        length -= 8;
+    }
+    state = static_cast<uint32_t>(state64);
+    while (length > 0) {
+        state = _mm_crc32_u8(state, *data++);
+        length--;
+    }
+    return state;
+}
+
+static bool cpu_has_crc32c_instructions() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+}
+static const bool crc32c_use_hardware = cpu_has_crc32c_instructions();
+
+#else
+
+static const bool crc32c_use_hardware = false;
+
+#endif
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+#if defined(__x86_64__)
+    if (crc32c_use_hardware) {
+        return ~crc32c_hardware(~crc, bytes, length);
+    }
+#endif
+    return ~crc32c_portable(~crc, bytes, length);
+}
+
+const char* crc32c_implementation_name() {
+    return crc32c_use_hardware ? "sse4.2+pclmul" : "portable";
+}
+
+// 跳过结构中的校验和字段（按零参与计算）
+static uint32_t crc32c_skip_field(uint32_t crc, const void* data, size_t length, size_t field_offset, size_t field_size) {
+    static const uint8_t zeros[sizeof(uint32_t)] = {};
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    crc = crc32c(crc, bytes, field_offset);
+    crc = crc32c(crc, zeros, field_size);
+    return crc32c(crc, bytes + field_offset + field_size, length - field_offset - field_size);
+}
+
+uint32_t superblock_checksum(const SimpleFS_SuperBlock* sb) {
+    return crc32c(0, sb, offsetof(SimpleFS_SuperBlock, s_checksum));
+}
+
+uint32_t group_desc_checksum(uint32_t group_idx, const SimpleFS_GroupDesc* gd) {
+    uint32_t crc = crc32c(0, &group_idx, sizeof(group_idx));
+    return crc32c_skip_field(crc, gd, sizeof(SimpleFS_GroupDesc), offsetof(SimpleFS_GroupDesc, bg_checksum),
+                             sizeof(gd->bg_checksum));
+}
+
+uint32_t bitmap_checksum(const void* bitmap, uint32_t block_size) {
+    return crc32c(0, bitmap, block_size);
+}
+
+uint32_t inode_checksum(uint32_t inode_num, const void* raw_inode, uint32_t inode_size) {
+    uint32_t crc = crc32c(0, &inode_num, sizeof(inode_num));
+    return crc32c_skip_field(crc, raw_inode, inode_size, offsetof(SimpleFS_Inode, i_checksum), sizeof(uint32_t));
+}
+
+bool verify_inode_checksum(uint32_t inode_num, const void* raw_inode, uint32_t inode_size) {
+    uint32_t stored;
+    std::memcpy(&stored, static_cast<const uint8_t*>(raw_inode) + offsetof(SimpleFS_Inode, i_checksum), sizeof(stored));
+    if (stored == inode_checksum(inode_num, raw_inode, inode_size)) {
+        return true;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(raw_inode);
+    for (uint32_t i = 0; i < inode_size; ++i) {
+        if (bytes[i] != 0) return false;
+    }
+    return true;
+}
+
+static uint32_t dir_block_checksum(uint32_t block_num, const void* block, uint32_t block_size) {
+    uint32_t crc = crc32c(0, &block_num, sizeof(block_num));
+    return crc32c(crc, block, block_size - sizeof(uint32_t));
+}
+
+void set_dir_block_checksum(uint32_t block_num, void* block, uint32_t block_size) {
+    SimpleFS_DirEntryTail* tail = reinterpret_cast<SimpleFS_DirEntryTail*>(
+        static_cast<uint8_t*>(block) + block_size - sizeof(SimpleFS_DirEntryTail));
+    tail->det_reserved_zero1 = 0;
+    tail->det_rec_len = sizeof(SimpleFS_DirEntryTail);
+    tail->det_reserved_zero2 = 0;
+    tail->det_reserved_ft = SIMPLEFS_DIR_TAIL_FILE_TYPE;
+    tail->det_checksum = dir_block_checksum(block_num, block, block_size);
+}
+
+bool verify_dir_block_checksum(uint32_t block_num, const void* block, uint32_t block_size) {
+    const SimpleFS_DirEntryTail* tail = reinterpret_cast<const SimpleFS_DirEntryTail*>(
+        static_cast<const uint8_t*>(block) + block_size - sizeof(SimpleFS_DirEntryTail));
+    return tail->det_reserved_zero1 == 0 && tail->det_rec_len == sizeof(SimpleFS_DirEntryTail) &&
+           tail->det_reserved_ft == SIMPLEFS_DIR_TAIL_FILE_TYPE &&
+           tail->det_checksum == dir_block_checksum(block_num, block, block_size);
+}
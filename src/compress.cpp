@@ -0,0 +1,527 @@
+#include "compress.h"
+#include "metadata.h"
+#include "disk_io.h"
+#include "delalloc.h"
+
+#include <iostream>
+#include <list>
+#include <unordered_map>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+// ---------------------------------------------------------------------------
+// LZ4块格式
+// 每个序列：token（高4位字面量长度，低4位匹配长度-4，取15时后续字节继续累加）、字面量、
+// 2字节小端偏移、匹配长度扩展字节。最后一个序列只有字面量。
+// 格式要求：最后5个字节必须是字面量，最后一个匹配至少在结尾前12字节开始。
+
+constexpr size_t LZ4_MIN_MATCH = 4;
+constexpr size_t LZ4_LAST_LITERALS = 5;
+constexpr size_t LZ4_MFLIMIT = 12;
+constexpr size_t LZ4_MAX_OFFSET = 65535;
+constexpr unsigned LZ4_HASH_LOG = 12;
+// 连续未找到匹配时逐渐加大步长，不可压缩的数据很快扫过
+constexpr unsigned LZ4_SKIP_TRIGGER = 6;
+
+static inline uint32_t read_u32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+// 写入长度扩展字节（token中对应字段为15时）
+static inline uint8_t* write_length_bytes(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
+
+// 写入一个序列，match_length为0时只写字面量（最后一个序列），空间不足返回nullptr
+static uint8_t* write_sequence(uint8_t* op, const uint8_t* op_end, const uint8_t* literals, size_t literal_length,
+                               size_t offset, size_t match_length) {
+    size_t needed = 1 + literal_length + literal_length / 255 + 1;
+    if (match_length > 0) needed += 2 + (match_length - LZ4_MIN_MATCH) / 255 + 1;
+    if (needed > static_cast<size_t>(op_end - op)) return nullptr;
+
+    uint8_t* token = op++;
+    *token = static_cast<uint8_t>(std::min<size_t>(literal_length, 15) << 4);
+    if (literal_length >= 15) op = write_length_bytes(op, literal_length - 15);
+    std::memcpy(op, literals, literal_length);
+    op += literal_length;
+    if (match_length == 0) return op;
+
+    *op++ = static_cast<uint8_t>(offset);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+    size_t match_code = match_length - LZ4_MIN_MATCH;
+    *token |= static_cast<uint8_t>(std::min<size_t>(match_code, 15));
+    if (match_code >= 15) op = write_length_bytes(op, match_code - 15);
+    return op;
+}
+
+size_t lz4_compress_block(const void* src, size_t src_size, void* dst, size_t dst_capacity) {
+    const uint8_t* const in = static_cast<const uint8_t*>(src);
+    uint8_t* op = static_cast<uint8_t*>(dst);
+    const uint8_t* const op_end = op + dst_capacity;
+    size_t anchor = 0;
+
+    if (src_size > LZ4_MFLIMIT) {
+        uint32_t hash_table[1u << LZ4_HASH_LOG] = {};
+        const size_t match_start_limit = src_size - LZ4_MFLIMIT; // 匹配只能从此之前开始
+        const size_t match_end_limit = src_size - LZ4_LAST_LITERALS; // 匹配只能延伸到此之前
+        size_t ip = 1;
+        hash_table[lz4_hash(read_u32(in))] = 0;
+        while (ip < match_start_limit) {
+            uint32_t sequence = read_u32(in + ip);
+            uint32_t hash = lz4_hash(sequence);
+            size_t ref = hash_table[hash];
+            hash_table[hash] = static_cast<uint32_t>(ip);
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read_u32(in + ref) != sequence) {
+                ip += 1 + ((ip - anchor) >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+            // 向前扩展到上一个序列的末尾
+            while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            size_t match_length = LZ4_MIN_MATCH;
+            while (ip + match_length < match_end_limit && in[ip + match_length] == in[ref + match_length]) {
+                match_length++;
+            }
+            op = write_sequence(op, op_end, in + anchor, ip - anchor, ip - ref, match_length);
+            if (!op) return 0;
+            ip += match_length;
+            anchor = ip;
+            if (ip < match_start_limit) {
+                hash_table[lz4_hash(read_u32(in + ip - 2))] = static_cast<uint32_t>(ip - 2);
+            }
+        }
+    }
+
+    op = write_sequence(op, op_end, in + anchor, src_size - anchor, 0, 0);
+    if (!op) return 0;
+    return op - static_cast<uint8_t*>(dst);
+}
+
+long lz4_decompress_block(const void* src, size_t src_size, void* dst, size_t dst_capacity) {
+    const uint8_t* ip = static_cast<const uint8_t*>(src);
+    const uint8_t* const ip_end = ip + src_size;
+    uint8_t* const out = static_cast<uint8_t*>(dst);
+    size_t op = 0;
+
+    auto read_length = [&](size_t length) -> long {
+        if (length != 15) return static_cast<long>(length);
+        uint8_t byte;
+        do {
+            if (ip >= ip_end) return -1;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return static_cast<long>(length);
+    };
+
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+        long literal_length = read_length(token >> 4);
+        if (literal_length < 0 || static_cast<size_t>(ip_end - ip) < static_cast<size_t>(literal_length) ||
+            dst_capacity - op < static_cast<size_t>(literal_length)) {
+            return -1;
+        }
+        std::memcpy(out + op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == ip_end) break; // 最后一个序列
+
+        if (ip_end - ip < 2) return -1;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        long match_code = read_length(token & 15);
+        if (offset == 0 || offset > op || match_code < 0) return -1;
+        size_t match_length = static_cast<size_t>(match_code) + LZ4_MIN_MATCH;
+        if (dst_capacity - op < match_length) return -1;
+        const uint8_t* match = out + op - offset;
+        if (offset >= match_length) {
+            std::memcpy(out + op, match, match_length);
+        } else {
+            // 重叠的匹配（游程）逐字节复制
+            for (size_t i = 0; i < match_length; ++i) out[op + i] = match[i];
+        }
+        op += match_length;
+    }
+    return static_cast<long>(op);
+}
+
+// ---------------------------------------------------------------------------
+// 簇缓存：保存解压后的压缩簇，按LRU淘汰
+// 以簇的第一个压缩数据块识别内容，簇被重写后映射改变，旧的缓存项自然失效
+
+constexpr size_t COMPRESS_CACHE_MAX_BYTES = 16 << 20;
+
+struct ClusterCacheEntry {
+    uint32_t first_data_block;
+    std::vector<uint8_t> data;
+    std::list<uint64_t>::iterator lru_pos;
+};
+
+// 以下状态由fs_mutex保护
+static std::unordered_map<uint64_t, ClusterCacheEntry> cluster_cache;
+static std::list<uint64_t> cluster_cache_lru; // 头部为最近使用
+static size_t cluster_cache_bytes = 0;
+
+static inline uint64_t cluster_cache_key(uint32_t inode_num, uint32_t cluster_start) {
+    return (static_cast<uint64_t>(inode_num) << 32) | cluster_start;
+}
+
+static void cluster_cache_erase(std::unordered_map<uint64_t, ClusterCacheEntry>::iterator it) {
+    cluster_cache_bytes -= it->second.data.size();
+    cluster_cache_lru.erase(it->second.lru_pos);
+    cluster_cache.erase(it);
+}
+
+// 丢弃inode在 [start_lbn, end_lbn) 内的簇
+static void cluster_cache_invalidate(uint32_t inode_num, uint32_t start_lbn, uint32_t end_lbn) {
+    for (auto it = cluster_cache.begin(); it != cluster_cache.end();) {
+        uint32_t cluster_start = static_cast<uint32_t>(it->first);
+        if ((it->first >> 32) == inode_num && cluster_start < end_lbn && cluster_start >= start_lbn) {
+            auto victim = it++;
+            cluster_cache_erase(victim);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void compress_cache_drop_inode(uint32_t inode_num) {
+    cluster_cache_invalidate(inode_num, 0, UINT32_MAX);
+}
+
+// 读出簇内各逻辑块的块号（去掉未写入标志），读取间接块失败返回false
+static bool read_cluster_ptrs(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t cluster_start,
+                              std::vector<uint32_t>& ptrs) {
+    ptrs.resize(context.compress_cluster_blocks);
+    for (uint32_t slot = 0; slot < context.compress_cluster_blocks; ++slot) {
+        errno = 0;
+        ptrs[slot] = map_logical_to_physical_block(context, inode, cluster_start + slot);
+        if (ptrs[slot] == 0 && errno != 0 && errno != ENOENT) return false;
+    }
+    return true;
+}
+
+bool compress_cluster_is_compressed(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx) {
+    if (context.compress_cluster_blocks == 0 || inode_has_inline_data(inode)) return false;
+    uint32_t cluster_start = logical_block_idx / context.compress_cluster_blocks * context.compress_cluster_blocks;
+    return map_logical_to_physical_block(context, inode, cluster_start) == SIMPLEFS_BLOCK_COMPRESSED;
+}
+
+// 读取并解压一个压缩簇，out为整簇大小，超出有效数据的部分为零
+static int load_compressed_cluster(SimpleFS_Context& context, uint32_t inode_num, const std::vector<uint32_t>& ptrs,
+                                   uint32_t cluster_start, std::vector<uint8_t>& out) {
+    const uint32_t block_size = context.block_size;
+    uint32_t packed_blocks = 0;
+    while (packed_blocks + 1 < ptrs.size() && ptrs[packed_blocks + 1] != 0) packed_blocks++;
+
+    std::vector<uint8_t> packed(static_cast<size_t>(packed_blocks) * block_size);
+    for (uint32_t i = 0; i < packed_blocks;) {
+        uint32_t run = 1;
+        while (i + run < packed_blocks && ptrs[i + 1 + run] == ptrs[i + 1] + run) run++;
+        if (read_blocks(context.device_fd, ptrs[i + 1], run, packed.data() + static_cast<size_t>(i) * block_size) != 0) {
+            return -EIO;
+        }
+        i += run;
+    }
+
+    SimpleFS_CompressHeader header;
+    out.assign(static_cast<size_t>(context.compress_cluster_blocks) * block_size, 0);
+    bool valid = packed_blocks > 0;
+    if (valid) {
+        std::memcpy(&header, packed.data(), sizeof(header));
+        valid = header.ch_algorithm == SIMPLEFS_COMPRESS_LZ4 && header.ch_raw_size <= out.size() &&
+                header.ch_compressed_size <= packed.size() - sizeof(header);
+    }
+    if (valid) {
+        long decoded = lz4_decompress_block(packed.data() + sizeof(header), header.ch_compressed_size,
+                                            out.data(), header.ch_raw_size);
+        valid = decoded == static_cast<long>(header.ch_raw_size);
+    }
+    if (!valid) {
+        std::cerr << "inode " << inode_num << " 的压缩簇（逻辑块 " << cluster_start << "）已损坏" << std::endl;
+        return -EIO;
+    }
+    return 0;
+}
+
+// 返回解压后的簇（指向缓存项），失败返回nullptr
+// inode号为0（浏览快照）时不经过缓存，结果在下次调用前有效
+static const std::vector<uint8_t>* cached_cluster(SimpleFS_Context& context, uint32_t inode_num,
+                                                  const SimpleFS_Inode* inode, uint32_t cluster_start) {
+    if (inode_num == 0) {
+        static std::vector<uint8_t> uncached_cluster;
+        std::vector<uint32_t> ptrs;
+        if (!read_cluster_ptrs(context, inode, cluster_start, ptrs) ||
+            load_compressed_cluster(context, inode_num, ptrs, cluster_start, uncached_cluster) != 0) {
+            return nullptr;
+        }
+        return &uncached_cluster;
+    }
+    uint64_t key = cluster_cache_key(inode_num, cluster_start);
+    errno = 0;
+    uint32_t first_data_block = map_logical_to_physical_block(context, inode, cluster_start + 1);
+    auto it = cluster_cache.find(key);
+    if (it != cluster_cache.end()) {
+        if (it->second.first_data_block == first_data_block) {
+            cluster_cache_lru.splice(cluster_cache_lru.begin(), cluster_cache_lru, it->second.lru_pos);
+            return &it->second.data;
+        }
+        cluster_cache_erase(it);
+    }
+
+    std::vector<uint32_t> ptrs;
+    std::vector<uint8_t> data;
+    if (!read_cluster_ptrs(context, inode, cluster_start, ptrs) ||
+        load_compressed_cluster(context, inode_num, ptrs, cluster_start, data) != 0) {
+        return nullptr;
+    }
+
+    while (!cluster_cache_lru.empty() && cluster_cache_bytes + data.size() > COMPRESS_CACHE_MAX_BYTES) {
+        cluster_cache_erase(cluster_cache.find(cluster_cache_lru.back()));
+    }
+    cluster_cache_lru.push_front(key);
+    cluster_cache_bytes += data.size();
+    ClusterCacheEntry& entry = cluster_cache[key];
+    entry.first_data_block = first_data_block;
+    entry.data = std::move(data);
+    entry.lru_pos = cluster_cache_lru.begin();
+    return &entry.data;
+}
+
+int compress_read_block(SimpleFS_Context& context, uint32_t inode_num, const SimpleFS_Inode* inode,
+                        uint32_t logical_block_idx, void* block_buffer) {
+    const uint32_t block_size = context.block_size;
+    uint32_t cluster_start = logical_block_idx / context.compress_cluster_blocks * context.compress_cluster_blocks;
+    errno = 0;
+    uint32_t first_ptr = map_logical_to_physical_block(context, inode, cluster_start);
+    if (first_ptr == 0 && errno != 0 && errno != ENOENT) return -EIO;
+
+    if (first_ptr != SIMPLEFS_BLOCK_COMPRESSED) {
+        // 原始格式存放的簇按普通块读取
+        bool block_unwritten = false;
+        errno = 0;
+        uint32_t physical_block_num = map_logical_to_physical_block(context, inode, logical_block_idx, &block_unwritten);
+        if (physical_block_num == 0 || block_unwritten) {
+            if (errno != 0 && errno != ENOENT) return -EIO;
+            std::memset(block_buffer, 0, block_size);
+            return 0;
+        }
+        return read_block(context.device_fd, physical_block_num, block_buffer) != 0 ? -EIO : 0;
+    }
+
+    const std::vector<uint8_t>* cluster = cached_cluster(context, inode_num, inode, cluster_start);
+    if (!cluster) return -EIO;
+    std::memcpy(block_buffer, cluster->data() + static_cast<size_t>(logical_block_idx - cluster_start) * block_size,
+                block_size);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// 回写
+
+void compress_abort_cluster(SimpleFS_Context& context, CompressClusterWrite& plan) {
+    if (!plan.new_blocks.empty()) {
+        free_blocks(context, plan.new_blocks);
+    }
+    plan.new_blocks.clear();
+    plan.new_ptrs.clear();
+}
+
+// 把 (块号, 数据) 列表中物理连续且数据连续的部分合并写入
+static int write_block_list(SimpleFS_Context& context, const std::vector<std::pair<uint32_t, const uint8_t*>>& writes) {
+    const uint32_t block_size = context.block_size;
+    for (size_t i = 0; i < writes.size();) {
+        size_t run = 1;
+        while (i + run < writes.size() && writes[i + run].first == writes[i].first + run &&
+               writes[i + run].second == writes[i].second + run * block_size) {
+            run++;
+        }
+        if (write_blocks(context.device_fd, writes[i].first, static_cast<uint32_t>(run), writes[i].second) != 0) {
+            return -EIO;
+        }
+        i += run;
+    }
+    return 0;
+}
+
+int compress_prepare_cluster(SimpleFS_Context& context, uint32_t inode_num, const SimpleFS_Inode* inode,
+                             uint32_t cluster_start, const uint8_t* cluster_data, uint32_t valid_blocks,
+                             const std::vector<bool>& dirty_slots, uint32_t goal_block, CompressClusterWrite* plan) {
+    const uint32_t block_size = context.block_size;
+    *plan = CompressClusterWrite();
+    plan->cluster_start = cluster_start;
+    bool was_compressed = compress_cluster_is_compressed(context, inode, cluster_start);
+
+    // 压缩数据加头部至少要比原始数据少一个块才值得按压缩格式存放
+    std::vector<uint8_t> packed;
+    uint32_t packed_blocks = 0;
+    if (valid_blocks >= 2) {
+        packed.assign(static_cast<size_t>(valid_blocks - 1) * block_size, 0);
+        SimpleFS_CompressHeader header = {};
+        size_t compressed_size = lz4_compress_block(cluster_data, static_cast<size_t>(valid_blocks) * block_size,
+                                                    packed.data() + sizeof(header), packed.size() - sizeof(header));
+        if (compressed_size > 0) {
+            header.ch_compressed_size = static_cast<uint32_t>(compressed_size);
+            header.ch_raw_size = valid_blocks * block_size;
+            header.ch_algorithm = SIMPLEFS_COMPRESS_LZ4;
+            std::memcpy(packed.data(), &header, sizeof(header));
+            packed_blocks = static_cast<uint32_t>((sizeof(header) + compressed_size + block_size - 1) / block_size);
+        }
+    }
+
+    // 原始格式：需要新块的簇内序号；原来就是原始格式的簇，已映射的修改块就地覆盖
+    std::vector<uint32_t> new_slots;
+    if (packed_blocks > 0) {
+        plan->compressed = true;
+        plan->replace_cluster = true;
+    } else if (was_compressed) {
+        plan->replace_cluster = true;
+        for (uint32_t slot = 0; slot < valid_blocks; ++slot) new_slots.push_back(slot);
+    } else {
+        std::vector<std::pair<uint32_t, const uint8_t*>> in_place_writes;
+        for (uint32_t slot = 0; slot < valid_blocks; ++slot) {
+            if (!dirty_slots[slot]) continue;
+            errno = 0;
+            uint32_t physical_block_num = map_logical_to_physical_block(context, inode, cluster_start + slot);
+            if (physical_block_num == 0 && errno != 0 && errno != ENOENT) return -EIO;
+            if (physical_block_num != 0) {
+                in_place_writes.emplace_back(physical_block_num, cluster_data + static_cast<size_t>(slot) * block_size);
+            } else {
+                new_slots.push_back(slot);
+            }
+        }
+        int res = write_block_list(context, in_place_writes);
+        if (res != 0) return res;
+    }
+
+    uint32_t needed = plan->compressed ? packed_blocks : static_cast<uint32_t>(new_slots.size());
+    if (goal_block == 0) goal_block = find_goal_block_for_inode(context, inode, inode_num, cluster_start);
+    while (plan->new_blocks.size() < needed) {
+        uint32_t remaining = needed - static_cast<uint32_t>(plan->new_blocks.size());
+        uint32_t got = 0;
+        errno = 0;
+        uint32_t start_block = alloc_blocks(context, goal_block, 1, remaining, &got, inode_num);
+        if (start_block == 0) {
+            int err = errno ? -errno : -ENOSPC;
+            compress_abort_cluster(context, *plan);
+            return err;
+        }
+        for (uint32_t i = 0; i < got; ++i) plan->new_blocks.push_back(start_block + i);
+        goal_block = start_block + got;
+    }
+
+    std::vector<std::pair<uint32_t, const uint8_t*>> writes;
+    if (plan->compressed) {
+        plan->new_ptrs.emplace_back(cluster_start, SIMPLEFS_BLOCK_COMPRESSED);
+        for (uint32_t i = 0; i < packed_blocks; ++i) {
+            plan->new_ptrs.emplace_back(cluster_start + 1 + i, plan->new_blocks[i]);
+            writes.emplace_back(plan->new_blocks[i], packed.data() + static_cast<size_t>(i) * block_size);
+        }
+    } else {
+        for (size_t i = 0; i < new_slots.size(); ++i) {
+            plan->new_ptrs.emplace_back(cluster_start + new_slots[i], plan->new_blocks[i]);
+            writes.emplace_back(plan->new_blocks[i], cluster_data + static_cast<size_t>(new_slots[i]) * block_size);
+        }
+    }
+    int res = write_block_list(context, writes);
+    if (res != 0) {
+        compress_abort_cluster(context, *plan);
+        return res;
+    }
+    return 0;
+}
+
+int compress_install_cluster(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode* inode,
+                             CompressClusterWrite& plan) {
+    const uint32_t cluster_end = plan.cluster_start + context.compress_cluster_blocks;
+    if (plan.replace_cluster) {
+        release_logical_block_range(context, inode, plan.cluster_start, cluster_end);
+    }
+    int result = 0;
+    size_t installed = 0;
+    for (; installed < plan.new_ptrs.size(); ++installed) {
+        uint32_t lbn = plan.new_ptrs[installed].first;
+        uint32_t block_ptr = plan.new_ptrs[installed].second;
+        errno = 0;
+        uint32_t physical_block_num = allocate_block_for_write(context, inode, inode_num, lbn, nullptr, 0, block_ptr);
+        if (physical_block_num == 0) {
+            result = errno ? -errno : -EIO;
+            break;
+        }
+        if (block_ptr == SIMPLEFS_BLOCK_COMPRESSED) {
+            inode->i_blocks -= context.block_size / 512; // 标记不占用块
+        } else if (physical_block_num != block_ptr) {
+            // 逻辑块已有映射（不应出现），新块归还空闲
+            std::vector<uint32_t> unused_block = {block_ptr};
+            free_blocks(context, unused_block);
+        }
+    }
+    if (result != 0) {
+        std::vector<uint32_t> unused_blocks;
+        for (size_t i = installed; i < plan.new_ptrs.size(); ++i) {
+            if (plan.new_ptrs[i].second != SIMPLEFS_BLOCK_COMPRESSED) unused_blocks.push_back(plan.new_ptrs[i].second);
+        }
+        free_blocks(context, unused_blocks);
+    }
+    plan.new_blocks.clear();
+    cluster_cache_invalidate(inode_num, plan.cluster_start, cluster_end);
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// 截断和打洞
+
+int compress_release_range(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode* inode,
+                           uint32_t start_lbn, uint32_t end_lbn) {
+    if (start_lbn >= end_lbn) return 0;
+    const uint32_t cluster_blocks = context.compress_cluster_blocks;
+    const uint32_t valid_blocks = (inode->i_size + context.block_size - 1) / context.block_size;
+
+    // 区间首尾只有一部分被释放的压缩簇
+    std::vector<uint32_t> split_clusters;
+    uint32_t head_cluster = start_lbn / cluster_blocks * cluster_blocks;
+    if (head_cluster < start_lbn && compress_cluster_is_compressed(context, inode, head_cluster)) {
+        split_clusters.push_back(head_cluster);
+    }
+    if (end_lbn != UINT32_MAX && end_lbn % cluster_blocks != 0) {
+        uint32_t tail_cluster = end_lbn / cluster_blocks * cluster_blocks;
+        if ((split_clusters.empty() || split_clusters.back() != tail_cluster) &&
+            compress_cluster_is_compressed(context, inode, tail_cluster)) {
+            split_clusters.push_back(tail_cluster);
+        }
+    }
+
+    // 保留的块先进入延迟分配缓存，回写时重新压缩
+    std::vector<uint8_t> block_buffer(context.block_size);
+    uint32_t release_start = start_lbn;
+    uint32_t release_end = end_lbn;
+    for (uint32_t cluster_start : split_clusters) {
+        uint32_t cluster_end = cluster_start + cluster_blocks;
+        for (uint32_t lbn = cluster_start; lbn < cluster_end && lbn < valid_blocks; ++lbn) {
+            if ((lbn >= start_lbn && lbn < end_lbn) || delalloc_read_block(inode_num, lbn, nullptr)) continue;
+            int res = compress_read_block(context, inode_num, inode, lbn, block_buffer.data());
+            if (res == 0) res = delalloc_write_block(context, inode_num, lbn, 0, block_buffer.data(), context.block_size);
+            if (res != 0) return res;
+        }
+        release_start = std::min(release_start, cluster_start);
+        release_end = std::max(release_end, cluster_end);
+    }
+
+    release_logical_block_range(context, inode, release_start, release_end);
+    cluster_cache_invalidate(inode_num, release_start / cluster_blocks * cluster_blocks, release_end);
+    return 0;
+}
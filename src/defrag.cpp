@@ -0,0 +1,229 @@
+#include "defrag.h"
+#include "metadata.h"
+#include "disk_io.h"
+#include "delalloc.h"
+#include "compress.h"
+#include "group_commit.h"
+
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <algorithm>
+#include <sys/stat.h> // S_ISREG, S_ISDIR
+
+// 每片迁移的块数，片间释放fs_mutex
+constexpr uint32_t DEFRAG_SLICE_BLOCKS = 256;
+
+// 待迁移的块：逻辑块号和整理开始时的块指针（可带未写入标志）
+struct DefragBlock {
+    uint32_t lbn;
+    uint32_t block_ptr;
+};
+
+static uint32_t block_ptr_of(SimpleFS_Context& context, const SimpleFS_Inode& inode, uint32_t lbn) {
+    bool unwritten = false;
+    uint32_t block_num = map_logical_to_physical_block(context, &inode, lbn, &unwritten);
+    if (block_num == 0) return 0;
+    return block_num | (unwritten ? SIMPLEFS_BLOCK_UNWRITTEN : 0);
+}
+
+// 按逻辑块顺序遍历已映射的块，返回物理段数；movable非空时收集可迁移的块
+static uint32_t scan_file_blocks(SimpleFS_Context& context, const SimpleFS_Inode& inode, std::vector<DefragBlock>* movable) {
+    const uint32_t end_lbn = (inode.i_size + context.block_size - 1) / context.block_size;
+    uint32_t extents = 0;
+    uint32_t prev_block = 0;
+    uint32_t lbn = find_data_or_hole_lbn(context, &inode, 0, end_lbn, true);
+    while (lbn < end_lbn) {
+        uint32_t block_ptr = block_ptr_of(context, inode, lbn);
+        uint32_t block_num = block_ptr & SIMPLEFS_BLOCK_PTR_MASK;
+        if (block_num != 0) {
+            if (extents == 0 || block_num != prev_block + 1) extents++;
+            prev_block = block_num;
+            // 共享的块属于多个文件，留在原处
+            if (movable && !logical_block_is_shared(context, &inode, lbn)) {
+                movable->push_back({lbn, block_ptr});
+            }
+        }
+        lbn = find_data_or_hole_lbn(context, &inode, lbn + 1, end_lbn, true);
+    }
+    return extents;
+}
+
+// 迁移一片：仍映射到原来的块的逻辑块复制到goal附近新分配的块，经过刷新屏障后替换块指针并释放原来的块
+// 调用者持有fs_mutex；*dst_goal推进到本片目标块之后，*moved累加迁移的块数
+static int migrate_slice(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode& inode,
+                         const DefragBlock* blocks, size_t count, uint32_t* dst_goal, uint32_t* moved) {
+    // 片间文件可能被改写、截断或克隆，只迁移映射没有变化且仍未共享的块
+    std::vector<DefragBlock> sources;
+    for (size_t i = 0; i < count; ++i) {
+        if (block_ptr_of(context, inode, blocks[i].lbn) == blocks[i].block_ptr &&
+            !logical_block_is_shared(context, &inode, blocks[i].lbn)) {
+            sources.push_back(blocks[i]);
+        }
+    }
+    if (sources.empty()) return 0;
+
+    std::vector<uint32_t> targets;
+    while (targets.size() < sources.size()) {
+        uint32_t got = 0;
+        errno = 0;
+        uint32_t start_block = alloc_blocks(context, *dst_goal, 1, static_cast<uint32_t>(sources.size() - targets.size()),
+                                            &got, inode_num);
+        if (start_block == 0) {
+            int res = errno ? -errno : -ENOSPC;
+            free_blocks(context, targets);
+            return res;
+        }
+        for (uint32_t i = 0; i < got; ++i) {
+            targets.push_back(start_block + i);
+        }
+        *dst_goal = start_block + got;
+    }
+
+    // 复制数据：目录块的校验和包含块号，逐块读出后按新块号写入；未写入的块内容无意义，不复制
+    const bool is_dir = S_ISDIR(inode.i_mode);
+    std::vector<uint8_t> block_buffer(context.block_size);
+    size_t i = 0;
+    while (i < sources.size()) {
+        uint32_t src_block = sources[i].block_ptr & SIMPLEFS_BLOCK_PTR_MASK;
+        if (sources[i].block_ptr & SIMPLEFS_BLOCK_UNWRITTEN) {
+            ++i;
+            continue;
+        }
+        size_t run = 1;
+        if (is_dir) {
+            if (read_dir_block(context, src_block, block_buffer.data()) != 0 ||
+                write_dir_block(context, targets[i], block_buffer.data()) != 0) {
+                free_blocks(context, targets);
+                return -EIO;
+            }
+        } else {
+            while (i + run < sources.size() && !(sources[i + run].block_ptr & SIMPLEFS_BLOCK_UNWRITTEN) &&
+                   sources[i + run].block_ptr == src_block + run && targets[i + run] == targets[i] + run) {
+                ++run;
+            }
+            if (copy_blocks(context.device_fd, src_block, targets[i], static_cast<uint32_t>(run)) != 0) {
+                free_blocks(context, targets);
+                return -EIO;
+            }
+        }
+        i += run;
+    }
+
+    // ordered和sync模式下新块的数据先落盘，再写入指向它们的块指针
+    if (context.durability_mode != SIMPLEFS_DURABILITY_WRITEBACK) {
+        int barrier_res = group_commit_flush(context.device_fd);
+        if (barrier_res != 0) {
+            free_blocks(context, targets);
+            return barrier_res;
+        }
+    }
+
+    std::vector<uint32_t> old_blocks;
+    std::vector<uint32_t> unused_targets;
+    int res = 0;
+    for (i = 0; i < sources.size(); ++i) {
+        uint32_t new_ptr = targets[i] | (sources[i].block_ptr & SIMPLEFS_BLOCK_UNWRITTEN);
+        if (res == 0 && set_logical_block_ptr(context, &inode, sources[i].lbn, new_ptr) != 0) {
+            res = -EIO;
+        }
+        if (res == 0) {
+            old_blocks.push_back(sources[i].block_ptr & SIMPLEFS_BLOCK_PTR_MASK);
+        } else {
+            unused_targets.push_back(targets[i]);
+        }
+    }
+    if (write_inode_to_disk(context, inode_num, &inode) != 0 && res == 0) res = -EIO;
+    free_blocks(context, old_blocks);
+    free_blocks(context, unused_targets);
+    sync_fs_metadata(context);
+    *moved += static_cast<uint32_t>(sources.size() - unused_targets.size());
+    return res;
+}
+
+// 片间让出fs_mutex；限速时按本片的数据量休眠
+static void throttle_between_slices(uint32_t max_kb_per_sec, uint64_t slice_bytes) {
+    if (max_kb_per_sec == 0) {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(slice_bytes * 1000 / max_kb_per_sec));
+}
+
+int defrag_inode(SimpleFS_Context& context, std::unique_lock<std::mutex>& fs_lock, uint32_t inode_num,
+                 SimpleFS_DefragArgs* args) {
+    args->extents_before = 0;
+    args->extents_after = 0;
+    args->blocks_moved = 0;
+
+    SimpleFS_Inode inode;
+    if (read_inode_from_disk(context, inode_num, &inode) != 0) return -EIO;
+    if (!S_ISREG(inode.i_mode) && !S_ISDIR(inode.i_mode)) return -EINVAL;
+    if (inode_has_inline_data(&inode)) return 0;
+    // 压缩簇整簇分配和替换，簇内已经连续
+    if (inode_is_compressed(&inode) && S_ISREG(inode.i_mode)) return -EOPNOTSUPP;
+
+    // 先回写延迟分配的数据，整理的是文件在磁盘上的最终布局
+    int res = delalloc_writeback_inode(context, inode_num);
+    if (res != 0) return res;
+    if (read_inode_from_disk(context, inode_num, &inode) != 0) return -EIO;
+
+    std::vector<DefragBlock> movable;
+    uint32_t extents = scan_file_blocks(context, inode, &movable);
+    args->extents_before = extents;
+    args->extents_after = extents;
+    const uint32_t total = static_cast<uint32_t>(movable.size());
+    if ((args->flags & SIMPLEFS_DEFRAG_DRY_RUN) || total == 0) return 0;
+    // 只看可迁移的块：它们已经排成最少的段时不再迁移（共享的块隔开的段无法合并）
+    uint32_t movable_extents = 1;
+    for (size_t i = 1; i < movable.size(); ++i) {
+        if ((movable[i].block_ptr & SIMPLEFS_BLOCK_PTR_MASK) != (movable[i - 1].block_ptr & SIMPLEFS_BLOCK_PTR_MASK) + 1) {
+            movable_extents++;
+        }
+    }
+    const uint32_t blocks_per_group = context.sb.s_blocks_per_group;
+    const uint32_t ideal_extents = std::max<uint32_t>(1, (total + blocks_per_group - 1) / blocks_per_group);
+    if (movable_extents <= ideal_extents) return 0;
+
+    // 目标段至少要长到使段数减少，最多一个块组；在inode所在组附近查找
+    uint32_t want_len = std::min(total, blocks_per_group);
+    uint32_t min_len = std::min(want_len, (total + movable_extents - 2) / (movable_extents - 1));
+    uint32_t inode_group = (inode_num - 1) / context.sb.s_inodes_per_group;
+    uint32_t run_len = 0;
+    uint32_t dst_goal = find_free_blocks(context, inode_group * blocks_per_group, min_len, want_len, &run_len, inode_num);
+    if (dst_goal == 0) return 0;
+    // 预留窗口使其他文件的分配避开目标段，迁移结束时释放
+    set_reservation_window(context, inode_num, dst_goal, dst_goal + run_len);
+
+    // 片间文件可能被删除，inode号可能已被重新使用：链接数、类型和创建时间必须不变
+    const mode_t file_type = inode.i_mode & S_IFMT;
+    const uint32_t crtime = inode.i_crtime;
+    const uint32_t crtime_nsec = inode.i_crtime_nsec;
+    uint32_t moved = 0;
+    for (size_t first = 0; first < movable.size(); first += DEFRAG_SLICE_BLOCKS) {
+        if (first > 0) {
+            fs_lock.unlock();
+            throttle_between_slices(args->max_kb_per_sec, static_cast<uint64_t>(DEFRAG_SLICE_BLOCKS) * context.block_size);
+            fs_lock.lock();
+            if (read_inode_from_disk(context, inode_num, &inode) != 0) {
+                res = -EIO;
+                break;
+            }
+            if (inode.i_links_count == 0 || (inode.i_mode & S_IFMT) != file_type || inode.i_crtime != crtime ||
+                inode.i_crtime_nsec != crtime_nsec || inode_has_inline_data(&inode)) {
+                break;
+            }
+        }
+        size_t count = std::min<size_t>(DEFRAG_SLICE_BLOCKS, movable.size() - first);
+        res = migrate_slice(context, inode_num, inode, movable.data() + first, count, &dst_goal, &moved);
+        if (res != 0) break;
+    }
+    release_reservation_window(context, inode_num);
+
+    args->blocks_moved = moved;
+    if (read_inode_from_disk(context, inode_num, &inode) == 0 && inode.i_links_count != 0) {
+        args->extents_after = scan_file_blocks(context, inode, nullptr);
+    }
+    return res;
+}
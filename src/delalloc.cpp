@@ -0,0 +1,483 @@
+#include "delalloc.h"
+#include "metadata.h"
+#include "disk_io.h"
+#include "group_commit.h"
+#include "compress.h"
+
+#include <iostream>
+#include <map>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+// 缓存数据总量上限，超过后立即回写
+constexpr size_t DELALLOC_MAX_DIRTY_BYTES = 32 << 20;
+// 单次合并写入的最大字节数
+constexpr size_t DELALLOC_MAX_RUN_BYTES = 1 << 20;
+// 定时回写间隔
+constexpr std::chrono::seconds DELALLOC_WRITEBACK_INTERVAL(5);
+
+// 每个inode的缓存状态，按逻辑块号有序，回写时即为分配顺序
+struct DelallocInode {
+    std::map<uint32_t, std::vector<uint8_t>> dirty_blocks;
+    int writeback_error = 0;
+};
+
+// 以下状态由fs_mutex保护
+static std::unordered_map<uint32_t, DelallocInode> delalloc_inodes;
+static size_t delalloc_dirty_block_count = 0;
+
+static std::thread flusher_thread;
+static std::mutex flusher_mutex;
+static std::condition_variable flusher_cv;
+static bool flusher_running = false;
+static bool flusher_stop = false;
+
+int delalloc_write_block(SimpleFS_Context& context, uint32_t inode_num, uint32_t logical_block_idx,
+                         uint32_t offset_in_block, const void* data, size_t length) {
+    DelallocInode& state = delalloc_inodes[inode_num];
+    auto it = state.dirty_blocks.find(logical_block_idx);
+    if (it == state.dirty_blocks.end()) {
+        // 预留数据块，并为回写时可能需要的间接块留出余量
+        uint64_t reserved_after = static_cast<uint64_t>(context.delalloc_reserved_blocks) + 1;
+        uint64_t metadata_margin = reserved_after / (context.block_size / sizeof(uint32_t)) + 3;
+        if (context.sb.s_free_blocks_count < reserved_after + metadata_margin) {
+            if (state.dirty_blocks.empty() && state.writeback_error == 0) {
+                delalloc_inodes.erase(inode_num);
+            }
+            return -ENOSPC;
+        }
+        context.delalloc_reserved_blocks++;
+        delalloc_dirty_block_count++;
+        it = state.dirty_blocks.emplace(logical_block_idx, std::vector<uint8_t>(context.block_size, 0)).first;
+    }
+    std::memcpy(it->second.data() + offset_in_block, data, length);
+    return 0;
+}
+
+bool delalloc_read_block(uint32_t inode_num, uint32_t logical_block_idx, void* block_buffer) {
+    auto inode_it = delalloc_inodes.find(inode_num);
+    if (inode_it == delalloc_inodes.end()) {
+        return false;
+    }
+    auto it = inode_it->second.dirty_blocks.find(logical_block_idx);
+    if (it == inode_it->second.dirty_blocks.end()) {
+        return false;
+    }
+    if (block_buffer) {
+        std::memcpy(block_buffer, it->second.data(), it->second.size());
+    }
+    return true;
+}
+
+uint32_t delalloc_next_dirty_block(uint32_t inode_num, uint32_t start_lbn) {
+    auto inode_it = delalloc_inodes.find(inode_num);
+    if (inode_it == delalloc_inodes.end()) {
+        return UINT32_MAX;
+    }
+    auto it = inode_it->second.dirty_blocks.lower_bound(start_lbn);
+    return (it == inode_it->second.dirty_blocks.end()) ? UINT32_MAX : it->first;
+}
+
+uint32_t delalloc_dirty_run_end(uint32_t inode_num, uint32_t start_lbn) {
+    auto inode_it = delalloc_inodes.find(inode_num);
+    if (inode_it == delalloc_inodes.end()) {
+        return start_lbn;
+    }
+    const auto& dirty_blocks = inode_it->second.dirty_blocks;
+    uint32_t lbn = start_lbn;
+    for (auto it = dirty_blocks.find(lbn); it != dirty_blocks.end() && it->first == lbn; ++it) {
+        lbn++;
+    }
+    return lbn;
+}
+
+void delalloc_discard_range(SimpleFS_Context& context, uint32_t inode_num, uint32_t start_lbn, uint32_t end_lbn) {
+    auto inode_it = delalloc_inodes.find(inode_num);
+    if (inode_it == delalloc_inodes.end()) {
+        return;
+    }
+    auto& dirty_blocks = inode_it->second.dirty_blocks;
+    for (auto it = dirty_blocks.lower_bound(start_lbn); it != dirty_blocks.end() && it->first < end_lbn;) {
+        it = dirty_blocks.erase(it);
+        context.delalloc_reserved_blocks--;
+        delalloc_dirty_block_count--;
+    }
+}
+
+void delalloc_drop_inode(SimpleFS_Context& context, uint32_t inode_num) {
+    auto inode_it = delalloc_inodes.find(inode_num);
+    if (inode_it == delalloc_inodes.end()) {
+        return;
+    }
+    size_t dropped = inode_it->second.dirty_blocks.size();
+    context.delalloc_reserved_blocks -= static_cast<uint32_t>(dropped);
+    delalloc_dirty_block_count -= dropped;
+    delalloc_inodes.erase(inode_it);
+}
+
+// 回写分为三个阶段：为缓存块分配新块并写入数据，经过一次刷新屏障，再把新块安装到inode的映射中，
+// 崩溃时映射不会指向未写入的块。回写全部inode时所有inode共用一次屏障
+struct AllocatedRun {
+    uint32_t first_lbn;
+    uint32_t start_block;
+    uint32_t count;
+};
+
+struct InodeWriteback {
+    uint32_t inode_num = 0;
+    SimpleFS_Inode inode_data;
+    bool active = false;     // 已读出inode，安装阶段需要写回
+    bool compressed = false;
+    std::vector<AllocatedRun> allocated_runs;      // 普通inode：已写入数据、尚未安装的段
+    std::vector<CompressClusterWrite> plans;       // 压缩inode：已写入数据、尚未安装的簇
+    std::vector<uint32_t> plan_dirty_counts;
+    int result = 0;
+};
+
+static bool writeback_has_data(const InodeWriteback& wb) {
+    return !wb.allocated_runs.empty() || !wb.plans.empty();
+}
+
+// 普通inode：按逻辑块顺序连续分配，每段数据一次写入新分配的块
+static void prepare_block_runs(SimpleFS_Context& context, InodeWriteback& wb, DelallocInode& state) {
+    std::vector<uint8_t> run_buffer;
+    const uint32_t max_run_blocks = std::max<uint32_t>(1, DELALLOC_MAX_RUN_BYTES / context.block_size);
+    run_buffer.reserve(static_cast<size_t>(max_run_blocks) * context.block_size);
+    auto& allocated_runs = wb.allocated_runs;
+
+    auto it = state.dirty_blocks.begin();
+    while (it != state.dirty_blocks.end()) {
+        // 逻辑连续的缓存块一次分配为物理连续的一段
+        uint32_t first_lbn = it->first;
+        uint32_t want = 1;
+        for (auto next = std::next(it); next != state.dirty_blocks.end() && next->first == first_lbn + want &&
+             want < max_run_blocks; ++next) {
+            want++;
+        }
+
+        // 先归还预留，使alloc_blocks可以使用这些块
+        context.delalloc_reserved_blocks -= want;
+        // 紧接上一段的逻辑块从上一段的物理末尾继续（上一段尚未安装到映射中），否则由预留窗口决定位置
+        uint32_t goal_block = 0;
+        if (!allocated_runs.empty() && allocated_runs.back().first_lbn + allocated_runs.back().count == first_lbn) {
+            goal_block = allocated_runs.back().start_block + allocated_runs.back().count;
+        }
+        uint32_t got = 0;
+        errno = 0;
+        uint32_t start_block = alloc_blocks_for_inode(context, &wb.inode_data, wb.inode_num, first_lbn, goal_block, want, &got);
+        context.delalloc_reserved_blocks += want - got;
+        if (start_block == 0) {
+            wb.result = errno ? -errno : -EIO;
+            break;
+        }
+
+        run_buffer.clear();
+        for (uint32_t i = 0; i < got; ++i, ++it) {
+            run_buffer.insert(run_buffer.end(), it->second.begin(), it->second.end());
+        }
+        if (write_blocks(context.device_fd, start_block, got, run_buffer.data()) != 0) {
+            std::vector<uint32_t> unused_blocks;
+            for (uint32_t i = 0; i < got; ++i) unused_blocks.push_back(start_block + i);
+            free_blocks(context, unused_blocks);
+            context.delalloc_reserved_blocks += got;
+            wb.result = -EIO;
+            break;
+        }
+        allocated_runs.push_back({first_lbn, start_block, got});
+    }
+}
+
+static void install_block_runs(SimpleFS_Context& context, InodeWriteback& wb, DelallocInode& state) {
+    const auto& allocated_runs = wb.allocated_runs;
+    for (size_t run_idx = 0; run_idx < allocated_runs.size(); ++run_idx) {
+        const AllocatedRun& run = allocated_runs[run_idx];
+        uint32_t installed = 0;
+        for (; installed < run.count; ++installed) {
+            uint32_t lbn = run.first_lbn + installed;
+            uint32_t block_num = run.start_block + installed;
+            errno = 0;
+            uint32_t physical_block_num = allocate_block_for_write(context, &wb.inode_data, wb.inode_num, lbn, nullptr,
+                                                                   0, block_num);
+            if (physical_block_num == 0) {
+                if (wb.result == 0) wb.result = errno ? -errno : -EIO;
+                break;
+            }
+            if (physical_block_num != block_num) {
+                // 逻辑块已有映射（缓存时是共享块，回写前另一方已释放），数据改写到已有的块并清除未写入标志，
+                // 预分配的块归还空闲
+                write_block(context.device_fd, physical_block_num, state.dirty_blocks[lbn].data());
+                set_logical_block_ptr(context, &wb.inode_data, lbn, physical_block_num);
+                std::vector<uint32_t> unused_block = {block_num};
+                free_blocks(context, unused_block);
+            }
+        }
+        // 已安装的缓存块可以丢弃
+        auto run_begin = state.dirty_blocks.find(run.first_lbn);
+        state.dirty_blocks.erase(run_begin, state.dirty_blocks.lower_bound(run.first_lbn + installed));
+        delalloc_dirty_block_count -= installed;
+        if (installed < run.count) {
+            // 本段及之后各段未安装的块归还空闲，对应的缓存块保留预留
+            for (size_t rest_idx = run_idx; rest_idx < allocated_runs.size(); ++rest_idx) {
+                const AllocatedRun& rest = allocated_runs[rest_idx];
+                uint32_t skip = (rest_idx == run_idx) ? installed : 0;
+                std::vector<uint32_t> unused_blocks;
+                for (uint32_t i = skip; i < rest.count; ++i) unused_blocks.push_back(rest.start_block + i);
+                free_blocks(context, unused_blocks);
+                context.delalloc_reserved_blocks += rest.count - skip;
+            }
+            break;
+        }
+    }
+}
+
+// 压缩inode：缓存块与磁盘上簇内其余块的内容合并，整簇压缩后写入新分配的块
+static void prepare_compressed_clusters(SimpleFS_Context& context, InodeWriteback& wb, DelallocInode& state) {
+    const uint32_t block_size = context.block_size;
+    const uint32_t cluster_blocks = context.compress_cluster_blocks;
+    const uint32_t file_blocks = (wb.inode_data.i_size + block_size - 1) / block_size;
+    std::vector<uint8_t> cluster_buffer(static_cast<size_t>(cluster_blocks) * block_size);
+    uint32_t goal_block = 0;
+
+    auto it = state.dirty_blocks.begin();
+    while (it != state.dirty_blocks.end()) {
+        uint32_t cluster_start = it->first / cluster_blocks * cluster_blocks;
+        auto cluster_last = state.dirty_blocks.lower_bound(cluster_start + cluster_blocks);
+        uint32_t last_dirty_lbn = std::prev(cluster_last)->first;
+        uint32_t valid_blocks = std::min(cluster_blocks, std::max(file_blocks, last_dirty_lbn + 1) - cluster_start);
+
+        // 簇内未缓存的块从磁盘读出（压缩簇经簇缓存解压）
+        std::vector<bool> dirty_slots(cluster_blocks, false);
+        uint32_t dirty_count = 0;
+        for (uint32_t slot = 0; slot < valid_blocks && wb.result == 0; ++slot) {
+            uint8_t* slot_data = cluster_buffer.data() + static_cast<size_t>(slot) * block_size;
+            if (it != cluster_last && it->first == cluster_start + slot) {
+                std::memcpy(slot_data, it->second.data(), block_size);
+                dirty_slots[slot] = true;
+                dirty_count++;
+                ++it;
+            } else {
+                wb.result = compress_read_block(context, wb.inode_num, &wb.inode_data, cluster_start + slot, slot_data);
+            }
+        }
+        if (wb.result != 0) break;
+
+        context.delalloc_reserved_blocks -= dirty_count;
+        CompressClusterWrite plan;
+        wb.result = compress_prepare_cluster(context, wb.inode_num, &wb.inode_data, cluster_start, cluster_buffer.data(),
+                                             valid_blocks, dirty_slots, goal_block, &plan);
+        if (wb.result != 0) {
+            context.delalloc_reserved_blocks += dirty_count;
+            break;
+        }
+        if (!plan.new_blocks.empty()) goal_block = plan.new_blocks.back() + 1;
+        wb.plans.push_back(std::move(plan));
+        wb.plan_dirty_counts.push_back(dirty_count);
+    }
+}
+
+static void install_compressed_clusters(SimpleFS_Context& context, InodeWriteback& wb, DelallocInode& state) {
+    const uint32_t cluster_blocks = context.compress_cluster_blocks;
+    for (size_t plan_idx = 0; plan_idx < wb.plans.size(); ++plan_idx) {
+        CompressClusterWrite& plan = wb.plans[plan_idx];
+        int install_res = compress_install_cluster(context, wb.inode_num, &wb.inode_data, plan);
+        if (install_res != 0) {
+            // 本簇及之后各簇的缓存块保留预留，之后的簇新分配的块归还空闲
+            for (size_t rest_idx = plan_idx; rest_idx < wb.plans.size(); ++rest_idx) {
+                if (rest_idx != plan_idx) compress_abort_cluster(context, wb.plans[rest_idx]);
+                context.delalloc_reserved_blocks += wb.plan_dirty_counts[rest_idx];
+            }
+            if (wb.result == 0) wb.result = install_res;
+            break;
+        }
+        state.dirty_blocks.erase(state.dirty_blocks.lower_bound(plan.cluster_start),
+                                 state.dirty_blocks.lower_bound(plan.cluster_start + cluster_blocks));
+        delalloc_dirty_block_count -= wb.plan_dirty_counts[plan_idx];
+    }
+}
+
+// 第一阶段：读出inode，为缓存块分配新块并写入数据
+static void writeback_prepare(SimpleFS_Context& context, uint32_t inode_num, InodeWriteback& wb) {
+    wb.inode_num = inode_num;
+    auto inode_it = delalloc_inodes.find(inode_num);
+    if (inode_it == delalloc_inodes.end() || inode_it->second.dirty_blocks.empty()) {
+        return;
+    }
+    DelallocInode& state = inode_it->second;
+    if (read_inode_from_disk(context, inode_num, &wb.inode_data) != 0) {
+        state.writeback_error = -EIO;
+        wb.result = -EIO;
+        return;
+    }
+    wb.active = true;
+    wb.compressed = inode_is_compressed(&wb.inode_data) && context.compress_cluster_blocks != 0;
+    if (wb.compressed) {
+        prepare_compressed_clusters(context, wb, state);
+    } else {
+        prepare_block_runs(context, wb, state);
+    }
+}
+
+// 第二阶段：ordered和sync模式下，映射写入之前确保数据已到达设备
+static void writeback_barrier(SimpleFS_Context& context, std::vector<InodeWriteback>& writebacks) {
+    if (context.durability_mode == SIMPLEFS_DURABILITY_WRITEBACK ||
+        std::none_of(writebacks.begin(), writebacks.end(), writeback_has_data)) {
+        return;
+    }
+    int barrier_res = group_commit_flush(context.device_fd);
+    if (barrier_res == 0) {
+        return;
+    }
+    // 数据是否落盘未知，不安装映射，新块归还空闲，缓存块保留预留以便重试
+    for (InodeWriteback& wb : writebacks) {
+        for (const AllocatedRun& run : wb.allocated_runs) {
+            std::vector<uint32_t> unused_blocks;
+            for (uint32_t i = 0; i < run.count; ++i) unused_blocks.push_back(run.start_block + i);
+            free_blocks(context, unused_blocks);
+            context.delalloc_reserved_blocks += run.count;
+        }
+        for (size_t i = 0; i < wb.plans.size(); ++i) {
+            compress_abort_cluster(context, wb.plans[i]);
+            context.delalloc_reserved_blocks += wb.plan_dirty_counts[i];
+        }
+        wb.allocated_runs.clear();
+        wb.plans.clear();
+        wb.plan_dirty_counts.clear();
+        if (wb.active && wb.result == 0) wb.result = barrier_res;
+    }
+}
+
+// 第三阶段：安装映射并写回inode，返回0或负的错误码
+static int writeback_install(SimpleFS_Context& context, InodeWriteback& wb) {
+    if (!wb.active) {
+        return wb.result;
+    }
+    auto inode_it = delalloc_inodes.find(wb.inode_num);
+    DelallocInode& state = inode_it->second;
+    if (wb.compressed) {
+        install_compressed_clusters(context, wb, state);
+    } else {
+        install_block_runs(context, wb, state);
+    }
+
+    if (write_inode_to_disk(context, wb.inode_num, &wb.inode_data) != 0 && wb.result == 0) {
+        wb.result = -EIO;
+    }
+    // 文件已关闭时不再保留预留窗口
+    if (context.open_file_counts.find(wb.inode_num) == context.open_file_counts.end()) {
+        release_reservation_window(context, wb.inode_num);
+    }
+
+    if (wb.result != 0) {
+        std::cerr << "延迟分配回写失败: inode " << wb.inode_num << " 错误 " << -wb.result << std::endl;
+        state.writeback_error = wb.result;
+    } else if (state.dirty_blocks.empty() && state.writeback_error == 0) {
+        delalloc_inodes.erase(inode_it);
+    }
+    return wb.result;
+}
+
+int delalloc_writeback_inode(SimpleFS_Context& context, uint32_t inode_num) {
+    std::vector<InodeWriteback> writebacks(1);
+    writeback_prepare(context, inode_num, writebacks[0]);
+    if (!writebacks[0].active) {
+        return writebacks[0].result;
+    }
+    writeback_barrier(context, writebacks);
+    int result = writeback_install(context, writebacks[0]);
+    sync_fs_metadata(context);
+    return result;
+}
+
+int delalloc_writeback_all(SimpleFS_Context& context) {
+    if (delalloc_inodes.empty()) {
+        return 0;
+    }
+    std::vector<InodeWriteback> writebacks(delalloc_inodes.size());
+    size_t idx = 0;
+    for (const auto& entry : delalloc_inodes) {
+        writebacks[idx++].inode_num = entry.first;
+    }
+
+    // 先写入所有inode的数据，再经过一次屏障统一安装映射
+    for (InodeWriteback& wb : writebacks) {
+        writeback_prepare(context, wb.inode_num, wb);
+    }
+    writeback_barrier(context, writebacks);
+
+    int first_error = 0;
+    for (InodeWriteback& wb : writebacks) {
+        int res = writeback_install(context, wb);
+        if (res != 0 && first_error == 0) {
+            first_error = res;
+        }
+    }
+    sync_fs_metadata(context);
+    return first_error;
+}
+
+void delalloc_writeback_if_over_limit(SimpleFS_Context& context) {
+    if (delalloc_dirty_block_count * context.block_size > DELALLOC_MAX_DIRTY_BYTES) {
+        delalloc_writeback_all(context);
+    }
+}
+
+int delalloc_take_error(uint32_t inode_num) {
+    auto inode_it = delalloc_inodes.find(inode_num);
+    if (inode_it == delalloc_inodes.end()) {
+        return 0;
+    }
+    int err = inode_it->second.writeback_error;
+    inode_it->second.writeback_error = 0;
+    if (inode_it->second.dirty_blocks.empty()) {
+        delalloc_inodes.erase(inode_it);
+    }
+    return err;
+}
+
+static void delalloc_flusher_main(SimpleFS_Context* context) {
+    std::unique_lock<std::mutex> lock(flusher_mutex);
+    while (!flusher_stop) {
+        flusher_cv.wait_for(lock, DELALLOC_WRITEBACK_INTERVAL, [] { return flusher_stop; });
+        if (flusher_stop) {
+            break;
+        }
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+            delalloc_writeback_all(*context);
+        }
+        lock.lock();
+    }
+}
+
+void start_delalloc_flusher(SimpleFS_Context& context) {
+    std::lock_guard<std::mutex> lock(flusher_mutex);
+    if (flusher_running) {
+        return;
+    }
+    flusher_stop = false;
+    flusher_thread = std::thread(delalloc_flusher_main, &context);
+    flusher_running = true;
+}
+
+void stop_delalloc_flusher() {
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        if (!flusher_running) {
+            return;
+        }
+        flusher_stop = true;
+    }
+    flusher_cv.notify_one();
+    flusher_thread.join();
+    std::lock_guard<std::mutex> lock(flusher_mutex);
+    flusher_running = false;
+}
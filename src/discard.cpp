@@ -0,0 +1,246 @@
+#include "discard.h"
+#include "metadata.h"
+#include "disk_io.h"
+#include "group_commit.h"
+#include "utils.h"
+
+#include <iostream>
+#include <map>
+#include <iterator>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+// 队列中的块数达到此值时立即唤醒后台线程
+constexpr uint32_t DISCARD_BATCH_BLOCKS = 8192;
+// 后台下发间隔
+constexpr std::chrono::seconds DISCARD_INTERVAL(1);
+
+// 以下状态由fs_mutex保护
+static std::map<uint32_t, uint32_t> pending_ranges; // 起始块 -> 块数，区间互不相邻
+static uint32_t pending_block_count = 0;
+static uint64_t freed_generation = 0;   // 每次释放块时递增
+static uint64_t durable_generation = 0; // 已随设备刷新持久化的释放
+static std::vector<uint32_t> trimmed_min_len; // 块组 -> 上次FITRIM处理整组时的最短段长，0表示之后有块被释放
+static bool discard_unsupported = false;
+
+static std::thread worker_thread;
+static std::mutex worker_mutex;
+static std::condition_variable worker_cv;
+static bool worker_running = false;
+static bool worker_stop = false;
+static bool worker_wakeup = false;
+
+static void wake_discard_worker() {
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        worker_wakeup = true;
+    }
+    worker_cv.notify_one();
+}
+
+void discard_note_freed(SimpleFS_Context& context, uint32_t start_block_num, uint32_t count) {
+    if (count == 0) return;
+    freed_generation++;
+    uint32_t end_block_num = start_block_num + count;
+    for (uint32_t group_idx = start_block_num / context.sb.s_blocks_per_group;
+         group_idx <= (end_block_num - 1) / context.sb.s_blocks_per_group && group_idx < trimmed_min_len.size(); ++group_idx) {
+        trimmed_min_len[group_idx] = 0;
+    }
+    if (!context.discard_freed_blocks || discard_unsupported) return;
+
+    // 与重叠或相邻的区间合并
+    auto it = pending_ranges.upper_bound(start_block_num);
+    if (it != pending_ranges.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second >= start_block_num) it = prev;
+    }
+    while (it != pending_ranges.end() && it->first <= end_block_num) {
+        start_block_num = std::min(start_block_num, it->first);
+        end_block_num = std::max(end_block_num, it->first + it->second);
+        pending_block_count -= it->second;
+        it = pending_ranges.erase(it);
+    }
+    pending_ranges[start_block_num] = end_block_num - start_block_num;
+    pending_block_count += end_block_num - start_block_num;
+    if (pending_block_count >= DISCARD_BATCH_BLOCKS) {
+        wake_discard_worker();
+    }
+}
+
+// 使此前的释放持久化：写回超级块和组描述符后刷新设备。调用者持有fs_mutex，
+// 释放块的操作已经写完它们的inode和间接块
+static int make_frees_durable(SimpleFS_Context& context) {
+    if (durable_generation == freed_generation) return 0;
+    uint64_t generation = freed_generation;
+    sync_fs_metadata(context);
+    int res = group_commit_flush(context.device_fd);
+    if (res == 0) durable_generation = generation;
+    return res;
+}
+
+// 设备不支持时只记录一次日志，之后不再下发
+static void note_discard_error(int err) {
+    if (err != EOPNOTSUPP && err != ENOTTY && err != EINVAL) {
+        std::cerr << "discard失败: " << std::strerror(err) << std::endl;
+        return;
+    }
+    if (!discard_unsupported) {
+        std::cerr << "设备不支持discard，停止下发" << std::endl;
+    }
+    discard_unsupported = true;
+    pending_ranges.clear();
+    pending_block_count = 0;
+}
+
+// 下发块组内 [first_bit, end_bit) 中不短于min_len的空闲段，返回下发的块数，失败返回-1并设置errno
+static int64_t discard_free_runs(SimpleFS_Context& context, uint32_t group_idx, const std::vector<uint8_t>& bitmap,
+                                 uint32_t first_bit, uint32_t end_bit, uint32_t min_len) {
+    uint32_t group_start = group_idx * context.sb.s_blocks_per_group;
+    int64_t discarded = 0;
+    uint32_t bit = first_bit;
+    while (bit < end_bit) {
+        uint32_t run_start = find_next_clear_bit(bitmap, bit, end_bit);
+        if (run_start >= end_bit) break;
+        uint32_t run_end = find_next_set_bit(bitmap, run_start, end_bit);
+        if (run_end - run_start >= min_len) {
+            if (discard_blocks(context.device_fd, group_start + run_start, run_end - run_start) != 0) return -1;
+            discarded += run_end - run_start;
+        }
+        bit = run_end;
+    }
+    return discarded;
+}
+
+// 下发队列中的区间，调用者持有fs_mutex；以块位图为准，已被重新分配的块跳过
+static void discard_pending(SimpleFS_Context& context) {
+    if (pending_ranges.empty()) return;
+    if (make_frees_durable(context) != 0) return; // 保留队列，下次重试
+
+    std::map<uint32_t, uint32_t> ranges;
+    ranges.swap(pending_ranges);
+    pending_block_count = 0;
+    const uint32_t blocks_per_group = context.sb.s_blocks_per_group;
+    std::vector<uint8_t> bitmap(context.block_size);
+    uint32_t loaded_group = UINT32_MAX;
+    for (const auto& range : ranges) {
+        uint32_t block_num = range.first;
+        uint32_t end_block_num = std::min(range.first + range.second, context.sb.s_blocks_count);
+        // 合并后的区间可能跨越块组
+        while (block_num < end_block_num) {
+            uint32_t group_idx = block_num / blocks_per_group;
+            uint32_t group_start = group_idx * blocks_per_group;
+            uint32_t run_end = std::min(end_block_num, group_start + blocks_per_group);
+            if (group_idx != loaded_group) {
+                loaded_group = UINT32_MAX;
+                if (peek_block_bitmap(context, group_idx, bitmap.data()) == 0) loaded_group = group_idx;
+            }
+            if (loaded_group == group_idx &&
+                discard_free_runs(context, group_idx, bitmap, block_num - group_start, run_end - group_start, 1) < 0) {
+                note_discard_error(errno);
+                if (discard_unsupported) return;
+            }
+            block_num = run_end;
+        }
+    }
+}
+
+int discard_trim_range(SimpleFS_Context& context, std::unique_lock<std::mutex>& fs_lock, struct fstrim_range* range) {
+    const uint64_t block_size = context.block_size;
+    const uint32_t blocks_per_group = context.sb.s_blocks_per_group;
+    uint64_t first_block = range->start / block_size;
+    uint64_t len_blocks = range->len / block_size;
+    uint64_t min_len = std::max<uint64_t>(1, range->minlen / block_size);
+    if (len_blocks == 0 || first_block >= context.sb.s_blocks_count || min_len > blocks_per_group) return -EINVAL;
+    if (discard_unsupported) return -EOPNOTSUPP;
+    uint64_t end_block = std::min<uint64_t>(context.sb.s_blocks_count, first_block + std::min(len_blocks, UINT64_MAX - first_block));
+    range->len = 0;
+    trimmed_min_len.resize(context.gdt.size(), 0);
+
+    // 逐组处理，组间释放fs_mutex
+    std::vector<uint8_t> bitmap(context.block_size);
+    uint64_t trimmed = 0;
+    uint32_t first_group = static_cast<uint32_t>(first_block / blocks_per_group);
+    uint32_t last_group = static_cast<uint32_t>((end_block - 1) / blocks_per_group);
+    for (uint32_t group_idx = first_group; group_idx <= last_group; ++group_idx) {
+        if (group_idx > first_group) {
+            fs_lock.unlock();
+            std::this_thread::yield();
+            fs_lock.lock();
+        }
+        uint64_t group_start = static_cast<uint64_t>(group_idx) * blocks_per_group;
+        uint64_t group_end = std::min<uint64_t>(group_start + blocks_per_group, context.sb.s_blocks_count);
+        uint32_t first_bit = static_cast<uint32_t>(std::max(first_block, group_start) - group_start);
+        uint32_t end_bit = static_cast<uint32_t>(std::min(end_block, group_end) - group_start);
+        // 处理过整组且之后没有块被释放的组跳过
+        const bool whole_group = (first_bit == 0 && end_bit == group_end - group_start);
+        if (whole_group && trimmed_min_len[group_idx] != 0 && min_len >= trimmed_min_len[group_idx]) continue;
+        if (context.gdt[group_idx].bg_free_blocks_count == 0 ||
+            context.group_free_summaries[group_idx].largest_free_run < min_len) {
+            continue;
+        }
+
+        int res = make_frees_durable(context);
+        if (res != 0) return res;
+        if (peek_block_bitmap(context, group_idx, bitmap.data()) != 0) return -EIO;
+        int64_t discarded = discard_free_runs(context, group_idx, bitmap, first_bit, end_bit, static_cast<uint32_t>(min_len));
+        if (discarded < 0) {
+            int err = errno;
+            note_discard_error(err);
+            return -err;
+        }
+        trimmed += static_cast<uint64_t>(discarded);
+        if (whole_group) trimmed_min_len[group_idx] = static_cast<uint32_t>(min_len);
+    }
+    range->len = trimmed * block_size;
+    return 0;
+}
+
+// 定期或队列达到批量时下发；停止时先处理完剩余的队列再退出
+static void discard_worker_main(SimpleFS_Context* context) {
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    while (true) {
+        worker_cv.wait_for(lock, DISCARD_INTERVAL, [] { return worker_stop || worker_wakeup; });
+        worker_wakeup = false;
+        bool stopping = worker_stop;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+            discard_pending(*context);
+        }
+        lock.lock();
+        if (stopping) {
+            break;
+        }
+    }
+}
+
+void start_discard_worker(SimpleFS_Context& context) {
+    std::lock_guard<std::mutex> lock(worker_mutex);
+    if (worker_running) {
+        return;
+    }
+    worker_stop = false;
+    worker_wakeup = false;
+    worker_thread = std::thread(discard_worker_main, &context);
+    worker_running = true;
+}
+
+void stop_discard_worker() {
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        if (!worker_running) {
+            return;
+        }
+        worker_stop = true;
+    }
+    worker_cv.notify_one();
+    worker_thread.join();
+    std::lock_guard<std::mutex> lock(worker_mutex);
+    worker_running = false;
+}
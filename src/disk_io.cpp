@@ -7,17 +7,79 @@
 #include <cstdio>
 #include <cstring>
 #include <vector>
+#include <algorithm>
+#include <sys/stat.h>   // fstat, S_ISBLK
+#include <sys/ioctl.h>
+#include <linux/fs.h>   // BLKDISCARD
+#include <linux/falloc.h> // FALLOC_FL_PUNCH_HOLE
+
+// 当前设备的块大小，格式化或挂载时根据超级块设置
+static uint32_t current_block_size = SIMPLEFS_BLOCK_SIZE;
+
+// 快照的写入钩子和读取重映射，未设置时为空
+static BlockWriteHook block_write_hook = nullptr;
+static BlockReadRemap block_read_remap = nullptr;
+
+void set_block_write_hook(BlockWriteHook hook) {
+    block_write_hook = hook;
+}
+
+void set_block_read_remap(BlockReadRemap remap) {
+    block_read_remap = remap;
+}
+
+// 写入前调用钩子，钩子失败时设置errno
+static int before_block_write(uint32_t start_block_num, uint32_t count) {
+    if (!block_write_hook) return 0;
+    int res = block_write_hook(start_block_num, count);
+    if (res != 0) {
+        errno = res;
+        return -1;
+    }
+    return 0;
+}
+
+void set_device_block_size(uint32_t block_size) {
+    current_block_size = block_size;
+}
+
+uint32_t device_block_size() {
+    return current_block_size;
+}
+
+bool is_valid_block_size(uint32_t block_size) {
+    return block_size >= SIMPLEFS_MIN_BLOCK_SIZE && block_size <= SIMPLEFS_MAX_BLOCK_SIZE &&
+           (block_size & (block_size - 1)) == 0;
+}
+
+// 超级块总在块1，即偏移为块大小处。按块大小从小到大探测，
+// 第一个魔数正确且块大小与所在偏移一致的即为当前超级块（mkfs会清零块0，覆盖更小偏移处的旧超级块）
+int probe_superblock(DeviceFd fd, SimpleFS_SuperBlock* sb) {
+    for (uint32_t block_size = SIMPLEFS_MIN_BLOCK_SIZE; block_size <= SIMPLEFS_MAX_BLOCK_SIZE; block_size <<= 1) {
+        ssize_t bytes_read = pread(fd, sb, sizeof(SimpleFS_SuperBlock), block_size);
+        if (bytes_read != static_cast<ssize_t>(sizeof(SimpleFS_SuperBlock))) {
+            continue;
+        }
+        if (sb->s_magic == SIMPLEFS_MAGIC && sb->s_log_block_size <= 6 &&
+            (SIMPLEFS_MIN_BLOCK_SIZE << sb->s_log_block_size) == block_size) {
+            set_device_block_size(block_size);
+            return 0;
+        }
+    }
+    return -1;
+}
 
 // 读取磁盘块
 int read_block(DeviceFd fd, uint32_t block_num, void* buffer) {
-    off_t offset = static_cast<off_t>(block_num) * SIMPLEFS_BLOCK_SIZE;
-    ssize_t bytes_read = pread(fd, buffer, SIMPLEFS_BLOCK_SIZE, offset);
+    if (block_read_remap) block_num = block_read_remap(block_num);
+    off_t offset = static_cast<off_t>(block_num) * current_block_size;
+    ssize_t bytes_read = pread(fd, buffer, current_block_size, offset);
 
     if (bytes_read == -1) {
         perror("磁盘读取失败");
         return -1;
     }
-    if (bytes_read < SIMPLEFS_BLOCK_SIZE) {
+    if (bytes_read < static_cast<ssize_t>(current_block_size)) {
         return -1;
     }
     return 0;
@@ -25,14 +87,15 @@ int read_block(DeviceFd fd, uint32_t block_num, void* buffer) {
 
 // 写入磁盘块
 int write_block(DeviceFd fd, uint32_t block_num, const void* buffer) {
-    off_t offset = static_cast<off_t>(block_num) * SIMPLEFS_BLOCK_SIZE;
-    ssize_t bytes_written = pwrite(fd, buffer, SIMPLEFS_BLOCK_SIZE, offset);
+    if (before_block_write(block_num, 1) != 0) return -1;
+    off_t offset = static_cast<off_t>(block_num) * current_block_size;
+    ssize_t bytes_written = pwrite(fd, buffer, current_block_size, offset);
 
     if (bytes_written == -1) {
         perror("磁盘写入失败");
         return -1;
     }
-    if (bytes_written < SIMPLEFS_BLOCK_SIZE) {
+    if (bytes_written < static_cast<ssize_t>(current_block_size)) {
         return -1;
     }
     return 0;
@@ -42,7 +105,7 @@ int write_block(DeviceFd fd, uint32_t block_num, const void* buffer) {
 int write_zero_blocks(DeviceFd fd, uint32_t start_block_num, uint32_t count) {
     if (count == 0) return 0;
     
-    std::vector<uint8_t> zero_buffer(SIMPLEFS_BLOCK_SIZE, 0);
+    std::vector<uint8_t> zero_buffer(current_block_size, 0);
     for (uint32_t i = 0; i < count; ++i) {
         if (write_block(fd, start_block_num + i, zero_buffer.data()) != 0) {
             return -1;
@@ -50,3 +113,119 @@ int write_zero_blocks(DeviceFd fd, uint32_t start_block_num, uint32_t count) {
     }
     return 0;
 }
+
+// 读取连续多个磁盘块，单次系统调用完成
+int read_blocks(DeviceFd fd, uint32_t start_block_num, uint32_t count, void* buffer) {
+    if (count == 0) return 0;
+    if (block_read_remap) {
+        // 重映射后的块不一定连续，逐块读取
+        for (uint32_t i = 0; i < count; ++i) {
+            if (read_block(fd, start_block_num + i, static_cast<uint8_t*>(buffer) + static_cast<size_t>(i) * current_block_size) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    off_t offset = static_cast<off_t>(start_block_num) * current_block_size;
+    size_t total_bytes = static_cast<size_t>(count) * current_block_size;
+    size_t done = 0;
+    while (done < total_bytes) {
+        ssize_t bytes_read = pread(fd, static_cast<uint8_t*>(buffer) + done, total_bytes - done, offset + done);
+        if (bytes_read == -1) {
+            if (errno == EINTR) continue;
+            perror("磁盘读取失败");
+            return -1;
+        }
+        if (bytes_read == 0) {
+            return -1;
+        }
+        done += bytes_read;
+    }
+    return 0;
+}
+
+// 写入连续多个磁盘块，单次系统调用完成
+int write_blocks(DeviceFd fd, uint32_t start_block_num, uint32_t count, const void* buffer) {
+    if (count == 0) return 0;
+    if (before_block_write(start_block_num, count) != 0) return -1;
+
+    off_t offset = static_cast<off_t>(start_block_num) * current_block_size;
+    size_t total_bytes = static_cast<size_t>(count) * current_block_size;
+    size_t done = 0;
+    while (done < total_bytes) {
+        ssize_t bytes_written = pwrite(fd, static_cast<const uint8_t*>(buffer) + done, total_bytes - done, offset + done);
+        if (bytes_written == -1) {
+            if (errno == EINTR) continue;
+            perror("磁盘写入失败");
+            return -1;
+        }
+        done += bytes_written;
+    }
+    return 0;
+}
+
+// 设备内块复制：copy_file_range不可用时退回分段读写
+int copy_blocks(DeviceFd fd, uint32_t src_block_num, uint32_t dst_block_num, uint32_t count) {
+    if (count == 0) return 0;
+    if (before_block_write(dst_block_num, count) != 0) return -1;
+
+    loff_t src_offset = static_cast<loff_t>(src_block_num) * current_block_size;
+    loff_t dst_offset = static_cast<loff_t>(dst_block_num) * current_block_size;
+    size_t remaining = static_cast<size_t>(count) * current_block_size;
+    while (remaining > 0) {
+        ssize_t copied = copy_file_range(fd, &src_offset, fd, &dst_offset, remaining, 0);
+        if (copied > 0) {
+            remaining -= copied;
+            continue;
+        }
+        if (copied == -1 && errno == EINTR) continue;
+        if (copied == -1 && errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) {
+            perror("设备内复制失败");
+            return -1;
+        }
+        break; // 不支持或无进展，改用普通读写
+    }
+
+    // 回退路径：从copy_file_range停止处按最多1MB一段读入再写出
+    std::vector<uint8_t> chunk_buffer(std::min<size_t>(remaining, 1 << 20));
+    while (remaining > 0) {
+        size_t chunk_bytes = std::min(remaining, chunk_buffer.size());
+        ssize_t bytes_read = pread(fd, chunk_buffer.data(), chunk_bytes, src_offset);
+        if (bytes_read <= 0) {
+            if (bytes_read == -1 && errno == EINTR) continue;
+            perror("磁盘读取失败");
+            return -1;
+        }
+        ssize_t bytes_written = pwrite(fd, chunk_buffer.data(), bytes_read, dst_offset);
+        if (bytes_written != bytes_read) {
+            perror("磁盘写入失败");
+            return -1;
+        }
+        src_offset += bytes_read;
+        dst_offset += bytes_read;
+        remaining -= bytes_read;
+    }
+    return 0;
+}
+
+// 普通文件（镜像）打洞，块设备下发BLKDISCARD
+int discard_blocks(DeviceFd fd, uint32_t start_block_num, uint32_t count) {
+    if (count == 0) return 0;
+    uint64_t offset = static_cast<uint64_t>(start_block_num) * current_block_size;
+    uint64_t length = static_cast<uint64_t>(count) * current_block_size;
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    if (S_ISBLK(st.st_mode)) {
+        uint64_t range[2] = {offset, length};
+        return ioctl(fd, BLKDISCARD, range) == 0 ? 0 : -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    while (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(length)) != 0) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include "freespace.h"
+#include "disk_io.h"
+#include "utils.h"
+#include "checksum.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <atomic>
+#include <thread>
+
+// 挂载时加载块位图的单次读取上限
+constexpr uint32_t BITMAP_READ_BATCH_BYTES = 1 << 20;
+// 挂载时并行读取块位图的线程数上限
+constexpr uint32_t FREE_SPACE_INDEX_MAX_WORKERS = 8;
+
+// 由块组位图计算空闲空间摘要
+static SimpleFS_GroupFreeSummary compute_group_free_summary(const SimpleFS_Context& context, uint32_t group_idx,
+                                                            const std::vector<uint8_t>& bitmap) {
+    SimpleFS_GroupFreeSummary summary;
+    uint32_t group_base = group_idx * context.sb.s_blocks_per_group;
+    uint32_t group_bits = std::min(context.sb.s_blocks_per_group, context.sb.s_blocks_count - group_base);
+
+    uint32_t bit = 0;
+    while (bit < group_bits) {
+        uint32_t run_start = find_next_clear_bit(bitmap, bit, group_bits);
+        if (run_start >= group_bits) {
+            break;
+        }
+        uint32_t run_end = find_next_set_bit(bitmap, run_start, group_bits);
+        uint32_t run_len = run_end - run_start;
+        uint32_t order = std::min<uint32_t>(31 - __builtin_clz(run_len), SIMPLEFS_FREE_RUN_ORDERS - 1);
+        summary.free_run_counts[order]++;
+        summary.largest_free_run = std::max(summary.largest_free_run, run_len);
+        bit = run_end;
+    }
+    return summary;
+}
+
+// 不读位图即可确定摘要的块组：全满的组没有空闲段；全空或位图未修改过的组，空闲块是组尾的一整段
+static bool summary_from_free_count(const SimpleFS_Context& context, uint32_t group_idx,
+                                    SimpleFS_GroupFreeSummary* summary) {
+    const SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+    uint32_t group_base = group_idx * context.sb.s_blocks_per_group;
+    uint32_t group_bits = std::min(context.sb.s_blocks_per_group, context.sb.s_blocks_count - group_base);
+    uint32_t free_blocks = gd.bg_free_blocks_count;
+    *summary = SimpleFS_GroupFreeSummary();
+    if (free_blocks == 0) {
+        return true;
+    }
+    if (free_blocks == group_bits || (gd.bg_flags & SIMPLEFS_BG_BLOCK_UNINIT)) {
+        uint32_t order = std::min<uint32_t>(31 - __builtin_clz(free_blocks), SIMPLEFS_FREE_RUN_ORDERS - 1);
+        summary->free_run_counts[order] = 1;
+        summary->largest_free_run = free_blocks;
+        return true;
+    }
+    return false;
+}
+
+// 一次读取的连续块位图：块组 [first_group, first_group + group_count)
+struct BitmapReadBatch {
+    uint32_t first_group;
+    uint32_t group_count;
+};
+
+int build_free_space_index(SimpleFS_Context& context) {
+    uint32_t num_groups = context.gdt.size();
+    context.group_free_summaries.assign(num_groups, SimpleFS_GroupFreeSummary());
+    context.groups_by_largest_run.clear();
+
+    // 划分读取批次：flex_bg布局下相邻块组的块位图连续存放，合并为一次读取
+    const uint32_t max_batch_groups = std::max<uint32_t>(1, BITMAP_READ_BATCH_BYTES / context.block_size);
+    std::vector<BitmapReadBatch> batches;
+    uint32_t group_idx = 0;
+    while (group_idx < num_groups) {
+        if (summary_from_free_count(context, group_idx, &context.group_free_summaries[group_idx])) {
+            group_idx++;
+            continue;
+        }
+        uint32_t first_bitmap_block = context.gdt[group_idx].bg_block_bitmap;
+        uint32_t batch_groups = 1;
+        while (batch_groups < max_batch_groups && group_idx + batch_groups < num_groups &&
+               context.gdt[group_idx + batch_groups].bg_block_bitmap == first_bitmap_block + batch_groups) {
+            batch_groups++;
+        }
+        batches.push_back({group_idx, batch_groups});
+        group_idx += batch_groups;
+    }
+
+    // 工作线程各自领取批次，读取位图并写入各自块组的摘要槽位，互不重叠
+    std::atomic<size_t> next_batch(0);
+    std::atomic<uint32_t> failed_group(UINT32_MAX);
+    auto worker = [&]() {
+        std::vector<uint8_t> batch_buffer(static_cast<size_t>(max_batch_groups) * context.block_size);
+        std::vector<uint8_t> block_bitmap_data(context.block_size);
+        for (size_t batch_idx = next_batch++; batch_idx < batches.size(); batch_idx = next_batch++) {
+            if (failed_group.load() != UINT32_MAX) {
+                return;
+            }
+            const BitmapReadBatch& batch = batches[batch_idx];
+            if (read_blocks(context.device_fd, context.gdt[batch.first_group].bg_block_bitmap, batch.group_count,
+                            batch_buffer.data()) != 0) {
+                uint32_t expected = UINT32_MAX;
+                failed_group.compare_exchange_strong(expected, batch.first_group);
+                return;
+            }
+            for (uint32_t i = 0; i < batch.group_count; ++i) {
+                std::copy_n(batch_buffer.begin() + static_cast<size_t>(i) * context.block_size, context.block_size,
+                            block_bitmap_data.begin());
+                uint32_t group_idx = batch.first_group + i;
+                if (has_metadata_csum(context.sb) &&
+                    bitmap_checksum(block_bitmap_data.data(), context.block_size) != context.gdt[group_idx].bg_block_bitmap_csum) {
+                    // 摘要留空；之后读取该位图时同样会校验失败，不会在损坏的位图上分配
+                    std::cerr << "块组 " << group_idx << " 的块位图校验和不匹配" << std::endl;
+                    continue;
+                }
+                context.group_free_summaries[group_idx] = compute_group_free_summary(context, group_idx, block_bitmap_data);
+            }
+        }
+    };
+
+    uint32_t worker_count = std::min<uint32_t>({std::max(1u, std::thread::hardware_concurrency()),
+                                                FREE_SPACE_INDEX_MAX_WORKERS, static_cast<uint32_t>(batches.size())});
+    std::vector<std::thread> workers;
+    for (uint32_t i = 1; i < worker_count; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker(); // 当前线程也参与
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    if (failed_group.load() != UINT32_MAX) {
+        std::cerr << "读取块组 " << failed_group.load() << " 的块位图失败" << std::endl;
+        errno = EIO;
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < num_groups; ++i) {
+        context.groups_by_largest_run.emplace(context.group_free_summaries[i].largest_free_run, i);
+    }
+    return 0;
+}
+
+void update_group_free_summary(SimpleFS_Context& context, uint32_t group_idx, const std::vector<uint8_t>& bitmap) {
+    context.gdt[group_idx].bg_flags &= ~SIMPLEFS_BG_BLOCK_UNINIT; // 位图已不是初始状态
+    if (group_idx >= context.group_free_summaries.size()) {
+        return; // 索引尚未建立
+    }
+    SimpleFS_GroupFreeSummary& summary = context.group_free_summaries[group_idx];
+    context.groups_by_largest_run.erase({summary.largest_free_run, group_idx});
+    summary = compute_group_free_summary(context, group_idx, bitmap);
+    context.groups_by_largest_run.emplace(summary.largest_free_run, group_idx);
+}
+
+uint32_t find_group_with_free_run(const SimpleFS_Context& context, uint32_t min_run_blocks, uint32_t goal_group) {
+    if (context.group_free_summaries.empty()) {
+        return UINT32_MAX;
+    }
+    min_run_blocks = std::max(min_run_blocks, 1u);
+    if (goal_group < context.group_free_summaries.size() &&
+        context.group_free_summaries[goal_group].largest_free_run >= min_run_blocks) {
+        return goal_group;
+    }
+    auto it = context.groups_by_largest_run.lower_bound({min_run_blocks, 0});
+    return (it == context.groups_by_largest_run.end()) ? UINT32_MAX : it->second;
+}
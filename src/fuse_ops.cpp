@@ -2,6 +2,15 @@
 #include "disk_io.h"
 #include "metadata.h"
 #include "utils.h"    // 路径解析和目录条目计算
+#include "orphan.h"   // 延迟删除
+#include "delalloc.h" // 延迟分配
+#include "group_commit.h" // 分组提交
+#include "compress.h"     // 透明压缩
+#include "refcount.h"     // reflink块共享
+#include "snapshot.h"     // 快照
+#include "defrag.h"       // 在线碎片整理
+#include "discard.h"      // 在线discard和FITRIM
+#include "simplefs_ioctl.h"
 
 #include <iostream>
 #include <cstring>
@@ -9,14 +18,19 @@
 #include <sys/stat.h> // S_ISDIR, S_IFMT, mode_t, S_ISUID, S_ISGID
 #include <sys/statvfs.h> // struct statvfs
 #include <algorithm>
+#include <cstdint>
+#include <mutex>
 #include <cmath>
+#include <cstdlib> // malloc, free：fuse_bufvec由libfuse释放
 #include <vector>
 #include <string>
 #include <unistd.h> // uid_t, gid_t, getgroups
+#include <fcntl.h>  // O_ACCMODE
 #include <time.h>   // time_t, time(), timespec
 #include <vector>   // std::vector
 #include <cstdio>   // perror
 #include <dirent.h> // DT_REG, DT_DIR, DT_LNK
+#include <linux/falloc.h> // FALLOC_FL_*
 
 // fuse_common.h (由fuse.h包含) 定义FUSE_SYMLINK_MAX
 // 如果由于某种原因不可用，定义一个回退值
@@ -35,7 +49,6 @@ static uint32_t resolve_path_recursive(const char* path_cstr, int depth, bool fo
 static uint32_t path_to_inode_num(const char* path_cstr); // resolve_path_recursive的包装器
 
 // static uint32_t map_logical_to_physical_block(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx); // 已移至metadata.h/cpp
-static uint32_t allocate_block_for_write(SimpleFS_Context& context, SimpleFS_Inode* inode, uint32_t inode_num, uint32_t logical_block_idx, bool* p_was_newly_allocated);
 
 
 // 给定路径，返回inode号
@@ -44,6 +57,38 @@ static uint32_t path_to_inode_num(const char* path_cstr) {
     return resolve_path_recursive(path_cstr, 0, true); // 默认：跟随最后的符号链接
 }
 
+// 快照路径：/.snapshots 是列出各快照的虚拟目录，/.snapshots/<名字>/... 在该快照中只读解析
+// 在持有fs_mutex时构造，析构时结束浏览；path()为实际要解析的路径
+struct SnapshotPathView {
+    bool snapshot_dir = false;      // 路径就是快照目录
+    bool active = false;            // 正在浏览某个快照
+    int error = 0;                  // 快照不存在时为-ENOENT
+    std::string inner_path;
+
+    SnapshotPathView(SimpleFS_Context& context, const char* path) : inner_path(path) {
+        if (!is_snapshot_path(context, path)) return;
+        std::string rest(path + std::strlen(SIMPLEFS_SNAPSHOT_DIR_PATH));
+        size_t name_start = rest.find_first_not_of('/');
+        if (name_start == std::string::npos) {
+            snapshot_dir = true;
+            return;
+        }
+        size_t name_end = rest.find('/', name_start);
+        std::string name = rest.substr(name_start, name_end == std::string::npos ? std::string::npos : name_end - name_start);
+        inner_path = (name_end == std::string::npos) ? "/" : rest.substr(name_end);
+        error = snapshot_view_begin(context, name);
+        active = (error == 0);
+    }
+    ~SnapshotPathView() {
+        if (active) snapshot_view_end();
+    }
+    SnapshotPathView(const SnapshotPathView&) = delete;
+    SnapshotPathView& operator=(const SnapshotPathView&) = delete;
+
+    bool read_only() const { return snapshot_dir || active; }
+    const char* path() const { return inner_path.c_str(); }
+};
+
 // 递归路径解析函数
 static uint32_t resolve_path_recursive(const char* path_cstr, int depth, bool follow_last_symlink) {
     if (depth > FUSE_SYMLINK_MAX) {
@@ -124,88 +169,97 @@ static uint32_t resolve_path_recursive(const char* path_cstr, int depth, bool fo
         uint32_t next_inode_num_candidate = 0;
         // SimpleFS_Inode component_inode_data; // 解析组件(文件/目录/符号链接)的数据
 
-        std::vector<uint8_t> dir_data_block_buffer(SIMPLEFS_BLOCK_SIZE);
+        std::vector<uint8_t> dir_data_block_buffer(context->block_size);
+
+        // 内联目录的目录项在inode内，不经过块映射
+        const bool inline_dir = inode_has_inline_data(&current_dir_inode_data);
+        if (inline_dir) {
+            errno = 0;
+            next_inode_num_candidate = lookup_dir_entry(*context, &current_dir_inode_data, component);
+            if (next_inode_num_candidate == 0 && errno != ENOENT) return 0;
+            found_component_in_dir = (next_inode_num_candidate != 0);
+        }
 
         // 遍历直接、一级、二级、三级间接块查找目录条目
 
         // 搜索直接块
-        for (int i = 0; i < SIMPLEFS_NUM_DIRECT_BLOCKS && !found_component_in_dir; ++i) {
+        for (int i = 0; i < SIMPLEFS_NUM_DIRECT_BLOCKS && !inline_dir && !found_component_in_dir; ++i) {
             uint32_t dir_block_ptr = current_dir_inode_data.i_block[i];
             if (dir_block_ptr == 0) continue;
-            if (read_block(context->device_fd, dir_block_ptr, dir_data_block_buffer.data()) != 0) { errno = EIO; return 0; }
-            uint16_t entry_offset = 0;
-            uint32_t block_start_offset_in_file = i * SIMPLEFS_BLOCK_SIZE;
+            if (read_dir_block(*context, dir_block_ptr, dir_data_block_buffer.data()) != 0) return 0;
+            uint32_t entry_offset = 0;
+            uint32_t block_start_offset_in_file = i * context->block_size;
             uint32_t effective_size_in_this_block = (current_dir_inode_data.i_size > block_start_offset_in_file) ?
-                                                std::min((uint32_t)SIMPLEFS_BLOCK_SIZE, current_dir_inode_data.i_size - block_start_offset_in_file) : 0;
+                                                std::min((uint32_t)context->block_size, current_dir_inode_data.i_size - block_start_offset_in_file) : 0;
             if (effective_size_in_this_block == 0 && i > 0 && current_dir_inode_data.i_size <= block_start_offset_in_file) continue;
 
             while (entry_offset < effective_size_in_this_block) {
                 SimpleFS_DirEntry* entry = reinterpret_cast<SimpleFS_DirEntry*>(dir_data_block_buffer.data() + entry_offset);
-                if (entry->rec_len == 0 || (calculate_dir_entry_len(entry->name_len) > entry->rec_len) || (entry_offset + entry->rec_len > effective_size_in_this_block)) break;
+                if (dir_entry_rec_len(entry) == 0 || (calculate_dir_entry_len(entry->name_len) > dir_entry_rec_len(entry)) || (entry_offset + dir_entry_rec_len(entry) > effective_size_in_this_block)) break;
                 if (entry->inode != 0 && entry->name_len == component.length() && strncmp(entry->name, component.c_str(), entry->name_len) == 0) {
                     next_inode_num_candidate = entry->inode;
                     found_component_in_dir = true;
                     break;
                 }
-                entry_offset += entry->rec_len;
+                entry_offset += dir_entry_rec_len(entry);
             }
         }
         // 搜索一级间接块
-        if (!found_component_in_dir) {
+        if (!found_component_in_dir && !inline_dir) {
             uint32_t single_indirect_block_ptr = current_dir_inode_data.i_block[SIMPLEFS_NUM_DIRECT_BLOCKS];
             if (single_indirect_block_ptr != 0) {
-                std::vector<uint32_t> indirect_block_content(SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t));
+                std::vector<uint32_t> indirect_block_content(context->block_size / sizeof(uint32_t));
                 if (read_block(context->device_fd, single_indirect_block_ptr, indirect_block_content.data()) == 0) {
-                    for (uint32_t k = 0; k < (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) && !found_component_in_dir; ++k) {
+                    for (uint32_t k = 0; k < (context->block_size / sizeof(uint32_t)) && !found_component_in_dir; ++k) {
                         uint32_t data_block_ptr = indirect_block_content[k];
                         if (data_block_ptr == 0) continue;
-                        if (read_block(context->device_fd, data_block_ptr, dir_data_block_buffer.data()) != 0) { errno = EIO; return 0; }
-                        uint16_t entry_offset = 0;
+                        if (read_dir_block(*context, data_block_ptr, dir_data_block_buffer.data()) != 0) return 0;
+                        uint32_t entry_offset = 0;
                         uint32_t logical_block_idx = SIMPLEFS_NUM_DIRECT_BLOCKS + k;
-                        uint32_t block_start_offset_in_file = logical_block_idx * SIMPLEFS_BLOCK_SIZE;
+                        uint32_t block_start_offset_in_file = logical_block_idx * context->block_size;
                         uint32_t effective_size_in_this_block = (current_dir_inode_data.i_size > block_start_offset_in_file) ?
-                                                            std::min((uint32_t)SIMPLEFS_BLOCK_SIZE, current_dir_inode_data.i_size - block_start_offset_in_file) : 0;
+                                                            std::min((uint32_t)context->block_size, current_dir_inode_data.i_size - block_start_offset_in_file) : 0;
                         if(effective_size_in_this_block == 0 && current_dir_inode_data.i_size <= block_start_offset_in_file) continue;
                         while (entry_offset < effective_size_in_this_block) {
                             SimpleFS_DirEntry* entry = reinterpret_cast<SimpleFS_DirEntry*>(dir_data_block_buffer.data() + entry_offset);
-                            if (entry->rec_len == 0 || (calculate_dir_entry_len(entry->name_len) > entry->rec_len) || (entry_offset + entry->rec_len > effective_size_in_this_block) ) break;
+                            if (dir_entry_rec_len(entry) == 0 || (calculate_dir_entry_len(entry->name_len) > dir_entry_rec_len(entry)) || (entry_offset + dir_entry_rec_len(entry) > effective_size_in_this_block) ) break;
                             if (entry->inode != 0 && entry->name_len == component.length() && strncmp(entry->name, component.c_str(), entry->name_len) == 0) {
                                 next_inode_num_candidate = entry->inode; found_component_in_dir = true; break;
                             }
-                            entry_offset += entry->rec_len;
+                            entry_offset += dir_entry_rec_len(entry);
                         }
                     }
                 }
             }
         }
         // 搜索二级间接块
-        if (!found_component_in_dir) {
+        if (!found_component_in_dir && !inline_dir) {
             uint32_t dbl_indirect_block_ptr = current_dir_inode_data.i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 1];
             if (dbl_indirect_block_ptr != 0) {
-                std::vector<uint32_t> dbl_indirect_content(SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t));
+                std::vector<uint32_t> dbl_indirect_content(context->block_size / sizeof(uint32_t));
                 if (read_block(context->device_fd, dbl_indirect_block_ptr, dbl_indirect_content.data()) == 0) {
-                    for (uint32_t l1_idx = 0; l1_idx < (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) && !found_component_in_dir; ++l1_idx) {
+                    for (uint32_t l1_idx = 0; l1_idx < (context->block_size / sizeof(uint32_t)) && !found_component_in_dir; ++l1_idx) {
                         uint32_t single_indirect_ptr = dbl_indirect_content[l1_idx];
                         if (single_indirect_ptr == 0) continue;
-                        std::vector<uint32_t> single_indirect_content(SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t));
+                        std::vector<uint32_t> single_indirect_content(context->block_size / sizeof(uint32_t));
                         if (read_block(context->device_fd, single_indirect_ptr, single_indirect_content.data()) == 0) {
-                            for (uint32_t l2_idx = 0; l2_idx < (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) && !found_component_in_dir; ++l2_idx) {
+                            for (uint32_t l2_idx = 0; l2_idx < (context->block_size / sizeof(uint32_t)) && !found_component_in_dir; ++l2_idx) {
                                 uint32_t data_block_ptr = single_indirect_content[l2_idx];
                                 if (data_block_ptr == 0) continue;
-                                if (read_block(context->device_fd, data_block_ptr, dir_data_block_buffer.data()) != 0) { errno = EIO; return 0; }
-                                uint16_t entry_offset = 0;
-                                uint32_t logical_block_idx = SIMPLEFS_NUM_DIRECT_BLOCKS + (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) + (l1_idx * (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t))) + l2_idx; // 取消注释
-                                uint32_t block_start_offset_in_file = logical_block_idx * SIMPLEFS_BLOCK_SIZE;
+                                if (read_dir_block(*context, data_block_ptr, dir_data_block_buffer.data()) != 0) return 0;
+                                uint32_t entry_offset = 0;
+                                uint32_t logical_block_idx = SIMPLEFS_NUM_DIRECT_BLOCKS + (context->block_size / sizeof(uint32_t)) + (l1_idx * (context->block_size / sizeof(uint32_t))) + l2_idx; // 取消注释
+                                uint32_t block_start_offset_in_file = logical_block_idx * context->block_size;
                                 uint32_t effective_size_in_this_block = (current_dir_inode_data.i_size > block_start_offset_in_file ) ?
-                                                                    std::min((uint32_t)SIMPLEFS_BLOCK_SIZE, (uint32_t)(current_dir_inode_data.i_size - block_start_offset_in_file) ) : 0;
+                                                                    std::min((uint32_t)context->block_size, (uint32_t)(current_dir_inode_data.i_size - block_start_offset_in_file) ) : 0;
                                 if(effective_size_in_this_block == 0 && current_dir_inode_data.i_size <= block_start_offset_in_file) continue;
                                 while (entry_offset < effective_size_in_this_block) {
                                    SimpleFS_DirEntry* entry = reinterpret_cast<SimpleFS_DirEntry*>(dir_data_block_buffer.data() + entry_offset);
-                                   if (entry->rec_len == 0 || (calculate_dir_entry_len(entry->name_len) > entry->rec_len) || (entry_offset + entry->rec_len > effective_size_in_this_block) ) break;
+                                   if (dir_entry_rec_len(entry) == 0 || (calculate_dir_entry_len(entry->name_len) > dir_entry_rec_len(entry)) || (entry_offset + dir_entry_rec_len(entry) > effective_size_in_this_block) ) break;
                                    if (entry->inode != 0 && entry->name_len == component.length() && strncmp(entry->name, component.c_str(), entry->name_len) == 0) {
                                        next_inode_num_candidate = entry->inode; found_component_in_dir = true; break;
                                    }
-                                   entry_offset += entry->rec_len;
+                                   entry_offset += dir_entry_rec_len(entry);
                                 }
                             }
                         }
@@ -214,38 +268,38 @@ static uint32_t resolve_path_recursive(const char* path_cstr, int depth, bool fo
             }
         }
         // 搜索三级间接块
-        if (!found_component_in_dir) {
+        if (!found_component_in_dir && !inline_dir) {
             uint32_t tpl_indirect_block_ptr = current_dir_inode_data.i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 2];
             if (tpl_indirect_block_ptr != 0) {
-                std::vector<uint32_t> tpl_indirect_content(SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t));
+                std::vector<uint32_t> tpl_indirect_content(context->block_size / sizeof(uint32_t));
                 if (read_block(context->device_fd, tpl_indirect_block_ptr, tpl_indirect_content.data()) == 0) {
-                    for (uint32_t l0_idx = 0; l0_idx < (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) && !found_component_in_dir; ++l0_idx) {
+                    for (uint32_t l0_idx = 0; l0_idx < (context->block_size / sizeof(uint32_t)) && !found_component_in_dir; ++l0_idx) {
                         uint32_t dbl_indirect_ptr_from_tpl = tpl_indirect_content[l0_idx];
                         if (dbl_indirect_ptr_from_tpl == 0) continue;
-                        std::vector<uint32_t> dbl_indirect_content_via_tpl(SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t));
+                        std::vector<uint32_t> dbl_indirect_content_via_tpl(context->block_size / sizeof(uint32_t));
                         if (read_block(context->device_fd, dbl_indirect_ptr_from_tpl, dbl_indirect_content_via_tpl.data()) == 0) {
-                            for (uint32_t l1_idx = 0; l1_idx < (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) && !found_component_in_dir; ++l1_idx) {
+                            for (uint32_t l1_idx = 0; l1_idx < (context->block_size / sizeof(uint32_t)) && !found_component_in_dir; ++l1_idx) {
                                 uint32_t sgl_indirect_ptr_from_dbl = dbl_indirect_content_via_tpl[l1_idx];
                                 if (sgl_indirect_ptr_from_dbl == 0) continue;
-                                std::vector<uint32_t> sgl_indirect_content_via_dbl_tpl(SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t));
+                                std::vector<uint32_t> sgl_indirect_content_via_dbl_tpl(context->block_size / sizeof(uint32_t));
                                 if (read_block(context->device_fd, sgl_indirect_ptr_from_dbl, sgl_indirect_content_via_dbl_tpl.data()) == 0) {
-                                    for (uint32_t l2_idx = 0; l2_idx < (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) && !found_component_in_dir; ++l2_idx) {
+                                    for (uint32_t l2_idx = 0; l2_idx < (context->block_size / sizeof(uint32_t)) && !found_component_in_dir; ++l2_idx) {
                                         uint32_t data_block_ptr = sgl_indirect_content_via_dbl_tpl[l2_idx];
                                         if (data_block_ptr == 0) continue;
-                                        if (read_block(context->device_fd, data_block_ptr, dir_data_block_buffer.data()) != 0) { errno = EIO; return 0; }
-                                        uint16_t entry_offset = 0;
-                                        uint32_t tpl_logical_block_idx = SIMPLEFS_NUM_DIRECT_BLOCKS + (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) + ((SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) * (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t))) + (l0_idx * (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t)) * (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t))) + (l1_idx * (SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t))) + l2_idx;
-                                        uint32_t tpl_block_start_offset_in_file = tpl_logical_block_idx * SIMPLEFS_BLOCK_SIZE;
+                                        if (read_dir_block(*context, data_block_ptr, dir_data_block_buffer.data()) != 0) return 0;
+                                        uint32_t entry_offset = 0;
+                                        uint32_t tpl_logical_block_idx = SIMPLEFS_NUM_DIRECT_BLOCKS + (context->block_size / sizeof(uint32_t)) + ((context->block_size / sizeof(uint32_t)) * (context->block_size / sizeof(uint32_t))) + (l0_idx * (context->block_size / sizeof(uint32_t)) * (context->block_size / sizeof(uint32_t))) + (l1_idx * (context->block_size / sizeof(uint32_t))) + l2_idx;
+                                        uint32_t tpl_block_start_offset_in_file = tpl_logical_block_idx * context->block_size;
                                         uint32_t effective_size_in_this_block = (current_dir_inode_data.i_size > tpl_block_start_offset_in_file) ?
-                                                                            std::min((uint32_t)SIMPLEFS_BLOCK_SIZE, current_dir_inode_data.i_size - tpl_block_start_offset_in_file) : 0;
+                                                                            std::min((uint32_t)context->block_size, current_dir_inode_data.i_size - tpl_block_start_offset_in_file) : 0;
                                         if(effective_size_in_this_block == 0 && current_dir_inode_data.i_size <= tpl_block_start_offset_in_file) continue;
                                         while (entry_offset < effective_size_in_this_block) {
                                             SimpleFS_DirEntry* entry = reinterpret_cast<SimpleFS_DirEntry*>(dir_data_block_buffer.data() + entry_offset);
-                                            if (entry->rec_len == 0 || (calculate_dir_entry_len(entry->name_len) > entry->rec_len) || (entry_offset + entry->rec_len > effective_size_in_this_block) ) break;
+                                            if (dir_entry_rec_len(entry) == 0 || (calculate_dir_entry_len(entry->name_len) > dir_entry_rec_len(entry)) || (entry_offset + dir_entry_rec_len(entry) > effective_size_in_this_block) ) break;
                                             if (entry->inode != 0 && entry->name_len == component.length() && strncmp(entry->name, component.c_str(), entry->name_len) == 0) {
                                                 next_inode_num_candidate = entry->inode; found_component_in_dir = true; break;
                                             }
-                                            entry_offset += entry->rec_len;
+                                            entry_offset += dir_entry_rec_len(entry);
                                         }
                                     }
                                 }
@@ -285,8 +339,8 @@ static uint32_t resolve_path_recursive(const char* path_cstr, int depth, bool fo
                 return next_inode_num_candidate;
             }
 
-            char target_path_buf[SIMPLEFS_BLOCK_SIZE];
-            std::memset(target_path_buf, 0, sizeof(target_path_buf));
+            std::vector<char> target_path_storage(context->block_size, 0);
+            char* target_path_buf = target_path_storage.data();
 
             std::string target_path_str;
             if (component_inode_data.i_blocks == 0) {
@@ -308,7 +362,7 @@ static uint32_t resolve_path_recursive(const char* path_cstr, int depth, bool fo
                     std::cerr << "无法读取inode " << next_inode_num_candidate << " 的符号链接目标数据块" << std::endl;
                     errno = EIO; return 0;
                 }
-                target_path_buf[std::min((size_t)SIMPLEFS_BLOCK_SIZE -1, (size_t)component_inode_data.i_size)] = '\0';
+                target_path_buf[std::min((size_t)context->block_size -1, (size_t)component_inode_data.i_size)] = '\0';
                 target_path_str = target_path_buf;
             }
 
@@ -363,8 +417,11 @@ int simplefs_getattr(const char *path, struct stat *stbuf) {
     std::memset(stbuf, 0, sizeof(struct stat));
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    SnapshotPathView view(*context, path);
+    if (view.error != 0) return view.error;
     errno = 0;
-    uint32_t inode_num = resolve_path_recursive(path, 0, false);
+    uint32_t inode_num = view.snapshot_dir ? SIMPLEFS_SNAPSHOT_DIR_INODE_NUM : resolve_path_recursive(view.path(), 0, false);
     if (inode_num == 0) return -errno;
     SimpleFS_Inode inode;
     if (read_inode_from_disk(*context, inode_num, &inode) != 0) return -errno;
@@ -373,11 +430,15 @@ int simplefs_getattr(const char *path, struct stat *stbuf) {
     stbuf->st_nlink = inode.i_links_count;
     stbuf->st_uid = inode.i_uid;
     stbuf->st_gid = inode.i_gid;
-    stbuf->st_size = inode.i_size;
+    stbuf->st_size = (static_cast<uint64_t>(inode.i_size_high) << 32) | inode.i_size;
     stbuf->st_blocks = inode.i_blocks;
-    stbuf->st_atime = inode.i_atime;
-    stbuf->st_mtime = inode.i_mtime;
-    stbuf->st_ctime = inode.i_ctime;
+    // 128字节inode没有纳秒字段，读出为零
+    stbuf->st_atim.tv_sec = inode.i_atime;
+    stbuf->st_atim.tv_nsec = inode.i_atime_nsec;
+    stbuf->st_mtim.tv_sec = inode.i_mtime;
+    stbuf->st_mtim.tv_nsec = inode.i_mtime_nsec;
+    stbuf->st_ctim.tv_sec = inode.i_ctime;
+    stbuf->st_ctim.tv_nsec = inode.i_ctime_nsec;
     return 0;
 }
 
@@ -387,24 +448,36 @@ int simplefs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     (void) offset; (void) fi;
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    SnapshotPathView view(*context, path);
+    if (view.error != 0) return view.error;
+    if (view.snapshot_dir) {
+        // 每个快照显示为一个目录，即该快照时刻的根目录
+        if (filler(buf, ".", nullptr, 0) != 0 || filler(buf, "..", nullptr, 0) != 0) return -ENOMEM;
+        for (const std::string& name : snapshot_names()) {
+            struct stat st_entry; std::memset(&st_entry, 0, sizeof(struct stat));
+            st_entry.st_mode = S_IFDIR | 0555;
+            if (filler(buf, name.c_str(), &st_entry, 0) != 0) return -ENOMEM;
+        }
+        return 0;
+    }
     errno = 0;
-    uint32_t dir_inode_num = path_to_inode_num(path);
+    uint32_t dir_inode_num = path_to_inode_num(view.path());
     if (dir_inode_num == 0) return -errno;
     SimpleFS_Inode dir_inode;
     if (read_inode_from_disk(*context, dir_inode_num, &dir_inode) != 0) return -errno;
     if (!S_ISDIR(dir_inode.i_mode)) return -ENOTDIR;
 
-    std::vector<uint8_t> block_buffer(SIMPLEFS_BLOCK_SIZE);
+    std::vector<uint8_t> block_buffer(context->block_size);
     uint32_t total_bytes_iterated = 0;
 
-    auto process_dir_block = [&](uint32_t data_block_num) {
-        if (read_block(context->device_fd, data_block_num, block_buffer.data()) != 0) return -EIO;
-        uint16_t entry_offset = 0;
+    auto process_dir_block = [&]() {
+        uint32_t entry_offset = 0;
         uint32_t current_block_bytes_processed = 0;
 
-        while(total_bytes_iterated < dir_inode.i_size && current_block_bytes_processed < SIMPLEFS_BLOCK_SIZE) {
+        while(total_bytes_iterated < dir_inode.i_size && current_block_bytes_processed < context->block_size) {
             SimpleFS_DirEntry* entry = reinterpret_cast<SimpleFS_DirEntry*>(block_buffer.data() + entry_offset);
-            if (entry->rec_len == 0 || (calculate_dir_entry_len(entry->name_len) > entry->rec_len) || (entry_offset + entry->rec_len > SIMPLEFS_BLOCK_SIZE) ) {
+            if (dir_entry_rec_len(entry) == 0 || (calculate_dir_entry_len(entry->name_len) > dir_entry_rec_len(entry)) || (entry_offset + dir_entry_rec_len(entry) > context->block_size) ) {
                  break;
             }
             if (entry->inode != 0 && entry->name_len > 0) {
@@ -421,27 +494,28 @@ int simplefs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 
                 if (filler(buf, filename.c_str(), &st_entry, 0) != 0) return -ENOMEM;
             }
-            entry_offset += entry->rec_len;
-            current_block_bytes_processed += entry->rec_len;
-            total_bytes_iterated += entry->rec_len;
-            if(entry_offset >= SIMPLEFS_BLOCK_SIZE) break;
+            entry_offset += dir_entry_rec_len(entry);
+            current_block_bytes_processed += dir_entry_rec_len(entry);
+            total_bytes_iterated += dir_entry_rec_len(entry);
+            if(entry_offset >= context->block_size) break;
         }
         return 0;
     };
 
-    // 遍历所有块级别
+    // 遍历所有块级别（内联目录只有逻辑块0）
     uint32_t lbn = 0;
     while(total_bytes_iterated < dir_inode.i_size) {
-        uint32_t physical_block = map_logical_to_physical_block(*context, &dir_inode, lbn);
-        if (physical_block == 0) { // 目录i_size正确时不应发生
+        int read_res = read_dir_logical_block(*context, &dir_inode, lbn, block_buffer.data());
+        if (read_res < 0) return -EIO;
+        if (read_res > 0) { // 目录i_size正确时不应发生
             if (total_bytes_iterated >= dir_inode.i_size) break; // 到达末尾
             lbn++; continue; // 目录中的稀疏块或错误
         }
-        int res = process_dir_block(physical_block);
+        int res = process_dir_block();
         if (res != 0) return res;
         if (total_bytes_iterated >= dir_inode.i_size) break; // 基于i_size确保循环终止
         lbn++;
-        if (lbn > (dir_inode.i_size / SIMPLEFS_BLOCK_SIZE) + SIMPLEFS_INODE_BLOCK_PTRS*1024*1024) { // 极端情况安全退出
+        if (lbn > (dir_inode.i_size / context->block_size) + SIMPLEFS_INODE_BLOCK_PTRS*1024*1024) { // 极端情况安全退出
              std::cerr << "目录 " << dir_inode_num << " LBN过大，可能出现无限循环" << std::endl;
              return -EIO;
         }
@@ -456,8 +530,11 @@ int simplefs_mknod(const char *path, mode_t mode, dev_t rdev);
 int simplefs_mkdir(const char *path, mode_t mode);
 int simplefs_unlink(const char *path);
 int simplefs_rmdir(const char *path);
+int simplefs_rename(const char *from, const char *to);
 int simplefs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
 int simplefs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
+int simplefs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fi);
+int simplefs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fi);
 int simplefs_truncate(const char *path, off_t size);
 int simplefs_chmod(const char *path, mode_t mode);
 int simplefs_chown(const char *path, uid_t uid, gid_t gid);
@@ -467,28 +544,185 @@ int simplefs_access(const char *path, int mask);
 int simplefs_symlink(const char *target, const char *linkpath);
 int simplefs_readlink(const char *path, char *buf, size_t size);
 int simplefs_link(const char *oldpath, const char *newpath);
+int simplefs_open(const char *path, struct fuse_file_info *fi);
+int simplefs_release(const char *path, struct fuse_file_info *fi);
+int simplefs_fsync(const char *path, int datasync, struct fuse_file_info *fi);
+int simplefs_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi);
+int simplefs_flush(const char *path, struct fuse_file_info *fi);
+int simplefs_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi);
+int simplefs_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data);
+void* simplefs_init(struct fuse_conn_info *conn);
+void simplefs_destroy(void *private_data);
+
+
+// sync模式下修改操作成功后回写全部缓存数据并刷新设备，返回op的结果或刷新错误
+// 刷新在fs_mutex之外进行，并发的修改操作经分组提交合并为一次刷新
+static int commit_if_sync(int op_result) {
+    SimpleFS_Context* context = get_fs_context();
+    if (op_result < 0 || !context || context->durability_mode != SIMPLEFS_DURABILITY_SYNC) return op_result;
+    {
+        std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+        int res = delalloc_writeback_all(*context);
+        if (res != 0) return res;
+    }
+    int flush_res = group_commit_flush(context->device_fd);
+    return flush_res != 0 ? flush_res : op_result;
+}
 
+// 修改操作的包装：调用Op后按持久化模式提交
+template <auto Op> struct DurableOp;
+template <typename... Args, int (*Op)(Args...)>
+struct DurableOp<Op> {
+    static int call(Args... args) {
+        return commit_if_sync(Op(args...));
+    }
+};
 
 // 初始化fuse_operations结构体
 void init_fuse_operations(struct fuse_operations *ops) {
     std::memset(ops, 0, sizeof(struct fuse_operations));
     ops->getattr = simplefs_getattr;
     ops->readdir = simplefs_readdir;
-    ops->mknod   = simplefs_mknod;
-    ops->mkdir   = simplefs_mkdir;
-    ops->unlink  = simplefs_unlink;
-    ops->rmdir   = simplefs_rmdir;
+    ops->mknod   = DurableOp<simplefs_mknod>::call;
+    ops->mkdir   = DurableOp<simplefs_mkdir>::call;
+    ops->unlink  = DurableOp<simplefs_unlink>::call;
+    ops->rmdir   = DurableOp<simplefs_rmdir>::call;
+    ops->rename  = DurableOp<simplefs_rename>::call;
     ops->read    = simplefs_read;
-    ops->write   = simplefs_write;
-    ops->truncate = simplefs_truncate;
-    ops->chmod   = simplefs_chmod;
-    ops->chown   = simplefs_chown;
-    ops->utimens = simplefs_utimens;
+    ops->write   = DurableOp<simplefs_write>::call;
+    ops->read_buf = simplefs_read_buf;
+    ops->write_buf = DurableOp<simplefs_write_buf>::call;
+    ops->truncate = DurableOp<simplefs_truncate>::call;
+    ops->chmod   = DurableOp<simplefs_chmod>::call;
+    ops->chown   = DurableOp<simplefs_chown>::call;
+    ops->utimens = DurableOp<simplefs_utimens>::call;
     ops->statfs  = simplefs_statfs;
     ops->access = simplefs_access;
-    ops->symlink = simplefs_symlink;
+    ops->symlink = DurableOp<simplefs_symlink>::call;
     ops->readlink = simplefs_readlink;
-    ops->link = simplefs_link;
+    ops->link = DurableOp<simplefs_link>::call;
+    ops->open = simplefs_open;
+    ops->release = simplefs_release;
+    ops->fsync = simplefs_fsync;
+    ops->fsyncdir = simplefs_fsyncdir;
+    ops->flush = simplefs_flush;
+    ops->fallocate = DurableOp<simplefs_fallocate>::call;
+    ops->ioctl = simplefs_ioctl;
+    ops->init = simplefs_init;
+    ops->destroy = simplefs_destroy;
+}
+
+// 挂载完成后启动后台线程（fuse_main可能在此之前fork到后台，线程必须在这里创建）
+void* simplefs_init(struct fuse_conn_info *conn) {
+    // write_buf的数据可由内核从FUSE通道splice到设备fd；read_buf只返回内存缓冲区，回复不需要splice
+    conn->want |= conn->capable & FUSE_CAP_SPLICE_READ;
+    SimpleFS_Context* context = get_fs_context();
+    if (context) {
+        start_orphan_reclaimer(*context);
+        start_delalloc_flusher(*context);
+        if (context->discard_freed_blocks) start_discard_worker(*context);
+    }
+    return context;
+}
+
+// 卸载时停止后台线程并同步元数据
+void simplefs_destroy(void *private_data) {
+    SimpleFS_Context* context = static_cast<SimpleFS_Context*>(private_data);
+    stop_delalloc_flusher();
+    stop_orphan_reclaimer();
+    if (context) {
+        std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+        delalloc_writeback_all(*context);
+        sync_fs_metadata(*context);
+        if (fdatasync(context->device_fd) != 0) {
+            perror("卸载时刷新设备失败");
+        }
+    }
+    stop_discard_worker(); // 下发队列中剩余的区间
+}
+
+// 打开文件：记录inode号和打开计数，供release释放预留窗口
+int simplefs_open(const char *path, struct fuse_file_info *fi) {
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    SnapshotPathView view(*context, path);
+    if (view.error != 0) return view.error;
+    errno = 0;
+    uint32_t inode_num = view.snapshot_dir ? SIMPLEFS_SNAPSHOT_DIR_INODE_NUM : path_to_inode_num(view.path());
+    if (inode_num == 0) return -errno;
+    if (view.read_only()) {
+        // 快照中的inode号与活动文件系统重叠，不记录打开计数
+        if ((fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC)) return -EROFS;
+        fi->fh = 0;
+        return 0;
+    }
+    fi->fh = inode_num;
+    context->open_file_counts[inode_num]++;
+    return 0;
+}
+
+// 关闭文件：最后一个句柄关闭时释放预留窗口
+int simplefs_release(const char *path, struct fuse_file_info *fi) {
+    (void)path;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    uint32_t inode_num = static_cast<uint32_t>(fi->fh);
+    auto it = context->open_file_counts.find(inode_num);
+    if (it == context->open_file_counts.end()) return 0;
+    if (--it->second == 0) {
+        context->open_file_counts.erase(it);
+        release_reservation_window(*context, inode_num);
+    }
+    return 0;
+}
+
+// 将文件的延迟分配数据回写到磁盘，并等待设备刷新
+// 元数据修改是同步写入的，fdatasync与fsync的处理相同：只回写本文件的缓存数据，
+// 设备刷新在fs_mutex之外通过分组提交进行，并发的fsync合并为一次刷新
+int simplefs_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
+    (void)datasync;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    {
+        std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+        if (is_snapshot_path(*context, path)) return 0; // 快照只读
+        uint32_t inode_num = fi ? static_cast<uint32_t>(fi->fh) : 0;
+        if (inode_num == 0) {
+            errno = 0;
+            inode_num = path_to_inode_num(path);
+            if (inode_num == 0) return -errno;
+        }
+        int res = delalloc_writeback_inode(*context, inode_num);
+        int pending_error = delalloc_take_error(inode_num);
+        if (res == 0) res = pending_error;
+        if (res != 0) return res;
+    }
+    return group_commit_flush(context->device_fd);
+}
+
+// 目录的修改都是同步写入的，只需等待设备刷新
+int simplefs_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi) {
+    (void)datasync; (void)fi;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    {
+        std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+        if (is_snapshot_path(*context, path)) return 0; // 快照只读
+        errno = 0;
+        if (path_to_inode_num(path) == 0) return -errno;
+    }
+    return group_commit_flush(context->device_fd);
+}
+
+// close时调用：报告此前后台回写的错误，不回写也不刷新设备
+int simplefs_flush(const char *path, struct fuse_file_info *fi) {
+    (void)path;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    return delalloc_take_error(static_cast<uint32_t>(fi->fh));
 }
 
 // 文件系统统计
@@ -496,12 +730,16 @@ int simplefs_statfs(const char *path, struct statvfs *stbuf) {
     (void)path;
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
     std::memset(stbuf, 0, sizeof(struct statvfs));
-    stbuf->f_bsize   = SIMPLEFS_BLOCK_SIZE;
-    stbuf->f_frsize  = SIMPLEFS_BLOCK_SIZE;
+    stbuf->f_bsize   = context->block_size;
+    stbuf->f_frsize  = context->block_size;
     stbuf->f_blocks  = context->sb.s_blocks_count;
-    stbuf->f_bfree   = context->sb.s_free_blocks_count;
-    stbuf->f_bavail  = context->sb.s_free_blocks_count;
+    // 延迟分配预留的块不再可用
+    uint32_t available_blocks = context->sb.s_free_blocks_count > context->delalloc_reserved_blocks ?
+                                context->sb.s_free_blocks_count - context->delalloc_reserved_blocks : 0;
+    stbuf->f_bfree   = available_blocks;
+    stbuf->f_bavail  = available_blocks;
     stbuf->f_files   = context->sb.s_inodes_count;
     stbuf->f_ffree   = context->sb.s_free_inodes_count;
     stbuf->f_favail  = context->sb.s_free_inodes_count;
@@ -515,222 +753,25 @@ int simplefs_statfs(const char *path, struct statvfs *stbuf) {
 int simplefs_access(const char *path, int mask) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    SnapshotPathView view(*context, path);
+    if (view.error != 0) return view.error;
+    if (view.read_only() && (mask & W_OK)) return -EROFS;
     errno = 0;
-    uint32_t inode_num = path_to_inode_num(path); // 跟随符号链接进行访问检查
+    uint32_t inode_num = view.snapshot_dir ? SIMPLEFS_SNAPSHOT_DIR_INODE_NUM : path_to_inode_num(view.path()); // 跟随符号链接进行访问检查
     if (inode_num == 0) return -errno;
     SimpleFS_Inode inode_data;
     if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
     return check_access(fuse_get_context(), &inode_data, mask);
 }
 
-// 确保为给定逻辑块索引分配物理块的辅助函数
-static uint32_t allocate_block_for_write(SimpleFS_Context& context, SimpleFS_Inode* inode, uint32_t inode_num ,
-                                         uint32_t logical_block_idx, bool* p_was_newly_allocated) {
-    if(p_was_newly_allocated) *p_was_newly_allocated = false;
-    if (!inode) { errno = EIO; return 0; }
-    uint32_t preferred_group = (inode_num -1) / context.sb.s_inodes_per_group;
-    uint32_t pointers_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t);
-    std::vector<uint32_t> indirect_block_buffer(pointers_per_block);
-
-    if (logical_block_idx < SIMPLEFS_NUM_DIRECT_BLOCKS) {
-        if (inode->i_block[logical_block_idx] == 0) {
-            uint32_t new_physical_block = alloc_block(context, preferred_group);
-            if (new_physical_block == 0) { return 0; }
-            inode->i_block[logical_block_idx] = new_physical_block;
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            if(p_was_newly_allocated) *p_was_newly_allocated = true;
-        }
-        return inode->i_block[logical_block_idx];
-    }
-
-    uint32_t single_indirect_start_idx = SIMPLEFS_NUM_DIRECT_BLOCKS;
-    uint32_t single_indirect_end_idx = single_indirect_start_idx + pointers_per_block;
-    if (logical_block_idx < single_indirect_end_idx) {
-        uint32_t* p_single_indirect_block_num = &inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS];
-        if (*p_single_indirect_block_num == 0) {
-            uint32_t new_l1_block = alloc_block(context, preferred_group);
-            if (new_l1_block == 0) { errno = ENOSPC; return 0; }
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
-            if (write_block(context.device_fd, new_l1_block, indirect_block_buffer.data()) != 0) {
-                free_block(context, new_l1_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                errno = EIO; return 0;
-            }
-            *p_single_indirect_block_num = new_l1_block;
-        }
-        if (read_block(context.device_fd, *p_single_indirect_block_num, indirect_block_buffer.data()) != 0) {
-             errno = EIO; return 0;
-        }
-        uint32_t idx_in_indirect = logical_block_idx - single_indirect_start_idx;
-        if (indirect_block_buffer[idx_in_indirect] == 0) {
-            uint32_t new_data_block = alloc_block(context, preferred_group);
-            if (new_data_block == 0) { errno = ENOSPC; return 0; }
-            indirect_block_buffer[idx_in_indirect] = new_data_block;
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            if(p_was_newly_allocated) *p_was_newly_allocated = true;
-            if (write_block(context.device_fd, *p_single_indirect_block_num, indirect_block_buffer.data()) != 0) {
-                free_block(context, new_data_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                indirect_block_buffer[idx_in_indirect] = 0;
-                errno = EIO; return 0;
-            }
-        }
-        return indirect_block_buffer[idx_in_indirect];
-    }
-
-    uint32_t double_indirect_start_idx = single_indirect_end_idx;
-    uint32_t double_indirect_max_logical_blocks = pointers_per_block * pointers_per_block;
-    uint32_t double_indirect_end_idx = double_indirect_start_idx + double_indirect_max_logical_blocks;
-    if (logical_block_idx < double_indirect_end_idx) {
-        uint32_t* p_dbl_indirect_block_num = &inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 1];
-        if (*p_dbl_indirect_block_num == 0) {
-            uint32_t new_l2_block = alloc_block(context, preferred_group);
-            if (new_l2_block == 0) { errno = ENOSPC; return 0; }
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
-            if (write_block(context.device_fd, new_l2_block, indirect_block_buffer.data()) != 0) {
-                free_block(context, new_l2_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                errno = EIO; return 0;
-            }
-            *p_dbl_indirect_block_num = new_l2_block;
-        }
-        std::vector<uint32_t> l2_buffer(pointers_per_block);
-        if (read_block(context.device_fd, *p_dbl_indirect_block_num, l2_buffer.data()) != 0) { errno = EIO; return 0; }
-        uint32_t logical_offset_in_dbl_range = logical_block_idx - double_indirect_start_idx;
-        uint32_t idx_in_l2_block = logical_offset_in_dbl_range / pointers_per_block;
-        uint32_t* p_l1_block_num_from_l2 = &l2_buffer[idx_in_l2_block];
-        if (*p_l1_block_num_from_l2 == 0) {
-            uint32_t new_l1_block = alloc_block(context, preferred_group);
-            if (new_l1_block == 0) { errno = ENOSPC; return 0;}
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
-            if (write_block(context.device_fd, new_l1_block, indirect_block_buffer.data()) != 0) {
-                free_block(context, new_l1_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                errno = EIO; return 0;
-            }
-            *p_l1_block_num_from_l2 = new_l1_block;
-            if (write_block(context.device_fd, *p_dbl_indirect_block_num, l2_buffer.data()) != 0) {
-                free_block(context, new_l1_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                *p_l1_block_num_from_l2 = 0;
-                errno = EIO; return 0;
-            }
-        }
-        std::vector<uint32_t> l1_buffer(pointers_per_block);
-        if (read_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) { errno = EIO; return 0;}
-        uint32_t idx_in_l1_block = logical_offset_in_dbl_range % pointers_per_block;
-        if (l1_buffer[idx_in_l1_block] == 0) {
-            uint32_t new_data_block = alloc_block(context, preferred_group);
-            if (new_data_block == 0) { errno = ENOSPC; return 0; }
-            l1_buffer[idx_in_l1_block] = new_data_block;
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            if(p_was_newly_allocated) *p_was_newly_allocated = true;
-            if (write_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) {
-                free_block(context, new_data_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                l1_buffer[idx_in_l1_block] = 0;
-                errno = EIO; return 0;
-            }
-        }
-        return l1_buffer[idx_in_l1_block];
-    }
-
-    uint32_t triple_indirect_start_idx = double_indirect_end_idx;
-    uint64_t triple_indirect_max_logical_blocks = (uint64_t)pointers_per_block * pointers_per_block * pointers_per_block;
-    uint64_t triple_indirect_end_idx = triple_indirect_start_idx + triple_indirect_max_logical_blocks;
-    if (logical_block_idx < triple_indirect_end_idx) {
-        uint32_t* p_tpl_indirect_block_num = &inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 2];
-        if (*p_tpl_indirect_block_num == 0) {
-            uint32_t new_l3_block = alloc_block(context, preferred_group);
-            if (new_l3_block == 0) { errno = ENOSPC; return 0; }
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
-            if (write_block(context.device_fd, new_l3_block, indirect_block_buffer.data()) != 0) {
-                free_block(context, new_l3_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                errno = EIO; return 0;
-            }
-            *p_tpl_indirect_block_num = new_l3_block;
-        }
-        std::vector<uint32_t> l3_buffer(pointers_per_block);
-        if (read_block(context.device_fd, *p_tpl_indirect_block_num, l3_buffer.data()) != 0) { errno = EIO; return 0; }
-        uint32_t logical_offset_in_tpl_range = logical_block_idx - triple_indirect_start_idx;
-        uint32_t idx_in_l3_block = logical_offset_in_tpl_range / (pointers_per_block * pointers_per_block);
-        uint32_t* p_l2_block_num_from_l3 = &l3_buffer[idx_in_l3_block];
-        if (*p_l2_block_num_from_l3 == 0) {
-            uint32_t new_l2_block = alloc_block(context, preferred_group);
-            if (new_l2_block == 0) { errno = ENOSPC; return 0; }
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
-            if (write_block(context.device_fd, new_l2_block, indirect_block_buffer.data()) != 0) {
-                free_block(context, new_l2_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                errno = EIO; return 0;
-            }
-            *p_l2_block_num_from_l3 = new_l2_block;
-            if (write_block(context.device_fd, *p_tpl_indirect_block_num, l3_buffer.data()) != 0) {
-                free_block(context, new_l2_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                *p_l2_block_num_from_l3 = 0;
-                errno = EIO; return 0;
-            }
-        }
-        std::vector<uint32_t> l2_buffer(pointers_per_block);
-        if (read_block(context.device_fd, *p_l2_block_num_from_l3, l2_buffer.data()) != 0) { errno = EIO; return 0; }
-        uint32_t logical_offset_in_l2_from_tpl = logical_offset_in_tpl_range % (pointers_per_block * pointers_per_block);
-        uint32_t idx_in_l2_from_tpl = logical_offset_in_l2_from_tpl / pointers_per_block;
-        uint32_t* p_l1_block_num_from_l2 = &l2_buffer[idx_in_l2_from_tpl];
-        if (*p_l1_block_num_from_l2 == 0) {
-            uint32_t new_l1_block = alloc_block(context, preferred_group);
-            if (new_l1_block == 0) { errno = ENOSPC; return 0; }
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
-            if (write_block(context.device_fd, new_l1_block, indirect_block_buffer.data()) != 0) {
-                free_block(context, new_l1_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                errno = EIO; return 0;
-            }
-            *p_l1_block_num_from_l2 = new_l1_block;
-            if (write_block(context.device_fd, *p_l2_block_num_from_l3, l2_buffer.data()) != 0) {
-                free_block(context, new_l1_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                *p_l1_block_num_from_l2 = 0;
-                errno = EIO; return 0;
-            }
-        }
-        std::vector<uint32_t> l1_buffer(pointers_per_block);
-        if (read_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) { errno = EIO; return 0; }
-        uint32_t idx_in_l1_final = logical_offset_in_l2_from_tpl % pointers_per_block;
-        if (l1_buffer[idx_in_l1_final] == 0) {
-            uint32_t new_data_block = alloc_block(context, preferred_group);
-            if (new_data_block == 0) { errno = ENOSPC; return 0; }
-            l1_buffer[idx_in_l1_final] = new_data_block;
-            inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
-            if(p_was_newly_allocated) *p_was_newly_allocated = true;
-            if (write_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) {
-                free_block(context, new_data_block);
-                inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
-                l1_buffer[idx_in_l1_final] = 0;
-                errno = EIO; return 0;
-            }
-        }
-        return l1_buffer[idx_in_l1_final];
-    }
-
-    std::cerr << "写入时分配块失败: 逻辑块 " << logical_block_idx
-              << " is beyond implemented allocation support (direct + single + double + triple indirect)." << std::endl;
-    errno = EFBIG;
-    return 0;
-}
-
 // 创建文件节点
 int simplefs_mknod(const char *path, mode_t mode, dev_t rdev) {
     (void)rdev;
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
     if (!S_ISREG(mode) && !S_ISFIFO(mode)) { // 也允许FIFO
         // 本项目只计划支持S_IFREG，符号链接是分开的
         // 如果严格只要S_IFREG:
@@ -763,7 +804,7 @@ int simplefs_mknod(const char *path, mode_t mode, dev_t rdev) {
     if (existing_inode_check != 0) return -EEXIST;
     if (errno != 0 && errno != ENOENT) return -errno;
 
-    uint32_t new_inode_num = alloc_inode(*context, mode);
+    uint32_t new_inode_num = alloc_inode(*context, mode, parent_inode_num);
     if (new_inode_num == 0) return -errno;
 
     SimpleFS_Inode new_inode;
@@ -773,8 +814,14 @@ int simplefs_mknod(const char *path, mode_t mode, dev_t rdev) {
     new_inode.i_gid = fuse_get_context()->gid;
     new_inode.i_links_count = 1;
     new_inode.i_size = 0;
-    new_inode.i_atime = new_inode.i_mtime = new_inode.i_ctime = time(nullptr);
+    touch_inode_times(&new_inode, SIMPLEFS_TIME_ALL);
     new_inode.i_blocks = 0;
+    if (S_ISREG(mode) && (context->sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_INLINE_DATA)) {
+        new_inode.i_flags |= SIMPLEFS_INODE_FL_INLINE_DATA; // 新文件先内联存储，超出后再转为块存储
+    }
+    if (S_ISREG(mode) && (context->compress_new_files || inode_is_compressed(&parent_inode_data))) {
+        new_inode.i_flags |= SIMPLEFS_INODE_FL_COMPRESS; // 挂载选项或父目录要求压缩
+    }
 
     if (write_inode_to_disk(*context, new_inode_num, &new_inode) != 0) {
         free_inode(*context, new_inode_num, new_inode.i_mode);
@@ -808,6 +855,8 @@ int simplefs_mknod(const char *path, mode_t mode, dev_t rdev) {
 int simplefs_mkdir(const char *path, mode_t mode) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
     std::string path_str(path);
     std::string dirname_str, basename_str;
     parse_path(path_str, dirname_str, basename_str);
@@ -831,13 +880,21 @@ int simplefs_mkdir(const char *path, mode_t mode) {
     if (existing_inode_check != 0) return -EEXIST;
     if (errno != 0 && errno != ENOENT) return -errno;
 
-    uint32_t new_dir_inode_num = alloc_inode(*context, S_IFDIR | (mode & 07777));
+    uint32_t new_dir_inode_num = alloc_inode(*context, S_IFDIR | (mode & 07777), parent_inode_num);
     if (new_dir_inode_num == 0) return -errno;
 
-    uint32_t new_dir_data_block = alloc_block(*context, (new_dir_inode_num -1) / context->sb.s_inodes_per_group);
-    if (new_dir_data_block == 0) {
-        free_inode(*context, new_dir_inode_num, S_IFDIR | (mode & 07777));
-        return -errno;
+    // 启用inline_data时"."和".."存放在inode内，目录项增多放不下时再转为块存储
+    const bool inline_dir = (context->sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_INLINE_DATA) != 0;
+    uint32_t new_dir_data_block = 0;
+    if (!inline_dir) {
+        uint32_t new_dir_group = (new_dir_inode_num - 1) / context->sb.s_inodes_per_group;
+        uint32_t allocated_len = 0;
+        new_dir_data_block = alloc_blocks(*context, new_dir_group * context->sb.s_blocks_per_group, 1, 1,
+                                          &allocated_len, new_dir_inode_num);
+        if (new_dir_data_block == 0) {
+            free_inode(*context, new_dir_inode_num, S_IFDIR | (mode & 07777));
+            return -errno;
+        }
     }
 
     SimpleFS_Inode new_dir_inode;
@@ -848,12 +905,14 @@ int simplefs_mkdir(const char *path, mode_t mode) {
     new_dir_inode.i_links_count = 2; // 用于'.'和父目录中的条目
     new_dir_inode.i_size = 0; // 将由add_dir_entry为"."和".."设置
     new_dir_inode.i_blocks = 0; // 计算"."和".."数据块时设置
-    new_dir_inode.i_atime = new_dir_inode.i_mtime = new_dir_inode.i_ctime = time(nullptr);
+    touch_inode_times(&new_dir_inode, SIMPLEFS_TIME_ALL);
+    new_dir_inode.i_flags = parent_inode_data.i_flags & SIMPLEFS_INODE_FL_COMPRESS; // 子目录继承压缩标志
     // new_dir_inode.i_block[0] = new_dir_data_block; // 块准备后设置
 
     // 准备包含"."和".."的目录块
-    std::vector<uint8_t> dir_block_buffer(SIMPLEFS_BLOCK_SIZE, 0);
-    uint16_t current_offset = 0;
+    std::vector<uint8_t> dir_block_buffer(context->block_size, 0);
+    uint32_t entries_end = inline_dir ? inode_inline_capacity(*context) : dir_block_entries_end(*context);
+    uint32_t current_offset = 0;
     uint8_t dot_file_type = (S_IFDIR & S_IFMT) >> 12;
 
     SimpleFS_DirEntry dot_entry;
@@ -861,34 +920,41 @@ int simplefs_mkdir(const char *path, mode_t mode) {
     dot_entry.name_len = 1;
     dot_entry.file_type = dot_file_type;
     std::strncpy(dot_entry.name, ".", 1);
-    dot_entry.rec_len = calculate_dir_entry_len(dot_entry.name_len);
+    set_dir_entry_rec_len(&dot_entry, calculate_dir_entry_len(dot_entry.name_len));
     std::memcpy(dir_block_buffer.data() + current_offset, &dot_entry, (size_t)calculate_dir_entry_len(0) + dot_entry.name_len);
-    current_offset += dot_entry.rec_len;
+    current_offset += dir_entry_rec_len(&dot_entry);
 
     SimpleFS_DirEntry dotdot_entry;
     dotdot_entry.inode = parent_inode_num;
     dotdot_entry.name_len = 2;
     dotdot_entry.file_type = dot_file_type;
     std::strncpy(dotdot_entry.name, "..", 2);
-    dotdot_entry.rec_len = SIMPLEFS_BLOCK_SIZE - current_offset; // 使".."填充剩余空间
+    set_dir_entry_rec_len(&dotdot_entry, entries_end - current_offset); // 使".."填充剩余空间
     std::memcpy(dir_block_buffer.data() + current_offset, &dotdot_entry, (size_t)calculate_dir_entry_len(0) + dotdot_entry.name_len);
-    current_offset += dotdot_entry.rec_len;
 
-    if (write_block(context->device_fd, new_dir_data_block, dir_block_buffer.data()) != 0) {
-        free_block(*context, new_dir_data_block);
-        free_inode(*context, new_dir_inode_num, new_dir_inode.i_mode);
-        return -EIO;
-    }
+    if (inline_dir) {
+        std::memcpy(inode_inline_data(&new_dir_inode), dir_block_buffer.data(), entries_end);
+        new_dir_inode.i_flags |= SIMPLEFS_INODE_FL_INLINE_DATA;
+        new_dir_inode.i_size = entries_end; // 目录项链占满内联数据区
+    } else {
+        if (write_dir_block(*context, new_dir_data_block, dir_block_buffer.data()) != 0) {
+            free_block(*context, new_dir_data_block);
+            free_inode(*context, new_dir_inode_num, new_dir_inode.i_mode);
+            return -EIO;
+        }
 
-    new_dir_inode.i_block[0] = new_dir_data_block;
-    new_dir_inode.i_blocks = SIMPLEFS_BLOCK_SIZE / 512;
-    new_dir_inode.i_size = current_offset; // "."和".."使用的实际大小
+        new_dir_inode.i_block[0] = new_dir_data_block;
+        new_dir_inode.i_blocks = context->block_size / 512;
+        new_dir_inode.i_size = context->block_size; // ".."填充到目录项链末尾，目录占满整块
+    }
 
     if (write_inode_to_disk(*context, new_dir_inode_num, &new_dir_inode) != 0) {
         // 回滚数据块
-        std::fill(dir_block_buffer.begin(), dir_block_buffer.end(), 0);
-        write_block(context->device_fd, new_dir_data_block, dir_block_buffer.data()); // 尝试清理
-        free_block(*context, new_dir_data_block);
+        if (new_dir_data_block != 0) {
+            std::fill(dir_block_buffer.begin(), dir_block_buffer.end(), 0);
+            write_block(context->device_fd, new_dir_data_block, dir_block_buffer.data()); // 尝试清理
+            free_block(*context, new_dir_data_block);
+        }
         // 回滚inode
         new_dir_inode.i_dtime = time(nullptr); new_dir_inode.i_links_count = 0;
         write_inode_to_disk(*context, new_dir_inode_num, &new_dir_inode);
@@ -901,9 +967,11 @@ int simplefs_mkdir(const char *path, mode_t mode) {
 
     if (add_entry_res_parent != 0) {
         // 完全回滚
-        std::fill(dir_block_buffer.begin(), dir_block_buffer.end(), 0);
-        write_block(context->device_fd, new_dir_data_block, dir_block_buffer.data());
-        free_block(*context, new_dir_data_block);
+        if (new_dir_data_block != 0) {
+            std::fill(dir_block_buffer.begin(), dir_block_buffer.end(), 0);
+            write_block(context->device_fd, new_dir_data_block, dir_block_buffer.data());
+            free_block(*context, new_dir_data_block);
+        }
         new_dir_inode.i_dtime = time(nullptr); new_dir_inode.i_links_count = 0;
         write_inode_to_disk(*context, new_dir_inode_num, &new_dir_inode);
         free_inode(*context, new_dir_inode_num, S_IFDIR | (mode & 07777)); // 使用原始模式计算目录数
@@ -915,7 +983,7 @@ int simplefs_mkdir(const char *path, mode_t mode) {
     // 我们的add_dir_entry不处理parent_inode.i_links_count
     // 对于mkdir，父目录的i_links_count应该增加1
     parent_inode_data.i_links_count++;
-    parent_inode_data.i_mtime = parent_inode_data.i_ctime = time(nullptr);
+    touch_inode_times(&parent_inode_data, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
     if(write_inode_to_disk(*context, parent_inode_num, &parent_inode_data) != 0) {
         // 完全回滚有些复杂，现在记录并继续
         std::cerr << "mkdir: 父目录链接数更新失败，文件系统可能不一致" << std::endl;
@@ -926,9 +994,52 @@ int simplefs_mkdir(const char *path, mode_t mode) {
 }
 
 // 删除文件
+// 目录项已移除后减少非目录inode的链接数，最后一个链接消失时释放inode
+// 大文件挂入孤儿链表，由后台线程分片释放数据块
+static int drop_inode_link(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode& inode_data) {
+    inode_data.i_links_count--;
+    touch_inode_times(&inode_data, SIMPLEFS_TIME_CTIME);
+
+    if (inode_data.i_links_count == 0) {
+        delalloc_drop_inode(context, inode_num);
+        release_reservation_window(context, inode_num);
+    }
+
+    if (inode_data.i_links_count == 0 && inode_needs_deferred_free(&inode_data)) {
+        orphan_list_add(context, inode_num, &inode_data);
+        if (write_inode_to_disk(context, inode_num, &inode_data) != 0) {
+            std::cerr << "unlink: 孤儿inode " << inode_num << " 写入失败" << std::endl;
+        }
+        wake_orphan_reclaimer();
+    } else if (inode_data.i_links_count == 0) {
+        
+        // 重要：仅在非快速符号链接时释放块
+        // 快速符号链接i_blocks==0且数据存储在i_block数组中
+        if (!(S_ISLNK(inode_data.i_mode) && inode_data.i_blocks == 0)) {
+            free_all_inode_blocks(context, &inode_data);
+        }
+
+        inode_data.i_size = 0;
+        inode_data.i_dtime = time(nullptr);
+
+        if (write_inode_to_disk(context, inode_num, &inode_data) != 0) {
+            std::cerr << "unlink: 释放前目标inode " << inode_num << " 写入失败，继续释放inode" << std::endl;
+        }
+        free_inode(context, inode_num, inode_data.i_mode);
+    } else {
+        if (write_inode_to_disk(context, inode_num, &inode_data) != 0) {
+            std::cerr << "unlink: 目标inode " << inode_num << " 链接数更新失败" << std::endl;
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
 int simplefs_unlink(const char *path) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
 
     std::string path_str(path);
     std::string dirname_str, basename_str;
@@ -993,38 +1104,79 @@ int simplefs_unlink(const char *path) {
         return remove_res;
     }
 
-    target_inode_data.i_links_count--;
-    target_inode_data.i_ctime = time(nullptr);
+    int drop_res = drop_inode_link(*context, target_inode_num, target_inode_data);
+    sync_fs_metadata(*context);
+    return drop_res;
+}
 
-    if (target_inode_data.i_links_count == 0) {
-        
-        // 重要：仅在非快速符号链接时释放块
-        // 快速符号链接i_blocks==0且数据存储在i_block数组中
-        if (!(S_ISLNK(target_inode_data.i_mode) && target_inode_data.i_blocks == 0)) {
-            free_all_inode_blocks(*context, &target_inode_data);
-        }
+// 检查目录是否为空（只包含"."和".."），为空返回0，否则返回-ENOTEMPTY
+static int check_dir_empty(SimpleFS_Context& context, uint32_t target_inode_num, const SimpleFS_Inode& target_inode_data) {
+    bool is_empty = true;
+    if (target_inode_data.i_size > 0) { // 检查目录是否为空（只包含"."和".."）
+        std::vector<uint8_t> block_buffer(context.block_size);
+        uint32_t total_dir_bytes_iterated = 0;
+        int non_dot_entries = 0;
 
-        target_inode_data.i_size = 0;
-        target_inode_data.i_dtime = time(nullptr);
+        uint32_t dir_lbn = 0;
+        while(total_dir_bytes_iterated < target_inode_data.i_size && non_dot_entries == 0) {
+            int read_res = read_dir_logical_block(context, &target_inode_data, dir_lbn, block_buffer.data());
+            if (read_res < 0) return -EIO;
+            if (read_res > 0) { // 目录通常应该是连续的
+                if (total_dir_bytes_iterated >= target_inode_data.i_size) break;
+                dir_lbn++; continue;
+            }
 
-        if (write_inode_to_disk(*context, target_inode_num, &target_inode_data) != 0) {
-            std::cerr << "unlink: 释放前目标inode " << target_inode_num << " 写入失败，继续释放inode" << std::endl;
-        }
-        free_inode(*context, target_inode_num, target_inode_data.i_mode);
-    } else {
-        if (write_inode_to_disk(*context, target_inode_num, &target_inode_data) != 0) {
-            std::cerr << "unlink: 目标inode " << target_inode_num << " 链接数更新失败" << std::endl;
-            return -EIO;
+            uint32_t entry_offset = 0;
+            uint32_t current_block_dir_bytes_processed = 0;
+            while(total_dir_bytes_iterated < target_inode_data.i_size && current_block_dir_bytes_processed < context.block_size) {
+                SimpleFS_DirEntry* entry = reinterpret_cast<SimpleFS_DirEntry*>(block_buffer.data() + entry_offset);
+                if (dir_entry_rec_len(entry) == 0 || (calculate_dir_entry_len(entry->name_len) > dir_entry_rec_len(entry)) || (entry_offset + dir_entry_rec_len(entry) > context.block_size)) break;
+                if (entry->inode != 0 && entry->name_len > 0) {
+                    std::string entry_s_name(entry->name, entry->name_len);
+                    if (entry_s_name != "." && entry_s_name != "..") {
+                        non_dot_entries++;
+                        break;
+                    }
+                }
+                entry_offset += dir_entry_rec_len(entry);
+                current_block_dir_bytes_processed += dir_entry_rec_len(entry);
+                total_dir_bytes_iterated += dir_entry_rec_len(entry);
+                if(entry_offset >= context.block_size) break;
+            }
+            if (non_dot_entries > 0) break;
+            dir_lbn++;
+             if (dir_lbn > (target_inode_data.i_size / context.block_size) + SIMPLEFS_INODE_BLOCK_PTRS*1024*1024) {
+                 std::cerr << "rmdir: Excessive LBN for dir " << target_inode_num << std::endl; return -EIO;
+             }
         }
+        if (non_dot_entries > 0) is_empty = false;
     }
-    sync_fs_metadata(*context);
-    return 0;
+    return is_empty ? 0 : -ENOTEMPTY;
+}
+
+// 释放已从父目录移除的空目录inode
+static void free_empty_dir_inode(SimpleFS_Context& context, uint32_t target_inode_num, SimpleFS_Inode& target_inode_data) {
+    // 释放被删除目录的块（应该只有一个包含"."和".."的块）
+    free_all_inode_blocks(context, &target_inode_data);
+
+    target_inode_data.i_links_count = 0; // 父目录链接消失，"."消失
+    target_inode_data.i_dtime = time(nullptr);
+    target_inode_data.i_size = 0;
+    // i_blocks由free_all_inode_blocks处理
+
+    mode_t mode_of_target = target_inode_data.i_mode;
+    if(write_inode_to_disk(context, target_inode_num, &target_inode_data) !=0) {
+        std::cerr << "rmdir: 释放前目标inode " << target_inode_num << " 写入失败" << std::endl;
+    }
+    free_inode(context, target_inode_num, mode_of_target); // mode_of_target用于bg_used_dirs_count
 }
 
 // 删除目录
 int simplefs_rmdir(const char *path) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
     std::string path_str(path);
     std::string dirname_str, basename_str;
     parse_path(path_str, dirname_str, basename_str);
@@ -1059,195 +1211,885 @@ int simplefs_rmdir(const char *path) {
 
     if (!S_ISDIR(target_inode_data.i_mode)) return -ENOTDIR;
 
-    bool is_empty = true;
-    if (target_inode_data.i_size > 0) { // 检查目录是否为空（只包含"."和".."）
-        std::vector<uint8_t> block_buffer(SIMPLEFS_BLOCK_SIZE);
-        uint32_t total_dir_bytes_iterated = 0;
-        int non_dot_entries = 0;
-
-        uint32_t dir_lbn = 0;
-        while(total_dir_bytes_iterated < target_inode_data.i_size && non_dot_entries == 0) {
-            uint32_t physical_block = map_logical_to_physical_block(*context, &target_inode_data, dir_lbn);
-            if (physical_block == 0) { // 目录通常应该是连续的
-                if (total_dir_bytes_iterated >= target_inode_data.i_size) break;
-                dir_lbn++; continue;
-            }
-            if (read_block(context->device_fd, physical_block, block_buffer.data()) != 0) return -EIO;
-
-            uint16_t entry_offset = 0;
-            uint32_t current_block_dir_bytes_processed = 0;
-            while(total_dir_bytes_iterated < target_inode_data.i_size && current_block_dir_bytes_processed < SIMPLEFS_BLOCK_SIZE) {
-                SimpleFS_DirEntry* entry = reinterpret_cast<SimpleFS_DirEntry*>(block_buffer.data() + entry_offset);
-                if (entry->rec_len == 0 || (calculate_dir_entry_len(entry->name_len) > entry->rec_len) || (entry_offset + entry->rec_len > SIMPLEFS_BLOCK_SIZE)) break;
-                if (entry->inode != 0 && entry->name_len > 0) {
-                    std::string entry_s_name(entry->name, entry->name_len);
-                    if (entry_s_name != "." && entry_s_name != "..") {
-                        non_dot_entries++;
-                        break;
-                    }
-                }
-                entry_offset += entry->rec_len;
-                current_block_dir_bytes_processed += entry->rec_len;
-                total_dir_bytes_iterated += entry->rec_len;
-                if(entry_offset >= SIMPLEFS_BLOCK_SIZE) break;
-            }
-            if (non_dot_entries > 0) break;
-            dir_lbn++;
-             if (dir_lbn > (target_inode_data.i_size / SIMPLEFS_BLOCK_SIZE) + SIMPLEFS_INODE_BLOCK_PTRS*1024*1024) {
-                 std::cerr << "rmdir: Excessive LBN for dir " << target_inode_num << std::endl; return -EIO;
-             }
-        }
-        if (non_dot_entries > 0) is_empty = false;
-    }
-    if (!is_empty) return -ENOTEMPTY;
+    int empty_res = check_dir_empty(*context, target_inode_num, target_inode_data);
+    if (empty_res != 0) return empty_res;
 
     int remove_res = remove_dir_entry(*context, &parent_inode_data, parent_inode_num, basename_str);
     if (remove_res != 0) return remove_res;
 
     // 减少父目录链接数，因为被删除目录的".."不再指向它
     parent_inode_data.i_links_count--;
-    parent_inode_data.i_mtime = parent_inode_data.i_ctime = time(nullptr);
+    touch_inode_times(&parent_inode_data, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
     if (write_inode_to_disk(*context, parent_inode_num, &parent_inode_data) != 0) { /* Log error, but proceed */ }
 
-    // 释放被删除目录的块（应该只有一个包含"."和".."的块）
-    free_all_inode_blocks(*context, &target_inode_data);
-
-    target_inode_data.i_links_count = 0; // 父目录链接消失，"."消失
-    target_inode_data.i_dtime = time(nullptr);
-    target_inode_data.i_size = 0;
-    // i_blocks由free_all_inode_blocks处理
-
-    mode_t mode_of_target = target_inode_data.i_mode;
-    if(write_inode_to_disk(*context, target_inode_num, &target_inode_data) !=0) {
-        std::cerr << "rmdir: 释放前目标inode " << target_inode_num << " 写入失败" << std::endl;
-    }
-    free_inode(*context, target_inode_num, mode_of_target); // mode_of_target用于bg_used_dirs_count
+    free_empty_dir_inode(*context, target_inode_num, target_inode_data);
     sync_fs_metadata(*context);
     return 0;
 }
 
-// 从打开的文件读取数据
-int simplefs_read(const char *path, char *buf, size_t size, off_t offset,
-                  struct fuse_file_info *fi) {
-    (void)fi;
-    SimpleFS_Context* context = get_fs_context();
-    if (!context) return -EACCES;
-    errno = 0;
-    uint32_t inode_num = path_to_inode_num(path);
-    if (inode_num == 0) return -errno;
-    SimpleFS_Inode inode_data;
-    if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
-    if (S_ISDIR(inode_data.i_mode)) return -EISDIR;
-    int access_res = check_access(fuse_get_context(), &inode_data, R_OK);
-    if (access_res != 0) return access_res;
-
-    if (offset >= (off_t)inode_data.i_size) return 0;
-    if (offset + size > inode_data.i_size) {
-        size = inode_data.i_size - offset;
+// 粘滞位目录中只有root、目录所有者和文件所有者可以删除或移走目录项
+static bool sticky_dir_denies(const SimpleFS_Inode& parent_inode_data, const SimpleFS_Inode& target_inode_data) {
+    if (!(parent_inode_data.i_mode & S_ISVTX)) {
+        return false;
     }
+    struct fuse_context *caller_ctx = fuse_get_context();
+    return caller_ctx->uid != 0 && caller_ctx->uid != parent_inode_data.i_uid &&
+           caller_ctx->uid != target_inode_data.i_uid;
+}
 
-    size_t total_bytes_read = 0;
-    std::vector<uint8_t> block_buffer(SIMPLEFS_BLOCK_SIZE);
-    while (total_bytes_read < size) {
-        uint32_t current_offset_in_file = offset + total_bytes_read;
-        uint32_t logical_block_idx = current_offset_in_file / SIMPLEFS_BLOCK_SIZE;
-        uint32_t offset_in_block = current_offset_in_file % SIMPLEFS_BLOCK_SIZE;
-        uint32_t physical_block_num = map_logical_to_physical_block(*context, &inode_data, logical_block_idx);
-        if (physical_block_num == 0) {
-            size_t bytes_to_zero_in_this_block = SIMPLEFS_BLOCK_SIZE - offset_in_block;
-            if (bytes_to_zero_in_this_block > (size - total_bytes_read)) {
-                bytes_to_zero_in_this_block = size - total_bytes_read;
-            }
-            std::memset(buf + total_bytes_read, 0, bytes_to_zero_in_this_block);
-            total_bytes_read += bytes_to_zero_in_this_block;
-            if (errno != 0 && errno != ENOENT) {
-                 if (total_bytes_read > 0) break;
-                 return -errno;
-            }
-            errno = 0;
-            continue;
-        }
-        if (read_block(context->device_fd, physical_block_num, block_buffer.data()) != 0) {
-            if (total_bytes_read > 0) break;
-            return -EIO;
+// ancestor_num是否为dir_num自身或其上级目录（沿".."向上查找到根目录）
+static int is_dir_ancestor(SimpleFS_Context& context, uint32_t ancestor_num, uint32_t dir_num, bool* is_ancestor) {
+    *is_ancestor = false;
+    for (uint32_t depth = 0; depth <= context.sb.s_inodes_count; ++depth) {
+        if (dir_num == ancestor_num) {
+            *is_ancestor = true;
+            return 0;
         }
-        size_t bytes_to_read_from_this_block = SIMPLEFS_BLOCK_SIZE - offset_in_block;
-        if (bytes_to_read_from_this_block > (size - total_bytes_read)) {
-            bytes_to_read_from_this_block = size - total_bytes_read;
+        if (dir_num == context.sb.s_root_inode) {
+            return 0;
         }
-        std::memcpy(buf + total_bytes_read, block_buffer.data() + offset_in_block, bytes_to_read_from_this_block);
-        total_bytes_read += bytes_to_read_from_this_block;
-    }
-    inode_data.i_atime = time(nullptr);
-    if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) {
-        std::cerr << "read: inode " << inode_num << " atime更新失败" << std::endl;
+        SimpleFS_Inode dir_inode_data;
+        if (read_inode_from_disk(context, dir_num, &dir_inode_data) != 0) return -EIO;
+        errno = 0;
+        dir_num = lookup_dir_entry(context, &dir_inode_data, "..");
+        if (dir_num == 0) return errno ? -errno : -EIO;
     }
-    return total_bytes_read;
+    return -ELOOP;
 }
 
-// 向打开的文件写入数据
-int simplefs_write(const char *path, const char *buf, size_t size, off_t offset,
-                   struct fuse_file_info *fi) {
-    (void)fi;
-    SimpleFS_Context* context = get_fs_context();
-    if (!context) return -EACCES;
-    errno = 0;
-    uint32_t inode_num = path_to_inode_num(path);
-    if (inode_num == 0) return -errno;
-    SimpleFS_Inode inode_data;
-    if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
-    if (S_ISDIR(inode_data.i_mode)) return -EISDIR;
-    int access_res = check_access(fuse_get_context(), &inode_data, W_OK);
+// 移动目录到新父目录：改写其".."并调整两个父目录的链接数
+static int reparent_dir(SimpleFS_Context& context, uint32_t dir_num, SimpleFS_Inode& dir_inode_data,
+                        SimpleFS_Inode* old_parent_inode, SimpleFS_Inode* new_parent_inode, uint32_t new_parent_num) {
+    int res = set_dir_entry_inode(context, &dir_inode_data, dir_num, "..", new_parent_num, S_IFDIR >> 12);
+    if (res != 0) return res;
+    old_parent_inode->i_links_count--;
+    new_parent_inode->i_links_count++;
+    return 0;
+}
+
+// rename的实现：只移动目录项，不复制数据，耗时与文件大小无关
+// flags可为SIMPLEFS_RENAME_NOREPLACE（目标存在时失败）或SIMPLEFS_RENAME_EXCHANGE（原子交换两个已存在的项）
+static int rename_internal(SimpleFS_Context& context, const char* from, const char* to, uint32_t flags) {
+    if (is_snapshot_path(context, from) || is_snapshot_path(context, to)) return -EROFS;
+    if ((flags & ~(SIMPLEFS_RENAME_NOREPLACE | SIMPLEFS_RENAME_EXCHANGE)) != 0 ||
+        (flags & SIMPLEFS_RENAME_NOREPLACE && flags & SIMPLEFS_RENAME_EXCHANGE)) {
+        return -EINVAL;
+    }
+
+    std::string old_dirname_str, old_basename_str, new_dirname_str, new_basename_str;
+    parse_path(from, old_dirname_str, old_basename_str);
+    parse_path(to, new_dirname_str, new_basename_str);
+    if (old_basename_str.empty() || old_basename_str == "." || old_basename_str == ".." || old_basename_str == "/" ||
+        new_basename_str.empty() || new_basename_str == "." || new_basename_str == ".." || new_basename_str == "/") {
+        return -EINVAL;
+    }
+    if (new_basename_str.length() > SIMPLEFS_MAX_FILENAME_LEN) return -ENAMETOOLONG;
+
+    // 1. 两个父目录：必须是目录且调用者有写和搜索权限
+    errno = 0;
+    uint32_t old_parent_num = path_to_inode_num(old_dirname_str.c_str());
+    if (old_parent_num == 0) return -errno;
+    errno = 0;
+    uint32_t new_parent_num = path_to_inode_num(new_dirname_str.c_str());
+    if (new_parent_num == 0) return -errno;
+
+    SimpleFS_Inode old_parent_data, new_parent_data;
+    if (read_inode_from_disk(context, old_parent_num, &old_parent_data) != 0) return -errno;
+    if (read_inode_from_disk(context, new_parent_num, &new_parent_data) != 0) return -errno;
+    // 同一父目录时两边操作同一份inode，避免其中一份的修改被另一份覆盖
+    bool same_parent = (old_parent_num == new_parent_num);
+    SimpleFS_Inode* old_parent_inode = &old_parent_data;
+    SimpleFS_Inode* new_parent_inode = same_parent ? &old_parent_data : &new_parent_data;
+    if (!S_ISDIR(old_parent_inode->i_mode) || !S_ISDIR(new_parent_inode->i_mode)) return -ENOTDIR;
+
+    int access_res = check_access(fuse_get_context(), old_parent_inode, W_OK | X_OK);
     if (access_res != 0) return access_res;
+    access_res = check_access(fuse_get_context(), new_parent_inode, W_OK | X_OK);
+    if (access_res != 0) return access_res;
+
+    // 2. 源和目标（不跟随最后一级符号链接）
+    uint32_t source_num = lookup_dir_entry(context, old_parent_inode, old_basename_str);
+    if (source_num == 0) return -ENOENT;
+    errno = 0;
+    uint32_t target_num = lookup_dir_entry(context, new_parent_inode, new_basename_str);
+    if (target_num == 0 && errno != ENOENT) return errno ? -errno : -EIO;
+
+    if (target_num != 0 && (flags & SIMPLEFS_RENAME_NOREPLACE)) return -EEXIST;
+    if (target_num == 0 && (flags & SIMPLEFS_RENAME_EXCHANGE)) return -ENOENT;
+    // 源和目标是同一inode（同名或硬链接）时什么也不做
+    if (target_num == source_num) return 0;
+
+    SimpleFS_Inode source_data, target_data;
+    if (read_inode_from_disk(context, source_num, &source_data) != 0) return -errno;
+    if (target_num != 0 && read_inode_from_disk(context, target_num, &target_data) != 0) return -errno;
+    bool source_is_dir = S_ISDIR(source_data.i_mode);
+    bool target_is_dir = target_num != 0 && S_ISDIR(target_data.i_mode);
+
+    if (sticky_dir_denies(*old_parent_inode, source_data)) return -EACCES;
+    if (target_num != 0 && sticky_dir_denies(*new_parent_inode, target_data)) return -EACCES;
+
+    // 3. 目录不能移入自己的子树；跨父目录移动目录需要改写其".."，要求对该目录有写权限
+    bool moves_dir_across = !same_parent && source_is_dir;
+    bool exchanges_dir_across = !same_parent && target_is_dir && (flags & SIMPLEFS_RENAME_EXCHANGE);
+    if (moves_dir_across) {
+        bool is_ancestor = false;
+        int res = is_dir_ancestor(context, source_num, new_parent_num, &is_ancestor);
+        if (res != 0) return res;
+        if (is_ancestor) return -EINVAL;
+        access_res = check_access(fuse_get_context(), &source_data, W_OK);
+        if (access_res != 0) return access_res;
+    }
+    if (exchanges_dir_across) {
+        bool is_ancestor = false;
+        int res = is_dir_ancestor(context, target_num, old_parent_num, &is_ancestor);
+        if (res != 0) return res;
+        if (is_ancestor) return -EINVAL;
+        access_res = check_access(fuse_get_context(), &target_data, W_OK);
+        if (access_res != 0) return access_res;
+    }
+
+    uint8_t source_file_type = (source_data.i_mode & S_IFMT) >> 12;
+    int res = 0;
 
+    if (flags & SIMPLEFS_RENAME_EXCHANGE) {
+        // 4a. 交换：两个目录项原地改写inode号，再修正跨目录移动的子目录的".."
+        uint8_t target_file_type = (target_data.i_mode & S_IFMT) >> 12;
+        res = set_dir_entry_inode(context, new_parent_inode, new_parent_num, new_basename_str, source_num, source_file_type);
+        if (res != 0) return res;
+        res = set_dir_entry_inode(context, old_parent_inode, old_parent_num, old_basename_str, target_num, target_file_type);
+        if (res != 0) return res;
+        if (moves_dir_across) {
+            res = reparent_dir(context, source_num, source_data, old_parent_inode, new_parent_inode, new_parent_num);
+            if (res != 0) return res;
+        }
+        if (exchanges_dir_across) {
+            res = reparent_dir(context, target_num, target_data, new_parent_inode, old_parent_inode, old_parent_num);
+            if (res != 0) return res;
+        }
+        touch_inode_times(&target_data, SIMPLEFS_TIME_CTIME);
+        if (write_inode_to_disk(context, target_num, &target_data) != 0) return -EIO;
+    } else if (target_num != 0) {
+        // 4b. 替换已存在的目标：目标目录项原地指向源inode，替换是原子的
+        if (source_is_dir && !target_is_dir) return -ENOTDIR;
+        if (!source_is_dir && target_is_dir) return -EISDIR;
+        if (target_is_dir) {
+            int empty_res = check_dir_empty(context, target_num, target_data);
+            if (empty_res != 0) return empty_res;
+        }
+        res = set_dir_entry_inode(context, new_parent_inode, new_parent_num, new_basename_str, source_num, source_file_type);
+        if (res != 0) return res;
+        res = remove_dir_entry(context, old_parent_inode, old_parent_num, old_basename_str);
+        if (res != 0) return res;
+        if (moves_dir_across) {
+            res = reparent_dir(context, source_num, source_data, old_parent_inode, new_parent_inode, new_parent_num);
+            if (res != 0) return res;
+        }
+        if (target_is_dir) {
+            new_parent_inode->i_links_count--; // 被替换目录的".."不再指向新父目录
+            free_empty_dir_inode(context, target_num, target_data);
+        } else {
+            res = drop_inode_link(context, target_num, target_data);
+            if (res != 0) return res;
+        }
+    } else {
+        // 4c. 目标不存在：在新目录添加目录项后删除旧目录项
+        res = add_dir_entry(context, new_parent_inode, new_parent_num, new_basename_str, source_num, source_file_type);
+        if (res != 0) return res;
+        res = remove_dir_entry(context, old_parent_inode, old_parent_num, old_basename_str);
+        if (res != 0) {
+            remove_dir_entry(context, new_parent_inode, new_parent_num, new_basename_str);
+            return res;
+        }
+        if (moves_dir_across) {
+            res = reparent_dir(context, source_num, source_data, old_parent_inode, new_parent_inode, new_parent_num);
+            if (res != 0) return res;
+        }
+    }
+
+    touch_inode_times(&source_data, SIMPLEFS_TIME_CTIME);
+    if (write_inode_to_disk(context, source_num, &source_data) != 0) return -EIO;
+    if (write_inode_to_disk(context, old_parent_num, old_parent_inode) != 0) return -EIO;
+    if (!same_parent && write_inode_to_disk(context, new_parent_num, new_parent_inode) != 0) return -EIO;
+    sync_fs_metadata(context);
+    return 0;
+}
+
+// 重命名文件或目录
+int simplefs_rename(const char *from, const char *to) {
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    return rename_internal(*context, from, to, 0);
+}
+
+// 按inode读取文件数据，不做权限检查也不更新atime，返回读取的字节数或负的错误码
+static int read_inode_data(SimpleFS_Context& context, uint32_t inode_num, const SimpleFS_Inode& inode_data,
+                           char *buf, size_t size, off_t offset) {
+    if (offset >= (off_t)inode_data.i_size) return 0;
+    if (offset + size > inode_data.i_size) {
+        size = inode_data.i_size - offset;
+    }
+    if (inode_has_inline_data(&inode_data)) {
+        std::memcpy(buf, inode_inline_data(&inode_data) + offset, size);
+        return size;
+    }
+
+    size_t total_bytes_read = 0;
+    std::vector<uint8_t> block_buffer(context.block_size);
+    while (total_bytes_read < size) {
+        uint32_t current_offset_in_file = offset + total_bytes_read;
+        uint32_t logical_block_idx = current_offset_in_file / context.block_size;
+        uint32_t offset_in_block = current_offset_in_file % context.block_size;
+        size_t bytes_to_read_from_this_block = context.block_size - offset_in_block;
+        if (bytes_to_read_from_this_block > (size - total_bytes_read)) {
+            bytes_to_read_from_this_block = size - total_bytes_read;
+        }
+        // 尚未回写的延迟分配块
+        if (delalloc_read_block(inode_num, logical_block_idx, block_buffer.data())) {
+            std::memcpy(buf + total_bytes_read, block_buffer.data() + offset_in_block, bytes_to_read_from_this_block);
+            total_bytes_read += bytes_to_read_from_this_block;
+            continue;
+        }
+        if (inode_is_compressed(&inode_data)) {
+            // 压缩簇经簇缓存整簇解压
+            int compress_res = compress_read_block(context, inode_num, &inode_data, logical_block_idx, block_buffer.data());
+            if (compress_res != 0) {
+                if (total_bytes_read > 0) break;
+                return compress_res;
+            }
+            std::memcpy(buf + total_bytes_read, block_buffer.data() + offset_in_block, bytes_to_read_from_this_block);
+            total_bytes_read += bytes_to_read_from_this_block;
+            continue;
+        }
+        bool block_unwritten = false;
+        uint32_t physical_block_num = map_logical_to_physical_block(context, &inode_data, logical_block_idx, &block_unwritten);
+        if (physical_block_num == 0 || block_unwritten) { // 空洞或预分配未写入的块读为零
+            size_t bytes_to_zero_in_this_block = context.block_size - offset_in_block;
+            if (bytes_to_zero_in_this_block > (size - total_bytes_read)) {
+                bytes_to_zero_in_this_block = size - total_bytes_read;
+            }
+            std::memset(buf + total_bytes_read, 0, bytes_to_zero_in_this_block);
+            total_bytes_read += bytes_to_zero_in_this_block;
+            if (errno != 0 && errno != ENOENT) {
+                 if (total_bytes_read > 0) break;
+                 return -errno;
+            }
+            errno = 0;
+            continue;
+        }
+        if (read_block(context.device_fd, physical_block_num, block_buffer.data()) != 0) {
+            if (total_bytes_read > 0) break;
+            return -EIO;
+        }
+        std::memcpy(buf + total_bytes_read, block_buffer.data() + offset_in_block, bytes_to_read_from_this_block);
+        total_bytes_read += bytes_to_read_from_this_block;
+    }
+    return total_bytes_read;
+}
+
+static int promote_inline_data(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode& inode_data);
+
+// 压缩文件的写入：所有块都进入延迟分配缓存，回写时整簇压缩
+// 尚未缓存的块被部分覆盖时，先取出磁盘上（可能需要解压）的原有内容
+static int write_compressed_inode_data(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode& inode_data,
+                                       const char *buf, size_t size, off_t offset) {
     size_t total_bytes_written = 0;
-    std::vector<uint8_t> block_rw_buffer(SIMPLEFS_BLOCK_SIZE);
+    std::vector<uint8_t> block_buffer(context.block_size);
     while (total_bytes_written < size) {
         uint32_t current_offset_in_file = offset + total_bytes_written;
-        uint32_t logical_block_idx = current_offset_in_file / SIMPLEFS_BLOCK_SIZE;
-        uint32_t offset_in_block = current_offset_in_file % SIMPLEFS_BLOCK_SIZE;
-        bool block_was_newly_allocated = false;
-        uint32_t physical_block_num = allocate_block_for_write(*context, &inode_data, inode_num, logical_block_idx, &block_was_newly_allocated);
-        if (physical_block_num == 0) {
+        uint32_t logical_block_idx = current_offset_in_file / context.block_size;
+        uint32_t offset_in_block = current_offset_in_file % context.block_size;
+        size_t bytes_to_write_in_this_block = std::min<size_t>(context.block_size - offset_in_block,
+                                                               size - total_bytes_written);
+        int res;
+        bool is_partial_block_overwrite = (bytes_to_write_in_this_block < context.block_size);
+        if (is_partial_block_overwrite && !delalloc_read_block(inode_num, logical_block_idx, nullptr)) {
+            res = compress_read_block(context, inode_num, &inode_data, logical_block_idx, block_buffer.data());
+            if (res == 0) {
+                std::memcpy(block_buffer.data() + offset_in_block, buf + total_bytes_written, bytes_to_write_in_this_block);
+                res = delalloc_write_block(context, inode_num, logical_block_idx, 0, block_buffer.data(), context.block_size);
+            }
+        } else {
+            res = delalloc_write_block(context, inode_num, logical_block_idx, offset_in_block,
+                                       buf + total_bytes_written, bytes_to_write_in_this_block);
+        }
+        if (res != 0) {
             if (total_bytes_written > 0) break;
-            return -errno;
+            return res;
         }
-        size_t bytes_to_write_in_this_block = SIMPLEFS_BLOCK_SIZE - offset_in_block;
+        total_bytes_written += bytes_to_write_in_this_block;
+    }
+    if ((offset + total_bytes_written) > inode_data.i_size) {
+        inode_data.i_size = offset + total_bytes_written;
+    }
+    return total_bytes_written;
+}
+
+// 按inode写入文件数据，inode_data中的块指针和大小随之更新，由调用者写回inode
+// 返回写入的字节数或负的错误码
+static int write_inode_data(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode& inode_data,
+                            const char *buf, size_t size, off_t offset) {
+    if (inode_has_inline_data(&inode_data)) {
+        if (offset + size <= inode_inline_capacity(context)) {
+            std::memcpy(inode_inline_data(&inode_data) + offset, buf, size);
+            if (offset + size > inode_data.i_size) {
+                inode_data.i_size = offset + size;
+            }
+            return size;
+        }
+        int promote_res = promote_inline_data(context, inode_num, inode_data);
+        if (promote_res != 0) return promote_res;
+    }
+    if (inode_is_compressed(&inode_data)) {
+        return write_compressed_inode_data(context, inode_num, inode_data, buf, size, offset);
+    }
+
+    size_t total_bytes_written = 0;
+    std::vector<uint8_t> block_rw_buffer(context.block_size);
+    std::vector<std::pair<uint32_t, uint32_t>> converted_blocks; // 写入了数据的未写入块 (逻辑块号, 物理块号)
+    while (total_bytes_written < size) {
+        uint32_t current_offset_in_file = offset + total_bytes_written;
+        uint32_t logical_block_idx = current_offset_in_file / context.block_size;
+        uint32_t offset_in_block = current_offset_in_file % context.block_size;
+        size_t bytes_to_write_in_this_block = context.block_size - offset_in_block;
         if (bytes_to_write_in_this_block > (size - total_bytes_written)) {
             bytes_to_write_in_this_block = size - total_bytes_written;
         }
-        bool is_partial_block_overwrite = (offset_in_block != 0 || bytes_to_write_in_this_block < SIMPLEFS_BLOCK_SIZE);
-        if (is_partial_block_overwrite && !block_was_newly_allocated) {
-            if (read_block(context->device_fd, physical_block_num, block_rw_buffer.data()) != 0) {
+        bool block_unwritten = false;
+        uint32_t physical_block_num = map_logical_to_physical_block(context, &inode_data, logical_block_idx, &block_unwritten);
+        errno = 0;
+        if (physical_block_num == 0) {
+            // 未映射的块先缓存，回写时再分配物理块
+            int delalloc_res = delalloc_write_block(context, inode_num, logical_block_idx, offset_in_block,
+                                                    buf + total_bytes_written, bytes_to_write_in_this_block);
+            if (delalloc_res != 0) {
+                if (total_bytes_written > 0) break;
+                return delalloc_res;
+            }
+            total_bytes_written += bytes_to_write_in_this_block;
+            continue;
+        }
+        bool is_partial_block_overwrite = (offset_in_block != 0 || bytes_to_write_in_this_block < context.block_size);
+        if (delalloc_read_block(inode_num, logical_block_idx, nullptr)) {
+            // 已缓存的块（写入时曾是共享块）继续写入缓存
+            int delalloc_res = delalloc_write_block(context, inode_num, logical_block_idx, offset_in_block,
+                                                    buf + total_bytes_written, bytes_to_write_in_this_block);
+            if (delalloc_res != 0) {
+                if (total_bytes_written > 0) break;
+                return delalloc_res;
+            }
+            total_bytes_written += bytes_to_write_in_this_block;
+            continue;
+        }
+        if (logical_block_is_shared(context, &inode_data, logical_block_idx)) {
+            // 共享块不能就地写入：合并后的整块进入缓存，回写时写入新块
+            if (is_partial_block_overwrite) {
+                if (block_unwritten) {
+                    std::fill(block_rw_buffer.begin(), block_rw_buffer.end(), 0);
+                } else if (read_block(context.device_fd, physical_block_num, block_rw_buffer.data()) != 0) {
+                    if (total_bytes_written > 0) break;
+                    return -EIO;
+                }
+            }
+            std::memcpy(block_rw_buffer.data() + offset_in_block, buf + total_bytes_written, bytes_to_write_in_this_block);
+            int delalloc_res = delalloc_write_block(context, inode_num, logical_block_idx, 0,
+                                                    block_rw_buffer.data(), context.block_size);
+            if (delalloc_res != 0) {
+                if (total_bytes_written > 0) break;
+                return delalloc_res;
+            }
+            total_bytes_written += bytes_to_write_in_this_block;
+            continue;
+        }
+        if (is_partial_block_overwrite) {
+            if (block_unwritten) {
+                // 未写入块的磁盘内容无意义，按零处理
+                std::fill(block_rw_buffer.begin(), block_rw_buffer.end(), 0);
+            } else if (read_block(context.device_fd, physical_block_num, block_rw_buffer.data()) != 0) {
                  if (total_bytes_written > 0) break;
                  return -EIO;
             }
-        } else {
-            if (is_partial_block_overwrite && block_was_newly_allocated)
-                 std::fill(block_rw_buffer.begin(), block_rw_buffer.end(), 0);
         }
         std::memcpy(block_rw_buffer.data() + offset_in_block, buf + total_bytes_written, bytes_to_write_in_this_block);
-        if (write_block(context->device_fd, physical_block_num, block_rw_buffer.data()) != 0) {
+        if (write_block(context.device_fd, physical_block_num, block_rw_buffer.data()) != 0) {
             if (total_bytes_written > 0) break;
             return -EIO;
         }
+        if (block_unwritten) {
+            converted_blocks.emplace_back(logical_block_idx, physical_block_num);
+        }
         total_bytes_written += bytes_to_write_in_this_block;
     }
+    // 数据落盘后再清除未写入标志，ordered和sync模式下先经过一次刷新屏障
+    if (!converted_blocks.empty()) {
+        int convert_res = 0;
+        if (context.durability_mode != SIMPLEFS_DURABILITY_WRITEBACK) {
+            convert_res = group_commit_flush(context.device_fd);
+        }
+        for (size_t i = 0; i < converted_blocks.size() && convert_res == 0; ++i) {
+            if (set_logical_block_ptr(context, &inode_data, converted_blocks[i].first, converted_blocks[i].second) != 0) {
+                convert_res = -EIO;
+            }
+        }
+        // 未能转换的块仍读为零，写入长度截断到第一个未转换块之前
+        if (convert_res != 0) {
+            uint64_t converted_end = 0;
+            for (const auto& block : converted_blocks) {
+                bool still_unwritten = false;
+                map_logical_to_physical_block(context, &inode_data, block.first, &still_unwritten);
+                if (still_unwritten) {
+                    converted_end = static_cast<uint64_t>(block.first) * context.block_size;
+                    break;
+                }
+            }
+            if (converted_end <= static_cast<uint64_t>(offset)) return convert_res;
+            total_bytes_written = std::min<size_t>(total_bytes_written, converted_end - offset);
+        }
+    }
     if ((offset + total_bytes_written) > inode_data.i_size) {
         inode_data.i_size = offset + total_bytes_written;
     }
-    inode_data.i_mtime = inode_data.i_ctime = time(nullptr);
+    return total_bytes_written;
+}
+
+// 内联数据转为块存储：清除内联标志后按普通写入放回逻辑块0（经延迟分配缓存）
+// 失败时恢复内联状态，返回0或负的错误码
+static int promote_inline_data(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode& inode_data) {
+    uint8_t* inline_data = inode_inline_data(&inode_data);
+    uint32_t inline_size = std::min<uint32_t>(inode_data.i_size, inode_inline_capacity(context));
+    std::vector<char> saved_data(inline_data, inline_data + SIMPLEFS_INLINE_DATA_MAX);
+    std::memset(inline_data, 0, SIMPLEFS_INLINE_DATA_MAX);
+    inode_data.i_flags &= ~SIMPLEFS_INODE_FL_INLINE_DATA;
+    if (inline_size == 0) return 0;
+
+    int written = write_inode_data(context, inode_num, inode_data, saved_data.data(), inline_size, 0);
+    if (written != static_cast<int>(inline_size)) {
+        delalloc_discard_range(context, inode_num, 0, 1);
+        std::memcpy(inline_data, saved_data.data(), SIMPLEFS_INLINE_DATA_MAX);
+        inode_data.i_flags |= SIMPLEFS_INODE_FL_INLINE_DATA;
+        return written < 0 ? written : -ENOSPC;
+    }
+    return 0;
+}
+
+// 从打开的文件读取数据
+int simplefs_read(const char *path, char *buf, size_t size, off_t offset,
+                  struct fuse_file_info *fi) {
+    (void)fi;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    SnapshotPathView view(*context, path);
+    if (view.error != 0) return view.error;
+    if (view.snapshot_dir) return -EISDIR;
+    errno = 0;
+    uint32_t inode_num = path_to_inode_num(view.path());
+    if (inode_num == 0) return -errno;
+    SimpleFS_Inode inode_data;
+    if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
+    if (S_ISDIR(inode_data.i_mode)) return -EISDIR;
+    int access_res = check_access(fuse_get_context(), &inode_data, R_OK);
+    if (access_res != 0) return access_res;
+
+    // 快照中的文件不使用活动文件系统按inode号缓存的数据，也不更新atime
+    int total_bytes_read = read_inode_data(*context, view.active ? 0 : inode_num, inode_data, buf, size, offset);
+    if (total_bytes_read <= 0 || view.active) return total_bytes_read;
+    touch_inode_times(&inode_data, SIMPLEFS_TIME_ATIME);
+    if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) {
+        std::cerr << "read: inode " << inode_num << " atime更新失败" << std::endl;
+    }
+    return total_bytes_read;
+}
+
+// 向打开的文件写入数据
+int simplefs_write(const char *path, const char *buf, size_t size, off_t offset,
+                   struct fuse_file_info *fi) {
+    (void)fi;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
+    errno = 0;
+    uint32_t inode_num = path_to_inode_num(path);
+    if (inode_num == 0) return -errno;
+    SimpleFS_Inode inode_data;
+    if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
+    if (S_ISDIR(inode_data.i_mode)) return -EISDIR;
+    int access_res = check_access(fuse_get_context(), &inode_data, W_OK);
+    if (access_res != 0) return access_res;
+
+    int total_bytes_written = write_inode_data(*context, inode_num, inode_data, buf, size, offset);
+    if (total_bytes_written < 0) return total_bytes_written;
+    touch_inode_times(&inode_data, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
+    if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) {
+        if (total_bytes_written == 0 && size > 0) return -EIO;
+    }
+    sync_fs_metadata(*context);
+    // inode已写回，此后回写会重新读取inode
+    delalloc_writeback_if_over_limit(*context);
+    return total_bytes_written;
+}
+
+// 按段读取：已写入磁盘的物理连续块每段一次read_blocks直接读入返回的缓冲区，不再经过逐块的中间缓冲；
+// 空洞、未写入块和延迟分配缓存块在内存中拼接
+// 所有数据都在持有fs_mutex时读入内存：不以设备fd区间返回，因为libfuse在释放fs_mutex之后才读取，
+// 期间块可能被截断、删除、碎片整理或孤儿回收释放并分配给其他文件（或已被discard），读者会得到别的文件的数据
+int simplefs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+                      struct fuse_file_info *fi) {
+    (void)fi;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    SnapshotPathView view(*context, path);
+    if (view.error != 0) return view.error;
+    if (view.snapshot_dir) return -EISDIR;
+    errno = 0;
+    uint32_t inode_num = path_to_inode_num(view.path());
+    if (inode_num == 0) return -errno;
+    SimpleFS_Inode inode_data;
+    if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
+    if (S_ISDIR(inode_data.i_mode)) return -EISDIR;
+    int access_res = check_access(fuse_get_context(), &inode_data, R_OK);
+    if (access_res != 0) return access_res;
+
+    if (view.active) {
+        // 快照中的块经重映射读取，不能以设备fd区间返回，整体读入一个内存缓冲区
+        struct fuse_bufvec* bufvec = static_cast<struct fuse_bufvec*>(std::calloc(1, sizeof(struct fuse_bufvec)));
+        if (!bufvec) return -ENOMEM;
+        bufvec->count = 1;
+        bufvec->buf[0].mem = std::malloc(std::max<size_t>(size, 1));
+        if (!bufvec->buf[0].mem) {
+            std::free(bufvec);
+            return -ENOMEM;
+        }
+        int total_bytes_read = read_inode_data(*context, 0, inode_data, static_cast<char*>(bufvec->buf[0].mem), size, offset);
+        if (total_bytes_read < 0) {
+            std::free(bufvec->buf[0].mem);
+            std::free(bufvec);
+            return total_bytes_read;
+        }
+        bufvec->buf[0].size = total_bytes_read;
+        *bufp = bufvec;
+        return 0;
+    }
+
+    if (offset >= (off_t)inode_data.i_size) {
+        size = 0;
+    } else if (offset + size > inode_data.i_size) {
+        size = inode_data.i_size - offset;
+    }
+
+    // 每段要么是设备上的连续区间，要么是一段内存数据
+    struct ReadSegment {
+        uint64_t device_pos;
+        size_t length;
+        bool on_device;
+        std::vector<char> data;
+    };
+    std::vector<ReadSegment> segments;
+    std::vector<uint8_t> block_buffer(context->block_size);
+    size_t total_bytes = 0;
+    if (inode_has_inline_data(&inode_data) && size > 0) {
+        // 内联数据位于inode中，整体作为一段内存数据返回
+        const char* src = reinterpret_cast<const char*>(inode_inline_data(&inode_data)) + offset;
+        segments.push_back({0, size, false, std::vector<char>(src, src + size)});
+        total_bytes = size;
+    }
+    while (total_bytes < size) {
+        uint32_t current_offset_in_file = offset + total_bytes;
+        uint32_t logical_block_idx = current_offset_in_file / context->block_size;
+        uint32_t offset_in_block = current_offset_in_file % context->block_size;
+        size_t bytes_in_this_block = std::min<size_t>(context->block_size - offset_in_block, size - total_bytes);
+
+        bool buffered = delalloc_read_block(inode_num, logical_block_idx, block_buffer.data());
+        bool block_unwritten = false;
+        uint32_t physical_block_num = 0;
+        if (!buffered && inode_is_compressed(&inode_data)) {
+            // 压缩文件的数据需要解压，不能直接从设备返回
+            int compress_res = compress_read_block(*context, inode_num, &inode_data, logical_block_idx, block_buffer.data());
+            if (compress_res != 0) {
+                if (total_bytes > 0) break;
+                return compress_res;
+            }
+            buffered = true;
+        }
+        if (!buffered) {
+            errno = 0;
+            physical_block_num = map_logical_to_physical_block(*context, &inode_data, logical_block_idx, &block_unwritten);
+            if (physical_block_num == 0 && errno != 0 && errno != ENOENT) {
+                if (total_bytes > 0) break;
+                return -errno;
+            }
+        }
+
+        if (physical_block_num != 0 && !block_unwritten) {
+            uint64_t device_pos = static_cast<uint64_t>(physical_block_num) * context->block_size + offset_in_block;
+            if (!segments.empty() && segments.back().on_device &&
+                segments.back().device_pos + segments.back().length == device_pos) {
+                segments.back().length += bytes_in_this_block;
+            } else {
+                segments.push_back({device_pos, bytes_in_this_block, true, {}});
+            }
+        } else {
+            if (segments.empty() || segments.back().on_device) {
+                segments.push_back({0, 0, false, {}});
+            }
+            ReadSegment& segment = segments.back();
+            if (buffered) {
+                const char* src = reinterpret_cast<const char*>(block_buffer.data()) + offset_in_block;
+                segment.data.insert(segment.data.end(), src, src + bytes_in_this_block);
+            } else {
+                segment.data.resize(segment.data.size() + bytes_in_this_block, 0);
+            }
+            segment.length += bytes_in_this_block;
+        }
+        total_bytes += bytes_in_this_block;
+    }
+
+    // bufvec及其内存缓冲区由libfuse用free()释放
+    size_t buffer_count = std::max<size_t>(segments.size(), 1);
+    size_t bufvec_bytes = sizeof(struct fuse_bufvec) + (buffer_count - 1) * sizeof(struct fuse_buf);
+    struct fuse_bufvec* bufvec = static_cast<struct fuse_bufvec*>(std::calloc(1, bufvec_bytes));
+    if (!bufvec) return -ENOMEM;
+    bufvec->count = buffer_count;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        struct fuse_buf& buf = bufvec->buf[i];
+        buf.size = segments[i].length;
+        int segment_error = 0;
+        if (segments[i].on_device) {
+            // 读入覆盖该段的整块，段首不在块边界时前移到缓冲区开头
+            uint32_t first_block = static_cast<uint32_t>(segments[i].device_pos / context->block_size);
+            size_t skip = segments[i].device_pos % context->block_size;
+            uint32_t block_count = static_cast<uint32_t>((skip + segments[i].length + context->block_size - 1) / context->block_size);
+            buf.mem = std::malloc(static_cast<size_t>(block_count) * context->block_size);
+            if (!buf.mem) {
+                segment_error = -ENOMEM;
+            } else if (read_blocks(context->device_fd, first_block, block_count, buf.mem) != 0) {
+                segment_error = -EIO;
+            } else if (skip != 0) {
+                std::memmove(buf.mem, static_cast<char*>(buf.mem) + skip, segments[i].length);
+            }
+        } else {
+            buf.mem = std::malloc(segments[i].length);
+            if (!buf.mem) {
+                segment_error = -ENOMEM;
+            } else {
+                std::memcpy(buf.mem, segments[i].data.data(), segments[i].length);
+            }
+        }
+        if (segment_error != 0) {
+            for (size_t j = 0; j <= i; ++j) std::free(bufvec->buf[j].mem);
+            std::free(bufvec);
+            return segment_error;
+        }
+    }
+    *bufp = bufvec;
+
+    if (total_bytes > 0) {
+        touch_inode_times(&inode_data, SIMPLEFS_TIME_ATIME);
+        if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) {
+            std::cerr << "read_buf: inode " << inode_num << " atime更新失败" << std::endl;
+        }
+    }
+    return 0;
+}
+
+// 单缓冲区的fuse_bufvec（等同于FUSE_BUFVEC_INIT，后者是C复合字面量）
+static struct fuse_bufvec single_fuse_bufvec(size_t size) {
+    struct fuse_bufvec bufvec;
+    std::memset(&bufvec, 0, sizeof(bufvec));
+    bufvec.count = 1;
+    bufvec.buf[0].size = size;
+    bufvec.buf[0].fd = -1;
+    return bufvec;
+}
+
+// 零拷贝写入：覆盖已写入的完整块时，数据直接从FUSE缓冲区（可能是管道）splice到设备fd；
+// 其余部分（部分块、未映射或未写入的块、已有缓存的块）经内存走常规写入路径
+int simplefs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                       struct fuse_file_info *fi) {
+    (void)fi;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
+    errno = 0;
+    uint32_t inode_num = path_to_inode_num(path);
+    if (inode_num == 0) return -errno;
+    SimpleFS_Inode inode_data;
+    if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
+    if (S_ISDIR(inode_data.i_mode)) return -EISDIR;
+    int access_res = check_access(fuse_get_context(), &inode_data, W_OK);
+    if (access_res != 0) return access_res;
+
+    size_t size = fuse_buf_size(buf);
+    size_t total_bytes_written = 0;
+    std::vector<char> staging_buffer;
+    int result = 0;
+    while (total_bytes_written < size) {
+        uint64_t current_offset_in_file = offset + total_bytes_written;
+        uint32_t logical_block_idx = current_offset_in_file / context->block_size;
+        uint32_t offset_in_block = current_offset_in_file % context->block_size;
+
+        // 从当前块开始，收集一段物理连续、可直接覆盖的完整块（压缩文件的块不能就地覆盖）
+        uint32_t run_start_block = 0;
+        size_t run_bytes = 0;
+        while (offset_in_block == 0 && !inode_is_compressed(&inode_data) &&
+               total_bytes_written + run_bytes + context->block_size <= size) {
+            uint32_t lbn = logical_block_idx + run_bytes / context->block_size;
+            if (delalloc_read_block(inode_num, lbn, nullptr)) break;
+            bool block_unwritten = false;
+            uint32_t physical_block_num = map_logical_to_physical_block(*context, &inode_data, lbn, &block_unwritten);
+            if (physical_block_num == 0 || block_unwritten) break;
+            if (logical_block_is_shared(*context, &inode_data, lbn)) break;
+            if (run_bytes == 0) {
+                run_start_block = physical_block_num;
+            } else if (physical_block_num != run_start_block + run_bytes / context->block_size) {
+                break;
+            }
+            run_bytes += context->block_size;
+        }
+
+        if (run_bytes > 0) {
+            // splice不经过disk_io的写入钩子，快照需要的旧内容先复制
+            int cow_res = snapshot_cow_blocks(*context, run_start_block, run_bytes / context->block_size);
+            if (cow_res != 0) {
+                result = cow_res;
+                break;
+            }
+            struct fuse_bufvec device_buf = single_fuse_bufvec(run_bytes);
+            device_buf.buf[0].flags = static_cast<enum fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+            device_buf.buf[0].fd = context->device_fd;
+            device_buf.buf[0].pos = static_cast<off_t>(run_start_block) * context->block_size;
+            ssize_t copied = fuse_buf_copy(&device_buf, buf, static_cast<enum fuse_buf_copy_flags>(0));
+            if (copied < 0) {
+                result = static_cast<int>(copied);
+                break;
+            }
+            total_bytes_written += copied;
+            if (static_cast<size_t>(copied) != run_bytes) {
+                result = -EIO;
+                break;
+            }
+            continue;
+        }
+
+        // 当前块不能直接覆盖：取出这一块的数据，交给常规写入路径
+        size_t bytes_in_this_block = std::min<size_t>(context->block_size - offset_in_block, size - total_bytes_written);
+        staging_buffer.resize(bytes_in_this_block);
+        struct fuse_bufvec memory_buf = single_fuse_bufvec(bytes_in_this_block);
+        memory_buf.buf[0].mem = staging_buffer.data();
+        ssize_t copied = fuse_buf_copy(&memory_buf, buf, static_cast<enum fuse_buf_copy_flags>(0));
+        if (copied < 0 || static_cast<size_t>(copied) != bytes_in_this_block) {
+            result = copied < 0 ? static_cast<int>(copied) : -EIO;
+            break;
+        }
+        int written = write_inode_data(*context, inode_num, inode_data, staging_buffer.data(), bytes_in_this_block,
+                                       current_offset_in_file);
+        if (written < 0) {
+            result = written;
+            break;
+        }
+        total_bytes_written += written;
+    }
+    if (total_bytes_written == 0 && result != 0) return result;
+
+    if (offset + total_bytes_written > inode_data.i_size) {
+        inode_data.i_size = offset + total_bytes_written;
+    }
+    touch_inode_times(&inode_data, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
     if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) {
         if (total_bytes_written == 0 && size > 0) return -EIO;
     }
     sync_fs_metadata(*context);
+    delalloc_writeback_if_over_limit(*context);
     return total_bytes_written;
 }
 
+// 将文件某个块内 [offset_in_block, offset_in_block + length) 清零
+// 延迟分配块直接修改缓存；空洞和未写入块本来就读为零，无需处理
+static int zero_partial_block(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t inode_num,
+                              uint32_t logical_block_idx, uint32_t offset_in_block, uint32_t length) {
+    std::vector<uint8_t> block_buffer(context.block_size);
+    if (delalloc_read_block(inode_num, logical_block_idx, block_buffer.data())) {
+        std::vector<uint8_t> zeros(length, 0);
+        return delalloc_write_block(context, inode_num, logical_block_idx, offset_in_block, zeros.data(), length);
+    }
+    if (inode_is_compressed(inode)) {
+        // 压缩簇不能就地修改，清零后的块进入缓存，回写时重新压缩
+        int res = compress_read_block(context, inode_num, inode, logical_block_idx, block_buffer.data());
+        if (res != 0) return res;
+        std::memset(block_buffer.data() + offset_in_block, 0, length);
+        return delalloc_write_block(context, inode_num, logical_block_idx, 0, block_buffer.data(), context.block_size);
+    }
+    bool block_unwritten = false;
+    uint32_t physical_block_num = map_logical_to_physical_block(context, inode, logical_block_idx, &block_unwritten);
+    if (physical_block_num == 0 || block_unwritten) {
+        return 0;
+    }
+    if (read_block(context.device_fd, physical_block_num, block_buffer.data()) != 0) {
+        return -EIO;
+    }
+    std::memset(block_buffer.data() + offset_in_block, 0, length);
+    if (logical_block_is_shared(context, inode, logical_block_idx)) {
+        // 共享块不能就地清零，清零后的块进入缓存，回写时写入新块
+        return delalloc_write_block(context, inode_num, logical_block_idx, 0, block_buffer.data(), context.block_size);
+    }
+    if (write_block(context.device_fd, physical_block_num, block_buffer.data()) != 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+// 将文件区间 [offset, range_end) 清零：首尾不完整的块就地清零，完整块丢弃缓存数据，
+// release_blocks为true时同时释放完整块（打洞）
+static int clear_file_range(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode& inode_data,
+                            uint64_t offset, uint64_t range_end, bool release_blocks) {
+    if (offset >= range_end) return 0;
+    if (inode_has_inline_data(&inode_data)) {
+        uint32_t inline_capacity = inode_inline_capacity(context);
+        if (offset < inline_capacity) {
+            std::memset(inode_inline_data(&inode_data) + offset, 0,
+                        std::min<uint64_t>(range_end, inline_capacity) - offset);
+        }
+        return 0;
+    }
+    uint32_t first_lbn = offset / context.block_size;
+    uint32_t last_lbn = (range_end - 1) / context.block_size;
+    uint32_t first_full_lbn = (offset + context.block_size - 1) / context.block_size;
+    uint32_t end_full_lbn = range_end / context.block_size;
+    uint32_t head_offset = offset % context.block_size;
+    uint32_t tail_length = range_end % context.block_size;
+    int res = 0;
+
+    if (first_lbn == last_lbn && (head_offset != 0 || tail_length != 0)) {
+        res = zero_partial_block(context, &inode_data, inode_num, first_lbn, head_offset, range_end - offset);
+    } else {
+        if (head_offset != 0) {
+            res = zero_partial_block(context, &inode_data, inode_num, first_lbn, head_offset, context.block_size - head_offset);
+        }
+        if (res == 0 && tail_length != 0) {
+            res = zero_partial_block(context, &inode_data, inode_num, last_lbn, 0, tail_length);
+        }
+    }
+    if (first_full_lbn < end_full_lbn) {
+        delalloc_discard_range(context, inode_num, first_full_lbn, end_full_lbn);
+        if (release_blocks && inode_is_compressed(&inode_data)) {
+            int release_res = compress_release_range(context, inode_num, &inode_data, first_full_lbn, end_full_lbn);
+            if (res == 0) res = release_res;
+        } else if (release_blocks) {
+            release_logical_block_range(context, &inode_data, first_full_lbn, end_full_lbn);
+        }
+    }
+    return res;
+}
+
 // 更改文件大小
 int simplefs_truncate(const char *path, off_t size) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
     errno = 0;
     uint32_t inode_num = path_to_inode_num(path); // 跟随符号链接
     if (inode_num == 0) return -errno;
@@ -1258,29 +2100,51 @@ int simplefs_truncate(const char *path, off_t size) {
     if (access_res != 0) return access_res;
 
     if (inode_data.i_size == (uint32_t)size) {
-        inode_data.i_ctime = time(nullptr);
+        touch_inode_times(&inode_data, SIMPLEFS_TIME_CTIME);
         if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) return -errno;
         return 0;
     }
+    if (inode_has_inline_data(&inode_data)) {
+        if (size <= (off_t)inode_inline_capacity(*context)) {
+            // 仍可内联：截断部分清零，保证之后扩展时读到零
+            if ((uint32_t)size < inode_data.i_size) {
+                std::memset(inode_inline_data(&inode_data) + size, 0, inode_data.i_size - size);
+            }
+            inode_data.i_size = size;
+            touch_inode_times(&inode_data, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
+            if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) return -errno;
+            return 0;
+        }
+        int promote_res = promote_inline_data(*context, inode_num, inode_data);
+        if (promote_res != 0) return promote_res;
+    }
     uint32_t old_size = inode_data.i_size;
     inode_data.i_size = size;
+    if ((uint32_t)size < old_size) {
+        delalloc_discard_range(*context, inode_num, (size + context->block_size - 1) / context->block_size, UINT32_MAX);
+    }
     if (size == 0) {
         free_all_inode_blocks(*context, &inode_data);
+        compress_cache_drop_inode(inode_num);
     } else if (size < old_size) {
-        uint32_t old_num_fs_blocks = (old_size + SIMPLEFS_BLOCK_SIZE - 1) / SIMPLEFS_BLOCK_SIZE;
-        if (inode_data.i_size == (uint32_t)size) {
-        return 0;
-    }
-    uint32_t old_size = inode_data.i_size;
-    inode_data.i_size = size;
-        uint32_t new_num_fs_blocks = (size + SIMPLEFS_BLOCK_SIZE - 1) / SIMPLEFS_BLOCK_SIZE;
-        if (size == 0) new_num_fs_blocks = 0;
-        if (new_num_fs_blocks < old_num_fs_blocks) {
-            release_logical_block_range(*context, &inode_data, new_num_fs_blocks, old_num_fs_blocks);
+        // 释放新大小之后的所有块（含间接块），空洞中的块不会重复计数
+        uint32_t new_num_fs_blocks = (size + context->block_size - 1) / context->block_size;
+        if (inode_is_compressed(&inode_data)) {
+            // 新的文件末尾落在压缩簇中间时，保留的部分先进入缓存
+            int release_res = compress_release_range(*context, inode_num, &inode_data, new_num_fs_blocks, UINT32_MAX);
+            if (release_res != 0) return release_res;
+        } else {
+            release_logical_block_range(*context, &inode_data, new_num_fs_blocks, UINT32_MAX);
+        }
+
+        // 清零最后一个不完整块的尾部，避免之后扩展时读到旧数据
+        uint32_t tail_offset = size % context->block_size;
+        if (tail_offset != 0) {
+            zero_partial_block(*context, &inode_data, inode_num, size / context->block_size,
+                               tail_offset, context->block_size - tail_offset);
         }
     }
-    inode_data.i_mtime = time(nullptr);
-    inode_data.i_ctime = time(nullptr);
+    touch_inode_times(&inode_data, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
     if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) return -errno;
     if (size < old_size || size == 0) {
         sync_fs_metadata(*context);
@@ -1292,6 +2156,8 @@ int simplefs_truncate(const char *path, off_t size) {
 int simplefs_chmod(const char *path, mode_t mode) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
     errno = 0;
     uint32_t inode_num = path_to_inode_num(path); // 跟随符号链接
     if (inode_num == 0) return -errno;
@@ -1302,7 +2168,7 @@ int simplefs_chmod(const char *path, mode_t mode) {
          return -EPERM;
     }
     inode_data.i_mode = (inode_data.i_mode & S_IFMT) | (mode & 07777);
-    inode_data.i_ctime = time(nullptr);
+    touch_inode_times(&inode_data, SIMPLEFS_TIME_CTIME);
     if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) return -errno;
     return 0;
 }
@@ -1311,6 +2177,8 @@ int simplefs_chmod(const char *path, mode_t mode) {
 int simplefs_chown(const char *path, uid_t uid, gid_t gid) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
     errno = 0;
     uint32_t inode_num = resolve_path_recursive(path, 0, false); // 如果是链接则操作链接本身
     if (inode_num == 0) return -errno;
@@ -1360,7 +2228,7 @@ int simplefs_chown(const char *path, uid_t uid, gid_t gid) {
         if (caller_context->uid != 0) {
             inode_data.i_mode &= ~(S_ISUID | S_ISGID);
         }
-        inode_data.i_ctime = time(nullptr);
+        touch_inode_times(&inode_data, SIMPLEFS_TIME_CTIME);
         if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) return -errno;
     }
     return 0;
@@ -1370,6 +2238,8 @@ int simplefs_chown(const char *path, uid_t uid, gid_t gid) {
 int simplefs_symlink(const char *target, const char *linkpath) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, linkpath)) return -EROFS;
     std::string linkpath_str(linkpath);
     std::string target_str(target);
     std::string dirname_str, basename_str;
@@ -1393,7 +2263,7 @@ int simplefs_symlink(const char *target, const char *linkpath) {
     if (existing_inode_check != 0) return -EEXIST;
     if (errno != 0 && errno != ENOENT) return -errno;
 
-    uint32_t symlink_inode_num = alloc_inode(*context, S_IFLNK | 0777);
+    uint32_t symlink_inode_num = alloc_inode(*context, S_IFLNK | 0777, parent_inode_num);
     if (symlink_inode_num == 0) return -errno;
 
     SimpleFS_Inode symlink_inode;
@@ -1403,7 +2273,7 @@ int simplefs_symlink(const char *target, const char *linkpath) {
     symlink_inode.i_gid = fuse_get_context()->gid;
     symlink_inode.i_links_count = 1;
     symlink_inode.i_size = target_str.length();
-    symlink_inode.i_atime = symlink_inode.i_mtime = symlink_inode.i_ctime = time(nullptr);
+    touch_inode_times(&symlink_inode, SIMPLEFS_TIME_ALL);
 
     // 快速符号链接优化
     if (target_str.length() < sizeof(symlink_inode.i_block)) {
@@ -1413,21 +2283,21 @@ int simplefs_symlink(const char *target, const char *linkpath) {
         std::cout << "[符号链接] 创建快速符号链接: " << target_str << std::endl;
     } else {
         // 路径太长，使用数据块（慢速符号链接）
-        if (target_str.length() >= SIMPLEFS_BLOCK_SIZE) {
+        if (target_str.length() >= context->block_size) {
             free_inode(*context, symlink_inode_num, symlink_inode.i_mode); return -ENAMETOOLONG;
         }
         uint32_t data_block_num = alloc_block(*context, (symlink_inode_num - 1) / context->sb.s_inodes_per_group);
         if (data_block_num == 0) {
             free_inode(*context, symlink_inode_num, symlink_inode.i_mode); return -errno;
         }
-        std::vector<char> block_buffer_vec(SIMPLEFS_BLOCK_SIZE, 0);
+        std::vector<char> block_buffer_vec(context->block_size, 0);
         std::memcpy(block_buffer_vec.data(), target_str.c_str(), target_str.length());
         if (write_block(context->device_fd, data_block_num, block_buffer_vec.data()) != 0) {
             free_block(*context, data_block_num);
             free_inode(*context, symlink_inode_num, symlink_inode.i_mode); return -EIO;
         }
         symlink_inode.i_block[0] = data_block_num;
-        symlink_inode.i_blocks = SIMPLEFS_BLOCK_SIZE / 512;
+        symlink_inode.i_blocks = context->block_size / 512;
     }
 
     if (write_inode_to_disk(*context, symlink_inode_num, &symlink_inode) != 0) {
@@ -1456,8 +2326,12 @@ int simplefs_symlink(const char *target, const char *linkpath) {
 int simplefs_readlink(const char *path, char *buf, size_t size) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    SnapshotPathView view(*context, path);
+    if (view.error != 0) return view.error;
+    if (view.snapshot_dir) return -EINVAL;
     errno = 0;
-    uint32_t inode_num = resolve_path_recursive(path, 0, false);
+    uint32_t inode_num = resolve_path_recursive(view.path(), 0, false);
     if (inode_num == 0) return -errno;
     SimpleFS_Inode inode_data;
     if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
@@ -1478,7 +2352,7 @@ int simplefs_readlink(const char *path, char *buf, size_t size) {
         // 慢速符号链接：目标路径在数据块中
         if (inode_data.i_block[0] == 0) return -EIO;
         size_t symlink_target_len = inode_data.i_size;
-        std::vector<char> block_buffer_vec(SIMPLEFS_BLOCK_SIZE);
+        std::vector<char> block_buffer_vec(context->block_size);
         if (read_block(context->device_fd, inode_data.i_block[0], block_buffer_vec.data()) != 0) return -EIO;
         actual_bytes_copied = std::min(size - 1, symlink_target_len); // 为null终止符留空间
         if (actual_bytes_copied > 0) {
@@ -1487,8 +2361,9 @@ int simplefs_readlink(const char *path, char *buf, size_t size) {
     }
     
     buf[actual_bytes_copied] = '\0'; // 总是null终止缓冲区
+    if (view.active) return 0;
 
-    inode_data.i_atime = time(nullptr);
+    touch_inode_times(&inode_data, SIMPLEFS_TIME_ATIME);
     if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) {
         std::cerr << "readlink: inode " << inode_num << " atime更新失败" << std::endl;
     }
@@ -1499,6 +2374,8 @@ int simplefs_readlink(const char *path, char *buf, size_t size) {
 int simplefs_link(const char *oldpath, const char *newpath) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, oldpath) || is_snapshot_path(*context, newpath)) return -EROFS;
 
     std::string oldpath_str(oldpath);
     std::string newpath_str(newpath);
@@ -1547,7 +2424,7 @@ int simplefs_link(const char *oldpath, const char *newpath) {
 
     // 6. 增加目标inode的链接数
     target_inode_data.i_links_count++;
-    target_inode_data.i_ctime = time(nullptr);
+    touch_inode_times(&target_inode_data, SIMPLEFS_TIME_CTIME);
     if (write_inode_to_disk(*context, target_inode_num, &target_inode_data) != 0) {
         // 尝试回滚目录条目添加
         remove_dir_entry(*context, &parent_inode_data, parent_inode_num, new_basename_str);
@@ -1562,6 +2439,8 @@ int simplefs_link(const char *oldpath, const char *newpath) {
 int simplefs_utimens(const char *path, const struct timespec tv[2]) {
     SimpleFS_Context* context = get_fs_context();
     if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
     errno = 0;
     uint32_t inode_num = path_to_inode_num(path); // 跟随符号链接进行utimens
     if (inode_num == 0) return -errno;
@@ -1594,10 +2473,9 @@ int simplefs_utimens(const char *path, const struct timespec tv[2]) {
         int access_res = check_access(caller_ctx, &inode_data, W_OK);
         if (access_res != 0) return access_res;
     }
-    time_t current_time = time(nullptr);
+    struct timespec current_time = current_inode_time();
     if (tv == nullptr) {
-        inode_data.i_atime = current_time;
-        inode_data.i_mtime = current_time;
+        set_inode_time(&inode_data, SIMPLEFS_TIME_ATIME | SIMPLEFS_TIME_MTIME, current_time);
     } else {
         #ifndef UTIME_NOW // 如果全局包含中不可用则在本地重新定义
         #define UTIME_NOW   ((1l << 30) - 1l)
@@ -1606,13 +2484,538 @@ int simplefs_utimens(const char *path, const struct timespec tv[2]) {
         #define UTIME_OMIT  ((1l << 30) - 2l)
         #endif
         if (tv[0].tv_nsec != UTIME_OMIT) {
-            inode_data.i_atime = (tv[0].tv_nsec == UTIME_NOW) ? current_time : tv[0].tv_sec;
+            set_inode_time(&inode_data, SIMPLEFS_TIME_ATIME, (tv[0].tv_nsec == UTIME_NOW) ? current_time : tv[0]);
         }
         if (tv[1].tv_nsec != UTIME_OMIT) {
-            inode_data.i_mtime = (tv[1].tv_nsec == UTIME_NOW) ? current_time : tv[1].tv_sec;
+            set_inode_time(&inode_data, SIMPLEFS_TIME_MTIME, (tv[1].tv_nsec == UTIME_NOW) ? current_time : tv[1]);
         }
     }
-    inode_data.i_ctime = current_time;
+    set_inode_time(&inode_data, SIMPLEFS_TIME_CTIME, current_time);
     if (write_inode_to_disk(*context, inode_num, &inode_data) != 0) return -errno;
     return 0;
 }
+
+// 预分配/打洞/清零文件区间
+// 预分配的块在块指针中带未写入标志，读取返回零，首次写入时清除，无需预先填零
+int simplefs_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi) {
+    (void)fi;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+    if (is_snapshot_path(*context, path)) return -EROFS;
+
+    const int supported_modes = FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE;
+    if (mode & ~supported_modes) return -EOPNOTSUPP;
+    bool punch_hole = (mode & FALLOC_FL_PUNCH_HOLE) != 0;
+    bool zero_range = (mode & FALLOC_FL_ZERO_RANGE) != 0;
+    bool keep_size = (mode & FALLOC_FL_KEEP_SIZE) != 0;
+    if (punch_hole && (!keep_size || zero_range)) return -EOPNOTSUPP;
+    if (offset < 0 || length <= 0) return -EINVAL;
+    uint64_t range_end = static_cast<uint64_t>(offset) + length;
+    if (range_end > UINT32_MAX) return -EFBIG;
+
+    errno = 0;
+    uint32_t inode_num = path_to_inode_num(path);
+    if (inode_num == 0) return -errno;
+    SimpleFS_Inode inode_data;
+    if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
+    if (S_ISDIR(inode_data.i_mode)) return -EISDIR;
+    if (!S_ISREG(inode_data.i_mode)) return -ENODEV;
+    int access_res = check_access(fuse_get_context(), &inode_data, W_OK);
+    if (access_res != 0) return access_res;
+    // 压缩文件的块在回写时按压缩结果分配，无法预分配，也没有未写入块可用于清零
+    if (inode_is_compressed(&inode_data) && !punch_hole) return -EOPNOTSUPP;
+    if (inode_has_inline_data(&inode_data) && !punch_hole) {
+        // 预分配需要数据块，先转为块存储；打洞只清零内联数据
+        int promote_res = promote_inline_data(*context, inode_num, inode_data);
+        if (promote_res != 0) return promote_res;
+    }
+
+    uint32_t first_lbn = offset / context->block_size;
+    uint32_t last_lbn = (range_end - 1) / context->block_size;
+    uint32_t first_full_lbn = (offset + context->block_size - 1) / context->block_size;
+    uint32_t end_full_lbn = range_end / context->block_size; // 完整块区间 [first_full_lbn, end_full_lbn)
+    int res = 0;
+
+    if (punch_hole || zero_range) {
+        res = clear_file_range(*context, inode_num, inode_data, offset, range_end, punch_hole);
+    }
+
+    if (!punch_hole && res == 0) {
+        // 需要分配的块收集为逻辑连续的段，每段用一次alloc_blocks分配
+        auto needs_allocation = [&](uint32_t lbn) {
+            if (delalloc_read_block(inode_num, lbn, nullptr)) return false; // 已有缓存数据，回写时分配
+            bool mapped = map_logical_to_physical_block(*context, &inode_data, lbn) != 0;
+            errno = 0;
+            return !mapped;
+        };
+        uint32_t lbn = first_lbn;
+        while (lbn <= last_lbn) {
+            if (delalloc_read_block(inode_num, lbn, nullptr)) {
+                lbn++;
+                continue;
+            }
+            bool block_unwritten = false;
+            uint32_t physical_block_num = map_logical_to_physical_block(*context, &inode_data, lbn, &block_unwritten);
+            if (physical_block_num != 0) {
+                // 清零区间内的完整块只需转为未写入，不产生数据I/O
+                bool full_block = (lbn >= first_full_lbn && lbn < end_full_lbn);
+                if (zero_range && full_block && !block_unwritten &&
+                    set_logical_block_ptr(*context, &inode_data, lbn, physical_block_num | SIMPLEFS_BLOCK_UNWRITTEN) != 0) {
+                    res = -EIO;
+                    break;
+                }
+                lbn++;
+                continue;
+            }
+
+            uint32_t run_end = lbn + 1;
+            while (run_end <= last_lbn && run_end - lbn < context->sb.s_blocks_per_group && needs_allocation(run_end)) {
+                run_end++;
+            }
+            uint32_t goal_block = find_goal_block_for_inode(*context, &inode_data, inode_num, lbn);
+            uint32_t got = 0;
+            errno = 0;
+            uint32_t start_block = alloc_blocks(*context, goal_block, 1, run_end - lbn, &got, inode_num);
+            if (start_block == 0) {
+                res = errno ? -errno : -ENOSPC;
+                break;
+            }
+            for (uint32_t i = 0; i < got; ++i) {
+                errno = 0;
+                if (allocate_block_for_write(*context, &inode_data, inode_num, lbn + i, nullptr,
+                                             SIMPLEFS_BLOCK_UNWRITTEN, start_block + i) == 0) {
+                    std::vector<uint32_t> unused_blocks;
+                    for (uint32_t j = i; j < got; ++j) unused_blocks.push_back(start_block + j);
+                    free_blocks(*context, unused_blocks);
+                    res = errno ? -errno : -ENOSPC;
+                    break;
+                }
+            }
+            if (res != 0) break;
+            lbn += got;
+        }
+        if (res == 0 && !keep_size && range_end > inode_data.i_size) {
+            inode_data.i_size = static_cast<uint32_t>(range_end);
+        }
+    }
+
+    unsigned changed_times = SIMPLEFS_TIME_CTIME;
+    if (punch_hole || zero_range || !keep_size) {
+        changed_times |= SIMPLEFS_TIME_MTIME;
+    }
+    touch_inode_times(&inode_data, changed_times);
+    if (write_inode_to_disk(*context, inode_num, &inode_data) != 0 && res == 0) res = -EIO;
+    sync_fs_metadata(*context);
+    return res;
+}
+
+// SEEK_DATA/SEEK_HOLE：只遍历间接块映射和延迟分配缓存，不读取数据块
+static int seek_data_or_hole(SimpleFS_Context& context, uint32_t inode_num, const SimpleFS_Inode& inode_data,
+                             SimpleFS_SeekArgs* args) {
+    if (args->whence != SEEK_DATA && args->whence != SEEK_HOLE) return -EINVAL;
+    uint64_t offset = args->offset;
+    if (offset >= inode_data.i_size) return -ENXIO;
+
+    uint32_t start_lbn = offset / context.block_size;
+    uint32_t end_lbn = (inode_data.i_size + context.block_size - 1) / context.block_size;
+    uint32_t lbn;
+    if (args->whence == SEEK_DATA) {
+        lbn = find_data_or_hole_lbn(context, &inode_data, start_lbn, end_lbn, true);
+        lbn = std::min(lbn, delalloc_next_dirty_block(inode_num, start_lbn));
+        if (lbn >= end_lbn) return -ENXIO;
+    } else {
+        // 磁盘上的空洞可能已有缓存数据，跳过缓存块继续查找；文件末尾视为空洞
+        lbn = start_lbn;
+        while (lbn < end_lbn) {
+            lbn = find_data_or_hole_lbn(context, &inode_data, lbn, end_lbn, false);
+            if (lbn >= end_lbn) break;
+            uint32_t dirty_run_end = delalloc_dirty_run_end(inode_num, lbn);
+            if (dirty_run_end == lbn) break;
+            lbn = dirty_run_end;
+        }
+    }
+    uint64_t result = std::max<uint64_t>(offset, static_cast<uint64_t>(lbn) * context.block_size);
+    args->offset = std::min<uint64_t>(result, inode_data.i_size);
+    return 0;
+}
+
+// 复制源文件中一段有数据的区间 [src_start, src_end)
+// 源和目标块内偏移一致时，完整块在设备内按连续物理块批量复制；其余部分经缓冲区读写
+static int copy_data_segment(SimpleFS_Context& context, uint32_t src_inode_num, const SimpleFS_Inode& src_inode,
+                             uint32_t dst_inode_num, SimpleFS_Inode& dst_inode,
+                             uint64_t src_start, uint64_t src_end, uint64_t dst_start) {
+    constexpr size_t COPY_BOUNCE_BYTES = 1 << 20;
+    std::vector<char> bounce_buffer;
+    auto copy_via_buffer = [&](uint64_t from, uint64_t to, uint64_t dst_pos) -> int {
+        bounce_buffer.resize(std::min<uint64_t>(COPY_BOUNCE_BYTES, to - from));
+        while (from < to) {
+            size_t chunk = std::min<uint64_t>(bounce_buffer.size(), to - from);
+            int bytes_read = read_inode_data(context, src_inode_num, src_inode, bounce_buffer.data(), chunk, from);
+            if (bytes_read <= 0) return bytes_read < 0 ? bytes_read : -EIO;
+            int bytes_written = write_inode_data(context, dst_inode_num, dst_inode, bounce_buffer.data(), bytes_read, dst_pos);
+            if (bytes_written != bytes_read) return bytes_written < 0 ? bytes_written : -EIO;
+            from += bytes_read;
+            dst_pos += bytes_read;
+        }
+        return 0;
+    };
+
+    // 压缩文件的块不能在设备内直接复制
+    if (src_start % context.block_size != dst_start % context.block_size ||
+        inode_is_compressed(&src_inode) || inode_is_compressed(&dst_inode)) {
+        return copy_via_buffer(src_start, src_end, dst_start);
+    }
+
+    uint64_t full_start = (src_start + context.block_size - 1) / context.block_size * context.block_size;
+    uint64_t full_end = src_end / context.block_size * context.block_size;
+    if (full_start >= full_end) {
+        return copy_via_buffer(src_start, src_end, dst_start);
+    }
+    int res = copy_via_buffer(src_start, full_start, dst_start);
+    if (res != 0) return res;
+
+    uint32_t first_src_lbn = full_start / context.block_size;
+    uint32_t end_src_lbn = full_end / context.block_size;
+    uint32_t first_dst_lbn = (dst_start + (full_start - src_start)) / context.block_size;
+
+    uint32_t run_src = 0, run_dst = 0, run_len = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> unwritten_to_clear; // 整段复制完成后清除未写入标志
+    // ordered和sync模式下新分配的目标块先映射为未写入，全部连续段复制完成后经过一次刷新屏障再清除标志
+    const bool ordered_copy = (context.durability_mode != SIMPLEFS_DURABILITY_WRITEBACK);
+    auto flush_run = [&]() -> int {
+        if (run_len > 0 && copy_blocks(context.device_fd, run_src, run_dst, run_len) != 0) return -EIO;
+        run_len = 0;
+        return 0;
+    };
+
+    for (uint32_t src_lbn = first_src_lbn; src_lbn < end_src_lbn; ++src_lbn) {
+        uint32_t dst_lbn = first_dst_lbn + (src_lbn - first_src_lbn);
+        uint32_t src_block = map_logical_to_physical_block(context, &src_inode, src_lbn);
+        if (src_block == 0) return -EIO;
+
+        delalloc_discard_range(context, dst_inode_num, dst_lbn, dst_lbn + 1);
+        bool dst_unwritten = false;
+        uint32_t dst_block = map_logical_to_physical_block(context, &dst_inode, dst_lbn, &dst_unwritten);
+        if (dst_block != 0 && logical_block_is_shared(context, &dst_inode, dst_lbn)) {
+            // 目标块与其他文件共享，不能就地覆盖：解除映射后按空洞重新分配
+            release_logical_block_range(context, &dst_inode, dst_lbn, dst_lbn + 1);
+            dst_block = 0;
+        }
+        if (dst_block == 0) {
+            errno = 0;
+            dst_block = allocate_block_for_write(context, &dst_inode, dst_inode_num, dst_lbn, nullptr,
+                                                 ordered_copy ? SIMPLEFS_BLOCK_UNWRITTEN : 0);
+            if (dst_block == 0) return errno ? -errno : -ENOSPC;
+            dst_unwritten = ordered_copy;
+        }
+
+        if (run_len > 0 && (src_block != run_src + run_len || dst_block != run_dst + run_len)) {
+            res = flush_run();
+            if (res != 0) return res;
+        }
+        if (run_len == 0) {
+            run_src = src_block;
+            run_dst = dst_block;
+        }
+        run_len++;
+        if (dst_unwritten) unwritten_to_clear.emplace_back(dst_lbn, dst_block);
+    }
+    res = flush_run();
+    if (res != 0) return res;
+    if (ordered_copy && !unwritten_to_clear.empty()) {
+        int barrier_res = group_commit_flush(context.device_fd);
+        if (barrier_res != 0) return barrier_res;
+    }
+    for (const auto& entry : unwritten_to_clear) {
+        if (set_logical_block_ptr(context, &dst_inode, entry.first, entry.second) != 0) return -EIO;
+    }
+
+    return copy_via_buffer(full_end, src_end, dst_start + (full_end - src_start));
+}
+
+// 文件系统内区间复制：源文件的空洞在目标中保持为空洞，数据块在设备内复制，不经过内核往返
+static int copy_file_range_internal(SimpleFS_Context& context, uint32_t dst_inode_num, SimpleFS_CopyRangeArgs* args) {
+    args->src_path[SIMPLEFS_IOC_PATH_MAX - 1] = '\0';
+    errno = 0;
+    uint32_t src_inode_num = path_to_inode_num(args->src_path);
+    if (src_inode_num == 0) return -errno;
+
+    // 源文件的缓存数据先落盘，之后只需处理块映射
+    int res = delalloc_writeback_inode(context, src_inode_num);
+    if (res != 0) return res;
+
+    SimpleFS_Inode src_inode, dst_inode;
+    if (read_inode_from_disk(context, src_inode_num, &src_inode) != 0) return -errno;
+    if (read_inode_from_disk(context, dst_inode_num, &dst_inode) != 0) return -errno;
+    if (S_ISDIR(src_inode.i_mode) || S_ISDIR(dst_inode.i_mode)) return -EISDIR;
+    if (!S_ISREG(src_inode.i_mode) || !S_ISREG(dst_inode.i_mode)) return -EINVAL;
+    int access_res = check_access(fuse_get_context(), &src_inode, R_OK);
+    if (access_res != 0) return access_res;
+    access_res = check_access(fuse_get_context(), &dst_inode, W_OK);
+    if (access_res != 0) return access_res;
+
+    args->bytes_copied = 0;
+    if (args->src_offset >= src_inode.i_size) return 0;
+    uint64_t length = std::min<uint64_t>(args->length, src_inode.i_size - args->src_offset);
+    if (length == 0) return 0;
+    if (args->dst_offset + length > UINT32_MAX) return -EFBIG;
+    if (src_inode_num == dst_inode_num &&
+        args->src_offset < args->dst_offset + length && args->dst_offset < args->src_offset + length) {
+        return -EINVAL; // 同一文件的重叠区间
+    }
+    if (inode_has_inline_data(&dst_inode) && args->dst_offset + length > inode_inline_capacity(context)) {
+        res = promote_inline_data(context, dst_inode_num, dst_inode);
+        if (res != 0) return res;
+    }
+
+    uint64_t src_end = args->src_offset + length;
+    uint32_t end_lbn = (src_end + context.block_size - 1) / context.block_size;
+    uint64_t pos = args->src_offset;
+    while (pos < src_end && res == 0) {
+        uint64_t dst_pos = args->dst_offset + (pos - args->src_offset);
+        uint32_t data_lbn = find_data_or_hole_lbn(context, &src_inode, pos / context.block_size, end_lbn, true);
+        uint64_t data_start = std::min<uint64_t>(src_end, std::max<uint64_t>(pos, static_cast<uint64_t>(data_lbn) * context.block_size));
+        if (data_start > pos) {
+            // 源中的空洞：目标对应区间打洞
+            res = clear_file_range(context, dst_inode_num, dst_inode, dst_pos, dst_pos + (data_start - pos), true);
+            if (res != 0) break;
+        }
+        if (data_start >= src_end) break;
+
+        uint32_t hole_lbn = find_data_or_hole_lbn(context, &src_inode, data_start / context.block_size, end_lbn, false);
+        uint64_t data_end = std::min<uint64_t>(src_end, static_cast<uint64_t>(hole_lbn) * context.block_size);
+        res = copy_data_segment(context, src_inode_num, src_inode, dst_inode_num, dst_inode,
+                                data_start, data_end, args->dst_offset + (data_start - args->src_offset));
+        pos = data_end;
+    }
+
+    if (res == 0) {
+        args->bytes_copied = length;
+        if (args->dst_offset + length > dst_inode.i_size) {
+            dst_inode.i_size = static_cast<uint32_t>(args->dst_offset + length);
+        }
+    }
+    touch_inode_times(&dst_inode, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
+    if (write_inode_to_disk(context, dst_inode_num, &dst_inode) != 0 && res == 0) res = -EIO;
+    sync_fs_metadata(context);
+    return res;
+}
+
+// reflink克隆：目标区间与源区间共享数据块，只修改块映射和引用计数，不复制数据
+// 整个文件克隆到不比源文件长的目标时直接共享顶层块指针（含间接块），与文件大小无关
+// 偏移须按块对齐；长度不是块的整数倍时只能延伸到源文件末尾，且须覆盖目标文件的剩余部分
+static int clone_file_range_internal(SimpleFS_Context& context, uint32_t dst_inode_num, SimpleFS_CopyRangeArgs* args) {
+    if (!has_reflink(context.sb)) return -EOPNOTSUPP;
+    args->src_path[SIMPLEFS_IOC_PATH_MAX - 1] = '\0';
+    errno = 0;
+    uint32_t src_inode_num = path_to_inode_num(args->src_path);
+    if (src_inode_num == 0) return -errno;
+
+    // 两个文件的缓存数据先落盘，之后只需处理块映射
+    int res = delalloc_writeback_inode(context, src_inode_num);
+    if (res == 0) res = delalloc_writeback_inode(context, dst_inode_num);
+    if (res != 0) return res;
+
+    SimpleFS_Inode src_inode, dst_inode;
+    if (read_inode_from_disk(context, src_inode_num, &src_inode) != 0) return -errno;
+    if (read_inode_from_disk(context, dst_inode_num, &dst_inode) != 0) return -errno;
+    if (S_ISDIR(src_inode.i_mode) || S_ISDIR(dst_inode.i_mode)) return -EISDIR;
+    if (!S_ISREG(src_inode.i_mode) || !S_ISREG(dst_inode.i_mode)) return -EINVAL;
+    int access_res = check_access(fuse_get_context(), &src_inode, R_OK);
+    if (access_res != 0) return access_res;
+    access_res = check_access(fuse_get_context(), &dst_inode, W_OK);
+    if (access_res != 0) return access_res;
+    // 压缩簇的块指针不能按逻辑块共享
+    if (inode_is_compressed(&src_inode) || inode_is_compressed(&dst_inode)) return -EOPNOTSUPP;
+
+    args->bytes_copied = 0;
+    if (args->src_offset >= src_inode.i_size) return 0;
+    uint64_t length = std::min<uint64_t>(args->length, src_inode.i_size - args->src_offset);
+    uint64_t src_end = args->src_offset + length;
+    if (args->dst_offset + length > UINT32_MAX) return -EFBIG;
+    if (args->src_offset % context.block_size != 0 || args->dst_offset % context.block_size != 0) return -EINVAL;
+    if (length % context.block_size != 0 && (src_end != src_inode.i_size || args->dst_offset + length < dst_inode.i_size)) {
+        return -EINVAL;
+    }
+    if (src_inode_num == dst_inode_num &&
+        args->src_offset < args->dst_offset + length && args->dst_offset < args->src_offset + length) {
+        return -EINVAL; // 同一文件的重叠区间
+    }
+    // 内联数据没有块可共享，按普通复制处理
+    if (inode_has_inline_data(&src_inode)) {
+        return copy_file_range_internal(context, dst_inode_num, args);
+    }
+    if (inode_has_inline_data(&dst_inode)) {
+        res = promote_inline_data(context, dst_inode_num, dst_inode);
+        if (res == 0 && write_inode_to_disk(context, dst_inode_num, &dst_inode) != 0) res = -EIO;
+        if (res == 0) res = delalloc_writeback_inode(context, dst_inode_num);
+        if (res == 0 && read_inode_from_disk(context, dst_inode_num, &dst_inode) != 0) res = -errno;
+        if (res != 0) return res;
+    }
+
+    if (args->src_offset == 0 && args->dst_offset == 0 && src_end == src_inode.i_size && dst_inode.i_size <= src_inode.i_size) {
+        // 整个文件：顶层块指针各增加一次引用，其下的块经由共享的间接块隐式共享
+        std::vector<uint32_t> top_level_blocks;
+        for (uint32_t i = 0; i < SIMPLEFS_INODE_BLOCK_PTRS; ++i) {
+            if (src_inode.i_block[i] != 0) top_level_blocks.push_back(src_inode.i_block[i]);
+        }
+        res = block_refs_get(context, top_level_blocks);
+        if (res != 0) return res;
+        free_all_inode_blocks(context, &dst_inode);
+        std::memcpy(dst_inode.i_block, src_inode.i_block, sizeof(uint32_t) * SIMPLEFS_INODE_BLOCK_PTRS);
+        dst_inode.i_blocks = src_inode.i_blocks;
+        dst_inode.i_size = src_inode.i_size;
+    } else {
+        uint32_t first_src_lbn = args->src_offset / context.block_size;
+        uint32_t first_dst_lbn = args->dst_offset / context.block_size;
+        uint32_t block_count = (length + context.block_size - 1) / context.block_size;
+        // 目标区间原有的块先释放，源中的空洞和未写入块在目标中保持为空洞
+        release_logical_block_range(context, &dst_inode, first_dst_lbn, first_dst_lbn + block_count);
+        std::vector<std::pair<uint32_t, uint32_t>> shared_blocks; // (目标逻辑块号, 物理块号)
+        std::vector<uint32_t> block_nums;
+        for (uint32_t i = 0; i < block_count; ++i) {
+            bool block_unwritten = false;
+            uint32_t physical_block_num = map_logical_to_physical_block(context, &src_inode, first_src_lbn + i, &block_unwritten);
+            errno = 0;
+            if (physical_block_num == 0 || block_unwritten) continue;
+            shared_blocks.emplace_back(first_dst_lbn + i, physical_block_num);
+            block_nums.push_back(physical_block_num);
+        }
+        res = block_refs_get(context, block_nums);
+        if (res != 0) return res;
+        for (size_t i = 0; i < shared_blocks.size(); ++i) {
+            errno = 0;
+            uint32_t installed = allocate_block_for_write(context, &dst_inode, dst_inode_num, shared_blocks[i].first,
+                                                          nullptr, 0, shared_blocks[i].second);
+            if (installed != shared_blocks[i].second) {
+                // 未能安装的块退回增加的引用
+                if (res == 0) res = errno ? -errno : -EIO;
+                std::vector<uint32_t> unused_refs;
+                for (size_t j = (installed == 0) ? i : i + 1; j < shared_blocks.size(); ++j) {
+                    unused_refs.push_back(shared_blocks[j].second);
+                }
+                if (installed != 0) unused_refs.push_back(shared_blocks[i].second);
+                free_blocks(context, unused_refs);
+                break;
+            }
+        }
+        if (res == 0 && args->dst_offset + length > dst_inode.i_size) {
+            dst_inode.i_size = static_cast<uint32_t>(args->dst_offset + length);
+        }
+    }
+
+    if (res == 0) args->bytes_copied = length;
+    touch_inode_times(&dst_inode, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
+    if (write_inode_to_disk(context, dst_inode_num, &dst_inode) != 0 && res == 0) res = -EIO;
+    sync_fs_metadata(context);
+    return res;
+}
+
+// 设置或清除压缩标志，只有所有者和root可以修改
+static int set_compress_flag(SimpleFS_Context& context, uint32_t inode_num, bool enable) {
+    if (enable && context.compress_cluster_blocks == 0) return -EOPNOTSUPP;
+    SimpleFS_Inode inode_data;
+    if (read_inode_from_disk(context, inode_num, &inode_data) != 0) return -errno;
+    if (!S_ISREG(inode_data.i_mode) && !S_ISDIR(inode_data.i_mode)) return -EINVAL;
+    struct fuse_context *caller_context = fuse_get_context();
+    if (caller_context->uid != 0 && caller_context->uid != inode_data.i_uid) return -EPERM;
+    if (inode_is_compressed(&inode_data) == enable) return 0;
+    // 普通文件的存放格式只能在没有数据时改变
+    if (S_ISREG(inode_data.i_mode) &&
+        (inode_data.i_size != 0 || delalloc_next_dirty_block(inode_num, 0) != UINT32_MAX)) {
+        return -EINVAL;
+    }
+    if (enable) {
+        inode_data.i_flags |= SIMPLEFS_INODE_FL_COMPRESS;
+    } else {
+        inode_data.i_flags &= ~SIMPLEFS_INODE_FL_COMPRESS;
+    }
+    touch_inode_times(&inode_data, SIMPLEFS_TIME_CTIME);
+    if (write_inode_to_disk(context, inode_num, &inode_data) != 0) return -EIO;
+    return 0;
+}
+
+// SimpleFS专用ioctl（见simplefs_ioctl.h）
+static int ioctl_dispatch(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data) {
+    (void)arg; (void)fi;
+    SimpleFS_Context* context = get_fs_context();
+    if (!context) return -EACCES;
+    std::unique_lock<std::mutex> fs_lock(context->fs_mutex); // 碎片整理和FITRIM在分片之间临时释放
+    if (flags & FUSE_IOCTL_COMPAT) return -ENOSYS;
+    if (is_snapshot_path(*context, path)) return -EROFS;
+
+    errno = 0;
+    uint32_t inode_num = path_to_inode_num(path);
+    if (inode_num == 0) return -errno;
+
+    switch (static_cast<unsigned int>(cmd)) {
+        case SIMPLEFS_IOC_SNAPSHOT_CREATE:
+        case SIMPLEFS_IOC_SNAPSHOT_DELETE: {
+            // 快照属于整个文件系统，ioctl可作用于其中任意已打开的文件或目录
+            if (fuse_get_context()->uid != 0) return -EPERM;
+            SimpleFS_SnapshotArgs* args = static_cast<SimpleFS_SnapshotArgs*>(data);
+            args->name[sizeof(args->name) - 1] = '\0';
+            if (static_cast<unsigned int>(cmd) == SIMPLEFS_IOC_SNAPSHOT_CREATE) {
+                return snapshot_create(*context, args->name);
+            }
+            return snapshot_delete(*context, args->name);
+        }
+        case SIMPLEFS_IOC_SEEK: {
+            SimpleFS_Inode inode_data;
+            if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
+            return seek_data_or_hole(*context, inode_num, inode_data, static_cast<SimpleFS_SeekArgs*>(data));
+        }
+        case SIMPLEFS_IOC_COPY_RANGE:
+            return copy_file_range_internal(*context, inode_num, static_cast<SimpleFS_CopyRangeArgs*>(data));
+        case SIMPLEFS_IOC_CLONE_RANGE:
+            return clone_file_range_internal(*context, inode_num, static_cast<SimpleFS_CopyRangeArgs*>(data));
+        case SIMPLEFS_IOC_RENAME: {
+            SimpleFS_RenameArgs* args = static_cast<SimpleFS_RenameArgs*>(data);
+            args->src_path[SIMPLEFS_IOC_PATH_MAX - 1] = '\0';
+            args->dst_path[SIMPLEFS_IOC_PATH_MAX - 1] = '\0';
+            return rename_internal(*context, args->src_path, args->dst_path, args->flags);
+        }
+        case SIMPLEFS_IOC_GET_COMPRESS: {
+            SimpleFS_Inode inode_data;
+            if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
+            *static_cast<uint32_t*>(data) = inode_is_compressed(&inode_data) ? 1 : 0;
+            return 0;
+        }
+        case SIMPLEFS_IOC_SET_COMPRESS:
+            return set_compress_flag(*context, inode_num, *static_cast<uint32_t*>(data) != 0);
+        case FITRIM: {
+            // 空闲空间属于整个文件系统，fstrim作用于挂载点，只有root可以执行
+            if (fuse_get_context()->uid != 0) return -EPERM;
+            return discard_trim_range(*context, fs_lock, static_cast<struct fstrim_range*>(data));
+        }
+        case SIMPLEFS_IOC_DEFRAG: {
+            SimpleFS_Inode inode_data;
+            if (read_inode_from_disk(*context, inode_num, &inode_data) != 0) return -errno;
+            struct fuse_context *caller_context = fuse_get_context();
+            if (caller_context->uid != 0 && caller_context->uid != inode_data.i_uid) return -EPERM;
+            return defrag_inode(*context, fs_lock, inode_num, static_cast<SimpleFS_DefragArgs*>(data));
+        }
+        default:
+            return -ENOTTY;
+    }
+}
+
+// 只读的命令和FITRIM（discard不改变文件系统内容，下发前已自行刷新）在sync模式下无需提交
+static bool ioctl_modifies_fs(unsigned int cmd, const void* data) {
+    switch (cmd) {
+        case SIMPLEFS_IOC_SEEK:
+        case SIMPLEFS_IOC_GET_COMPRESS:
+        case FITRIM:
+            return false;
+        case SIMPLEFS_IOC_DEFRAG:
+            return !(static_cast<const SimpleFS_DefragArgs*>(data)->flags & SIMPLEFS_DEFRAG_DRY_RUN);
+        default:
+            return true;
+    }
+}
+
+int simplefs_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data) {
+    int res = ioctl_dispatch(path, cmd, arg, fi, flags, data);
+    return ioctl_modifies_fs(static_cast<unsigned int>(cmd), data) ? commit_if_sync(res) : res;
+}
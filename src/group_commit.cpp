@@ -0,0 +1,51 @@
+#include "group_commit.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+
+// 以下状态由commit_mutex保护
+static std::mutex commit_mutex;
+static std::condition_variable commit_cv;
+static uint64_t commit_requested_seq = 0;  // 已发出的刷新请求序号
+static uint64_t commit_completed_seq = 0;  // 已完成的刷新覆盖到的请求序号
+static bool commit_flush_running = false;
+// 最近一次失败的刷新覆盖的请求区间 (commit_failed_after, commit_failed_through]
+static uint64_t commit_failed_after = 0;
+static uint64_t commit_failed_through = 0;
+static int commit_failed_errno = 0;
+
+int group_commit_flush(DeviceFd fd) {
+    std::unique_lock<std::mutex> lock(commit_mutex);
+    // 调用者的写入已经完成，此后开始的刷新一定覆盖它们
+    uint64_t my_seq = ++commit_requested_seq;
+
+    while (commit_completed_seq < my_seq) {
+        if (commit_flush_running) {
+            commit_cv.wait(lock);
+            continue;
+        }
+        // 由本线程执行刷新，覆盖到目前为止的所有请求
+        commit_flush_running = true;
+        uint64_t flush_through = commit_requested_seq;
+        uint64_t flush_after = commit_completed_seq;
+        lock.unlock();
+        int flush_errno = (fdatasync(fd) == 0) ? 0 : errno;
+        lock.lock();
+        if (flush_errno != 0) {
+            commit_failed_after = flush_after;
+            commit_failed_through = flush_through;
+            commit_failed_errno = flush_errno;
+        }
+        commit_completed_seq = flush_through;
+        commit_flush_running = false;
+        commit_cv.notify_all();
+    }
+
+    if (commit_failed_errno != 0 && my_seq > commit_failed_after && my_seq <= commit_failed_through) {
+        return -commit_failed_errno;
+    }
+    return 0;
+}
@@ -3,6 +3,10 @@
 #include "disk_io.h"  // read_block等
 #include "simplefs.h" // 结构体
 #include "utils.h"    // is_block_device
+#include "freespace.h" // 空闲空间索引
+#include "checksum.h"  // 元数据校验和
+#include "refcount.h"  // reflink块引用计数
+#include "snapshot.h"  // 快照
 
 #include <iostream>
 #include <vector>
@@ -12,12 +16,51 @@
 #include <fcntl.h> // open
 #include <unistd.h> // close
 #include <cmath>    // ceil
+#include <chrono>   // 挂载耗时
 
 static SimpleFS_Context fs_context; // 全局文件系统上下文
 
+// 从逗号分隔的FUSE选项串中取出SimpleFS自己的选项（durability=、compress、discard），其余选项原样保留
+// 返回false表示取值无效
+static bool take_simplefs_options(std::string& option_list, uint32_t* mode, bool* compress, bool* discard) {
+    std::string remaining;
+    size_t pos = 0;
+    while (pos <= option_list.length()) {
+        size_t comma = option_list.find(',', pos);
+        if (comma == std::string::npos) comma = option_list.length();
+        std::string option = option_list.substr(pos, comma - pos);
+        pos = comma + 1;
+        if (option == "compress") {
+            *compress = true;
+            continue;
+        }
+        if (option == "discard") {
+            *discard = true;
+            continue;
+        }
+        if (option.compare(0, 11, "durability=") != 0) {
+            if (!option.empty()) remaining += (remaining.empty() ? "" : ",") + option;
+            continue;
+        }
+        std::string value = option.substr(11);
+        if (value == "sync") {
+            *mode = SIMPLEFS_DURABILITY_SYNC;
+        } else if (value == "ordered") {
+            *mode = SIMPLEFS_DURABILITY_ORDERED;
+        } else if (value == "writeback") {
+            *mode = SIMPLEFS_DURABILITY_WRITEBACK;
+        } else {
+            std::cerr << "无效的持久化模式: " << value << "（可选 sync, ordered, writeback）" << std::endl;
+            return false;
+        }
+    }
+    option_list = remaining;
+    return true;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        std::cerr << "用法: " << argv[0] << " <设备文件> <挂载点> [FUSE选项...]" << std::endl;
+        std::cerr << "用法: " << argv[0] << " <设备文件> <挂载点> [-o durability=sync|ordered|writeback] [-o compress] [-o discard] [FUSE选项...]" << std::endl;
         return 1;
     }
 
@@ -33,47 +76,113 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    // 读取超级块
-    std::vector<uint8_t> sb_buffer(SIMPLEFS_BLOCK_SIZE);
-    if (read_block(fs_context.device_fd, 1, sb_buffer.data()) != 0) { // 超级块在块1
-        std::cerr << "无法读取超级块" << std::endl;
+    // 读取超级块（按块大小探测位置）
+    if (probe_superblock(fs_context.device_fd, &fs_context.sb) != 0) {
+        std::cerr << "无法读取超级块，不是有效的SimpleFS文件系统" << std::endl;
         close(fs_context.device_fd);
         return 1;
     }
-    std::memcpy(&fs_context.sb, sb_buffer.data(), sizeof(SimpleFS_SuperBlock));
+    fs_context.block_size = device_block_size();
 
-    // 验证超级块魔数
-    if (fs_context.sb.s_magic != SIMPLEFS_MAGIC) {
-        std::cerr << "魔数不匹配，不是有效的SimpleFS文件系统" << std::endl;
+    if (!is_valid_inode_size(fs_context.sb.s_inode_size)) {
+        std::cerr << "不支持的inode大小: " << fs_context.sb.s_inode_size << std::endl;
         close(fs_context.device_fd);
         return 1;
     }
 
-    std::cout << "SimpleFS已加载 - 块总数: " << fs_context.sb.s_blocks_count 
+    // 含有未知不兼容特性的文件系统不能安全挂载
+    uint32_t unsupported_features = fs_context.sb.s_feature_incompat & ~SIMPLEFS_FEATURE_INCOMPAT_SUPPORTED;
+    if (unsupported_features != 0) {
+        std::cerr << "文件系统包含不支持的特性: 0x" << std::hex << unsupported_features << std::dec << std::endl;
+        close(fs_context.device_fd);
+        return 1;
+    }
+
+    if (has_metadata_csum(fs_context.sb)) {
+        if (fs_context.sb.s_checksum != superblock_checksum(&fs_context.sb)) {
+            std::cerr << "超级块校验和不匹配" << std::endl;
+            close(fs_context.device_fd);
+            return 1;
+        }
+        std::cout << "元数据校验和已启用 (CRC32C: " << crc32c_implementation_name() << ")" << std::endl;
+    }
+
+    if (fs_context.sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_COMPRESSION) {
+        uint32_t log_cluster_blocks = fs_context.sb.s_log_cluster_blocks;
+        if (log_cluster_blocks == 0 || log_cluster_blocks > 31 ||
+            (static_cast<uint64_t>(fs_context.block_size) << log_cluster_blocks) > SIMPLEFS_MAX_CLUSTER_SIZE) {
+            std::cerr << "无效的压缩簇大小: 2^" << log_cluster_blocks << " 块" << std::endl;
+            close(fs_context.device_fd);
+            return 1;
+        }
+        fs_context.compress_cluster_blocks = 1u << log_cluster_blocks;
+        std::cout << "透明压缩已启用 (LZ4, 簇大小: " << fs_context.block_size * fs_context.compress_cluster_blocks
+                  << " 字节)" << std::endl;
+    }
+
+    std::cout << "SimpleFS已加载 - 块大小: " << fs_context.block_size << ", 块总数: " << fs_context.sb.s_blocks_count
               << ", 空闲块: " << fs_context.sb.s_free_blocks_count << std::endl;
 
 
     // 读取组描述符表(GDT)
+    auto load_start_time = std::chrono::steady_clock::now();
     uint32_t num_block_groups = static_cast<uint32_t>(std::ceil(static_cast<double>(fs_context.sb.s_blocks_count) / fs_context.sb.s_blocks_per_group));
     if (num_block_groups == 0 && fs_context.sb.s_blocks_count > 0) num_block_groups = 1;
 
 
     uint32_t gdt_size_bytes = num_block_groups * sizeof(SimpleFS_GroupDesc);
-    uint32_t gdt_blocks_count = static_cast<uint32_t>(std::ceil(static_cast<double>(gdt_size_bytes) / SIMPLEFS_BLOCK_SIZE));
+    uint32_t gdt_blocks_count = static_cast<uint32_t>(std::ceil(static_cast<double>(gdt_size_bytes) / fs_context.block_size));
 
     fs_context.gdt.resize(num_block_groups);
-    std::vector<uint8_t> gdt_buffer_raw(gdt_blocks_count * SIMPLEFS_BLOCK_SIZE);
+    std::vector<uint8_t> gdt_buffer_raw(gdt_blocks_count * fs_context.block_size);
 
     uint32_t gdt_start_block = 1 + 1; // 超级块在块1，GDT从块2开始
 
-    for (uint32_t i = 0; i < gdt_blocks_count; ++i) {
-        if (read_block(fs_context.device_fd, gdt_start_block + i, gdt_buffer_raw.data() + (i * SIMPLEFS_BLOCK_SIZE)) != 0) {
-            std::cerr << "无法读取组描述符表" << std::endl;
+    // GDT连续存放，一次读取
+    if (read_blocks(fs_context.device_fd, gdt_start_block, gdt_blocks_count, gdt_buffer_raw.data()) != 0) {
+        std::cerr << "无法读取组描述符表" << std::endl;
+        close(fs_context.device_fd);
+        return 1;
+    }
+    std::memcpy(fs_context.gdt.data(), gdt_buffer_raw.data(), gdt_size_bytes);
+    if (has_metadata_csum(fs_context.sb)) {
+        for (uint32_t group_idx = 0; group_idx < num_block_groups; ++group_idx) {
+            if (fs_context.gdt[group_idx].bg_checksum != group_desc_checksum(group_idx, &fs_context.gdt[group_idx])) {
+                std::cerr << "块组 " << group_idx << " 的描述符校验和不匹配" << std::endl;
+                close(fs_context.device_fd);
+                return 1;
+            }
+        }
+    }
+
+    // 建立块组空闲空间索引
+    if (build_free_space_index(fs_context) != 0) {
+        close(fs_context.device_fd);
+        return 1;
+    }
+
+    // reflink：读入共享块的引用计数
+    if (has_reflink(fs_context.sb)) {
+        if (load_block_refcounts(fs_context) != 0) {
+            std::cerr << "无法读取块引用计数表" << std::endl;
             close(fs_context.device_fd);
             return 1;
         }
+        std::cout << "reflink已启用 (共享块: " << fs_context.block_extra_refs.size() << ")" << std::endl;
     }
-    std::memcpy(fs_context.gdt.data(), gdt_buffer_raw.data(), gdt_size_bytes);
+
+    // 快照：读入快照列表，之后的块写入都先经过写时复制
+    if (has_snapshot(fs_context.sb)) {
+        if (load_snapshots(fs_context) != 0) {
+            std::cerr << "无法读取快照列表" << std::endl;
+            close(fs_context.device_fd);
+            return 1;
+        }
+        std::cout << "快照已启用 (快照数: " << fs_context.sb.s_snapshot_count << ")" << std::endl;
+    }
+
+    auto load_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - load_start_time);
+    std::cout << "块组元数据已加载 - 块组数: " << num_block_groups << ", 耗时: " << load_elapsed.count() << " ms" << std::endl;
 
     // 准备FUSE参数
     bool is_blk_dev = is_block_device(fs_context.device_fd);
@@ -89,11 +198,45 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // durability=、compress和discard是SimpleFS自己的选项，不传给FUSE
+    std::vector<std::string> fuse_args;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool separate_value = (arg == "-o" && i + 1 < argc);
+        bool joined_value = (arg.length() > 2 && arg.compare(0, 2, "-o") == 0);
+        if (!separate_value && !joined_value) {
+            fuse_args.push_back(arg);
+            continue;
+        }
+        std::string option_list = separate_value ? argv[++i] : arg.substr(2);
+        if (!take_simplefs_options(option_list, &fs_context.durability_mode, &fs_context.compress_new_files,
+                                   &fs_context.discard_freed_blocks)) {
+            close(fs_context.device_fd);
+            return 1;
+        }
+        if (!option_list.empty()) {
+            fuse_args.push_back("-o" + option_list);
+        }
+    }
+    static const char* const durability_names[] = {"sync", "ordered", "writeback"};
+    std::cout << "持久化模式: " << durability_names[fs_context.durability_mode] << std::endl;
+    if (fs_context.compress_new_files) {
+        if (fs_context.compress_cluster_blocks == 0) {
+            std::cerr << "-o compress需要用mkfs -O compression创建的文件系统" << std::endl;
+            close(fs_context.device_fd);
+            return 1;
+        }
+        std::cout << "新建文件压缩存放" << std::endl;
+    }
+    if (fs_context.discard_freed_blocks) {
+        std::cout << "释放的块在后台discard" << std::endl;
+    }
+
     std::vector<char*> fuse_argv_vec;
     fuse_argv_vec.push_back(argv[0]); // 程序名
     // 添加原始参数，除了设备路径
-    for (int i = 2; i < argc; ++i) {
-        fuse_argv_vec.push_back(argv[i]);
+    for (std::string& arg : fuse_args) {
+        fuse_argv_vec.push_back(&arg[0]);
     }
 
     if (!allow_other_found) {
@@ -5,6 +5,12 @@
 #include <unistd.h>
 #include "simplefs_context.h"
 #include "utils.h"
+#include "freespace.h"
+#include "checksum.h"
+#include "compress.h"
+#include "refcount.h"
+#include "snapshot.h"
+#include "discard.h"
 #include <sys/stat.h>
 #include <vector>
 #include <cstdio>
@@ -14,18 +20,229 @@
 #include <algorithm>
 #include <cmath>
 
-// 分配可用的inode
-uint32_t alloc_inode(SimpleFS_Context& context, mode_t mode) {
+uint32_t inode_inline_capacity(const SimpleFS_Context& context) {
+    return has_metadata_csum(context.sb) ? SIMPLEFS_INLINE_DATA_MAX_CSUM : SIMPLEFS_INLINE_DATA_MAX;
+}
+
+uint32_t dir_block_entries_end(const SimpleFS_Context& context) {
+    return has_metadata_csum(context.sb) ? context.block_size - sizeof(SimpleFS_DirEntryTail) : context.block_size;
+}
+
+// 读取位图块并校验，校验和不匹配按读取失败处理
+static int read_bitmap_block(SimpleFS_Context& context, uint32_t block_num, uint32_t expected_csum, void* buffer,
+                             uint32_t group_idx, const char* what) {
+    if (read_block(context.device_fd, block_num, buffer) != 0) {
+        errno = EIO;
+        return -1;
+    }
+    if (has_metadata_csum(context.sb) && bitmap_checksum(buffer, context.block_size) != expected_csum) {
+        std::cerr << "块组 " << group_idx << " 的" << what << "校验和不匹配" << std::endl;
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int read_block_bitmap(SimpleFS_Context& context, uint32_t group_idx, void* buffer) {
+    const SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+    // 块位图读出后会被修改写回，快照需要的旧内容在读取前复制：复制时分配块会改写位图，
+    // 不能发生在调用者读出与写回之间
+    int cow_res = snapshot_cow_blocks(context, gd.bg_block_bitmap, 1);
+    if (cow_res != 0) {
+        errno = -cow_res;
+        return -1;
+    }
+    return read_bitmap_block(context, gd.bg_block_bitmap, gd.bg_block_bitmap_csum, buffer, group_idx, "块位图");
+}
+
+int peek_block_bitmap(SimpleFS_Context& context, uint32_t group_idx, void* buffer) {
+    const SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+    return read_bitmap_block(context, gd.bg_block_bitmap, gd.bg_block_bitmap_csum, buffer, group_idx, "块位图");
+}
+
+int read_inode_bitmap(SimpleFS_Context& context, uint32_t group_idx, void* buffer) {
+    const SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+    return read_bitmap_block(context, gd.bg_inode_bitmap, gd.bg_inode_bitmap_csum, buffer, group_idx, "inode位图");
+}
+
+// 位图校验和保存在内存中的块组描述符里，随sync_fs_metadata写回
+int write_block_bitmap(SimpleFS_Context& context, uint32_t group_idx, const void* buffer) {
+    SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+    if (write_block(context.device_fd, gd.bg_block_bitmap, buffer) != 0) {
+        errno = EIO;
+        return -1;
+    }
+    if (has_metadata_csum(context.sb)) {
+        gd.bg_block_bitmap_csum = bitmap_checksum(buffer, context.block_size);
+    }
+    return 0;
+}
+
+int write_inode_bitmap(SimpleFS_Context& context, uint32_t group_idx, const void* buffer) {
+    SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+    if (write_block(context.device_fd, gd.bg_inode_bitmap, buffer) != 0) {
+        errno = EIO;
+        return -1;
+    }
+    if (has_metadata_csum(context.sb)) {
+        gd.bg_inode_bitmap_csum = bitmap_checksum(buffer, context.block_size);
+    }
+    return 0;
+}
+
+int read_dir_block(SimpleFS_Context& context, uint32_t block_num, void* buffer) {
+    if (read_block(context.device_fd, block_num, buffer) != 0) {
+        errno = EIO;
+        return -1;
+    }
+    if (has_metadata_csum(context.sb) && !verify_dir_block_checksum(block_num, buffer, context.block_size)) {
+        std::cerr << "目录块 " << block_num << " 校验和不匹配" << std::endl;
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int write_dir_block(SimpleFS_Context& context, uint32_t block_num, void* buffer) {
+    if (has_metadata_csum(context.sb)) {
+        set_dir_block_checksum(block_num, buffer, context.block_size);
+    }
+    if (write_block(context.device_fd, block_num, buffer) != 0) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int read_dir_logical_block(SimpleFS_Context& context, const SimpleFS_Inode* dir_inode, uint32_t logical_block_idx,
+                           void* buffer, uint32_t* physical_block) {
+    if (physical_block) *physical_block = 0;
+    if (inode_has_inline_data(dir_inode)) {
+        if (logical_block_idx != 0) return 1;
+        uint32_t inline_capacity = inode_inline_capacity(context);
+        std::memcpy(buffer, inode_inline_data(dir_inode), inline_capacity);
+        std::memset(static_cast<uint8_t*>(buffer) + inline_capacity, 0, context.block_size - inline_capacity);
+        return 0;
+    }
+    uint32_t block_num = map_logical_to_physical_block(context, dir_inode, logical_block_idx);
+    if (block_num == 0) return 1;
+    if (physical_block) *physical_block = block_num;
+    return read_dir_block(context, block_num, buffer);
+}
+
+int write_dir_logical_block(SimpleFS_Context& context, SimpleFS_Inode* dir_inode, uint32_t physical_block, void* buffer) {
+    if (inode_has_inline_data(dir_inode)) {
+        std::memcpy(inode_inline_data(dir_inode), buffer, inode_inline_capacity(context));
+        return 0;
+    }
+    return write_dir_block(context, physical_block, buffer);
+}
+
+// 新目录块：首个目录项rec_len为0表示块内没有目录项，启用校验和时另有尾部
+static int write_empty_dir_block(SimpleFS_Context& context, uint32_t block_num) {
+    std::vector<uint8_t> block_buffer(context.block_size, 0);
+    return write_dir_block(context, block_num, block_buffer.data());
+}
+
+// 为新inode选择块组（Orlov策略），没有合适的组时返回UINT32_MAX
+// 根目录下的子目录分散到空闲inode和空闲块都不低于平均值、目录最少的组；
+// 其他目录留在父目录附近，除非该组目录过多或空间偏少；普通文件放在父目录所在的组
+static uint32_t find_group_for_inode(const SimpleFS_Context& context, mode_t mode, uint32_t parent_inode_num) {
+    uint32_t num_groups = context.gdt.size();
+    if (num_groups == 0) return UINT32_MAX;
+    uint32_t parent_group = (parent_inode_num == 0) ? 0 : (parent_inode_num - 1) / context.sb.s_inodes_per_group;
+    if (parent_group >= num_groups) parent_group = 0;
+
+    uint32_t free_blocks = context.sb.s_free_blocks_count > context.delalloc_reserved_blocks ?
+                           context.sb.s_free_blocks_count - context.delalloc_reserved_blocks : 0;
+    uint32_t avg_free_inodes = context.sb.s_free_inodes_count / num_groups;
+    uint32_t avg_free_blocks = free_blocks / num_groups;
+
+    if (S_ISDIR(mode) && parent_inode_num == context.sb.s_root_inode) {
+        uint32_t best_group = UINT32_MAX;
+        for (uint32_t group_idx = 0; group_idx < num_groups; ++group_idx) {
+            const SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+            if (gd.bg_free_inodes_count == 0 || gd.bg_free_inodes_count < avg_free_inodes ||
+                gd.bg_free_blocks_count < avg_free_blocks) {
+                continue;
+            }
+            if (best_group == UINT32_MAX ||
+                gd.bg_used_dirs_count < context.gdt[best_group].bg_used_dirs_count ||
+                (gd.bg_used_dirs_count == context.gdt[best_group].bg_used_dirs_count &&
+                 gd.bg_free_blocks_count > context.gdt[best_group].bg_free_blocks_count)) {
+                best_group = group_idx;
+            }
+        }
+        if (best_group != UINT32_MAX) return best_group;
+    } else if (S_ISDIR(mode)) {
+        uint32_t total_dirs = 0;
+        for (const auto& gd : context.gdt) total_dirs += gd.bg_used_dirs_count;
+        uint32_t max_dirs = total_dirs / num_groups + context.sb.s_inodes_per_group / 16;
+        uint32_t min_inodes = avg_free_inodes > context.sb.s_inodes_per_group / 4 ?
+                              avg_free_inodes - context.sb.s_inodes_per_group / 4 : 1;
+        uint32_t min_blocks = avg_free_blocks > context.sb.s_blocks_per_group / 4 ?
+                              avg_free_blocks - context.sb.s_blocks_per_group / 4 : 0;
+        for (uint32_t i = 0; i < num_groups; ++i) {
+            uint32_t group_idx = (parent_group + i) % num_groups;
+            const SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+            if (gd.bg_used_dirs_count < max_dirs && gd.bg_free_inodes_count >= min_inodes &&
+                gd.bg_free_blocks_count >= min_blocks) {
+                return group_idx;
+            }
+        }
+        for (uint32_t i = 0; i < num_groups; ++i) {
+            uint32_t group_idx = (parent_group + i) % num_groups;
+            if (context.gdt[group_idx].bg_free_inodes_count >= std::max(avg_free_inodes, 1u)) {
+                return group_idx;
+            }
+        }
+    } else {
+        const SimpleFS_GroupDesc& parent_gd = context.gdt[parent_group];
+        if (parent_gd.bg_free_inodes_count > 0 && parent_gd.bg_free_blocks_count > 0) {
+            return parent_group;
+        }
+        // 父目录的组已满：按二次探测跳到较远的组，避免所有文件挤到相邻组
+        uint32_t group_idx = (parent_group + parent_inode_num) % num_groups;
+        for (uint32_t step = 1; step < num_groups; step <<= 1) {
+            group_idx = (group_idx + step) % num_groups;
+            const SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+            if (gd.bg_free_inodes_count > 0 && gd.bg_free_blocks_count > 0) {
+                return group_idx;
+            }
+        }
+    }
+
+    // 兜底：从父目录的组开始找任何有空闲inode的组
+    for (uint32_t i = 0; i < num_groups; ++i) {
+        uint32_t group_idx = (parent_group + i) % num_groups;
+        if (context.gdt[group_idx].bg_free_inodes_count > 0) {
+            return group_idx;
+        }
+    }
+    return UINT32_MAX;
+}
+
+// 分配可用的inode，位置由父目录和文件类型决定
+uint32_t alloc_inode(SimpleFS_Context& context, mode_t mode, uint32_t parent_inode_num) {
     if (context.sb.s_free_inodes_count == 0) {
         errno = ENOSPC;
         return 0;
     }
 
-    for (uint32_t group_idx = 0; group_idx < context.gdt.size(); ++group_idx) {
+    uint32_t num_groups = context.gdt.size();
+    uint32_t goal_group = find_group_for_inode(context, mode, parent_inode_num);
+    if (goal_group == UINT32_MAX) {
+        errno = ENOSPC;
+        return 0;
+    }
+
+    // 目标组优先，位图读取失败等情况下继续搜索后续的组
+    for (uint32_t i = 0; i < num_groups; ++i) {
+        uint32_t group_idx = (goal_group + i) % num_groups;
         SimpleFS_GroupDesc& gd = context.gdt[group_idx];
         if (gd.bg_free_inodes_count > 0) {
-            std::vector<uint8_t> inode_bitmap_data(SIMPLEFS_BLOCK_SIZE);
-            if (read_block(context.device_fd, gd.bg_inode_bitmap, inode_bitmap_data.data()) != 0) {
+            std::vector<uint8_t> inode_bitmap_data(context.block_size);
+            if (read_inode_bitmap(context, group_idx, inode_bitmap_data.data()) != 0) {
                 continue;
             }
 
@@ -38,7 +255,7 @@ uint32_t alloc_inode(SimpleFS_Context& context, mode_t mode) {
                     }
 
                     set_bitmap_bit(inode_bitmap_data, bit_idx);
-                    if (write_block(context.device_fd, gd.bg_inode_bitmap, inode_bitmap_data.data()) != 0) {
+                    if (write_inode_bitmap(context, group_idx, inode_bitmap_data.data()) != 0) {
                         errno = EIO;
                         return 0;
                     }
@@ -74,18 +291,19 @@ void free_inode(SimpleFS_Context& context, uint32_t inode_num, mode_t mode_of_fr
     SimpleFS_GroupDesc& gd = context.gdt[group_idx];
     uint32_t bit_idx = (inode_num - 1) % context.sb.s_inodes_per_group;
 
-    std::vector<uint8_t> inode_bitmap_data(SIMPLEFS_BLOCK_SIZE);
-    if (read_block(context.device_fd, gd.bg_inode_bitmap, inode_bitmap_data.data()) != 0) {
+    std::vector<uint8_t> inode_bitmap_data(context.block_size);
+    if (read_inode_bitmap(context, group_idx, inode_bitmap_data.data()) != 0) {
         return;
     }
 
     clear_bitmap_bit(inode_bitmap_data, bit_idx);
-    if (write_block(context.device_fd, gd.bg_inode_bitmap, inode_bitmap_data.data()) != 0) {
+    if (write_inode_bitmap(context, group_idx, inode_bitmap_data.data()) != 0) {
         return;
     }
 
     gd.bg_free_inodes_count++;
     context.sb.s_free_inodes_count++;
+    compress_cache_drop_inode(inode_num);
 
     if (S_ISDIR(mode_of_freed_inode)) {
        if (gd.bg_used_dirs_count > 0) gd.bg_used_dirs_count--;
@@ -94,73 +312,445 @@ void free_inode(SimpleFS_Context& context, uint32_t inode_num, mode_t mode_of_fr
 
 #include <numeric>
 
+// 查找包含block_num的其他inode的预留窗口，返回窗口结束块号；不在任何他人窗口内则返回0
+static uint32_t foreign_window_end(const SimpleFS_Context& context, uint32_t block_num, uint32_t owner_inode_num) {
+    auto it = context.rsv_window_starts.upper_bound(block_num);
+    if (it == context.rsv_window_starts.begin()) {
+        return 0;
+    }
+    --it;
+    if (it->second == owner_inode_num) {
+        return 0;
+    }
+    const SimpleFS_ReservationWindow& window = context.rsv_windows.at(it->second);
+    return (block_num < window.end_block) ? window.end_block : 0;
+}
+
+// 在块组位图的 [from_bit, to_bit) 中查找首个空闲块，honor_windows为true时跳过其他inode的预留窗口
+// 找不到返回UINT32_MAX
+static uint32_t find_free_bit_in_group(const SimpleFS_Context& context, uint32_t group_idx, const std::vector<uint8_t>& bitmap,
+                                       uint32_t from_bit, uint32_t to_bit, uint32_t owner_inode_num, bool honor_windows) {
+    uint32_t group_base = group_idx * context.sb.s_blocks_per_group;
+    for (uint32_t bit_idx = find_next_clear_bit(bitmap, from_bit, to_bit); bit_idx < to_bit;
+         bit_idx = find_next_clear_bit(bitmap, bit_idx + 1, to_bit)) {
+        uint32_t block_num = group_base + bit_idx;
+        if (block_num == 0 || block_num >= context.sb.s_blocks_count) {
+            continue;
+        }
+        if (honor_windows) {
+            uint32_t window_end = foreign_window_end(context, block_num, owner_inode_num);
+            if (window_end != 0) {
+                bit_idx = window_end - group_base - 1; // 跳到窗口之后
+                continue;
+            }
+        }
+        return bit_idx;
+    }
+    return UINT32_MAX;
+}
+
+// 在位图中占用一个块并写回，更新空闲计数
+static uint32_t claim_block_in_group(SimpleFS_Context& context, uint32_t group_idx, std::vector<uint8_t>& bitmap, uint32_t bit_idx) {
+    SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+    set_bitmap_bit(bitmap, bit_idx);
+    if (write_block_bitmap(context, group_idx, bitmap.data()) != 0) {
+        errno = EIO;
+        return 0;
+    }
+    gd.bg_free_blocks_count--;
+    context.sb.s_free_blocks_count--;
+    update_group_free_summary(context, group_idx, bitmap);
+    return group_idx * context.sb.s_blocks_per_group + bit_idx;
+}
+
+// 块组内可用的位数（最后一个块组可能不完整）
+static uint32_t group_bit_count(const SimpleFS_Context& context, uint32_t group_idx) {
+    uint32_t group_base = group_idx * context.sb.s_blocks_per_group;
+    return std::min(context.sb.s_blocks_per_group, context.sb.s_blocks_count - group_base);
+}
+
 // 分配数据块
 uint32_t alloc_block(SimpleFS_Context& context, uint32_t preferred_group_for_inode) {
-    // 简化的一致性检查
-    if (context.sb.s_free_blocks_count == 0) {
+    // 简化的一致性检查；延迟分配预留的块不可被其他分配占用
+    if (context.sb.s_free_blocks_count <= context.delalloc_reserved_blocks) {
         errno = ENOSPC;
         return 0;
     }
 
-    uint32_t target_group_idx = static_cast<uint32_t>(-1);
     uint32_t num_groups = context.gdt.size();
+    std::vector<uint8_t> block_bitmap_data(context.block_size);
+
+    // 先避开其他inode的预留窗口；空间紧张时窗口只是建议，第二轮忽略窗口
+    for (int pass = 0; pass < 2; ++pass) {
+        bool honor_windows = (pass == 0);
+        // 首选组（inode所在组）已满时，由空闲空间索引直接给出有空闲块的组，
+        // 之后再从首选组开始依次搜索，溢出的块落在附近的组
+        uint32_t goal_group = preferred_group_for_inode < num_groups ? preferred_group_for_inode : 0;
+        uint32_t indexed_group = find_group_with_free_run(context, 1, goal_group);
+        for (uint32_t i = 0; i <= num_groups; ++i) {
+            uint32_t group_idx;
+            if (i == 0) {
+                if (indexed_group == UINT32_MAX) continue;
+                group_idx = indexed_group;
+            } else {
+                group_idx = (goal_group + i - 1) % num_groups;
+                if (group_idx == indexed_group) continue;
+            }
+            if (context.gdt[group_idx].bg_free_blocks_count == 0) {
+                continue;
+            }
 
-    // 优先尝试首选组
-    if (preferred_group_for_inode < num_groups) {
-        if (context.gdt[preferred_group_for_inode].bg_free_blocks_count > 0) {
-            target_group_idx = preferred_group_for_inode;
+            if (read_block_bitmap(context, group_idx, block_bitmap_data.data()) != 0) {
+                errno = EIO;
+                return 0;
+            }
+            uint32_t bit_idx = find_free_bit_in_group(context, group_idx, block_bitmap_data, 0,
+                                                      group_bit_count(context, group_idx), 0, honor_windows);
+            if (bit_idx != UINT32_MAX) {
+                return claim_block_in_group(context, group_idx, block_bitmap_data, bit_idx);
+            }
+        }
+        if (context.rsv_windows.empty()) {
+            break;
         }
     }
 
-    // 如果首选组不可用，搜索所有组
-    if (target_group_idx == static_cast<uint32_t>(-1)) {
-        for (uint32_t i = 0; i < num_groups; ++i) {
-            if (context.gdt[i].bg_free_blocks_count > 0) {
-                target_group_idx = i;
-                break;
+    errno = ENOSPC;
+    return 0;
+}
+
+// 在块组位图的 [from_bit, to_bit) 中查找空闲段：返回第一个长度达到max_len的段，
+// 否则返回其中最长且不短于min_len的段；honor_windows为true时段不进入其他inode的预留窗口
+// 找不到返回UINT32_MAX，*run_len为可用长度（不超过max_len）
+static uint32_t find_free_run_in_group(const SimpleFS_Context& context, uint32_t group_idx, const std::vector<uint8_t>& bitmap,
+                                       uint32_t from_bit, uint32_t to_bit, uint32_t min_len, uint32_t max_len,
+                                       uint32_t owner_inode_num, bool honor_windows, uint32_t* run_len) {
+    uint32_t group_base = group_idx * context.sb.s_blocks_per_group;
+    uint32_t best_start = UINT32_MAX;
+    uint32_t best_len = 0;
+    uint32_t bit_idx = from_bit;
+    while (bit_idx < to_bit) {
+        uint32_t start = find_free_bit_in_group(context, group_idx, bitmap, bit_idx, to_bit, owner_inode_num, honor_windows);
+        if (start == UINT32_MAX) {
+            break;
+        }
+        uint32_t end = find_next_set_bit(bitmap, start, to_bit);
+        if (honor_windows) {
+            // 空闲段在下一个他人窗口的起点截断
+            auto next_it = context.rsv_window_starts.upper_bound(group_base + start);
+            while (next_it != context.rsv_window_starts.end() && next_it->first < group_base + end) {
+                if (next_it->second != owner_inode_num) {
+                    end = next_it->first - group_base;
+                    break;
+                }
+                ++next_it;
             }
         }
+        uint32_t len = end - start;
+        if (len >= max_len) {
+            *run_len = max_len;
+            return start;
+        }
+        if (len >= min_len && len > best_len) {
+            best_start = start;
+            best_len = len;
+        }
+        bit_idx = end;
     }
+    *run_len = best_len;
+    return best_start;
+}
 
-    if (target_group_idx == static_cast<uint32_t>(-1)) {
-        errno = ENOSPC;
-        return 0;
+// 文件逻辑块的分配目标：紧接前一个逻辑块的物理块，其次是自己的预留窗口，否则为inode所在组的起点
+uint32_t find_goal_block_for_inode(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t inode_num,
+                                   uint32_t logical_block_idx) {
+    if (logical_block_idx > 0 && inode) {
+        uint32_t prev_block = map_logical_to_physical_block(context, inode, logical_block_idx - 1);
+        errno = 0;
+        if (prev_block != 0 && prev_block + 1 < context.sb.s_blocks_count) return prev_block + 1;
     }
+    auto window_it = context.rsv_windows.find(inode_num);
+    if (window_it != context.rsv_windows.end()) {
+        return window_it->second.next_goal;
+    }
+    uint32_t inode_group = (inode_num - 1) / context.sb.s_inodes_per_group;
+    if (inode_group >= context.gdt.size()) inode_group = 0;
+    return inode_group * context.sb.s_blocks_per_group;
+}
 
-    SimpleFS_GroupDesc& gd = context.gdt[target_group_idx];
-    std::vector<uint8_t> block_bitmap_data(SIMPLEFS_BLOCK_SIZE);
-
-    if (read_block(context.device_fd, gd.bg_block_bitmap, block_bitmap_data.data()) != 0) {
-        errno = EIO;
+// 在goal_block附近查找一段长度在 [min_len, max_len] 内的连续空闲块，claim为true时同时分配
+// 先尝试目标位置所在的组，再由空闲空间索引选择有足够长空闲段的组，最后逐组搜索
+// 成功返回起始块号，*allocated_len为实际长度；失败返回0并设置errno
+static uint32_t search_free_blocks(SimpleFS_Context& context, uint32_t goal_block, uint32_t min_len, uint32_t max_len,
+                                   uint32_t* allocated_len, uint32_t owner_inode_num, bool claim) {
+    *allocated_len = 0;
+    if (min_len == 0) min_len = 1;
+    max_len = std::min(std::max(max_len, min_len), context.sb.s_blocks_per_group);
+    if (context.sb.s_free_blocks_count <= context.delalloc_reserved_blocks ||
+        context.sb.s_free_blocks_count - context.delalloc_reserved_blocks < min_len || min_len > max_len) {
+        errno = ENOSPC;
         return 0;
     }
+    max_len = std::min(max_len, context.sb.s_free_blocks_count - context.delalloc_reserved_blocks);
 
-    for (uint32_t bit_idx = 0; bit_idx < context.sb.s_blocks_per_group; ++bit_idx) {
-        if (!is_bitmap_bit_set(block_bitmap_data, bit_idx)) {
-            uint32_t block_num = (target_group_idx * context.sb.s_blocks_per_group) + bit_idx;
+    uint32_t num_groups = context.gdt.size();
+    uint32_t goal_group = (goal_block != 0 && goal_block < context.sb.s_blocks_count) ?
+                          goal_block / context.sb.s_blocks_per_group : 0;
+    std::vector<uint8_t> block_bitmap_data(context.block_size);
+
+    for (int pass = 0; pass < 2; ++pass) {
+        bool honor_windows = (pass == 0);
+        // 候选顺序：目标组、能容纳max_len的组、能容纳min_len的组，然后从目标组开始逐组搜索
+        std::vector<uint32_t> candidates = {goal_group};
+        uint32_t max_fit_group = find_group_with_free_run(context, max_len, goal_group);
+        if (max_fit_group != UINT32_MAX) candidates.push_back(max_fit_group);
+        uint32_t min_fit_group = find_group_with_free_run(context, min_len, goal_group);
+        if (min_fit_group != UINT32_MAX) candidates.push_back(min_fit_group);
+        for (uint32_t i = 1; i < num_groups; ++i) {
+            candidates.push_back((goal_group + i) % num_groups);
+        }
 
-            if (block_num == 0 && target_group_idx == 0 && bit_idx == 0) {
-                 continue;
+        std::vector<bool> tried(num_groups, false);
+        for (uint32_t group_idx : candidates) {
+            if (tried[group_idx]) continue;
+            tried[group_idx] = true;
+            if (context.gdt[group_idx].bg_free_blocks_count < min_len) continue;
+            if (group_idx < context.group_free_summaries.size() &&
+                context.group_free_summaries[group_idx].largest_free_run < min_len) {
+                continue;
             }
-            if (block_num >= context.sb.s_blocks_count) {
-                 continue;
+
+            if (read_block_bitmap(context, group_idx, block_bitmap_data.data()) != 0) {
+                errno = EIO;
+                return 0;
+            }
+            uint32_t group_base = group_idx * context.sb.s_blocks_per_group;
+            uint32_t group_bits = group_bit_count(context, group_idx);
+            uint32_t from_bit = (group_idx == goal_group && goal_block > group_base) ? goal_block - group_base : 0;
+            uint32_t run_len = 0;
+            uint32_t start_bit = find_free_run_in_group(context, group_idx, block_bitmap_data, from_bit, group_bits,
+                                                        min_len, max_len, owner_inode_num, honor_windows, &run_len);
+            if (start_bit == UINT32_MAX && from_bit > 0) {
+                start_bit = find_free_run_in_group(context, group_idx, block_bitmap_data, 0, from_bit,
+                                                   min_len, max_len, owner_inode_num, honor_windows, &run_len);
+            }
+            if (start_bit == UINT32_MAX) continue;
+            if (!claim) {
+                *allocated_len = run_len;
+                return group_base + start_bit;
             }
 
-            set_bitmap_bit(block_bitmap_data, bit_idx);
-            if (write_block(context.device_fd, gd.bg_block_bitmap, block_bitmap_data.data()) != 0) {
+            SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+            set_bitmap_range(block_bitmap_data, start_bit, run_len);
+            if (write_block_bitmap(context, group_idx, block_bitmap_data.data()) != 0) {
                 errno = EIO;
                 return 0;
             }
+            gd.bg_free_blocks_count -= run_len;
+            context.sb.s_free_blocks_count -= run_len;
+            update_group_free_summary(context, group_idx, block_bitmap_data);
+
+            // 分配段落在自己的窗口内时推进窗口的下一个目标
+            uint32_t start_block = group_base + start_bit;
+            auto window_it = context.rsv_windows.find(owner_inode_num);
+            if (owner_inode_num != 0 && window_it != context.rsv_windows.end() &&
+                start_block >= window_it->second.start_block && start_block < window_it->second.end_block) {
+                window_it->second.next_goal = std::max(window_it->second.next_goal, start_block + run_len);
+            }
+            *allocated_len = run_len;
+            return start_block;
+        }
+        if (context.rsv_windows.empty()) {
+            break;
+        }
+    }
+
+    errno = ENOSPC;
+    return 0;
+}
 
-            gd.bg_free_blocks_count--;
-            context.sb.s_free_blocks_count--;
+uint32_t alloc_blocks(SimpleFS_Context& context, uint32_t goal_block, uint32_t min_len, uint32_t max_len,
+                      uint32_t* allocated_len, uint32_t owner_inode_num) {
+    return search_free_blocks(context, goal_block, min_len, max_len, allocated_len, owner_inode_num, true);
+}
 
+uint32_t find_free_blocks(SimpleFS_Context& context, uint32_t goal_block, uint32_t min_len, uint32_t max_len,
+                          uint32_t* run_len, uint32_t owner_inode_num) {
+    return search_free_blocks(context, goal_block, min_len, max_len, run_len, owner_inode_num, false);
+}
+
+// 为inode建立覆盖 [start_block, end_block) 的预留窗口，替换原有窗口；区间须在一个块组内且不与他人窗口重叠
+void set_reservation_window(SimpleFS_Context& context, uint32_t inode_num, uint32_t start_block, uint32_t end_block) {
+    release_reservation_window(context, inode_num);
+    SimpleFS_ReservationWindow window;
+    window.start_block = start_block;
+    window.end_block = end_block;
+    window.next_goal = start_block;
+    window.size = std::min(end_block - start_block, SIMPLEFS_RSV_WINDOW_MAX_BLOCKS);
+    context.rsv_windows[inode_num] = window;
+    context.rsv_window_starts[start_block] = inode_num;
+}
+
+// 释放inode的预留窗口（文件关闭或删除时）
+void release_reservation_window(SimpleFS_Context& context, uint32_t inode_num) {
+    auto it = context.rsv_windows.find(inode_num);
+    if (it == context.rsv_windows.end()) {
+        return;
+    }
+    context.rsv_window_starts.erase(it->second.start_block);
+    context.rsv_windows.erase(it);
+}
+
+// 为文件分配块：优先使用inode自己的预留窗口，窗口耗尽时在目标块之后建立新窗口
+// 目标块为文件前一个逻辑块的物理块号之后，使顺序增长的文件保持物理连续
+uint32_t alloc_block_for_inode(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t inode_num, uint32_t logical_block_idx) {
+    if (context.sb.s_free_blocks_count <= context.delalloc_reserved_blocks) {
+        errno = ENOSPC;
+        return 0;
+    }
+
+    uint32_t inode_group = (inode_num - 1) / context.sb.s_inodes_per_group;
+    uint32_t num_groups = context.gdt.size();
+    std::vector<uint8_t> block_bitmap_data(context.block_size);
+    uint32_t goal_block = 0;
+    uint32_t window_size = SIMPLEFS_RSV_WINDOW_MIN_BLOCKS;
+
+    auto window_it = context.rsv_windows.find(inode_num);
+    if (window_it != context.rsv_windows.end()) {
+        SimpleFS_ReservationWindow& window = window_it->second;
+        uint32_t group_idx = window.start_block / context.sb.s_blocks_per_group;
+        uint32_t group_base = group_idx * context.sb.s_blocks_per_group;
+        if (read_block_bitmap(context, group_idx, block_bitmap_data.data()) != 0) {
+            errno = EIO;
+            return 0;
+        }
+        uint32_t from_block = std::max(window.next_goal, window.start_block);
+        uint32_t bit_idx = find_free_bit_in_group(context, group_idx, block_bitmap_data,
+                                                  from_block - group_base, window.end_block - group_base, inode_num, false);
+        if (bit_idx != UINT32_MAX) {
+            uint32_t block_num = claim_block_in_group(context, group_idx, block_bitmap_data, bit_idx);
+            if (block_num != 0) window.next_goal = block_num + 1;
             return block_num;
         }
+        // 窗口已用完：在其后建立更大的新窗口
+        goal_block = window.next_goal;
+        window_size = std::min(window.size * 2, SIMPLEFS_RSV_WINDOW_MAX_BLOCKS);
+        release_reservation_window(context, inode_num);
+    } else if (logical_block_idx > 0 && inode) {
+        uint32_t prev_block = map_logical_to_physical_block(context, inode, logical_block_idx - 1);
+        if (prev_block != 0) goal_block = prev_block + 1;
+        errno = 0;
     }
 
-    errno = ENOSPC;
-    return 0;
+    uint32_t goal_group = (goal_block != 0 && goal_block < context.sb.s_blocks_count) ?
+                          goal_block / context.sb.s_blocks_per_group : inode_group;
+    if (goal_group >= num_groups) goal_group = 0;
+    if (goal_block == 0) {
+        // 没有前驱块可以接续：inode所在组放不下整个窗口时，选一个有足够长空闲段的组
+        uint32_t run_group = find_group_with_free_run(context, window_size, goal_group);
+        if (run_group != UINT32_MAX) goal_group = run_group;
+    }
+
+    // 从目标组的目标位置开始，依次搜索后续块组
+    for (uint32_t i = 0; i < num_groups; ++i) {
+        uint32_t group_idx = (goal_group + i) % num_groups;
+        if (context.gdt[group_idx].bg_free_blocks_count == 0) {
+            continue;
+        }
+        if (read_block_bitmap(context, group_idx, block_bitmap_data.data()) != 0) {
+            errno = EIO;
+            return 0;
+        }
+        uint32_t group_base = group_idx * context.sb.s_blocks_per_group;
+        uint32_t group_bits = group_bit_count(context, group_idx);
+        uint32_t from_bit = (i == 0 && goal_block > group_base) ? goal_block - group_base : 0;
+        uint32_t bit_idx = find_free_bit_in_group(context, group_idx, block_bitmap_data, from_bit, group_bits, inode_num, true);
+        if (bit_idx == UINT32_MAX && from_bit > 0) {
+            bit_idx = find_free_bit_in_group(context, group_idx, block_bitmap_data, 0, from_bit, inode_num, true);
+        }
+        if (bit_idx == UINT32_MAX) {
+            continue;
+        }
+
+        uint32_t block_num = claim_block_in_group(context, group_idx, block_bitmap_data, bit_idx);
+        if (block_num == 0) {
+            return 0;
+        }
+
+        // 新窗口不跨越块组，也不与其他inode的窗口重叠
+        uint64_t window_end = std::min<uint64_t>(static_cast<uint64_t>(block_num) + window_size, group_base + group_bits);
+        auto next_it = context.rsv_window_starts.upper_bound(block_num);
+        if (next_it != context.rsv_window_starts.end() && next_it->first < window_end) {
+            window_end = next_it->first;
+        }
+        SimpleFS_ReservationWindow window;
+        window.start_block = block_num;
+        window.end_block = static_cast<uint32_t>(window_end);
+        window.next_goal = block_num + 1;
+        window.size = window_size;
+        context.rsv_windows[inode_num] = window;
+        context.rsv_window_starts[block_num] = inode_num;
+        return block_num;
+    }
+
+    // 所有空闲块都在他人窗口内，退回普通分配
+    return alloc_block(context, inode_group);
+}
+
+// 为文件逻辑连续的一段块分配物理连续的块：与alloc_block_for_inode相同，先用inode自己的预留窗口，
+// 窗口用完时在其后建立加倍的新窗口；goal_block非0时从该块接续（同一次回写中尚未安装的上一段）
+uint32_t alloc_blocks_for_inode(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t inode_num,
+                                uint32_t logical_block_idx, uint32_t goal_block, uint32_t max_len, uint32_t* allocated_len) {
+    *allocated_len = 0;
+    uint32_t window_size = SIMPLEFS_RSV_WINDOW_MIN_BLOCKS;
+    auto window_it = context.rsv_windows.find(inode_num);
+    if (window_it != context.rsv_windows.end()) {
+        SimpleFS_ReservationWindow& window = window_it->second;
+        uint32_t from_block = goal_block != 0 ? goal_block : window.next_goal;
+        if (from_block >= window.start_block && from_block < window.end_block) {
+            // 长度不超过窗口的剩余部分，窗口内从目标块开始的空闲段最先满足
+            uint32_t in_window_len = std::min(max_len, window.end_block - from_block);
+            uint32_t run_len = 0;
+            uint32_t run_start = find_free_blocks(context, from_block, 1, in_window_len, &run_len, inode_num);
+            if (run_start >= window.start_block && run_start < window.end_block) {
+                uint32_t start_block = alloc_blocks(context, run_start, 1, run_len, allocated_len, inode_num);
+                if (start_block != 0) window.next_goal = std::max(window.next_goal, start_block + *allocated_len);
+                return start_block;
+            }
+        }
+        // 窗口已用完：在其后建立更大的新窗口
+        if (goal_block == 0) goal_block = window.next_goal;
+        window_size = std::min(window.size * 2, SIMPLEFS_RSV_WINDOW_MAX_BLOCKS);
+        release_reservation_window(context, inode_num);
+    }
+
+    if (goal_block == 0) goal_block = find_goal_block_for_inode(context, inode, inode_num, logical_block_idx);
+    if (logical_block_idx == 0) {
+        // 没有前驱块可以接续：目标组放不下整个窗口时，选一个有足够长空闲段的组
+        uint32_t goal_group = goal_block / context.sb.s_blocks_per_group;
+        uint32_t run_group = find_group_with_free_run(context, std::max(window_size, max_len), goal_group);
+        if (run_group != UINT32_MAX && run_group != goal_group) goal_block = run_group * context.sb.s_blocks_per_group;
+    }
+    uint32_t start_block = alloc_blocks(context, goal_block, 1, max_len, allocated_len, inode_num);
+    if (start_block == 0) return 0;
+
+    // 新窗口不跨越块组，也不与其他inode的窗口重叠
+    uint32_t group_idx = start_block / context.sb.s_blocks_per_group;
+    uint64_t group_end = static_cast<uint64_t>(group_idx) * context.sb.s_blocks_per_group + group_bit_count(context, group_idx);
+    uint64_t window_end = std::min<uint64_t>(static_cast<uint64_t>(start_block) + std::max(window_size, *allocated_len), group_end);
+    auto next_it = context.rsv_window_starts.upper_bound(start_block);
+    if (next_it != context.rsv_window_starts.end() && next_it->first < window_end) {
+        window_end = next_it->first;
+    }
+    window_end = std::max<uint64_t>(window_end, start_block + *allocated_len);
+    SimpleFS_ReservationWindow window;
+    window.start_block = start_block;
+    window.end_block = static_cast<uint32_t>(window_end);
+    window.next_goal = start_block + *allocated_len;
+    window.size = window_size;
+    context.rsv_windows[inode_num] = window;
+    context.rsv_window_starts[start_block] = inode_num;
+    return start_block;
 }
 
 // 释放数据块
@@ -168,6 +758,17 @@ void free_block(SimpleFS_Context& context, uint32_t block_num) {
     if (block_num == 0 || block_num >= context.sb.s_blocks_count) {
         return;
     }
+    if (block_is_shared(context, block_num)) {
+        // 共享块只减少一次引用
+        std::vector<uint32_t> shared_block = {block_num};
+        block_refs_put(context, shared_block);
+        return;
+    }
+    std::vector<uint32_t> freed_block = {block_num};
+    snapshot_retain_freed_blocks(context, freed_block);
+    if (freed_block.empty()) {
+        return; // 块转入快照
+    }
 
     uint32_t group_idx = block_num / context.sb.s_blocks_per_group;
     if (group_idx >= context.gdt.size()) {
@@ -176,18 +777,92 @@ void free_block(SimpleFS_Context& context, uint32_t block_num) {
     SimpleFS_GroupDesc& gd = context.gdt[group_idx];
     uint32_t bit_idx = block_num % context.sb.s_blocks_per_group;
 
-    std::vector<uint8_t> block_bitmap_data(SIMPLEFS_BLOCK_SIZE);
-    if (read_block(context.device_fd, gd.bg_block_bitmap, block_bitmap_data.data()) != 0) {
+    std::vector<uint8_t> block_bitmap_data(context.block_size);
+    if (read_block_bitmap(context, group_idx, block_bitmap_data.data()) != 0) {
         return;
     }
 
     clear_bitmap_bit(block_bitmap_data, bit_idx);
-    if (write_block(context.device_fd, gd.bg_block_bitmap, block_bitmap_data.data()) != 0) {
+    if (write_block_bitmap(context, group_idx, block_bitmap_data.data()) != 0) {
         return;
     }
 
     gd.bg_free_blocks_count++;
     context.sb.s_free_blocks_count++;
+    update_group_free_summary(context, group_idx, block_bitmap_data);
+    discard_note_freed(context, block_num, 1);
+}
+
+// 批量释放数据块
+// 先排序，使同一块组的块相邻；每个块组的位图只读写一次，连续的块按区间清除
+void free_blocks(SimpleFS_Context& context, std::vector<uint32_t>& block_nums) {
+    // 共享块只减少引用，从列表中移除
+    block_refs_put(context, block_nums);
+    if (block_nums.empty()) {
+        return;
+    }
+
+    std::sort(block_nums.begin(), block_nums.end());
+    block_nums.erase(std::unique(block_nums.begin(), block_nums.end()), block_nums.end());
+    // 最新快照仍需要的块转入快照，不归还
+    snapshot_retain_freed_blocks(context, block_nums);
+
+    std::vector<uint8_t> block_bitmap_data(context.block_size);
+    size_t idx = 0;
+    while (idx < block_nums.size()) {
+        uint32_t block_num = block_nums[idx];
+        if (block_num == 0 || block_num >= context.sb.s_blocks_count) {
+            idx++;
+            continue;
+        }
+
+        uint32_t group_idx = block_num / context.sb.s_blocks_per_group;
+        if (group_idx >= context.gdt.size()) {
+            idx++;
+            continue;
+        }
+        uint32_t group_start = group_idx * context.sb.s_blocks_per_group;
+        uint32_t group_end = std::min(group_start + context.sb.s_blocks_per_group, context.sb.s_blocks_count);
+
+        // 本组内的块区间 [idx, group_last_idx)
+        size_t group_last_idx = idx;
+        while (group_last_idx < block_nums.size() && block_nums[group_last_idx] < group_end) {
+            group_last_idx++;
+        }
+
+        SimpleFS_GroupDesc& gd = context.gdt[group_idx];
+        if (read_block_bitmap(context, group_idx, block_bitmap_data.data()) != 0) {
+            idx = group_last_idx;
+            continue;
+        }
+
+        uint32_t freed_in_group = 0;
+        const size_t group_first_idx = idx;
+        while (idx < group_last_idx) {
+            // 合并连续块为一个区间
+            uint32_t run_start = block_nums[idx];
+            uint32_t run_len = 1;
+            while (idx + run_len < group_last_idx && block_nums[idx + run_len] == run_start + run_len) {
+                run_len++;
+            }
+            freed_in_group += clear_bitmap_range(block_bitmap_data, run_start - group_start, run_len);
+            idx += run_len;
+        }
+
+        if (freed_in_group == 0) {
+            continue;
+        }
+        if (write_block_bitmap(context, group_idx, block_bitmap_data.data()) != 0) {
+            continue;
+        }
+
+        gd.bg_free_blocks_count += freed_in_group;
+        context.sb.s_free_blocks_count += freed_in_group;
+        update_group_free_summary(context, group_idx, block_bitmap_data);
+        for (size_t i = group_first_idx; i < group_last_idx; ++i) {
+            discard_note_freed(context, block_nums[i], 1);
+        }
+    }
 }
 
 // 将inode数据写入磁盘
@@ -205,10 +880,11 @@ int write_inode_to_disk(SimpleFS_Context& context, uint32_t inode_num, const Sim
     const SimpleFS_GroupDesc& gd = context.gdt[group_idx];
 
     uint32_t inode_offset_in_group = (inode_num - 1) % context.sb.s_inodes_per_group;
-    uint32_t inodes_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(SimpleFS_Inode);
+    uint32_t inode_size = context.sb.s_inode_size;
+    uint32_t inodes_per_block = context.block_size / inode_size;
 
     uint32_t block_num_in_table = inode_offset_in_group / inodes_per_block;
-    uint32_t offset_within_block = (inode_offset_in_group % inodes_per_block) * sizeof(SimpleFS_Inode);
+    uint32_t offset_within_block = (inode_offset_in_group % inodes_per_block) * inode_size;
 
     uint32_t absolute_block_rw = gd.bg_inode_table + block_num_in_table;
 
@@ -217,12 +893,22 @@ int write_inode_to_disk(SimpleFS_Context& context, uint32_t inode_num, const Sim
         return -EIO;
     }
 
-    std::vector<uint8_t> block_buffer(SIMPLEFS_BLOCK_SIZE);
+    std::vector<uint8_t> block_buffer(context.block_size);
     if (read_block(context.device_fd, absolute_block_rw, block_buffer.data()) != 0) {
         return -EIO;
     }
 
-    std::memcpy(block_buffer.data() + offset_within_block, inode_data, sizeof(SimpleFS_Inode));
+    std::memcpy(block_buffer.data() + offset_within_block, inode_data, inode_size);
+    if (inode_size > SIMPLEFS_INODE_SIZE) {
+        // 扩展字段大小由文件系统维护，调用者无需设置
+        uint16_t extra_isize = SIMPLEFS_INODE_EXTRA_ISIZE;
+        std::memcpy(block_buffer.data() + offset_within_block + offsetof(SimpleFS_Inode, i_extra_isize),
+                    &extra_isize, sizeof(extra_isize));
+    }
+    if (has_metadata_csum(context.sb)) {
+        uint32_t csum = inode_checksum(inode_num, block_buffer.data() + offset_within_block, inode_size);
+        std::memcpy(block_buffer.data() + offset_within_block + offsetof(SimpleFS_Inode, i_checksum), &csum, sizeof(csum));
+    }
 
     if (write_block(context.device_fd, absolute_block_rw, block_buffer.data()) != 0) {
         return -EIO;
@@ -245,10 +931,11 @@ int read_inode_from_disk(SimpleFS_Context& context, uint32_t inode_num, SimpleFS
     const SimpleFS_GroupDesc& gd = context.gdt[group_idx];
 
     uint32_t inode_offset_in_group = (inode_num - 1) % context.sb.s_inodes_per_group;
-    uint32_t inodes_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(SimpleFS_Inode);
+    uint32_t inode_size = context.sb.s_inode_size;
+    uint32_t inodes_per_block = context.block_size / inode_size;
 
     uint32_t block_num_in_table = inode_offset_in_group / inodes_per_block;
-    uint32_t offset_within_block = (inode_offset_in_group % inodes_per_block) * sizeof(SimpleFS_Inode);
+    uint32_t offset_within_block = (inode_offset_in_group % inodes_per_block) * inode_size;
 
     uint32_t absolute_block_to_read = gd.bg_inode_table + block_num_in_table;
 
@@ -257,16 +944,182 @@ int read_inode_from_disk(SimpleFS_Context& context, uint32_t inode_num, SimpleFS
         return -EIO;
     }
 
-    std::vector<uint8_t> block_buffer(SIMPLEFS_BLOCK_SIZE);
+    std::vector<uint8_t> block_buffer(context.block_size);
 
     if (read_block(context.device_fd, absolute_block_to_read, block_buffer.data()) != 0) {
         return -EIO;
     }
+    if (has_metadata_csum(context.sb) &&
+        !verify_inode_checksum(inode_num, block_buffer.data() + offset_within_block, inode_size)) {
+        std::cerr << "inode " << inode_num << " 校验和不匹配" << std::endl;
+        errno = EIO;
+        return -EIO;
+    }
 
-    std::memcpy(inode_struct, block_buffer.data() + offset_within_block, sizeof(SimpleFS_Inode));
+    // 磁盘上没有的扩展字段读为零
+    std::memset(inode_struct, 0, sizeof(SimpleFS_Inode));
+    std::memcpy(inode_struct, block_buffer.data() + offset_within_block, inode_size);
     return 0;
 }
 
+struct timespec current_inode_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts;
+}
+
+void set_inode_time(SimpleFS_Inode* inode, unsigned which, const struct timespec& ts) {
+    uint32_t sec = static_cast<uint32_t>(ts.tv_sec);
+    uint32_t nsec = static_cast<uint32_t>(ts.tv_nsec);
+    if (which & SIMPLEFS_TIME_ATIME) { inode->i_atime = sec; inode->i_atime_nsec = nsec; }
+    if (which & SIMPLEFS_TIME_MTIME) { inode->i_mtime = sec; inode->i_mtime_nsec = nsec; }
+    if (which & SIMPLEFS_TIME_CTIME) { inode->i_ctime = sec; inode->i_ctime_nsec = nsec; }
+    if (which & SIMPLEFS_TIME_CRTIME) { inode->i_crtime = sec; inode->i_crtime_nsec = nsec; }
+}
+
+void touch_inode_times(SimpleFS_Inode* inode, unsigned which) {
+    set_inode_time(inode, which, current_inode_time());
+}
+
+
+// 在目录块的目录项链 [0, entries_end) 中放置新目录项，放不下时返回false且不修改block_data
+static bool place_dir_entry(uint8_t* block_data, uint32_t entries_end, const std::string& entry_name,
+                            uint32_t child_inode_num, uint8_t file_type) {
+    uint16_t needed_len_for_new_entry = calculate_dir_entry_len(entry_name.length());
+    uint16_t min_rec_len_for_empty = calculate_dir_entry_len(0);
+
+    uint32_t current_offset = 0;
+    while(current_offset < entries_end) {
+        SimpleFS_DirEntry* dir_entry = reinterpret_cast<SimpleFS_DirEntry*>(block_data + current_offset);
+
+        if (dir_entry_rec_len(dir_entry) == 0) { 
+             if (current_offset == 0 && entries_end >= needed_len_for_new_entry) {
+                dir_entry->inode = child_inode_num;
+                dir_entry->name_len = static_cast<uint8_t>(entry_name.length());
+                dir_entry->file_type = file_type;
+                std::strncpy(dir_entry->name, entry_name.c_str(), entry_name.length());
+                set_dir_entry_rec_len(dir_entry, entries_end);
+                return true;
+             }
+             return false;
+        }
+        
+        uint16_t actual_len_of_current_entry = calculate_dir_entry_len(dir_entry->name_len);
+
+        // 尝试使用空条目
+        if (dir_entry->inode == 0 && dir_entry_rec_len(dir_entry) >= needed_len_for_new_entry) {
+            uint32_t original_empty_rec_len = dir_entry_rec_len(dir_entry);
+            
+            dir_entry->inode = child_inode_num;
+            dir_entry->name_len = static_cast<uint8_t>(entry_name.length());
+            dir_entry->file_type = file_type;
+            std::strncpy(dir_entry->name, entry_name.c_str(), entry_name.length());
+            set_dir_entry_rec_len(dir_entry, needed_len_for_new_entry);
+
+            uint32_t space_left_after_new_entry = original_empty_rec_len - needed_len_for_new_entry;
+
+            if (space_left_after_new_entry > 0) {
+                if (space_left_after_new_entry < min_rec_len_for_empty) {
+                    set_dir_entry_rec_len(dir_entry, dir_entry_rec_len(dir_entry) + space_left_after_new_entry);
+                } else {
+                    SimpleFS_DirEntry* remainder_entry = reinterpret_cast<SimpleFS_DirEntry*>(block_data + current_offset + needed_len_for_new_entry);
+                    remainder_entry->inode = 0;
+                    remainder_entry->name_len = 0; 
+                    remainder_entry->file_type = 0;
+                    set_dir_entry_rec_len(remainder_entry, space_left_after_new_entry);
+                }
+            }
+            return true;
+        }
+
+        // 尝试使用现有活动条目的空白填充
+        uint32_t original_rec_len_of_active_entry = dir_entry_rec_len(dir_entry); 
+        if (dir_entry->inode != 0 && (original_rec_len_of_active_entry - actual_len_of_current_entry >= needed_len_for_new_entry)) {
+            uint32_t padding_available = original_rec_len_of_active_entry - actual_len_of_current_entry;
+            
+            set_dir_entry_rec_len(dir_entry, actual_len_of_current_entry); 
+
+            SimpleFS_DirEntry* new_entry_spot = reinterpret_cast<SimpleFS_DirEntry*>(block_data + current_offset + actual_len_of_current_entry);
+            new_entry_spot->inode = child_inode_num;
+            new_entry_spot->name_len = static_cast<uint8_t>(entry_name.length());
+            new_entry_spot->file_type = file_type;
+            std::strncpy(new_entry_spot->name, entry_name.c_str(), entry_name.length());
+            set_dir_entry_rec_len(new_entry_spot, needed_len_for_new_entry);
+
+            uint32_t space_left_for_final_empty = padding_available - needed_len_for_new_entry;
+
+            if (space_left_for_final_empty > 0) {
+                if (space_left_for_final_empty < min_rec_len_for_empty) {
+                    set_dir_entry_rec_len(new_entry_spot, dir_entry_rec_len(new_entry_spot) + space_left_for_final_empty);
+                } else {
+                    SimpleFS_DirEntry* final_empty_entry = reinterpret_cast<SimpleFS_DirEntry*>( (uint8_t*)new_entry_spot + needed_len_for_new_entry );
+                    final_empty_entry->inode = 0;
+                    final_empty_entry->name_len = 0;
+                    final_empty_entry->file_type = 0; 
+                    set_dir_entry_rec_len(final_empty_entry, space_left_for_final_empty);
+                }
+            }
+            return true;
+        }
+        
+        // 如果这是块中的最后一个条目
+        if (current_offset + dir_entry_rec_len(dir_entry) >= entries_end) {
+            if (dir_entry->inode != 0 && (current_offset + actual_len_of_current_entry + needed_len_for_new_entry <= entries_end) ) {
+                 set_dir_entry_rec_len(dir_entry, actual_len_of_current_entry); 
+
+                 SimpleFS_DirEntry* new_entry_location = reinterpret_cast<SimpleFS_DirEntry*>(block_data + current_offset + actual_len_of_current_entry);
+                 new_entry_location->inode = child_inode_num;
+                 new_entry_location->name_len = static_cast<uint8_t>(entry_name.length());
+                 new_entry_location->file_type = file_type;
+                 std::strncpy(new_entry_location->name, entry_name.c_str(), entry_name.length());
+                 set_dir_entry_rec_len(new_entry_location, entries_end - (current_offset + actual_len_of_current_entry));
+                 return true;
+            }
+            return false; 
+        }
+        current_offset += dir_entry_rec_len(dir_entry);
+    } 
+    return false;
+}
+
+// 内联目录转为块存储：目录项链原样移入新分配的逻辑块0，最后一个目录项延伸到块的目录项链末尾
+// 调用者之后写回inode；失败时恢复内联状态，返回0或负的错误码
+static int promote_inline_dir(SimpleFS_Context& context, SimpleFS_Inode* dir_inode, uint32_t dir_inode_num) {
+    const uint32_t inline_capacity = inode_inline_capacity(context);
+    std::vector<uint8_t> block_buffer(context.block_size, 0);
+    std::memcpy(block_buffer.data(), inode_inline_data(dir_inode), inline_capacity);
+    uint32_t last_offset = 0;
+    for (uint32_t offset = 0; offset < inline_capacity;) {
+        uint32_t rec_len = dir_entry_rec_len(reinterpret_cast<SimpleFS_DirEntry*>(block_buffer.data() + offset));
+        if (rec_len == 0 || offset + rec_len > inline_capacity) {
+            errno = EIO;
+            return -EIO;
+        }
+        last_offset = offset;
+        offset += rec_len;
+    }
+    set_dir_entry_rec_len(reinterpret_cast<SimpleFS_DirEntry*>(block_buffer.data() + last_offset),
+                          dir_block_entries_end(context) - last_offset);
+
+    std::vector<uint8_t> saved_data(inode_inline_data(dir_inode), inode_inline_data(dir_inode) + SIMPLEFS_INLINE_DATA_MAX);
+    std::memset(inode_inline_data(dir_inode), 0, SIMPLEFS_INLINE_DATA_MAX);
+    dir_inode->i_flags &= ~SIMPLEFS_INODE_FL_INLINE_DATA;
+    errno = 0;
+    uint32_t block_num = get_or_alloc_dir_block(context, dir_inode, dir_inode_num, 0);
+    if (block_num == 0 || write_dir_block(context, block_num, block_buffer.data()) != 0) {
+        int err = errno ? errno : EIO;
+        if (block_num != 0) {
+            free_block(context, block_num);
+            dir_inode->i_blocks -= context.block_size / 512;
+        }
+        std::memcpy(inode_inline_data(dir_inode), saved_data.data(), SIMPLEFS_INLINE_DATA_MAX);
+        dir_inode->i_flags |= SIMPLEFS_INODE_FL_INLINE_DATA;
+        errno = err;
+        return -err;
+    }
+    dir_inode->i_size = context.block_size;
+    return 0;
+}
 
 // 向目录中添加文件项
 int add_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, uint32_t parent_inode_num,
@@ -276,17 +1129,25 @@ int add_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, uint3
         return -ENAMETOOLONG;
     }
 
-    uint16_t needed_len_for_new_entry = calculate_dir_entry_len(entry_name.length());
-    uint16_t min_rec_len_for_empty = calculate_dir_entry_len(0);
+    if (inode_has_inline_data(parent_inode)) {
+        if (place_dir_entry(inode_inline_data(parent_inode), inode_inline_capacity(context), entry_name,
+                            child_inode_num, file_type)) {
+            touch_inode_times(parent_inode, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
+            return write_inode_to_disk(context, parent_inode_num, parent_inode) != 0 ? -EIO : 0;
+        }
+        // 内联数据区放不下，转为块存储后按普通目录添加
+        int promote_res = promote_inline_dir(context, parent_inode, parent_inode_num);
+        if (promote_res != 0) return promote_res;
+    }
 
-    std::vector<uint8_t> dir_block_data_buffer(SIMPLEFS_BLOCK_SIZE);
-    uint32_t pointers_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t);
+    uint32_t entries_end = dir_block_entries_end(context);
+
+    std::vector<uint8_t> dir_block_data_buffer(context.block_size);
+    uint32_t pointers_per_block = context.block_size / sizeof(uint32_t);
     uint32_t max_logical_blocks = SIMPLEFS_NUM_DIRECT_BLOCKS +
                                  pointers_per_block + 
                                  pointers_per_block * pointers_per_block + 
                                  pointers_per_block * pointers_per_block * pointers_per_block;
-    
-    bool entry_placed = false;
 
     for (uint32_t logical_block_idx = 0; logical_block_idx < max_logical_blocks; ++logical_block_idx) {
         uint32_t current_physical_block = get_or_alloc_dir_block(context, parent_inode, parent_inode_num, logical_block_idx);
@@ -295,124 +1156,27 @@ int add_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, uint3
             return -errno;
         }
 
-        if (read_block(context.device_fd, current_physical_block, dir_block_data_buffer.data()) != 0) {
-            errno = EIO;
+        if (read_dir_block(context, current_physical_block, dir_block_data_buffer.data()) != 0) {
             return -EIO;
         }
 
-        uint16_t current_offset = 0;
-        while(current_offset < SIMPLEFS_BLOCK_SIZE) {
-            SimpleFS_DirEntry* dir_entry = reinterpret_cast<SimpleFS_DirEntry*>(dir_block_data_buffer.data() + current_offset);
-
-            if (dir_entry->rec_len == 0) { 
-                 if (current_offset == 0 && SIMPLEFS_BLOCK_SIZE >= needed_len_for_new_entry) {
-                    dir_entry->inode = child_inode_num;
-                    dir_entry->name_len = static_cast<uint8_t>(entry_name.length());
-                    dir_entry->file_type = file_type;
-                    std::strncpy(dir_entry->name, entry_name.c_str(), entry_name.length());
-                    dir_entry->rec_len = SIMPLEFS_BLOCK_SIZE;
-                    entry_placed = true;
-                    break;
-                 }
-                 goto next_block; 
-            }
-            
-            uint16_t actual_len_of_current_entry = calculate_dir_entry_len(dir_entry->name_len);
-
-            // 尝试使用空条目
-            if (dir_entry->inode == 0 && dir_entry->rec_len >= needed_len_for_new_entry) {
-                uint16_t original_empty_rec_len = dir_entry->rec_len;
-                
-                dir_entry->inode = child_inode_num;
-                dir_entry->name_len = static_cast<uint8_t>(entry_name.length());
-                dir_entry->file_type = file_type;
-                std::strncpy(dir_entry->name, entry_name.c_str(), entry_name.length());
-                dir_entry->rec_len = needed_len_for_new_entry;
-
-                uint16_t space_left_after_new_entry = original_empty_rec_len - needed_len_for_new_entry;
-
-                if (space_left_after_new_entry > 0) {
-                    if (space_left_after_new_entry < min_rec_len_for_empty) {
-                        dir_entry->rec_len += space_left_after_new_entry;
-                    } else {
-                        SimpleFS_DirEntry* remainder_entry = reinterpret_cast<SimpleFS_DirEntry*>(dir_block_data_buffer.data() + current_offset + needed_len_for_new_entry);
-                        remainder_entry->inode = 0;
-                        remainder_entry->name_len = 0; 
-                        remainder_entry->file_type = 0;
-                        remainder_entry->rec_len = space_left_after_new_entry;
-                    }
-                }
-                entry_placed = true;
-                break;
-            }
-
-            // 尝试使用现有活动条目的空白填充
-            uint16_t original_rec_len_of_active_entry = dir_entry->rec_len; 
-            if (dir_entry->inode != 0 && (original_rec_len_of_active_entry - actual_len_of_current_entry >= needed_len_for_new_entry)) {
-                uint16_t padding_available = original_rec_len_of_active_entry - actual_len_of_current_entry;
-                
-                dir_entry->rec_len = actual_len_of_current_entry; 
-
-                SimpleFS_DirEntry* new_entry_spot = reinterpret_cast<SimpleFS_DirEntry*>(dir_block_data_buffer.data() + current_offset + actual_len_of_current_entry);
-                new_entry_spot->inode = child_inode_num;
-                new_entry_spot->name_len = static_cast<uint8_t>(entry_name.length());
-                new_entry_spot->file_type = file_type;
-                std::strncpy(new_entry_spot->name, entry_name.c_str(), entry_name.length());
-                new_entry_spot->rec_len = needed_len_for_new_entry;
-
-                uint16_t space_left_for_final_empty = padding_available - needed_len_for_new_entry;
-
-                if (space_left_for_final_empty > 0) {
-                    if (space_left_for_final_empty < min_rec_len_for_empty) {
-                        new_entry_spot->rec_len += space_left_for_final_empty;
-                    } else {
-                        SimpleFS_DirEntry* final_empty_entry = reinterpret_cast<SimpleFS_DirEntry*>( (uint8_t*)new_entry_spot + needed_len_for_new_entry );
-                        final_empty_entry->inode = 0;
-                        final_empty_entry->name_len = 0;
-                        final_empty_entry->file_type = 0; 
-                        final_empty_entry->rec_len = space_left_for_final_empty;
-                    }
-                }
-                entry_placed = true;
-                break;
-            }
-            
-            // 如果这是块中的最后一个条目
-            if (current_offset + dir_entry->rec_len >= SIMPLEFS_BLOCK_SIZE) {
-                if (dir_entry->inode != 0 && (current_offset + actual_len_of_current_entry + needed_len_for_new_entry <= SIMPLEFS_BLOCK_SIZE) ) {
-                     dir_entry->rec_len = actual_len_of_current_entry; 
-
-                     SimpleFS_DirEntry* new_entry_location = reinterpret_cast<SimpleFS_DirEntry*>(dir_block_data_buffer.data() + current_offset + actual_len_of_current_entry);
-                     new_entry_location->inode = child_inode_num;
-                     new_entry_location->name_len = static_cast<uint8_t>(entry_name.length());
-                     new_entry_location->file_type = file_type;
-                     std::strncpy(new_entry_location->name, entry_name.c_str(), entry_name.length());
-                     new_entry_location->rec_len = SIMPLEFS_BLOCK_SIZE - (current_offset + actual_len_of_current_entry);
-                     entry_placed = true;
-                }
-                break; 
-            }
-            current_offset += dir_entry->rec_len;
-        } 
-
-        if (entry_placed) {
-            if (write_block(context.device_fd, current_physical_block, dir_block_data_buffer.data()) != 0) {
-                errno = EIO; return -EIO;
+        if (place_dir_entry(dir_block_data_buffer.data(), entries_end, entry_name, child_inode_num, file_type)) {
+            if (write_dir_block(context, current_physical_block, dir_block_data_buffer.data()) != 0) {
+                return -EIO;
             }
             
             // 更新父目录大小
-            uint32_t size_if_this_block_is_last = (logical_block_idx + 1) * SIMPLEFS_BLOCK_SIZE;
+            uint32_t size_if_this_block_is_last = (logical_block_idx + 1) * context.block_size;
             if (parent_inode->i_size < size_if_this_block_is_last) {
                  parent_inode->i_size = size_if_this_block_is_last;
             }
 
-            parent_inode->i_mtime = parent_inode->i_ctime = time(nullptr);
+            touch_inode_times(parent_inode, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
             if (write_inode_to_disk(context, parent_inode_num, parent_inode) != 0) {
                  return -EIO; 
             }
             return 0; 
         }
-        next_block:; 
     } 
 
     errno = ENOSPC;
@@ -426,39 +1190,38 @@ int remove_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, ui
         return -EINVAL;
     }
 
-    std::vector<uint8_t> dir_block_data_buffer(SIMPLEFS_BLOCK_SIZE);
+    std::vector<uint8_t> dir_block_data_buffer(context.block_size);
     bool entry_found_and_removed = false;
 
-    uint32_t num_data_blocks_in_dir = (parent_inode->i_size + SIMPLEFS_BLOCK_SIZE - 1) / SIMPLEFS_BLOCK_SIZE;
+    uint32_t num_data_blocks_in_dir = (parent_inode->i_size + context.block_size - 1) / context.block_size;
     if (parent_inode->i_size == 0) num_data_blocks_in_dir = 0;
 
     for (uint32_t logical_block_idx = 0; logical_block_idx < num_data_blocks_in_dir; ++logical_block_idx) {
-        uint32_t current_physical_block = map_logical_to_physical_block(context, parent_inode, logical_block_idx);
-        
-        if (current_physical_block == 0) {
-            continue;
-        }
-
-        if (read_block(context.device_fd, current_physical_block, dir_block_data_buffer.data()) != 0) {
-            errno = EIO;
+        uint32_t current_physical_block = 0;
+        int read_res = read_dir_logical_block(context, parent_inode, logical_block_idx, dir_block_data_buffer.data(),
+                                              &current_physical_block);
+        if (read_res < 0) {
             return -EIO;
         }
+        if (read_res > 0) {
+            continue;
+        }
 
-        uint16_t current_offset = 0;
+        uint32_t current_offset = 0;
         SimpleFS_DirEntry* prev_entry = nullptr;
 
         // 计算此块中的有效数据范围
-        uint32_t block_start_byte_offset = logical_block_idx * SIMPLEFS_BLOCK_SIZE;
-        uint32_t max_offset_in_block = SIMPLEFS_BLOCK_SIZE;
-        if (block_start_byte_offset + SIMPLEFS_BLOCK_SIZE > parent_inode->i_size) {
-             max_offset_in_block = parent_inode->i_size % SIMPLEFS_BLOCK_SIZE;
-             if (max_offset_in_block == 0 && parent_inode->i_size > 0) max_offset_in_block = SIMPLEFS_BLOCK_SIZE;
+        uint32_t block_start_byte_offset = logical_block_idx * context.block_size;
+        uint32_t max_offset_in_block = context.block_size;
+        if (block_start_byte_offset + context.block_size > parent_inode->i_size) {
+             max_offset_in_block = parent_inode->i_size % context.block_size;
+             if (max_offset_in_block == 0 && parent_inode->i_size > 0) max_offset_in_block = context.block_size;
         }
 
         while (current_offset < max_offset_in_block) {
             SimpleFS_DirEntry* current_entry = reinterpret_cast<SimpleFS_DirEntry*>(dir_block_data_buffer.data() + current_offset);
 
-            if (current_entry->rec_len == 0) {
+            if (dir_entry_rec_len(current_entry) == 0) {
                 break; 
             }
              uint16_t min_possible_rec_len = calculate_dir_entry_len(0);
@@ -466,7 +1229,7 @@ int remove_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, ui
                 min_possible_rec_len = calculate_dir_entry_len(current_entry->name_len);
              }
 
-            if (current_entry->rec_len < min_possible_rec_len || (current_offset + current_entry->rec_len > SIMPLEFS_BLOCK_SIZE) ) {
+            if (dir_entry_rec_len(current_entry) < min_possible_rec_len || (current_offset + dir_entry_rec_len(current_entry) > context.block_size) ) {
                  errno = EIO;
                  return -EIO;
             }
@@ -478,7 +1241,7 @@ int remove_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, ui
                     // 找到要删除的条目
                     if (prev_entry != nullptr) {
                         // 将此条目的长度合并到前一个条目
-                        prev_entry->rec_len += current_entry->rec_len;
+                        set_dir_entry_rec_len(prev_entry, dir_entry_rec_len(prev_entry) + dir_entry_rec_len(current_entry));
                     } else {
                         // 这是块中的第一个条目，标记为未使用
                         current_entry->inode = 0;
@@ -489,16 +1252,15 @@ int remove_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, ui
             }
 
             prev_entry = current_entry;
-            current_offset += current_entry->rec_len;
+            current_offset += dir_entry_rec_len(current_entry);
         }
 
         if (entry_found_and_removed) {
-            if (write_block(context.device_fd, current_physical_block, dir_block_data_buffer.data()) != 0) {
-                errno = EIO;
+            if (write_dir_logical_block(context, parent_inode, current_physical_block, dir_block_data_buffer.data()) != 0) {
                 return -EIO;
             }
             
-            parent_inode->i_mtime = parent_inode->i_ctime = time(nullptr);
+            touch_inode_times(parent_inode, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
             if (write_inode_to_disk(context, parent_inode_num, parent_inode) != 0) {
                  return -EIO; 
             }
@@ -511,10 +1273,91 @@ int remove_dir_entry(SimpleFS_Context& context, SimpleFS_Inode* parent_inode, ui
 }
 
 
+// 在目录中查找名为entry_name的活动目录项，找到时block_buffer为其所在块的内容
+// 返回0并通过physical_block和entry_offset返回位置（内联目录的physical_block为0），找不到返回-ENOENT
+static int locate_dir_entry(SimpleFS_Context& context, const SimpleFS_Inode* dir_inode, const std::string& entry_name,
+                            std::vector<uint8_t>& block_buffer, uint32_t* physical_block, uint32_t* entry_offset) {
+    block_buffer.resize(context.block_size);
+    uint32_t num_data_blocks_in_dir = (dir_inode->i_size + context.block_size - 1) / context.block_size;
+
+    for (uint32_t logical_block_idx = 0; logical_block_idx < num_data_blocks_in_dir; ++logical_block_idx) {
+        uint32_t current_physical_block = 0;
+        int read_res = read_dir_logical_block(context, dir_inode, logical_block_idx, block_buffer.data(),
+                                              &current_physical_block);
+        if (read_res < 0) {
+            return -EIO;
+        }
+        if (read_res > 0) {
+            continue;
+        }
+
+        uint32_t current_offset = 0;
+        while (current_offset < context.block_size) {
+            SimpleFS_DirEntry* current_entry = reinterpret_cast<SimpleFS_DirEntry*>(block_buffer.data() + current_offset);
+            uint32_t rec_len = dir_entry_rec_len(current_entry);
+            if (rec_len == 0 || current_offset + rec_len > context.block_size) {
+                break;
+            }
+            if (current_entry->inode != 0 && entry_name.length() == current_entry->name_len &&
+                strncmp(current_entry->name, entry_name.c_str(), current_entry->name_len) == 0) {
+                *physical_block = current_physical_block;
+                *entry_offset = current_offset;
+                return 0;
+            }
+            current_offset += rec_len;
+        }
+    }
+
+    errno = ENOENT;
+    return -ENOENT;
+}
+
+uint32_t lookup_dir_entry(SimpleFS_Context& context, const SimpleFS_Inode* dir_inode, const std::string& entry_name) {
+    std::vector<uint8_t> block_buffer;
+    uint32_t physical_block = 0;
+    uint32_t entry_offset = 0;
+    if (locate_dir_entry(context, dir_inode, entry_name, block_buffer, &physical_block, &entry_offset) != 0) {
+        return 0;
+    }
+    return reinterpret_cast<SimpleFS_DirEntry*>(block_buffer.data() + entry_offset)->inode;
+}
+
+int set_dir_entry_inode(SimpleFS_Context& context, SimpleFS_Inode* dir_inode, uint32_t dir_inode_num,
+                        const std::string& entry_name, uint32_t new_inode_num, uint8_t file_type) {
+    std::vector<uint8_t> block_buffer;
+    uint32_t physical_block = 0;
+    uint32_t entry_offset = 0;
+    int res = locate_dir_entry(context, dir_inode, entry_name, block_buffer, &physical_block, &entry_offset);
+    if (res != 0) {
+        return res;
+    }
+
+    // 只改写目录项的inode号和类型，名字和rec_len不变，单块写入即完成替换（内联目录随inode写入）
+    SimpleFS_DirEntry* entry = reinterpret_cast<SimpleFS_DirEntry*>(block_buffer.data() + entry_offset);
+    entry->inode = new_inode_num;
+    entry->file_type = file_type;
+    if (write_dir_logical_block(context, dir_inode, physical_block, block_buffer.data()) != 0) {
+        return -EIO;
+    }
+
+    touch_inode_times(dir_inode, SIMPLEFS_TIME_MTIME | SIMPLEFS_TIME_CTIME);
+    if (write_inode_to_disk(context, dir_inode_num, dir_inode) != 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
 // 同步文件系统元数据到磁盘
 void sync_fs_metadata(SimpleFS_Context& context) {
+    if (has_metadata_csum(context.sb)) {
+        for (uint32_t group_idx = 0; group_idx < context.gdt.size(); ++group_idx) {
+            context.gdt[group_idx].bg_checksum = group_desc_checksum(group_idx, &context.gdt[group_idx]);
+        }
+        context.sb.s_checksum = superblock_checksum(&context.sb);
+    }
+
     // 写入超级块
-    std::vector<uint8_t> sb_block_buffer(SIMPLEFS_BLOCK_SIZE, 0);
+    std::vector<uint8_t> sb_block_buffer(context.block_size, 0);
     std::memcpy(sb_block_buffer.data(), &(context.sb), sizeof(SimpleFS_SuperBlock));
     if (write_block(context.device_fd, 1, sb_block_buffer.data()) != 0) {
         return;
@@ -526,17 +1369,17 @@ void sync_fs_metadata(SimpleFS_Context& context) {
     }
 
     uint32_t gdt_size_bytes = context.gdt.size() * sizeof(SimpleFS_GroupDesc);
-    uint32_t gdt_blocks_count = static_cast<uint32_t>(std::ceil(static_cast<double>(gdt_size_bytes) / SIMPLEFS_BLOCK_SIZE));
+    uint32_t gdt_blocks_count = static_cast<uint32_t>(std::ceil(static_cast<double>(gdt_size_bytes) / context.block_size));
     uint32_t gdt_start_block = 1 + 1; // 超级块在块1，GDT从块2开始
 
-    std::vector<uint8_t> gdt_one_block_buffer(SIMPLEFS_BLOCK_SIZE, 0);
+    std::vector<uint8_t> gdt_one_block_buffer(context.block_size, 0);
     const uint8_t* gdt_data_ptr = reinterpret_cast<const uint8_t*>(context.gdt.data());
 
     for (uint32_t i = 0; i < gdt_blocks_count; ++i) {
         std::fill(gdt_one_block_buffer.begin(), gdt_one_block_buffer.end(), 0);
 
-        uint32_t bytes_to_copy_this_block = SIMPLEFS_BLOCK_SIZE;
-        uint32_t offset_in_gdt_data = i * SIMPLEFS_BLOCK_SIZE;
+        uint32_t bytes_to_copy_this_block = context.block_size;
+        uint32_t offset_in_gdt_data = i * context.block_size;
 
         if (offset_in_gdt_data >= gdt_size_bytes) break;
 
@@ -560,8 +1403,8 @@ void sync_fs_metadata(SimpleFS_Context& context) {
         
         for (uint32_t i = 0; i < gdt_blocks_count; ++i) {
             std::fill(gdt_one_block_buffer.begin(), gdt_one_block_buffer.end(), 0);
-            uint32_t bytes_to_copy_this_block = SIMPLEFS_BLOCK_SIZE;
-            uint32_t offset_in_gdt_data = i * SIMPLEFS_BLOCK_SIZE;
+            uint32_t bytes_to_copy_this_block = context.block_size;
+            uint32_t offset_in_gdt_data = i * context.block_size;
             if (offset_in_gdt_data >= gdt_size_bytes) break;
             if (offset_in_gdt_data + bytes_to_copy_this_block > gdt_size_bytes) {
                 bytes_to_copy_this_block = gdt_size_bytes - offset_in_gdt_data;
@@ -632,32 +1475,59 @@ int check_access(const struct fuse_context* caller_context, const SimpleFS_Inode
     return 0;
 }
 
-// 递归释放块树结构
-static void free_block_tree_recursive(SimpleFS_Context& context, uint32_t block_num, int level) {
+// 统计子树中的块数（数据块和间接块），只读取间接块
+static uint64_t count_block_tree(SimpleFS_Context& context, uint32_t block_num, int level) {
+    if (block_num == 0 || block_num == SIMPLEFS_BLOCK_COMPRESSED) {
+        return 0;
+    }
+    if (level == 0) {
+        return 1;
+    }
+    std::vector<uint32_t> indirect_block_content(context.block_size / sizeof(uint32_t));
+    if (read_block(context.device_fd, block_num, indirect_block_content.data()) != 0) {
+        return 1;
+    }
+    uint64_t count = 1;
+    for (uint32_t child_block_num : indirect_block_content) {
+        count += count_block_tree(context, child_block_num, level - 1);
+    }
+    return count;
+}
+
+// 递归收集块树中的所有块（数据块和间接块），返回从文件映射中移除的块数
+// 共享的间接块只需减少它自己的引用，其下的块仍由其他文件引用，不再展开
+static uint64_t collect_block_tree_recursive(SimpleFS_Context& context, uint32_t block_num, int level, std::vector<uint32_t>& out_blocks) {
     if (block_num == 0) {
-        return;
+        return 0;
+    }
+
+    if (level == 0) { // 数据块（压缩簇标记不是块）
+        if (block_num == SIMPLEFS_BLOCK_COMPRESSED) return 0;
+        out_blocks.push_back(block_num & SIMPLEFS_BLOCK_PTR_MASK);
+        return 1;
     }
 
-    if (level == 0) { // 数据块
-        free_block(context, block_num);
-        return;
+    if (block_is_shared(context, block_num)) {
+        out_blocks.push_back(block_num);
+        return count_block_tree(context, block_num, level);
     }
 
-    // 间接块，需要读取并释放其子块
-    std::vector<uint32_t> indirect_block_content(SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t));
+    // 间接块，需要读取并收集其子块
+    std::vector<uint32_t> indirect_block_content(context.block_size / sizeof(uint32_t));
     if (read_block(context.device_fd, block_num, indirect_block_content.data()) != 0) {
-        return;
+        return 0;
     }
 
-    // 递归释放子块
+    uint64_t count = 0;
     for (uint32_t child_block_num : indirect_block_content) {
         if (child_block_num != 0) {
-            free_block_tree_recursive(context, child_block_num, level - 1);
+            count += collect_block_tree_recursive(context, child_block_num, level - 1, out_blocks);
         }
     }
 
-    // 释放间接块本身
-    free_block(context, block_num);
+    // 间接块本身
+    out_blocks.push_back(block_num);
+    return count + 1;
 }
 
 // 释放inode关联的所有数据块
@@ -665,18 +1535,27 @@ void free_all_inode_blocks(SimpleFS_Context& context, SimpleFS_Inode* inode) {
     if (!inode) {
         return;
     }
+    if (inode_has_inline_data(inode)) {
+        // 内联数据没有块，清空数据区即可
+        std::memset(inode_inline_data(inode), 0, SIMPLEFS_INLINE_DATA_MAX);
+        return;
+    }
+
+    std::vector<uint32_t> blocks_to_free;
 
-    // 释放直接块
-    for (int i = 0; i < SIMPLEFS_NUM_DIRECT_BLOCKS; ++i) {
-        if (inode->i_block[i] != 0) {
-            free_block(context, inode->i_block[i]);
+    // 直接块
+    for (uint32_t i = 0; i < SIMPLEFS_NUM_DIRECT_BLOCKS; ++i) {
+        if (inode->i_block[i] != 0 && inode->i_block[i] != SIMPLEFS_BLOCK_COMPRESSED) {
+            blocks_to_free.push_back(inode->i_block[i] & SIMPLEFS_BLOCK_PTR_MASK);
         }
     }
 
-    // 释放间接块结构
-    free_block_tree_recursive(context, inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS], 1);     // 一级间接
-    free_block_tree_recursive(context, inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 1], 2); // 二级间接
-    free_block_tree_recursive(context, inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 2], 3); // 三级间接
+    // 间接块结构
+    collect_block_tree_recursive(context, inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS], 1, blocks_to_free);     // 一级间接
+    collect_block_tree_recursive(context, inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 1], 2, blocks_to_free); // 二级间接
+    collect_block_tree_recursive(context, inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 2], 3, blocks_to_free); // 三级间接
+
+    free_blocks(context, blocks_to_free);
 
     // 重置inode块指针
     std::memset(inode->i_block, 0, sizeof(uint32_t) * SIMPLEFS_INODE_BLOCK_PTRS);
@@ -688,21 +1567,20 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
     if (!dir_inode) { errno = EIO; return 0; }
 
     uint32_t preferred_group = (dir_inode_num - 1) / context.sb.s_inodes_per_group;
-    uint32_t pointers_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t);
+    uint32_t pointers_per_block = context.block_size / sizeof(uint32_t);
     std::vector<uint32_t> indirect_block_content(pointers_per_block);
-    std::vector<uint8_t> zero_block_buffer(SIMPLEFS_BLOCK_SIZE, 0);
 
     // 直接块
     if (logical_block_idx < SIMPLEFS_NUM_DIRECT_BLOCKS) {
         if (dir_inode->i_block[logical_block_idx] == 0) {
             uint32_t new_data_block = alloc_block(context, preferred_group);
             if (new_data_block == 0) { return 0; }
-            if (write_block(context.device_fd, new_data_block, zero_block_buffer.data()) != 0) {
+            if (write_empty_dir_block(context, new_data_block) != 0) {
                 errno = EIO;
                 return 0;
             }
             dir_inode->i_block[logical_block_idx] = new_data_block;
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
         }
         return dir_inode->i_block[logical_block_idx];
     }
@@ -715,11 +1593,11 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
         if (*p_single_indirect_block_num == 0) {
             uint32_t new_l1_block = alloc_block(context, preferred_group);
             if (new_l1_block == 0) { errno = ENOSPC; return 0; }
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
             std::fill(indirect_block_content.begin(), indirect_block_content.end(), 0);
             if (write_block(context.device_fd, new_l1_block, indirect_block_content.data()) != 0) {
                 free_block(context, new_l1_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 errno = EIO; return 0;
             }
             *p_single_indirect_block_num = new_l1_block;
@@ -732,16 +1610,16 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
         if (indirect_block_content[idx_in_indirect] == 0) {
             uint32_t new_data_block = alloc_block(context, preferred_group);
             if (new_data_block == 0) { errno = ENOSPC; return 0; }
-            if (write_block(context.device_fd, new_data_block, zero_block_buffer.data()) != 0) {
+            if (write_empty_dir_block(context, new_data_block) != 0) {
                 free_block(context, new_data_block);
                 errno = EIO; return 0;
             }
             
             indirect_block_content[idx_in_indirect] = new_data_block;
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
             if (write_block(context.device_fd, *p_single_indirect_block_num, indirect_block_content.data()) != 0) {
                 free_block(context, new_data_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 indirect_block_content[idx_in_indirect] = 0;
                 errno = EIO; return 0;
             }
@@ -758,11 +1636,11 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
         if (*p_dbl_indirect_block_num == 0) {
             uint32_t new_l2_block = alloc_block(context, preferred_group);
             if (new_l2_block == 0) { errno = ENOSPC; return 0; }
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
             std::fill(indirect_block_content.begin(), indirect_block_content.end(), 0);
             if (write_block(context.device_fd, new_l2_block, indirect_block_content.data()) != 0) {
                 free_block(context, new_l2_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 errno = EIO; return 0;
             }
             *p_dbl_indirect_block_num = new_l2_block;
@@ -778,17 +1656,17 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
         if (*p_l1_block_num_from_l2 == 0) {
             uint32_t new_l1_block = alloc_block(context, preferred_group);
             if (new_l1_block == 0) { errno = ENOSPC; return 0;}
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
             std::fill(indirect_block_content.begin(), indirect_block_content.end(), 0);
             if (write_block(context.device_fd, new_l1_block, indirect_block_content.data()) != 0) {
                 free_block(context, new_l1_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 errno = EIO; return 0;
             }
             *p_l1_block_num_from_l2 = new_l1_block;
             if (write_block(context.device_fd, *p_dbl_indirect_block_num, l2_buffer.data()) != 0) {
                 free_block(context, new_l1_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 *p_l1_block_num_from_l2 = 0;
                 errno = EIO; return 0;
             }
@@ -801,16 +1679,16 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
         if (l1_buffer[idx_in_l1_block] == 0) {
             uint32_t new_data_block = alloc_block(context, preferred_group);
             if (new_data_block == 0) { errno = ENOSPC; return 0; }
-            if (write_block(context.device_fd, new_data_block, zero_block_buffer.data()) != 0) {
+            if (write_empty_dir_block(context, new_data_block) != 0) {
                 free_block(context, new_data_block);
                 errno = EIO; return 0;
             }
             
             l1_buffer[idx_in_l1_block] = new_data_block;
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
             if (write_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) {
                 free_block(context, new_data_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 l1_buffer[idx_in_l1_block] = 0;
                 errno = EIO; return 0;
             }
@@ -828,11 +1706,11 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
         if (*p_tpl_indirect_block_num == 0) {
             uint32_t new_l3_block = alloc_block(context, preferred_group);
             if (new_l3_block == 0) { errno = ENOSPC; return 0; }
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
             std::fill(indirect_block_content.begin(), indirect_block_content.end(), 0);
             if (write_block(context.device_fd, new_l3_block, indirect_block_content.data()) != 0) {
                 free_block(context, new_l3_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 errno = EIO; return 0;
             }
             *p_tpl_indirect_block_num = new_l3_block;
@@ -848,17 +1726,17 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
         if (*p_l2_block_num_from_l3 == 0) {
             uint32_t new_l2_block = alloc_block(context, preferred_group);
             if (new_l2_block == 0) { errno = ENOSPC; return 0; }
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
             std::fill(indirect_block_content.begin(), indirect_block_content.end(), 0);
             if (write_block(context.device_fd, new_l2_block, indirect_block_content.data()) != 0) {
                 free_block(context, new_l2_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 errno = EIO; return 0;
             }
             *p_l2_block_num_from_l3 = new_l2_block;
             if (write_block(context.device_fd, *p_tpl_indirect_block_num, l3_buffer.data()) != 0) {
                 free_block(context, new_l2_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 *p_l2_block_num_from_l3 = 0;
                 errno = EIO; return 0;
             }
@@ -874,17 +1752,17 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
         if (*p_l1_block_num_from_l2 == 0) {
             uint32_t new_l1_block = alloc_block(context, preferred_group);
             if (new_l1_block == 0) { errno = ENOSPC; return 0;}
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
             std::fill(indirect_block_content.begin(), indirect_block_content.end(), 0);
             if (write_block(context.device_fd, new_l1_block, indirect_block_content.data()) != 0) {
                 free_block(context, new_l1_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 errno = EIO; return 0;
             }
             *p_l1_block_num_from_l2 = new_l1_block;
             if (write_block(context.device_fd, *p_l2_block_num_from_l3, l2_buffer.data()) != 0) {
                 free_block(context, new_l1_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 *p_l1_block_num_from_l2 = 0;
                 errno = EIO; return 0;
             }
@@ -897,16 +1775,16 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
         if (l1_buffer[idx_in_l1_final] == 0) {
             uint32_t new_data_block = alloc_block(context, preferred_group);
             if (new_data_block == 0) { errno = ENOSPC; return 0; }
-            if (write_block(context.device_fd, new_data_block, zero_block_buffer.data()) != 0) {
+            if (write_empty_dir_block(context, new_data_block) != 0) {
                 free_block(context, new_data_block);
                 errno = EIO; return 0;
             }
             
             l1_buffer[idx_in_l1_final] = new_data_block;
-            dir_inode->i_blocks += (SIMPLEFS_BLOCK_SIZE / 512);
+            dir_inode->i_blocks += (context.block_size / 512);
             if (write_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) {
                 free_block(context, new_data_block);
-                dir_inode->i_blocks -= (SIMPLEFS_BLOCK_SIZE / 512);
+                dir_inode->i_blocks -= (context.block_size / 512);
                 l1_buffer[idx_in_l1_final] = 0;
                 errno = EIO; return 0;
             }
@@ -921,102 +1799,713 @@ uint32_t get_or_alloc_dir_block(SimpleFS_Context& context, SimpleFS_Inode* dir_i
 
 
 // 映射逻辑块到物理块（不分配）
-uint32_t map_logical_to_physical_block(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx) {
+// 查找逻辑块对应的原始块指针（含标志位）
+static uint32_t map_logical_to_block_ptr(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx) {
     if (!inode) { errno = EINVAL; return 0; }
+    if (inode_has_inline_data(inode)) { errno = 0; return 0; }
 
     if (logical_block_idx < SIMPLEFS_NUM_DIRECT_BLOCKS) {
         return inode->i_block[logical_block_idx];
     }
 
-    uint32_t pointers_per_block = SIMPLEFS_BLOCK_SIZE / sizeof(uint32_t);
+    // 默认块大小下每块指针数为编译期常量，除法和取模可以编译为移位
+    return dispatch_block_size(context.block_size, [&](auto block_size) -> uint32_t {
+        const uint32_t pointers_per_block = block_size / sizeof(uint32_t);
+        std::vector<uint32_t> indirect_block_buffer(pointers_per_block);
+
+        uint32_t single_indirect_start_idx = SIMPLEFS_NUM_DIRECT_BLOCKS;
+        uint32_t single_indirect_end_idx = single_indirect_start_idx + pointers_per_block;
+        if (logical_block_idx < single_indirect_end_idx) {
+            uint32_t single_indirect_block_num = inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS];
+            if (single_indirect_block_num == 0) {errno = 0; return 0;}
+
+            if (read_block(context.device_fd, single_indirect_block_num, indirect_block_buffer.data()) != 0) {
+                errno = EIO;
+                return 0;
+            }
+            uint32_t idx_in_indirect = logical_block_idx - single_indirect_start_idx;
+            return indirect_block_buffer[idx_in_indirect];
+        }
+
+        uint32_t double_indirect_start_idx = single_indirect_end_idx;
+        uint32_t double_indirect_max_entries = pointers_per_block * pointers_per_block;
+        uint32_t double_indirect_end_idx = double_indirect_start_idx + double_indirect_max_entries;
+        if (logical_block_idx < double_indirect_end_idx) {
+            uint32_t dbl_indirect_block_num = inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 1];
+            if (dbl_indirect_block_num == 0) {errno=0; return 0;}
+
+            if (read_block(context.device_fd, dbl_indirect_block_num, indirect_block_buffer.data()) != 0) {
+                 errno = EIO; return 0;
+            }
+            uint32_t logical_offset_in_dbl = logical_block_idx - double_indirect_start_idx;
+            uint32_t idx_in_dbl_indirect_block = logical_offset_in_dbl / pointers_per_block;
+            uint32_t single_indirect_block_to_read = indirect_block_buffer[idx_in_dbl_indirect_block];
+            if (single_indirect_block_to_read == 0) {errno=0; return 0;}
+
+            if (read_block(context.device_fd, single_indirect_block_to_read, indirect_block_buffer.data()) != 0) {
+                errno = EIO; return 0;
+            }
+            uint32_t idx_in_single_indirect_block = logical_offset_in_dbl % pointers_per_block;
+            return indirect_block_buffer[idx_in_single_indirect_block];
+        }
+
+        uint32_t triple_indirect_start_idx = double_indirect_end_idx;
+        uint64_t triple_indirect_max_logical_blocks = (uint64_t)pointers_per_block * pointers_per_block * pointers_per_block;
+        uint64_t triple_indirect_end_idx = triple_indirect_start_idx + triple_indirect_max_logical_blocks;
+
+        if (logical_block_idx < triple_indirect_end_idx) {
+            uint32_t tpl_indirect_block_num = inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 2];
+            if (tpl_indirect_block_num == 0) { errno = 0; return 0; }
+
+            if (read_block(context.device_fd, tpl_indirect_block_num, indirect_block_buffer.data()) != 0) {
+                errno = EIO; return 0;
+            }
+
+            uint32_t logical_offset_in_tpl = logical_block_idx - triple_indirect_start_idx;
+            uint32_t idx_in_tpl_indirect_block = logical_offset_in_tpl / (pointers_per_block * pointers_per_block);
+            uint32_t dbl_indirect_block_to_read = indirect_block_buffer[idx_in_tpl_indirect_block];
+            if (dbl_indirect_block_to_read == 0) { errno = 0; return 0; }
+
+            if (read_block(context.device_fd, dbl_indirect_block_to_read, indirect_block_buffer.data()) != 0) {
+                errno = EIO; return 0;
+            }
+
+            uint32_t logical_offset_in_dbl_from_tpl = logical_offset_in_tpl % (pointers_per_block * pointers_per_block);
+            uint32_t idx_in_dbl_from_tpl = logical_offset_in_dbl_from_tpl / pointers_per_block;
+            uint32_t sgl_indirect_block_to_read = indirect_block_buffer[idx_in_dbl_from_tpl];
+            if (sgl_indirect_block_to_read == 0) { errno = 0; return 0; }
+
+            if (read_block(context.device_fd, sgl_indirect_block_to_read, indirect_block_buffer.data()) != 0) {
+                errno = EIO; return 0;
+            }
+            uint32_t idx_in_sgl_final = logical_offset_in_dbl_from_tpl % pointers_per_block;
+            return indirect_block_buffer[idx_in_sgl_final];
+        }
+
+        errno = EFBIG;
+        return 0;
+    });
+}
+
+// 查找逻辑块对应的物理块号，p_unwritten返回该块是否为已预分配未写入
+uint32_t map_logical_to_physical_block(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx, bool* p_unwritten) {
+    uint32_t block_ptr = map_logical_to_block_ptr(context, inode, logical_block_idx);
+    if (p_unwritten) *p_unwritten = (block_ptr & SIMPLEFS_BLOCK_UNWRITTEN) != 0;
+    return block_ptr & SIMPLEFS_BLOCK_PTR_MASK;
+}
+
+// 间接块寻址：逻辑块（不小于SIMPLEFS_NUM_DIRECT_BLOCKS）所在的间接层级（1~3），
+// 以及它在该层子树内的相对块号和整棵子树的跨度；超出三级间接范围返回-1
+static int indirect_level_of(const SimpleFS_Context& context, uint32_t logical_block_idx,
+                             uint64_t* p_relative_lbn, uint64_t* p_level_span) {
+    uint64_t pointers_per_block = context.block_size / sizeof(uint32_t);
+    uint64_t relative_lbn = logical_block_idx - SIMPLEFS_NUM_DIRECT_BLOCKS;
+    uint64_t level_span = pointers_per_block;
+    int level = 1;
+    while (relative_lbn >= level_span) {
+        relative_lbn -= level_span;
+        level_span *= pointers_per_block;
+        if (++level > 3) return -1;
+    }
+    *p_relative_lbn = relative_lbn;
+    *p_level_span = level_span;
+    return level;
+}
+
+// 逻辑块的映射是否与其他文件共享：数据块本身或路径上任一间接块被共享时，就地写入会改变其他文件的内容
+bool logical_block_is_shared(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t logical_block_idx) {
+    if (context.block_extra_refs.empty() || inode_has_inline_data(inode)) {
+        return false;
+    }
+    if (logical_block_idx < SIMPLEFS_NUM_DIRECT_BLOCKS) {
+        return block_is_shared(context, inode->i_block[logical_block_idx]);
+    }
+    uint64_t relative_lbn, level_span;
+    int level = indirect_level_of(context, logical_block_idx, &relative_lbn, &level_span);
+    if (level < 0) return false;
+
+    uint64_t pointers_per_block = context.block_size / sizeof(uint32_t);
+    std::vector<uint32_t> indirect_block_buffer(pointers_per_block);
+    uint32_t block_num = inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + level - 1];
+    for (int current_level = level; current_level >= 1; --current_level) {
+        if (block_num == 0) return false;
+        if (block_is_shared(context, block_num)) return true;
+        // 读取失败时按共享处理，调用者改走不修改原块的路径
+        if (read_block(context.device_fd, block_num, indirect_block_buffer.data()) != 0) return true;
+        level_span /= pointers_per_block;
+        block_num = indirect_block_buffer[relative_lbn / level_span];
+        relative_lbn %= level_span;
+    }
+    return block_num != 0 && block_is_shared(context, block_num);
+}
+
+// 写时复制一个共享的间接块：内容复制到新块，其中的每个子块增加一次引用
+// 返回新块号，失败返回0并设置errno；原块的引用由调用者在安装新块后释放
+static uint32_t copy_shared_indirect_block(SimpleFS_Context& context, uint32_t block_num) {
+    std::vector<uint32_t> indirect_block_content(context.block_size / sizeof(uint32_t));
+    if (read_block(context.device_fd, block_num, indirect_block_content.data()) != 0) {
+        errno = EIO;
+        return 0;
+    }
+    uint32_t new_block = alloc_block(context, block_num / context.sb.s_blocks_per_group);
+    if (new_block == 0) {
+        errno = ENOSPC;
+        return 0;
+    }
+    std::vector<uint32_t> child_blocks;
+    for (uint32_t child_ptr : indirect_block_content) {
+        if (child_ptr != 0 && child_ptr != SIMPLEFS_BLOCK_COMPRESSED) child_blocks.push_back(child_ptr);
+    }
+    if (write_block(context.device_fd, new_block, indirect_block_content.data()) != 0) {
+        free_block(context, new_block);
+        errno = EIO;
+        return 0;
+    }
+    int res = block_refs_get(context, child_blocks);
+    if (res != 0) {
+        free_block(context, new_block);
+        errno = -res;
+        return 0;
+    }
+    return new_block;
+}
+
+// 逻辑块路径上的共享间接块逐级写时复制，之后可以就地修改路径上的间接块
+// 顶层指针直接修改inode，由调用者写回inode；返回0或-1（设置errno）
+static int unshare_block_path(SimpleFS_Context& context, SimpleFS_Inode* inode, uint32_t logical_block_idx) {
+    if (logical_block_idx < SIMPLEFS_NUM_DIRECT_BLOCKS) {
+        return 0;
+    }
+    uint64_t relative_lbn, level_span;
+    int level = indirect_level_of(context, logical_block_idx, &relative_lbn, &level_span);
+    if (level < 0) { errno = EFBIG; return -1; }
+
+    uint64_t pointers_per_block = context.block_size / sizeof(uint32_t);
+    std::vector<uint32_t> parent_buffer(pointers_per_block), indirect_block_buffer(pointers_per_block);
+    uint32_t parent_block = 0; // 0表示父级是inode
+    uint32_t* p_slot = &inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + level - 1];
+    for (int current_level = level; current_level >= 1; --current_level) {
+        uint32_t block_num = *p_slot;
+        if (block_num == 0) return 0;
+        if (block_is_shared(context, block_num)) {
+            uint32_t new_block = copy_shared_indirect_block(context, block_num);
+            if (new_block == 0) return -1;
+            *p_slot = new_block;
+            if (parent_block != 0 && write_block(context.device_fd, parent_block, parent_buffer.data()) != 0) {
+                *p_slot = block_num;
+                free_block(context, new_block);
+                errno = EIO;
+                return -1;
+            }
+            free_block(context, block_num); // 原块减少一次引用
+            block_num = new_block;
+        }
+        if (current_level == 1) return 0;
+        if (read_block(context.device_fd, block_num, indirect_block_buffer.data()) != 0) { errno = EIO; return -1; }
+        level_span /= pointers_per_block;
+        parent_buffer.swap(indirect_block_buffer);
+        parent_block = block_num;
+        p_slot = &parent_buffer[relative_lbn / level_span];
+        relative_lbn %= level_span;
+    }
+    return 0;
+}
+
+// 修改已映射逻辑块的原始块指针（用于设置/清除未写入标志），间接块路径必须已存在
+// 直接块只修改inode中的指针，由调用者写回inode
+int set_logical_block_ptr(SimpleFS_Context& context, SimpleFS_Inode* inode, uint32_t logical_block_idx, uint32_t block_ptr) {
+    if (inode_has_inline_data(inode)) { errno = EINVAL; return -1; }
+    if (logical_block_idx < SIMPLEFS_NUM_DIRECT_BLOCKS) {
+        inode->i_block[logical_block_idx] = block_ptr;
+        return 0;
+    }
+    // 共享的间接块不能就地修改
+    if (!context.block_extra_refs.empty() && unshare_block_path(context, inode, logical_block_idx) != 0) {
+        return -1;
+    }
+
+    uint64_t pointers_per_block = context.block_size / sizeof(uint32_t);
+    uint64_t relative_lbn, level_span;
+    int level = indirect_level_of(context, logical_block_idx, &relative_lbn, &level_span);
+    if (level < 0) { errno = EFBIG; return -1; }
+
+    std::vector<uint32_t> indirect_block_buffer(pointers_per_block);
+    uint32_t block_num = inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + level - 1];
+    for (int current_level = level; current_level >= 1; --current_level) {
+        if (block_num == 0) { errno = ENOENT; return -1; }
+        if (read_block(context.device_fd, block_num, indirect_block_buffer.data()) != 0) { errno = EIO; return -1; }
+        level_span /= pointers_per_block;
+        uint32_t idx = static_cast<uint32_t>(relative_lbn / level_span);
+        relative_lbn %= level_span;
+        if (current_level == 1) {
+            indirect_block_buffer[idx] = block_ptr;
+            if (write_block(context.device_fd, block_num, indirect_block_buffer.data()) != 0) { errno = EIO; return -1; }
+            return 0;
+        }
+        block_num = indirect_block_buffer[idx];
+    }
+    return -1;
+}
+
+// 确保为给定逻辑块索引分配物理块的辅助函数
+uint32_t allocate_block_for_write(SimpleFS_Context& context, SimpleFS_Inode* inode, uint32_t inode_num ,
+                                         uint32_t logical_block_idx, bool* p_was_newly_allocated, uint32_t data_ptr_flags,
+                                         uint32_t preallocated_block) {
+    if(p_was_newly_allocated) *p_was_newly_allocated = false;
+    if (!inode) { errno = EIO; return 0; }
+    if (inode_has_inline_data(inode)) { errno = EINVAL; return 0; } // 调用者需先转换为块存储
+    // 数据块可由调用者预先分配（批量分配的连续段），索引块仍在这里逐个分配
+    auto alloc_data_block = [&]() {
+        return preallocated_block != 0 ? preallocated_block
+                                       : alloc_block_for_inode(context, inode, inode_num, logical_block_idx);
+    };
+    auto free_data_block = [&](uint32_t block_num) {
+        if (preallocated_block == 0) free_block(context, block_num);
+    };
+    // 共享的数据块不能就地写入：换成新块（未预分配时复制原内容并保留原标志），原块减少一次引用
+    // parent_block为0表示槽位在inode中，由调用者写回inode
+    auto replace_shared_data_block = [&](uint32_t* p_slot, uint32_t parent_block, const uint32_t* parent_buffer) -> uint32_t {
+        uint32_t old_ptr = *p_slot;
+        uint32_t new_data_block = alloc_data_block();
+        if (new_data_block == 0) { if (errno == 0) errno = ENOSPC; return 0; }
+        uint32_t new_ptr = new_data_block | data_ptr_flags;
+        if (preallocated_block == 0) {
+            std::vector<uint8_t> block_content(context.block_size);
+            if (read_block(context.device_fd, old_ptr & SIMPLEFS_BLOCK_PTR_MASK, block_content.data()) != 0 ||
+                write_block(context.device_fd, new_data_block, block_content.data()) != 0) {
+                free_data_block(new_data_block);
+                errno = EIO; return 0;
+            }
+            new_ptr = new_data_block | (old_ptr & ~SIMPLEFS_BLOCK_PTR_MASK);
+        }
+        *p_slot = new_ptr;
+        if (parent_block != 0 && write_block(context.device_fd, parent_block, parent_buffer) != 0) {
+            *p_slot = old_ptr;
+            free_data_block(new_data_block);
+            errno = EIO; return 0;
+        }
+        free_block(context, old_ptr & SIMPLEFS_BLOCK_PTR_MASK);
+        return new_data_block;
+    };
+    // 路径上共享的间接块先写时复制，之后可以就地修改
+    if (!context.block_extra_refs.empty() && unshare_block_path(context, inode, logical_block_idx) != 0) {
+        return 0;
+    }
+    uint32_t pointers_per_block = context.block_size / sizeof(uint32_t);
     std::vector<uint32_t> indirect_block_buffer(pointers_per_block);
 
+    if (logical_block_idx < SIMPLEFS_NUM_DIRECT_BLOCKS) {
+        if (inode->i_block[logical_block_idx] == 0) {
+            uint32_t new_physical_block = alloc_data_block();
+            if (new_physical_block == 0) { return 0; }
+            inode->i_block[logical_block_idx] = new_physical_block | data_ptr_flags;
+            inode->i_blocks += (context.block_size / 512);
+            if(p_was_newly_allocated) *p_was_newly_allocated = true;
+        } else if (block_is_shared(context, inode->i_block[logical_block_idx])) {
+            return replace_shared_data_block(&inode->i_block[logical_block_idx], 0, nullptr);
+        }
+        return inode->i_block[logical_block_idx] & SIMPLEFS_BLOCK_PTR_MASK;
+    }
+
     uint32_t single_indirect_start_idx = SIMPLEFS_NUM_DIRECT_BLOCKS;
     uint32_t single_indirect_end_idx = single_indirect_start_idx + pointers_per_block;
     if (logical_block_idx < single_indirect_end_idx) {
-        uint32_t single_indirect_block_num = inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS];
-        if (single_indirect_block_num == 0) {errno = 0; return 0;}
-
-        if (read_block(context.device_fd, single_indirect_block_num, indirect_block_buffer.data()) != 0) {
-            errno = EIO;
-            return 0;
+        uint32_t* p_single_indirect_block_num = &inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS];
+        if (*p_single_indirect_block_num == 0) {
+            uint32_t new_l1_block = alloc_block_for_inode(context, inode, inode_num, logical_block_idx);
+            if (new_l1_block == 0) { errno = ENOSPC; return 0; }
+            inode->i_blocks += (context.block_size / 512);
+            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
+            if (write_block(context.device_fd, new_l1_block, indirect_block_buffer.data()) != 0) {
+                free_block(context, new_l1_block);
+                inode->i_blocks -= (context.block_size / 512);
+                errno = EIO; return 0;
+            }
+            *p_single_indirect_block_num = new_l1_block;
+        }
+        if (read_block(context.device_fd, *p_single_indirect_block_num, indirect_block_buffer.data()) != 0) {
+             errno = EIO; return 0;
         }
         uint32_t idx_in_indirect = logical_block_idx - single_indirect_start_idx;
-        return indirect_block_buffer[idx_in_indirect];
+        if (indirect_block_buffer[idx_in_indirect] == 0) {
+            uint32_t new_data_block = alloc_data_block();
+            if (new_data_block == 0) { errno = ENOSPC; return 0; }
+            indirect_block_buffer[idx_in_indirect] = new_data_block | data_ptr_flags;
+            inode->i_blocks += (context.block_size / 512);
+            if(p_was_newly_allocated) *p_was_newly_allocated = true;
+            if (write_block(context.device_fd, *p_single_indirect_block_num, indirect_block_buffer.data()) != 0) {
+                free_data_block(new_data_block);
+                inode->i_blocks -= (context.block_size / 512);
+                indirect_block_buffer[idx_in_indirect] = 0;
+                errno = EIO; return 0;
+            }
+        } else if (block_is_shared(context, indirect_block_buffer[idx_in_indirect])) {
+            return replace_shared_data_block(&indirect_block_buffer[idx_in_indirect], *p_single_indirect_block_num,
+                                             indirect_block_buffer.data());
+        }
+        return indirect_block_buffer[idx_in_indirect] & SIMPLEFS_BLOCK_PTR_MASK;
     }
 
     uint32_t double_indirect_start_idx = single_indirect_end_idx;
-    uint32_t double_indirect_max_entries = pointers_per_block * pointers_per_block;
-    uint32_t double_indirect_end_idx = double_indirect_start_idx + double_indirect_max_entries;
+    uint32_t double_indirect_max_logical_blocks = pointers_per_block * pointers_per_block;
+    uint32_t double_indirect_end_idx = double_indirect_start_idx + double_indirect_max_logical_blocks;
     if (logical_block_idx < double_indirect_end_idx) {
-        uint32_t dbl_indirect_block_num = inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 1];
-        if (dbl_indirect_block_num == 0) {errno=0; return 0;}
-
-        if (read_block(context.device_fd, dbl_indirect_block_num, indirect_block_buffer.data()) != 0) {
-             errno = EIO; return 0;
+        uint32_t* p_dbl_indirect_block_num = &inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 1];
+        if (*p_dbl_indirect_block_num == 0) {
+            uint32_t new_l2_block = alloc_block_for_inode(context, inode, inode_num, logical_block_idx);
+            if (new_l2_block == 0) { errno = ENOSPC; return 0; }
+            inode->i_blocks += (context.block_size / 512);
+            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
+            if (write_block(context.device_fd, new_l2_block, indirect_block_buffer.data()) != 0) {
+                free_block(context, new_l2_block);
+                inode->i_blocks -= (context.block_size / 512);
+                errno = EIO; return 0;
+            }
+            *p_dbl_indirect_block_num = new_l2_block;
         }
-        uint32_t logical_offset_in_dbl = logical_block_idx - double_indirect_start_idx;
-        uint32_t idx_in_dbl_indirect_block = logical_offset_in_dbl / pointers_per_block;
-        uint32_t single_indirect_block_to_read = indirect_block_buffer[idx_in_dbl_indirect_block];
-        if (single_indirect_block_to_read == 0) {errno=0; return 0;}
-
-        if (read_block(context.device_fd, single_indirect_block_to_read, indirect_block_buffer.data()) != 0) {
-            errno = EIO; return 0;
+        std::vector<uint32_t> l2_buffer(pointers_per_block);
+        if (read_block(context.device_fd, *p_dbl_indirect_block_num, l2_buffer.data()) != 0) { errno = EIO; return 0; }
+        uint32_t logical_offset_in_dbl_range = logical_block_idx - double_indirect_start_idx;
+        uint32_t idx_in_l2_block = logical_offset_in_dbl_range / pointers_per_block;
+        uint32_t* p_l1_block_num_from_l2 = &l2_buffer[idx_in_l2_block];
+        if (*p_l1_block_num_from_l2 == 0) {
+            uint32_t new_l1_block = alloc_block_for_inode(context, inode, inode_num, logical_block_idx);
+            if (new_l1_block == 0) { errno = ENOSPC; return 0;}
+            inode->i_blocks += (context.block_size / 512);
+            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
+            if (write_block(context.device_fd, new_l1_block, indirect_block_buffer.data()) != 0) {
+                free_block(context, new_l1_block);
+                inode->i_blocks -= (context.block_size / 512);
+                errno = EIO; return 0;
+            }
+            *p_l1_block_num_from_l2 = new_l1_block;
+            if (write_block(context.device_fd, *p_dbl_indirect_block_num, l2_buffer.data()) != 0) {
+                free_block(context, new_l1_block);
+                inode->i_blocks -= (context.block_size / 512);
+                *p_l1_block_num_from_l2 = 0;
+                errno = EIO; return 0;
+            }
+        }
+        std::vector<uint32_t> l1_buffer(pointers_per_block);
+        if (read_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) { errno = EIO; return 0;}
+        uint32_t idx_in_l1_block = logical_offset_in_dbl_range % pointers_per_block;
+        if (l1_buffer[idx_in_l1_block] == 0) {
+            uint32_t new_data_block = alloc_data_block();
+            if (new_data_block == 0) { errno = ENOSPC; return 0; }
+            l1_buffer[idx_in_l1_block] = new_data_block | data_ptr_flags;
+            inode->i_blocks += (context.block_size / 512);
+            if(p_was_newly_allocated) *p_was_newly_allocated = true;
+            if (write_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) {
+                free_data_block(new_data_block);
+                inode->i_blocks -= (context.block_size / 512);
+                l1_buffer[idx_in_l1_block] = 0;
+                errno = EIO; return 0;
+            }
+        } else if (block_is_shared(context, l1_buffer[idx_in_l1_block])) {
+            return replace_shared_data_block(&l1_buffer[idx_in_l1_block], *p_l1_block_num_from_l2, l1_buffer.data());
         }
-        uint32_t idx_in_single_indirect_block = logical_offset_in_dbl % pointers_per_block;
-        return indirect_block_buffer[idx_in_single_indirect_block];
+        return l1_buffer[idx_in_l1_block] & SIMPLEFS_BLOCK_PTR_MASK;
     }
 
     uint32_t triple_indirect_start_idx = double_indirect_end_idx;
     uint64_t triple_indirect_max_logical_blocks = (uint64_t)pointers_per_block * pointers_per_block * pointers_per_block;
     uint64_t triple_indirect_end_idx = triple_indirect_start_idx + triple_indirect_max_logical_blocks;
-
     if (logical_block_idx < triple_indirect_end_idx) {
-        uint32_t tpl_indirect_block_num = inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 2];
-        if (tpl_indirect_block_num == 0) { errno = 0; return 0; }
+        uint32_t* p_tpl_indirect_block_num = &inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + 2];
+        if (*p_tpl_indirect_block_num == 0) {
+            uint32_t new_l3_block = alloc_block_for_inode(context, inode, inode_num, logical_block_idx);
+            if (new_l3_block == 0) { errno = ENOSPC; return 0; }
+            inode->i_blocks += (context.block_size / 512);
+            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
+            if (write_block(context.device_fd, new_l3_block, indirect_block_buffer.data()) != 0) {
+                free_block(context, new_l3_block);
+                inode->i_blocks -= (context.block_size / 512);
+                errno = EIO; return 0;
+            }
+            *p_tpl_indirect_block_num = new_l3_block;
+        }
+        std::vector<uint32_t> l3_buffer(pointers_per_block);
+        if (read_block(context.device_fd, *p_tpl_indirect_block_num, l3_buffer.data()) != 0) { errno = EIO; return 0; }
+        uint32_t logical_offset_in_tpl_range = logical_block_idx - triple_indirect_start_idx;
+        uint32_t idx_in_l3_block = logical_offset_in_tpl_range / (pointers_per_block * pointers_per_block);
+        uint32_t* p_l2_block_num_from_l3 = &l3_buffer[idx_in_l3_block];
+        if (*p_l2_block_num_from_l3 == 0) {
+            uint32_t new_l2_block = alloc_block_for_inode(context, inode, inode_num, logical_block_idx);
+            if (new_l2_block == 0) { errno = ENOSPC; return 0; }
+            inode->i_blocks += (context.block_size / 512);
+            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
+            if (write_block(context.device_fd, new_l2_block, indirect_block_buffer.data()) != 0) {
+                free_block(context, new_l2_block);
+                inode->i_blocks -= (context.block_size / 512);
+                errno = EIO; return 0;
+            }
+            *p_l2_block_num_from_l3 = new_l2_block;
+            if (write_block(context.device_fd, *p_tpl_indirect_block_num, l3_buffer.data()) != 0) {
+                free_block(context, new_l2_block);
+                inode->i_blocks -= (context.block_size / 512);
+                *p_l2_block_num_from_l3 = 0;
+                errno = EIO; return 0;
+            }
+        }
+        std::vector<uint32_t> l2_buffer(pointers_per_block);
+        if (read_block(context.device_fd, *p_l2_block_num_from_l3, l2_buffer.data()) != 0) { errno = EIO; return 0; }
+        uint32_t logical_offset_in_l2_from_tpl = logical_offset_in_tpl_range % (pointers_per_block * pointers_per_block);
+        uint32_t idx_in_l2_from_tpl = logical_offset_in_l2_from_tpl / pointers_per_block;
+        uint32_t* p_l1_block_num_from_l2 = &l2_buffer[idx_in_l2_from_tpl];
+        if (*p_l1_block_num_from_l2 == 0) {
+            uint32_t new_l1_block = alloc_block_for_inode(context, inode, inode_num, logical_block_idx);
+            if (new_l1_block == 0) { errno = ENOSPC; return 0; }
+            inode->i_blocks += (context.block_size / 512);
+            std::fill(indirect_block_buffer.begin(), indirect_block_buffer.end(), 0);
+            if (write_block(context.device_fd, new_l1_block, indirect_block_buffer.data()) != 0) {
+                free_block(context, new_l1_block);
+                inode->i_blocks -= (context.block_size / 512);
+                errno = EIO; return 0;
+            }
+            *p_l1_block_num_from_l2 = new_l1_block;
+            if (write_block(context.device_fd, *p_l2_block_num_from_l3, l2_buffer.data()) != 0) {
+                free_block(context, new_l1_block);
+                inode->i_blocks -= (context.block_size / 512);
+                *p_l1_block_num_from_l2 = 0;
+                errno = EIO; return 0;
+            }
+        }
+        std::vector<uint32_t> l1_buffer(pointers_per_block);
+        if (read_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) { errno = EIO; return 0; }
+        uint32_t idx_in_l1_final = logical_offset_in_l2_from_tpl % pointers_per_block;
+        if (l1_buffer[idx_in_l1_final] == 0) {
+            uint32_t new_data_block = alloc_data_block();
+            if (new_data_block == 0) { errno = ENOSPC; return 0; }
+            l1_buffer[idx_in_l1_final] = new_data_block | data_ptr_flags;
+            inode->i_blocks += (context.block_size / 512);
+            if(p_was_newly_allocated) *p_was_newly_allocated = true;
+            if (write_block(context.device_fd, *p_l1_block_num_from_l2, l1_buffer.data()) != 0) {
+                free_data_block(new_data_block);
+                inode->i_blocks -= (context.block_size / 512);
+                l1_buffer[idx_in_l1_final] = 0;
+                errno = EIO; return 0;
+            }
+        } else if (block_is_shared(context, l1_buffer[idx_in_l1_final])) {
+            return replace_shared_data_block(&l1_buffer[idx_in_l1_final], *p_l1_block_num_from_l2, l1_buffer.data());
+        }
+        return l1_buffer[idx_in_l1_final] & SIMPLEFS_BLOCK_PTR_MASK;
+    }
 
-        if (read_block(context.device_fd, tpl_indirect_block_num, indirect_block_buffer.data()) != 0) {
-            errno = EIO; return 0;
+    std::cerr << "写入时分配块失败: 逻辑块 " << logical_block_idx
+              << " is beyond implemented allocation support (direct + single + double + triple indirect)." << std::endl;
+    errno = EFBIG;
+    return 0;
+}
+
+// 在子树中查找 [start_lbn, end_lbn) 内第一个"是否有数据"等于want_data的逻辑块，找不到返回UINT64_MAX
+// 只读取间接块，不读取数据块；未写入的预分配块视为空洞
+static uint64_t scan_block_tree(SimpleFS_Context& context, uint32_t block_ptr, int level, uint64_t subtree_base_lbn,
+                                uint64_t start_lbn, uint64_t end_lbn, bool want_data) {
+    uint64_t first_lbn = std::max(start_lbn, subtree_base_lbn);
+    if (block_ptr == 0) {
+        return want_data ? UINT64_MAX : first_lbn;
+    }
+    if (level == 0) {
+        bool has_data = (block_ptr & SIMPLEFS_BLOCK_UNWRITTEN) == 0;
+        return (has_data == want_data) ? first_lbn : UINT64_MAX;
+    }
+
+    uint64_t pointers_per_block = context.block_size / sizeof(uint32_t);
+    std::vector<uint32_t> indirect_block_content(pointers_per_block);
+    if (read_block(context.device_fd, block_ptr, indirect_block_content.data()) != 0) {
+        return want_data ? UINT64_MAX : first_lbn; // 读取失败按空洞处理
+    }
+    uint64_t child_span = 1;
+    for (int i = 1; i < level; ++i) child_span *= pointers_per_block;
+
+    uint64_t first_child = (start_lbn > subtree_base_lbn) ? (start_lbn - subtree_base_lbn) / child_span : 0;
+    for (uint64_t child = first_child; child < pointers_per_block; ++child) {
+        uint64_t child_base_lbn = subtree_base_lbn + child * child_span;
+        if (child_base_lbn >= end_lbn) break;
+        uint64_t found = scan_block_tree(context, indirect_block_content[child], level - 1, child_base_lbn,
+                                         start_lbn, end_lbn, want_data);
+        if (found != UINT64_MAX) {
+            return found;
         }
+    }
+    return UINT64_MAX;
+}
 
-        uint32_t logical_offset_in_tpl = logical_block_idx - triple_indirect_start_idx;
-        uint32_t idx_in_tpl_indirect_block = logical_offset_in_tpl / (pointers_per_block * pointers_per_block);
-        uint32_t dbl_indirect_block_to_read = indirect_block_buffer[idx_in_tpl_indirect_block];
-        if (dbl_indirect_block_to_read == 0) { errno = 0; return 0; }
+// 按块指针查找，不区分压缩簇
+static uint32_t find_mapped_data_or_hole_lbn(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t start_lbn,
+                                             uint32_t end_lbn, bool want_data) {
+    if (inode_has_inline_data(inode)) {
+        // 内联数据只占逻辑块0
+        bool has_data = inode->i_size > 0;
+        if (want_data) return (start_lbn == 0 && has_data) ? 0 : end_lbn;
+        return (start_lbn == 0 && has_data) ? std::min<uint32_t>(1, end_lbn) : start_lbn;
+    }
 
-        if (read_block(context.device_fd, dbl_indirect_block_to_read, indirect_block_buffer.data()) != 0) {
-            errno = EIO; return 0;
+    for (uint32_t lbn = start_lbn; lbn < end_lbn && lbn < SIMPLEFS_NUM_DIRECT_BLOCKS; ++lbn) {
+        uint64_t found = scan_block_tree(context, inode->i_block[lbn], 0, lbn, lbn, lbn + 1, want_data);
+        if (found != UINT64_MAX) {
+            return lbn;
+        }
+    }
+
+    uint64_t pointers_per_block = context.block_size / sizeof(uint32_t);
+    uint64_t level_base_lbn = SIMPLEFS_NUM_DIRECT_BLOCKS;
+    uint64_t level_span = pointers_per_block;
+    for (int level = 1; level <= 3; ++level) {
+        if (end_lbn <= level_base_lbn) break;
+        if (start_lbn < level_base_lbn + level_span) {
+            uint64_t found = scan_block_tree(context, inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + level - 1], level,
+                                             level_base_lbn, start_lbn, end_lbn, want_data);
+            if (found != UINT64_MAX) {
+                return static_cast<uint32_t>(std::min<uint64_t>(found, end_lbn));
+            }
         }
+        level_base_lbn += level_span;
+        level_span *= pointers_per_block;
+    }
+    return end_lbn;
+}
+
+// 查找 [start_lbn, end_lbn) 内第一个有数据（want_data）或空洞（!want_data）的逻辑块，找不到返回end_lbn
+// 压缩簇只有前几个指针非零，整簇都视为数据
+uint32_t find_data_or_hole_lbn(SimpleFS_Context& context, const SimpleFS_Inode* inode, uint32_t start_lbn, uint32_t end_lbn, bool want_data) {
+    if (!inode || start_lbn >= end_lbn) {
+        return end_lbn;
+    }
+    if (!inode_is_compressed(inode) || context.compress_cluster_blocks == 0) {
+        return find_mapped_data_or_hole_lbn(context, inode, start_lbn, end_lbn, want_data);
+    }
+    const uint32_t cluster_blocks = context.compress_cluster_blocks;
+    auto cluster_end_of = [&](uint32_t lbn) {
+        uint64_t cluster_end = static_cast<uint64_t>(lbn / cluster_blocks + 1) * cluster_blocks;
+        return static_cast<uint32_t>(std::min<uint64_t>(cluster_end, end_lbn));
+    };
+    if (want_data) {
+        if (compress_cluster_is_compressed(context, inode, start_lbn)) return start_lbn;
+        // 之后的压缩簇从标记所在的首个逻辑块起就是数据
+        return find_mapped_data_or_hole_lbn(context, inode, start_lbn, end_lbn, true);
+    }
+    uint32_t lbn = start_lbn;
+    while (lbn < end_lbn) {
+        if (compress_cluster_is_compressed(context, inode, lbn)) {
+            lbn = cluster_end_of(lbn);
+            continue;
+        }
+        uint32_t hole_lbn = find_mapped_data_or_hole_lbn(context, inode, lbn, end_lbn, false);
+        if (hole_lbn >= end_lbn || !compress_cluster_is_compressed(context, inode, hole_lbn)) return hole_lbn;
+        lbn = cluster_end_of(hole_lbn);
+    }
+    return end_lbn;
+}
 
-        uint32_t logical_offset_in_dbl_from_tpl = logical_offset_in_tpl % (pointers_per_block * pointers_per_block);
-        uint32_t idx_in_dbl_from_tpl = logical_offset_in_dbl_from_tpl / pointers_per_block;
-        uint32_t sgl_indirect_block_to_read = indirect_block_buffer[idx_in_dbl_from_tpl];
-        if (sgl_indirect_block_to_read == 0) { errno = 0; return 0; }
+// 在一棵间接块子树中释放 [start_lbn, end_lbn) 范围内的块
+// subtree_base_lbn 为该子树覆盖的首个逻辑块号；被完全清空的间接块一并释放
+// 返回值表示 *p_block_num 所在的父级是否需要写回
+static bool release_block_tree_range(SimpleFS_Context& context, uint32_t* p_block_num, int level,
+                                     uint64_t subtree_base_lbn, uint64_t start_lbn, uint64_t end_lbn,
+                                     std::vector<uint32_t>& out_blocks, uint64_t& released_count) {
+    if (*p_block_num == 0) {
+        return false;
+    }
 
-        if (read_block(context.device_fd, sgl_indirect_block_to_read, indirect_block_buffer.data()) != 0) {
-            errno = EIO; return 0;
+    uint64_t pointers_per_block = context.block_size / sizeof(uint32_t);
+    uint64_t subtree_span = 1;
+    for (int i = 0; i < level; ++i) subtree_span *= pointers_per_block;
+
+    // 整棵子树都在范围内，无需逐项清零
+    if (start_lbn <= subtree_base_lbn && end_lbn >= subtree_base_lbn + subtree_span) {
+        released_count += collect_block_tree_recursive(context, *p_block_num, level, out_blocks);
+        *p_block_num = 0;
+        return true;
+    }
+
+    // 只释放部分子树时要修改间接块，共享的间接块先写时复制
+    bool replaced = false;
+    if (block_is_shared(context, *p_block_num)) {
+        uint32_t new_block = copy_shared_indirect_block(context, *p_block_num);
+        if (new_block == 0) {
+            std::cerr << "复制共享的间接块 " << *p_block_num << " 失败" << std::endl;
+            return false;
         }
-        uint32_t idx_in_sgl_final = logical_offset_in_dbl_from_tpl % pointers_per_block;
-        return indirect_block_buffer[idx_in_sgl_final];
+        out_blocks.push_back(*p_block_num);
+        *p_block_num = new_block;
+        replaced = true;
     }
 
-    errno = EFBIG;
-    return 0;
+    std::vector<uint32_t> indirect_block_content(pointers_per_block);
+    if (read_block(context.device_fd, *p_block_num, indirect_block_content.data()) != 0) {
+        return replaced;
+    }
+
+    uint64_t child_span = subtree_span / pointers_per_block;
+    uint64_t first_child = (start_lbn > subtree_base_lbn) ? (start_lbn - subtree_base_lbn) / child_span : 0;
+    bool changed = false;
+    for (uint64_t child = first_child; child < pointers_per_block; ++child) {
+        uint64_t child_base_lbn = subtree_base_lbn + child * child_span;
+        if (child_base_lbn >= end_lbn) break;
+        if (indirect_block_content[child] == 0) continue;
+
+        if (level == 1) {
+            if (indirect_block_content[child] != SIMPLEFS_BLOCK_COMPRESSED) {
+                out_blocks.push_back(indirect_block_content[child] & SIMPLEFS_BLOCK_PTR_MASK);
+                released_count++;
+            }
+            indirect_block_content[child] = 0;
+            changed = true;
+        } else if (release_block_tree_range(context, &indirect_block_content[child], level - 1,
+                                            child_base_lbn, start_lbn, end_lbn, out_blocks, released_count)) {
+            changed = true;
+        }
+    }
+
+    if (!changed) {
+        return replaced;
+    }
+
+    bool now_empty = std::all_of(indirect_block_content.begin(), indirect_block_content.end(),
+                                 [](uint32_t ptr) { return ptr == 0; });
+    if (now_empty) {
+        out_blocks.push_back(*p_block_num);
+        released_count++;
+        *p_block_num = 0;
+        return true;
+    }
+    write_block(context.device_fd, *p_block_num, indirect_block_content.data());
+    return replaced;
 }
 
-// 释放逻辑块范围
+// 释放逻辑块范围 [start_lbn, end_lbn)，清除对应的块指针
 void release_logical_block_range(SimpleFS_Context& context, SimpleFS_Inode* inode, uint32_t start_lbn, uint32_t end_lbn) {
-    if (start_lbn >= end_lbn || !inode) {
+    if (start_lbn >= end_lbn || !inode || inode_has_inline_data(inode)) {
         return;
     }
 
-    for (uint32_t lbn_to_free = start_lbn; lbn_to_free < end_lbn; ++lbn_to_free) {
-        uint32_t physical_block = map_logical_to_physical_block(context, inode, lbn_to_free);
-        if (physical_block != 0) {
-            free_block(context, physical_block);
+    std::vector<uint32_t> blocks_to_free;
+    uint64_t released_count = 0; // 从映射中移除的块数，共享块不会真正释放，不能按blocks_to_free计算
+    uint64_t pointers_per_block = context.block_size / sizeof(uint32_t);
+
+    for (uint32_t lbn = start_lbn; lbn < end_lbn && lbn < SIMPLEFS_NUM_DIRECT_BLOCKS; ++lbn) {
+        if (inode->i_block[lbn] != 0) {
+            if (inode->i_block[lbn] != SIMPLEFS_BLOCK_COMPRESSED) {
+                blocks_to_free.push_back(inode->i_block[lbn] & SIMPLEFS_BLOCK_PTR_MASK);
+                released_count++;
+            }
+            inode->i_block[lbn] = 0;
         }
     }
 
-    // 简单重新计算块计数
-    inode->i_blocks = (inode->i_size + 511) / 512;
+    uint64_t level_base_lbn = SIMPLEFS_NUM_DIRECT_BLOCKS;
+    uint64_t level_span = pointers_per_block;
+    for (int level = 1; level <= 3; ++level) {
+        if (end_lbn <= level_base_lbn) break;
+        release_block_tree_range(context, &inode->i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + level - 1], level,
+                                 level_base_lbn, start_lbn, end_lbn, blocks_to_free, released_count);
+        level_base_lbn += level_span;
+        level_span *= pointers_per_block;
+    }
+
+    free_blocks(context, blocks_to_free);
+
+    uint64_t sectors_released = released_count * (context.block_size / 512);
+    inode->i_blocks = (inode->i_blocks > sectors_released) ? inode->i_blocks - sectors_released : 0;
 }
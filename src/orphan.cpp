@@ -0,0 +1,134 @@
+#include "orphan.h"
+#include "metadata.h"
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <time.h>
+#include <sys/stat.h>
+
+// 每次持锁释放的逻辑块数上限，回收过程中其他FUSE请求可在片间获得锁
+constexpr uint32_t ORPHAN_RECLAIM_SLICE_BLOCKS = 1024;
+
+static std::thread reclaimer_thread;
+static std::mutex reclaimer_mutex;
+static std::condition_variable reclaimer_cv;
+static bool reclaimer_running = false;
+static bool reclaimer_stop = false;
+static bool reclaimer_wakeup = false;
+
+bool inode_needs_deferred_free(const SimpleFS_Inode* inode) {
+    if (!S_ISREG(inode->i_mode) || inode_has_inline_data(inode)) {
+        return false;
+    }
+    // 只有直接块的文件最多释放12个块，同步释放即可
+    for (uint32_t i = SIMPLEFS_NUM_DIRECT_BLOCKS; i < SIMPLEFS_INODE_BLOCK_PTRS; ++i) {
+        if (inode->i_block[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void orphan_list_add(SimpleFS_Context& context, uint32_t inode_num, SimpleFS_Inode* inode) {
+    inode->i_dtime = context.sb.s_last_orphan; // 孤儿inode的i_dtime保存下一个孤儿的inode号
+    context.sb.s_last_orphan = inode_num;
+}
+
+// 回收链表头部孤儿inode的一片数据块，返回是否还有剩余工作
+// 每片都把缩小后的i_size写回磁盘，崩溃后从中断处继续
+static bool reclaim_orphan_slice(SimpleFS_Context& context) {
+    uint32_t inode_num = context.sb.s_last_orphan;
+    if (inode_num == 0) {
+        return false;
+    }
+
+    SimpleFS_Inode inode;
+    if (inode_num > context.sb.s_inodes_count || read_inode_from_disk(context, inode_num, &inode) != 0 ||
+        inode.i_links_count != 0) {
+        std::cerr << "孤儿链表损坏，inode " << inode_num << " 无效，放弃剩余链表" << std::endl;
+        context.sb.s_last_orphan = 0;
+        sync_fs_metadata(context);
+        return false;
+    }
+
+    uint32_t num_fs_blocks = (inode.i_size + context.block_size - 1) / context.block_size;
+    if (num_fs_blocks > ORPHAN_RECLAIM_SLICE_BLOCKS) {
+        // 从文件末尾向前释放一片
+        uint32_t new_num_fs_blocks = num_fs_blocks - ORPHAN_RECLAIM_SLICE_BLOCKS;
+        release_logical_block_range(context, &inode, new_num_fs_blocks, UINT32_MAX);
+        inode.i_size = new_num_fs_blocks * context.block_size;
+        write_inode_to_disk(context, inode_num, &inode);
+        sync_fs_metadata(context);
+        return true;
+    }
+
+    // 最后一片：释放剩余块和inode本身，并从链表中摘除
+    free_all_inode_blocks(context, &inode);
+    context.sb.s_last_orphan = inode.i_dtime;
+    inode.i_size = 0;
+    inode.i_dtime = time(nullptr);
+    write_inode_to_disk(context, inode_num, &inode);
+    free_inode(context, inode_num, inode.i_mode);
+    sync_fs_metadata(context);
+    return context.sb.s_last_orphan != 0;
+}
+
+static void orphan_reclaimer_main(SimpleFS_Context* context) {
+    while (true) {
+        bool more_work;
+        {
+            std::lock_guard<std::mutex> fs_guard(context->fs_mutex);
+            more_work = reclaim_orphan_slice(*context);
+        }
+
+        std::unique_lock<std::mutex> lock(reclaimer_mutex);
+        if (!more_work) {
+            reclaimer_cv.wait(lock, [] { return reclaimer_stop || reclaimer_wakeup; });
+        }
+        reclaimer_wakeup = false;
+        if (reclaimer_stop) {
+            break;
+        }
+        lock.unlock();
+        std::this_thread::yield(); // 片间让出，避免连续占用fs_mutex
+    }
+}
+
+void start_orphan_reclaimer(SimpleFS_Context& context) {
+    std::lock_guard<std::mutex> lock(reclaimer_mutex);
+    if (reclaimer_running) {
+        return;
+    }
+    if (context.sb.s_last_orphan != 0) {
+        std::cout << "发现未完成回收的孤儿inode，后台继续回收" << std::endl;
+    }
+    reclaimer_stop = false;
+    reclaimer_wakeup = false;
+    reclaimer_thread = std::thread(orphan_reclaimer_main, &context);
+    reclaimer_running = true;
+}
+
+void stop_orphan_reclaimer() {
+    {
+        std::lock_guard<std::mutex> lock(reclaimer_mutex);
+        if (!reclaimer_running) {
+            return;
+        }
+        reclaimer_stop = true;
+    }
+    reclaimer_cv.notify_one();
+    reclaimer_thread.join(); // 未回收完的孤儿留在磁盘链表中，下次挂载继续
+    std::lock_guard<std::mutex> lock(reclaimer_mutex);
+    reclaimer_running = false;
+}
+
+void wake_orphan_reclaimer() {
+    {
+        std::lock_guard<std::mutex> lock(reclaimer_mutex);
+        reclaimer_wakeup = true;
+    }
+    reclaimer_cv.notify_one();
+}
@@ -0,0 +1,152 @@
+#include "refcount.h"
+#include "metadata.h"
+#include "disk_io.h"
+
+#include <iostream>
+#include <set>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <sys/stat.h> // S_ISREG
+
+// 引用计数表中一个块容纳的计数个数
+static uint32_t refcounts_per_block(const SimpleFS_Context& context) {
+    return context.block_size / sizeof(uint32_t);
+}
+
+int load_block_refcounts(SimpleFS_Context& context) {
+    context.block_extra_refs.clear();
+    SimpleFS_Inode table_inode;
+    if (read_inode_from_disk(context, SIMPLEFS_REFCOUNT_INODE_NUM, &table_inode) != 0) {
+        return -1;
+    }
+    if (!S_ISREG(table_inode.i_mode)) {
+        std::cerr << "引用计数表inode " << SIMPLEFS_REFCOUNT_INODE_NUM << " 无效" << std::endl;
+        errno = EIO;
+        return -1;
+    }
+
+    const uint32_t per_block = refcounts_per_block(context);
+    const uint32_t end_lbn = (context.sb.s_blocks_count + per_block - 1) / per_block;
+    std::vector<uint32_t> table_block(per_block);
+    // 只读取表中已分配的块，空洞中的计数都是0
+    uint32_t lbn = find_data_or_hole_lbn(context, &table_inode, 0, end_lbn, true);
+    while (lbn < end_lbn) {
+        uint32_t physical_block_num = map_logical_to_physical_block(context, &table_inode, lbn);
+        if (physical_block_num != 0) {
+            if (read_block(context.device_fd, physical_block_num, table_block.data()) != 0) {
+                errno = EIO;
+                return -1;
+            }
+            for (uint32_t i = 0; i < per_block; ++i) {
+                if (table_block[i] != 0) {
+                    context.block_extra_refs[lbn * per_block + i] = table_block[i];
+                }
+            }
+        }
+        lbn = find_data_or_hole_lbn(context, &table_inode, lbn + 1, end_lbn, true);
+    }
+    return 0;
+}
+
+// 按内存中的计数重写引用计数表的若干块，全零的块释放为空洞
+static int write_refcount_table(SimpleFS_Context& context, const std::set<uint32_t>& table_lbns) {
+    if (table_lbns.empty()) {
+        return 0;
+    }
+    SimpleFS_Inode table_inode;
+    if (read_inode_from_disk(context, SIMPLEFS_REFCOUNT_INODE_NUM, &table_inode) != 0) {
+        return -EIO;
+    }
+    const uint32_t per_block = refcounts_per_block(context);
+    std::vector<uint32_t> table_block(per_block);
+    bool inode_changed = false;
+    int result = 0;
+    for (uint32_t lbn : table_lbns) {
+        bool all_zero = true;
+        for (uint32_t i = 0; i < per_block; ++i) {
+            auto it = context.block_extra_refs.find(lbn * per_block + i);
+            table_block[i] = (it == context.block_extra_refs.end()) ? 0 : it->second;
+            all_zero = all_zero && table_block[i] == 0;
+        }
+        uint32_t physical_block_num = map_logical_to_physical_block(context, &table_inode, lbn);
+        if (all_zero) {
+            // 不再有共享块的表块释放为空洞
+            if (physical_block_num != 0) {
+                release_logical_block_range(context, &table_inode, lbn, lbn + 1);
+                inode_changed = true;
+            }
+            continue;
+        }
+        if (physical_block_num == 0) {
+            errno = 0;
+            physical_block_num = allocate_block_for_write(context, &table_inode, SIMPLEFS_REFCOUNT_INODE_NUM, lbn, nullptr);
+            if (physical_block_num == 0) {
+                result = errno ? -errno : -ENOSPC;
+                break;
+            }
+            // 加载时按块总数确定表的范围，i_size只用于显示
+            uint64_t table_end = static_cast<uint64_t>(lbn + 1) * context.block_size;
+            if (table_end > table_inode.i_size) table_inode.i_size = static_cast<uint32_t>(std::min<uint64_t>(table_end, UINT32_MAX));
+            inode_changed = true;
+        }
+        if (write_block(context.device_fd, physical_block_num, table_block.data()) != 0) {
+            result = -EIO;
+            break;
+        }
+    }
+    if (inode_changed && write_inode_to_disk(context, SIMPLEFS_REFCOUNT_INODE_NUM, &table_inode) != 0 && result == 0) {
+        result = -EIO;
+    }
+    return result;
+}
+
+int block_refs_get(SimpleFS_Context& context, const std::vector<uint32_t>& block_nums) {
+    if (!has_reflink(context.sb)) {
+        return -EOPNOTSUPP;
+    }
+    const uint32_t per_block = refcounts_per_block(context);
+    std::set<uint32_t> table_lbns;
+    for (uint32_t block_ptr : block_nums) {
+        uint32_t block_num = block_ptr & SIMPLEFS_BLOCK_PTR_MASK;
+        context.block_extra_refs[block_num]++;
+        table_lbns.insert(block_num / per_block);
+    }
+    int res = write_refcount_table(context, table_lbns);
+    if (res != 0) {
+        // 已写入的表块只会多记引用，最坏情况是块泄漏而不会被提前释放
+        for (uint32_t block_ptr : block_nums) {
+            auto it = context.block_extra_refs.find(block_ptr & SIMPLEFS_BLOCK_PTR_MASK);
+            if (it != context.block_extra_refs.end() && --it->second == 0) {
+                context.block_extra_refs.erase(it);
+            }
+        }
+    }
+    return res;
+}
+
+void block_refs_put(SimpleFS_Context& context, std::vector<uint32_t>& block_nums) {
+    if (context.block_extra_refs.empty()) {
+        return;
+    }
+    const uint32_t per_block = refcounts_per_block(context);
+    std::set<uint32_t> table_lbns;
+    size_t kept = 0;
+    for (size_t i = 0; i < block_nums.size(); ++i) {
+        auto it = context.block_extra_refs.find(block_nums[i]);
+        if (it == context.block_extra_refs.end()) {
+            block_nums[kept++] = block_nums[i];
+            continue;
+        }
+        // 同一块在列表中出现多次时，前几次减少引用，计数归零后的那次才释放
+        if (--it->second == 0) {
+            context.block_extra_refs.erase(it);
+        }
+        table_lbns.insert(block_nums[i] / per_block);
+    }
+    block_nums.resize(kept);
+    if (write_refcount_table(context, table_lbns) != 0) {
+        std::cerr << "引用计数表写入失败" << std::endl;
+    }
+}
@@ -0,0 +1,666 @@
+#include "snapshot.h"
+#include "metadata.h"
+#include "disk_io.h"
+#include "delalloc.h"
+#include "utils.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <set>
+#include <map>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+#include <sys/stat.h> // S_IFREG
+#include <time.h>
+
+// 一个快照：名字、存储inode号和内存中的存储inode（块映射变化时写回）
+struct SnapshotStore {
+    std::string name;
+    uint32_t inode_num;
+    SimpleFS_Inode inode;
+    bool overflowed;                // 已因空间不足丢失过旧内容（只提示一次）
+};
+
+// 以下状态由fs_mutex保护
+static SimpleFS_Context* snapshot_context = nullptr;
+static std::vector<SnapshotStore> snapshots; // 从旧到新，back()为最新快照
+// 最新快照各块组的待复制位图：置位的块在最新快照时刻在用且尚未复制，按需加载，空表示尚未加载
+static std::vector<std::vector<uint8_t>> pending_bitmaps;
+static int view_index = -1;         // 正在浏览的快照，-1表示没有
+// 删除快照期间不需要复制或保留的块：快照存储自己的块，只有删除过程会改写或释放它们
+static std::set<uint32_t> unretained_blocks;
+
+static uint32_t gdt_blocks_count(const SimpleFS_Context& context) {
+    uint32_t gdt_size_bytes = context.gdt.size() * sizeof(SimpleFS_GroupDesc);
+    return static_cast<uint32_t>(std::ceil(static_cast<double>(gdt_size_bytes) / context.block_size));
+}
+
+static uint32_t inode_table_block_of(const SimpleFS_Context& context, uint32_t inode_num) {
+    uint32_t group_idx = (inode_num - 1) / context.sb.s_inodes_per_group;
+    uint32_t inode_offset_in_group = (inode_num - 1) % context.sb.s_inodes_per_group;
+    uint32_t inodes_per_block = context.block_size / context.sb.s_inode_size;
+    return context.gdt[group_idx].bg_inode_table + inode_offset_in_group / inodes_per_block;
+}
+
+// 逻辑块在块树中的位置：root为i_block下标，levels为间接层数，indexes为各层间接块中的下标
+struct StorePath {
+    uint32_t root;
+    int levels;
+    uint32_t indexes[3];
+};
+
+static int store_path_of(const SimpleFS_Context& context, uint32_t lbn, StorePath* path) {
+    if (lbn < SIMPLEFS_NUM_DIRECT_BLOCKS) {
+        path->root = lbn;
+        path->levels = 0;
+        return 0;
+    }
+    const uint64_t pointers_per_block = context.block_size / sizeof(uint32_t);
+    uint64_t rel = lbn - SIMPLEFS_NUM_DIRECT_BLOCKS;
+    uint64_t span = pointers_per_block;
+    for (int level = 1; level <= 3; ++level) {
+        if (rel < span) {
+            path->root = SIMPLEFS_NUM_DIRECT_BLOCKS + level - 1;
+            path->levels = level;
+            for (int i = level - 1; i >= 0; --i) {
+                path->indexes[i] = static_cast<uint32_t>(rel % pointers_per_block);
+                rel /= pointers_per_block;
+            }
+            return 0;
+        }
+        rel -= span;
+        span *= pointers_per_block;
+    }
+    return -EFBIG;
+}
+
+// 映射lbn还缺少的间接块数（只读）
+static int store_missing_levels(SimpleFS_Context& context, const SimpleFS_Inode& inode, const StorePath& path) {
+    uint32_t block_num = inode.i_block[path.root];
+    std::vector<uint32_t> indirect_block(context.block_size / sizeof(uint32_t));
+    for (int i = 0; i < path.levels; ++i) {
+        if (block_num == 0) return path.levels - i;
+        if (read_block(context.device_fd, block_num, indirect_block.data()) != 0) return -EIO;
+        block_num = indirect_block[path.indexes[i]];
+    }
+    return 0;
+}
+
+// 设置存储中lbn的映射（ptr为0时清除），缺少的间接块取自spares，不在这里分配：
+// 分配块会修改块位图，可能引起对最新快照的嵌套复制，放在读出任何间接块之前完成
+// 不写回存储inode
+static int store_set_block(SimpleFS_Context& context, SimpleFS_Inode& inode, uint32_t lbn, uint32_t ptr,
+                           std::vector<uint32_t>& spares) {
+    StorePath path;
+    int res = store_path_of(context, lbn, &path);
+    if (res != 0) return res;
+    const uint32_t sectors_per_block = context.block_size / 512;
+    auto take_spare = [&](uint32_t* p_block_num) {
+        if (spares.empty()) return -EIO;
+        *p_block_num = spares.back();
+        spares.pop_back();
+        if (write_zero_blocks(context.device_fd, *p_block_num, 1) != 0) return -EIO;
+        inode.i_blocks += sectors_per_block;
+        return 0;
+    };
+
+    uint32_t old_ptr;
+    if (path.levels == 0) {
+        old_ptr = inode.i_block[path.root];
+        inode.i_block[path.root] = ptr;
+    } else {
+        if (inode.i_block[path.root] == 0) {
+            if (ptr == 0) return 0;
+            if ((res = take_spare(&inode.i_block[path.root])) != 0) return res;
+        }
+        uint32_t block_num = inode.i_block[path.root];
+        std::vector<uint32_t> indirect_block(context.block_size / sizeof(uint32_t));
+        for (int i = 0;; ++i) {
+            if (read_block(context.device_fd, block_num, indirect_block.data()) != 0) return -EIO;
+            uint32_t& entry = indirect_block[path.indexes[i]];
+            if (i == path.levels - 1) {
+                old_ptr = entry;
+                entry = ptr;
+                if (write_block(context.device_fd, block_num, indirect_block.data()) != 0) return -EIO;
+                break;
+            }
+            if (entry == 0) {
+                if (ptr == 0) return 0;
+                if ((res = take_spare(&entry)) != 0) return res;
+                if (write_block(context.device_fd, block_num, indirect_block.data()) != 0) return -EIO;
+            }
+            block_num = entry;
+        }
+    }
+    if (old_ptr == 0 && ptr != 0) inode.i_blocks += sectors_per_block;
+    if (old_ptr != 0 && ptr == 0) inode.i_blocks -= sectors_per_block;
+    return 0;
+}
+
+// 将lbn映射到ptr，先按需分配间接块再一次性安装映射；不写回存储inode
+static int store_map_block(SimpleFS_Context& context, SnapshotStore& store, uint32_t lbn, uint32_t ptr) {
+    StorePath path;
+    int res = store_path_of(context, lbn, &path);
+    if (res != 0) return res;
+    int missing = store_missing_levels(context, store.inode, path);
+    if (missing < 0) return missing;
+
+    std::vector<uint32_t> spares;
+    for (int i = 0; i < missing; ++i) {
+        errno = 0;
+        uint32_t block_num = alloc_block(context, lbn / context.sb.s_blocks_per_group);
+        if (block_num == 0) {
+            res = errno ? -errno : -ENOSPC;
+            break;
+        }
+        spares.push_back(block_num);
+    }
+    if (res == 0) {
+        // 分配期间的嵌套复制可能已经建好部分间接块，用不上的备用块归还
+        res = store_set_block(context, store.inode, lbn, ptr, spares);
+    }
+    if (!spares.empty()) {
+        free_blocks(context, spares);
+    }
+    return res;
+}
+
+// 快照index读取块b时实际读取的块：自己及之后的快照中第一个保存了b的副本，都没有时为b本身
+static uint32_t resolve_view_block(SimpleFS_Context& context, size_t index, uint32_t block_num) {
+    for (size_t j = index; j < snapshots.size(); ++j) {
+        uint32_t copy_block = map_logical_to_physical_block(context, &snapshots[j].inode, block_num);
+        if (copy_block != 0) return copy_block;
+    }
+    return block_num;
+}
+
+// 读取快照index时刻块组的块位图
+static int read_view_block_bitmap(SimpleFS_Context& context, size_t index, uint32_t group_idx, std::vector<uint8_t>& bitmap) {
+    bitmap.resize(context.block_size);
+    uint32_t block_num = resolve_view_block(context, index, context.gdt[group_idx].bg_block_bitmap);
+    return read_block(context.device_fd, block_num, bitmap.data()) == 0 ? 0 : -EIO;
+}
+
+// 块组的待复制位图，必要时加载：最新快照时刻的块位图，去掉已有副本的块和不需要保留的元数据块
+// 超级块、组描述符表及其备份由sync_fs_metadata整体重写，计数与快照无关；快照浏览不使用inode位图
+static std::vector<uint8_t>* pending_bitmap(SimpleFS_Context& context, uint32_t group_idx) {
+    std::vector<uint8_t>& bitmap = pending_bitmaps[group_idx];
+    if (!bitmap.empty()) return &bitmap;
+
+    std::vector<uint8_t> loaded;
+    if (read_view_block_bitmap(context, snapshots.size() - 1, group_idx, loaded) != 0) return nullptr;
+    const SimpleFS_Inode& latest_inode = snapshots.back().inode;
+    uint32_t group_start = group_idx * context.sb.s_blocks_per_group;
+    uint32_t group_end = std::min(group_start + context.sb.s_blocks_per_group, context.sb.s_blocks_count);
+    uint32_t lbn = find_data_or_hole_lbn(context, &latest_inode, group_start, group_end, true);
+    while (lbn < group_end) {
+        uint32_t hole_lbn = find_data_or_hole_lbn(context, &latest_inode, lbn, group_end, false);
+        clear_bitmap_range(loaded, lbn - group_start, hole_lbn - lbn);
+        lbn = find_data_or_hole_lbn(context, &latest_inode, hole_lbn, group_end, true);
+    }
+    if (group_idx == 0) {
+        clear_bitmap_range(loaded, 0, 2 + gdt_blocks_count(context));
+    } else if (is_backup_group(group_idx)) {
+        clear_bitmap_range(loaded, 0, 1 + gdt_blocks_count(context));
+    }
+    for (const SimpleFS_GroupDesc& gd : context.gdt) {
+        if (gd.bg_inode_bitmap / context.sb.s_blocks_per_group == group_idx) {
+            clear_bitmap_bit(loaded, gd.bg_inode_bitmap - group_start);
+        }
+    }
+    bitmap = std::move(loaded);
+    return &bitmap;
+}
+
+// 块是否待复制，加载失败返回-EIO
+static int block_is_pending(SimpleFS_Context& context, uint32_t block_num) {
+    if (snapshots.empty() || block_num == 0 || block_num >= context.sb.s_blocks_count) return 0;
+    if (unretained_blocks.count(block_num) != 0) return 0;
+    uint32_t group_idx = block_num / context.sb.s_blocks_per_group;
+    std::vector<uint8_t>* bitmap = pending_bitmap(context, group_idx);
+    if (!bitmap) return -EIO;
+    return is_bitmap_bit_set(*bitmap, block_num % context.sb.s_blocks_per_group) ? 1 : 0;
+}
+
+static void set_block_pending(SimpleFS_Context& context, uint32_t block_num, bool pending) {
+    std::vector<uint8_t>& bitmap = pending_bitmaps[block_num / context.sb.s_blocks_per_group];
+    if (bitmap.empty()) return;
+    if (pending) {
+        set_bitmap_bit(bitmap, block_num % context.sb.s_blocks_per_group);
+    } else {
+        clear_bitmap_bit(bitmap, block_num % context.sb.s_blocks_per_group);
+    }
+}
+
+// 空间不足时快照放弃保留旧内容，活动文件系统照常工作（同LVM快照溢出）
+static void report_overflow(SnapshotStore& store, uint32_t block_num) {
+    if (store.overflowed) return;
+    store.overflowed = true;
+    std::cerr << "快照 " << store.name << " 空间不足，块 " << block_num << " 起的旧内容未能保留，该快照已不完整" << std::endl;
+}
+
+// 将待复制的块b复制到最新快照
+static int cow_block(SimpleFS_Context& context, uint32_t block_num) {
+    SnapshotStore& latest = snapshots.back();
+    // 先清除待复制标记：分配副本时的嵌套写入不会再复制它
+    set_block_pending(context, block_num, false);
+    std::vector<uint8_t> old_content(context.block_size);
+    if (read_block(context.device_fd, block_num, old_content.data()) != 0) {
+        set_block_pending(context, block_num, true);
+        return -EIO;
+    }
+    errno = 0;
+    uint32_t copy_block = alloc_block(context, block_num / context.sb.s_blocks_per_group);
+    if (copy_block == 0) {
+        if (errno != 0 && errno != ENOSPC) {
+            set_block_pending(context, block_num, true);
+            return -EIO;
+        }
+        report_overflow(latest, block_num);
+        return 0;
+    }
+    int res = write_block(context.device_fd, copy_block, old_content.data()) == 0 ? 0 : -EIO;
+    if (res == 0) res = store_map_block(context, latest, block_num, copy_block);
+    if (res != 0) {
+        free_block(context, copy_block);
+        if (res != -ENOSPC) {
+            set_block_pending(context, block_num, true);
+            return -EIO;
+        }
+        report_overflow(latest, block_num);
+        return 0;
+    }
+    if (write_inode_to_disk(context, latest.inode_num, &latest.inode) != 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+int snapshot_cow_blocks(SimpleFS_Context& context, uint32_t start_block_num, uint32_t count) {
+    if (snapshots.empty()) return 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t block_num = start_block_num + i;
+        int pending = block_is_pending(context, block_num);
+        if (pending < 0) return pending;
+        if (pending) {
+            int res = cow_block(context, block_num);
+            if (res != 0) return res;
+        }
+    }
+    return 0;
+}
+
+// disk_io的写入钩子
+static int snapshot_write_hook(uint32_t start_block_num, uint32_t count) {
+    return -snapshot_cow_blocks(*snapshot_context, start_block_num, count);
+}
+
+void snapshot_retain_freed_blocks(SimpleFS_Context& context, std::vector<uint32_t>& block_nums) {
+    if (snapshots.empty()) return;
+    SnapshotStore& latest = snapshots.back();
+    bool retained_any = false;
+    size_t kept = 0;
+    for (size_t i = 0; i < block_nums.size(); ++i) {
+        uint32_t block_num = block_nums[i];
+        if (block_is_pending(context, block_num) > 0) {
+            // 块原样转入快照存储，不复制也不释放
+            set_block_pending(context, block_num, false);
+            int res = store_map_block(context, latest, block_num, block_num);
+            if (res == 0) {
+                retained_any = true;
+                continue;
+            }
+            report_overflow(latest, block_num);
+        }
+        block_nums[kept++] = block_num;
+    }
+    block_nums.resize(kept);
+    if (retained_any && write_inode_to_disk(context, latest.inode_num, &latest.inode) != 0) {
+        std::cerr << "快照 " << latest.name << " 的inode写入失败" << std::endl;
+    }
+}
+
+// 成为最新快照时，先复制自己的存储inode所在的inode表块：
+// 之后的复制要写回存储inode，不能在复制这个块的过程中再改写它
+static int activate_latest(SimpleFS_Context& context) {
+    pending_bitmaps.assign(context.gdt.size(), std::vector<uint8_t>());
+    if (snapshots.empty()) return 0;
+    return snapshot_cow_blocks(context, inode_table_block_of(context, snapshots.back().inode_num), 1);
+}
+
+// 读取重映射：浏览快照时的块读取
+static uint32_t snapshot_read_remap(uint32_t block_num) {
+    if (view_index < 0 || block_num >= snapshot_context->sb.s_blocks_count) return block_num;
+    // 查找副本时读取的是快照存储自己的间接块，不经重映射
+    int saved_errno = errno;
+    set_block_read_remap(nullptr);
+    uint32_t resolved = resolve_view_block(*snapshot_context, view_index, block_num);
+    set_block_read_remap(snapshot_read_remap);
+    errno = saved_errno;
+    return resolved;
+}
+
+int snapshot_view_begin(SimpleFS_Context& context, const std::string& name) {
+    for (size_t i = 0; i < snapshots.size(); ++i) {
+        if (snapshots[i].name == name) {
+            (void)context;
+            view_index = static_cast<int>(i);
+            set_block_read_remap(snapshot_read_remap);
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+void snapshot_view_end() {
+    set_block_read_remap(nullptr);
+    view_index = -1;
+}
+
+std::vector<std::string> snapshot_names() {
+    std::vector<std::string> names;
+    for (const SnapshotStore& store : snapshots) {
+        names.push_back(store.name);
+    }
+    return names;
+}
+
+bool is_snapshot_path(const SimpleFS_Context& context, const char* path) {
+    if (!has_snapshot(context.sb)) return false;
+    size_t dir_len = std::strlen(SIMPLEFS_SNAPSHOT_DIR_PATH);
+    return std::strncmp(path, SIMPLEFS_SNAPSHOT_DIR_PATH, dir_len) == 0 &&
+           (path[dir_len] == '\0' || path[dir_len] == '/');
+}
+
+// 快照目录中的 名字 -> 存储inode号
+static int read_snapshot_dir(SimpleFS_Context& context, std::map<uint32_t, std::string>& names) {
+    SimpleFS_Inode dir_inode;
+    if (read_inode_from_disk(context, SIMPLEFS_SNAPSHOT_DIR_INODE_NUM, &dir_inode) != 0) return -1;
+    std::vector<uint8_t> block_buffer(context.block_size);
+    uint32_t dir_blocks = (dir_inode.i_size + context.block_size - 1) / context.block_size;
+    for (uint32_t lbn = 0; lbn < dir_blocks; ++lbn) {
+        int read_res = read_dir_logical_block(context, &dir_inode, lbn, block_buffer.data());
+        if (read_res < 0) return -1;
+        if (read_res > 0) continue;
+        uint32_t entry_offset = 0;
+        while (entry_offset < dir_block_entries_end(context)) {
+            SimpleFS_DirEntry* entry = reinterpret_cast<SimpleFS_DirEntry*>(block_buffer.data() + entry_offset);
+            if (dir_entry_rec_len(entry) == 0) break;
+            if (entry->inode != 0 && entry->name_len > 0) {
+                names[entry->inode] = std::string(entry->name, entry->name_len);
+            }
+            entry_offset += dir_entry_rec_len(entry);
+        }
+    }
+    return 0;
+}
+
+int load_snapshots(SimpleFS_Context& context) {
+    snapshots.clear();
+    std::map<uint32_t, std::string> names;
+    if (context.sb.s_snapshot_count > SIMPLEFS_MAX_SNAPSHOTS || read_snapshot_dir(context, names) != 0) {
+        std::cerr << "快照目录无效" << std::endl;
+        errno = EIO;
+        return -1;
+    }
+    for (uint32_t i = 0; i < context.sb.s_snapshot_count; ++i) {
+        SnapshotStore store;
+        store.inode_num = context.sb.s_snapshot_inodes[i];
+        store.overflowed = false;
+        auto it = names.find(store.inode_num);
+        if (it == names.end() || read_inode_from_disk(context, store.inode_num, &store.inode) != 0 ||
+            !S_ISREG(store.inode.i_mode)) {
+            std::cerr << "快照inode " << store.inode_num << " 无效" << std::endl;
+            snapshots.clear();
+            errno = EIO;
+            return -1;
+        }
+        store.name = it->second;
+        snapshots.push_back(store);
+    }
+    snapshot_context = &context;
+    set_block_write_hook(snapshot_write_hook);
+    if (activate_latest(context) != 0) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+static bool is_valid_snapshot_name(const std::string& name) {
+    return !name.empty() && name != "." && name != ".." && name.find('/') == std::string::npos;
+}
+
+int snapshot_create(SimpleFS_Context& context, const std::string& name) {
+    if (!has_snapshot(context.sb)) return -EOPNOTSUPP;
+    if (!is_valid_snapshot_name(name)) return -EINVAL;
+    if (name.length() > SIMPLEFS_MAX_FILENAME_LEN) return -ENAMETOOLONG;
+    for (const SnapshotStore& store : snapshots) {
+        if (store.name == name) return -EEXIST;
+    }
+    if (snapshots.size() >= SIMPLEFS_MAX_SNAPSHOTS) return -ENOSPC;
+
+    // 快照只包含磁盘上的内容，先回写延迟分配的数据
+    int res = delalloc_writeback_all(context);
+    if (res != 0) return res;
+
+    uint32_t inode_num = alloc_inode(context, S_IFREG | 0400, SIMPLEFS_SNAPSHOT_DIR_INODE_NUM);
+    if (inode_num == 0) return -errno;
+    SnapshotStore store;
+    store.name = name;
+    store.inode_num = inode_num;
+    store.overflowed = false;
+    std::memset(&store.inode, 0, sizeof(SimpleFS_Inode));
+    store.inode.i_mode = S_IFREG | 0400;
+    store.inode.i_links_count = 1;
+    // 存储按块号映射，文件大小即设备大小
+    uint64_t store_size = static_cast<uint64_t>(context.sb.s_blocks_count) * context.block_size;
+    store.inode.i_size = static_cast<uint32_t>(store_size);
+    store.inode.i_size_high = static_cast<uint32_t>(store_size >> 32);
+    touch_inode_times(&store.inode, SIMPLEFS_TIME_ALL);
+    if (write_inode_to_disk(context, inode_num, &store.inode) != 0) {
+        free_inode(context, inode_num, store.inode.i_mode);
+        return -EIO;
+    }
+
+    SimpleFS_Inode dir_inode;
+    if (read_inode_from_disk(context, SIMPLEFS_SNAPSHOT_DIR_INODE_NUM, &dir_inode) != 0) {
+        res = -EIO;
+    } else {
+        res = add_dir_entry(context, &dir_inode, SIMPLEFS_SNAPSHOT_DIR_INODE_NUM, name, inode_num, (S_IFREG >> 12));
+    }
+    if (res != 0) {
+        store.inode.i_links_count = 0;
+        store.inode.i_dtime = time(nullptr);
+        write_inode_to_disk(context, inode_num, &store.inode);
+        free_inode(context, inode_num, store.inode.i_mode);
+        return res;
+    }
+
+    // 超级块写入之后的修改都由新快照保留
+    context.sb.s_snapshot_inodes[context.sb.s_snapshot_count++] = inode_num;
+    sync_fs_metadata(context);
+    snapshots.push_back(store);
+    if (activate_latest(context) != 0) {
+        std::cerr << "快照 " << name << " 的inode表块复制失败" << std::endl;
+    }
+    return 0;
+}
+
+// 递归收集存储块树中的块，indirect_only时只收集间接块
+static void collect_store_tree(SimpleFS_Context& context, uint32_t block_num, int level, bool indirect_only,
+                               std::vector<uint32_t>& out_blocks) {
+    if (block_num == 0) return;
+    if (level == 0) {
+        if (!indirect_only) out_blocks.push_back(block_num);
+        return;
+    }
+    std::vector<uint32_t> indirect_block(context.block_size / sizeof(uint32_t));
+    if (read_block(context.device_fd, block_num, indirect_block.data()) == 0) {
+        for (uint32_t child : indirect_block) {
+            collect_store_tree(context, child, level - 1, indirect_only, out_blocks);
+        }
+    }
+    out_blocks.push_back(block_num);
+}
+
+static void collect_store_blocks(SimpleFS_Context& context, const SimpleFS_Inode& inode, bool indirect_only,
+                                 std::vector<uint32_t>& out_blocks) {
+    for (uint32_t i = 0; i < SIMPLEFS_NUM_DIRECT_BLOCKS; ++i) {
+        collect_store_tree(context, inode.i_block[i], 0, indirect_only, out_blocks);
+    }
+    for (int level = 1; level <= 3; ++level) {
+        collect_store_tree(context, inode.i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + level - 1], level, indirect_only, out_blocks);
+    }
+}
+
+// 快照k删除时由前一个快照接管的副本 (块号, 副本)：前一个快照在该块上是空洞（两个快照之间未修改），
+// 且它的时刻该块在用；前一个快照时刻的块位图按块组缓存在heir_bitmaps中
+static int find_transfers(SimpleFS_Context& context, size_t k, std::map<uint32_t, std::vector<uint8_t>>& heir_bitmaps,
+                          std::vector<std::pair<uint32_t, uint32_t>>& transfers) {
+    const SimpleFS_Inode& victim_inode = snapshots[k].inode;
+    const SimpleFS_Inode& heir_inode = snapshots[k - 1].inode;
+    const uint32_t end_lbn = context.sb.s_blocks_count;
+    uint32_t lbn = find_data_or_hole_lbn(context, &victim_inode, 0, end_lbn, true);
+    while (lbn < end_lbn) {
+        if (map_logical_to_physical_block(context, &heir_inode, lbn) == 0) {
+            uint32_t group_idx = lbn / context.sb.s_blocks_per_group;
+            auto it = heir_bitmaps.find(group_idx);
+            if (it == heir_bitmaps.end()) {
+                it = heir_bitmaps.emplace(group_idx, std::vector<uint8_t>()).first;
+                if (read_view_block_bitmap(context, k - 1, group_idx, it->second) != 0) return -EIO;
+            }
+            if (is_bitmap_bit_set(it->second, lbn % context.sb.s_blocks_per_group)) {
+                transfers.emplace_back(lbn, map_logical_to_physical_block(context, &victim_inode, lbn));
+            }
+        }
+        lbn = find_data_or_hole_lbn(context, &victim_inode, lbn + 1, end_lbn, true);
+    }
+    return 0;
+}
+
+// 删除非最新快照后，从较新快照时刻的块位图中去掉它归还的块：这些块在较新快照时刻是快照存储而不是
+// 文件数据，之后可能被重新分配，不应再被复制或保留。最新快照没有位图块副本时先复制，不能修改设备上的块位图
+static int forget_freed_blocks(SimpleFS_Context& context, size_t first_newer, const std::vector<uint32_t>& freed_blocks) {
+    std::map<uint32_t, std::vector<uint32_t>> blocks_by_group;
+    for (uint32_t block_num : freed_blocks) {
+        if (block_num != 0 && block_num < context.sb.s_blocks_count) {
+            blocks_by_group[block_num / context.sb.s_blocks_per_group].push_back(block_num);
+        }
+    }
+    std::vector<uint8_t> bitmap(context.block_size);
+    for (const auto& group : blocks_by_group) {
+        uint32_t group_idx = group.first;
+        uint32_t group_start = group_idx * context.sb.s_blocks_per_group;
+        uint32_t bitmap_block = context.gdt[group_idx].bg_block_bitmap;
+        int res = snapshot_cow_blocks(context, bitmap_block, 1);
+        if (res != 0) return res;
+        for (size_t j = first_newer; j < snapshots.size(); ++j) {
+            uint32_t copy_block = map_logical_to_physical_block(context, &snapshots[j].inode, bitmap_block);
+            if (copy_block == 0) continue;
+            // 较旧快照的副本也是快照存储的块，改写时不需要复制
+            unretained_blocks.insert(copy_block);
+            if (read_block(context.device_fd, copy_block, bitmap.data()) != 0) return -EIO;
+            for (uint32_t block_num : group.second) {
+                clear_bitmap_bit(bitmap, block_num - group_start);
+            }
+            if (write_block(context.device_fd, copy_block, bitmap.data()) != 0) return -EIO;
+        }
+        std::vector<uint8_t>* pending = pending_bitmap(context, group_idx);
+        if (!pending) return -EIO;
+        for (uint32_t block_num : group.second) {
+            clear_bitmap_bit(*pending, block_num - group_start);
+        }
+    }
+    return 0;
+}
+
+int snapshot_delete(SimpleFS_Context& context, const std::string& name) {
+    if (!has_snapshot(context.sb)) return -EOPNOTSUPP;
+    size_t k = 0;
+    while (k < snapshots.size() && snapshots[k].name != name) ++k;
+    if (k == snapshots.size()) return -ENOENT;
+    const bool was_latest = (k + 1 == snapshots.size());
+
+    // 被删除快照的存储块和前一个快照的间接块在删除期间被改写或释放时不需要复制
+    std::vector<uint32_t> store_blocks;
+    collect_store_blocks(context, snapshots[k].inode, false, store_blocks);
+    if (k > 0) collect_store_blocks(context, snapshots[k - 1].inode, true, store_blocks);
+    unretained_blocks.clear();
+    unretained_blocks.insert(store_blocks.begin(), store_blocks.end());
+
+    // 前一个快照接管它仍需要的副本；判断是否需要时读取的块位图必须在修改任何位图副本之前取得
+    std::vector<std::pair<uint32_t, uint32_t>> transferred;
+    if (k > 0) {
+        SnapshotStore& heir = snapshots[k - 1];
+        std::map<uint32_t, std::vector<uint8_t>> heir_bitmaps;
+        std::vector<std::pair<uint32_t, uint32_t>> transfers;
+        int res = find_transfers(context, k, heir_bitmaps, transfers);
+        while (res == 0 && !transfers.empty()) {
+            for (const auto& transfer : transfers) {
+                res = store_map_block(context, heir, transfer.first, transfer.second);
+                if (res != 0) break;
+                transferred.push_back(transfer);
+            }
+            if (res == 0 && write_inode_to_disk(context, heir.inode_num, &heir.inode) != 0) res = -EIO;
+            transfers.clear();
+            // 被删除的是最新快照时，接管过程中的分配和写入又会向它复制块，直到没有新的副本需要接管
+            if (res == 0 && was_latest) res = find_transfers(context, k, heir_bitmaps, transfers);
+        }
+        if (res != 0) {
+            // 撤销已接管的映射，清除映射不需要分配
+            std::vector<uint32_t> no_spares;
+            for (const auto& transfer : transferred) {
+                store_set_block(context, heir.inode, transfer.first, 0, no_spares);
+            }
+            write_inode_to_disk(context, heir.inode_num, &heir.inode);
+            unretained_blocks.clear();
+            return res;
+        }
+    }
+
+    SimpleFS_Inode dir_inode;
+    if (read_inode_from_disk(context, SIMPLEFS_SNAPSHOT_DIR_INODE_NUM, &dir_inode) != 0 ||
+        remove_dir_entry(context, &dir_inode, SIMPLEFS_SNAPSHOT_DIR_INODE_NUM, name) != 0) {
+        std::cerr << "快照目录项 " << name << " 删除失败" << std::endl;
+    }
+    std::copy(context.sb.s_snapshot_inodes + k + 1, context.sb.s_snapshot_inodes + context.sb.s_snapshot_count,
+              context.sb.s_snapshot_inodes + k);
+    context.sb.s_snapshot_inodes[--context.sb.s_snapshot_count] = 0;
+    sync_fs_metadata(context);
+
+    SnapshotStore victim = snapshots[k];
+    snapshots.erase(snapshots.begin() + k);
+    if (was_latest && activate_latest(context) != 0) {
+        std::cerr << "快照 " << snapshots.back().name << " 的inode表块复制失败" << std::endl;
+    }
+
+    // 归还存储块，已由前一个快照接管的副本除外
+    std::set<uint32_t> kept_blocks;
+    for (const auto& transfer : transferred) {
+        kept_blocks.insert(transfer.second);
+    }
+    std::vector<uint32_t> freed_blocks;
+    store_blocks.clear();
+    collect_store_blocks(context, victim.inode, false, store_blocks);
+    for (uint32_t block_num : store_blocks) {
+        if (kept_blocks.count(block_num) == 0) freed_blocks.push_back(block_num);
+    }
+    if (!was_latest && forget_freed_blocks(context, k, freed_blocks) != 0) {
+        std::cerr << "快照 " << name << " 归还的块未能从较新快照中去除" << std::endl;
+    }
+    free_blocks(context, freed_blocks);
+    unretained_blocks.clear();
+
+    std::memset(victim.inode.i_block, 0, sizeof(victim.inode.i_block));
+    victim.inode.i_blocks = 0;
+    victim.inode.i_links_count = 0;
+    victim.inode.i_dtime = time(nullptr);
+    write_inode_to_disk(context, victim.inode_num, &victim.inode);
+    free_inode(context, victim.inode_num, victim.inode.i_mode);
+    sync_fs_metadata(context);
+    return 0;
+}
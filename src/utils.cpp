@@ -1,6 +1,7 @@
 #include "utils.h"
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 
 void set_bitmap_bit(std::vector<uint8_t>& bitmap_data, uint32_t bit_index) {
     uint32_t byte_index = bit_index / 8;
@@ -27,6 +28,83 @@ bool is_bitmap_bit_set(const std::vector<uint8_t>& bitmap_data, uint32_t bit_ind
     return true;
 }
 
+// 区间位操作的公共实现：首尾不足64位的部分逐位处理，中间按64位字处理
+static uint32_t update_bitmap_range(std::vector<uint8_t>& bitmap_data, uint32_t start_bit, uint32_t count, bool set_bits) {
+    uint64_t limit = static_cast<uint64_t>(bitmap_data.size()) * 8;
+    if (start_bit >= limit) return 0;
+    uint64_t end_bit = std::min<uint64_t>(limit, static_cast<uint64_t>(start_bit) + count);
+    uint32_t changed = 0;
+    uint64_t bit = start_bit;
+
+    while (bit < end_bit && (bit % 64) != 0) {
+        uint8_t mask = static_cast<uint8_t>(1 << (bit % 8));
+        uint8_t& byte = bitmap_data[bit / 8];
+        if (((byte & mask) != 0) != set_bits) {
+            byte ^= mask;
+            changed++;
+        }
+        bit++;
+    }
+
+    while (bit + 64 <= end_bit) {
+        uint64_t word;
+        std::memcpy(&word, bitmap_data.data() + bit / 8, sizeof(word));
+        changed += set_bits ? (64 - __builtin_popcountll(word)) : __builtin_popcountll(word);
+        word = set_bits ? ~0ULL : 0ULL;
+        std::memcpy(bitmap_data.data() + bit / 8, &word, sizeof(word));
+        bit += 64;
+    }
+
+    while (bit < end_bit) {
+        uint8_t mask = static_cast<uint8_t>(1 << (bit % 8));
+        uint8_t& byte = bitmap_data[bit / 8];
+        if (((byte & mask) != 0) != set_bits) {
+            byte ^= mask;
+            changed++;
+        }
+        bit++;
+    }
+    return changed;
+}
+
+uint32_t set_bitmap_range(std::vector<uint8_t>& bitmap_data, uint32_t start_bit, uint32_t count) {
+    return update_bitmap_range(bitmap_data, start_bit, count, true);
+}
+
+uint32_t clear_bitmap_range(std::vector<uint8_t>& bitmap_data, uint32_t start_bit, uint32_t count) {
+    return update_bitmap_range(bitmap_data, start_bit, count, false);
+}
+
+// 查找下一个等于want_set的位；want_set为false时把字取反后统一按查找1处理
+static uint32_t find_next_bit(const std::vector<uint8_t>& bitmap_data, uint32_t from_bit, uint32_t limit_bit, bool want_set) {
+    uint64_t limit = std::min<uint64_t>(limit_bit, static_cast<uint64_t>(bitmap_data.size()) * 8);
+    uint64_t bit = from_bit;
+    while (bit < limit && (bit % 64) != 0) {
+        if (((bitmap_data[bit / 8] >> (bit % 8)) & 1) == want_set) return static_cast<uint32_t>(bit);
+        bit++;
+    }
+    while (bit + 64 <= limit) {
+        uint64_t word;
+        std::memcpy(&word, bitmap_data.data() + bit / 8, sizeof(word));
+        if (!want_set) word = ~word;
+        if (word != 0) return static_cast<uint32_t>(bit + __builtin_ctzll(word));
+        bit += 64;
+    }
+    while (bit < limit) {
+        if (((bitmap_data[bit / 8] >> (bit % 8)) & 1) == want_set) return static_cast<uint32_t>(bit);
+        bit++;
+    }
+    return limit_bit;
+}
+
+uint32_t find_next_clear_bit(const std::vector<uint8_t>& bitmap_data, uint32_t from_bit, uint32_t limit_bit) {
+    return find_next_bit(bitmap_data, from_bit, limit_bit, false);
+}
+
+uint32_t find_next_set_bit(const std::vector<uint8_t>& bitmap_data, uint32_t from_bit, uint32_t limit_bit) {
+    return find_next_bit(bitmap_data, from_bit, limit_bit, true);
+}
+
 void parse_path(const std::string& path, std::string& dirname, std::string& basename) {
     if (path.empty()) {
         dirname = ".";
@@ -12,6 +12,9 @@ import random
 import string
 import shutil
 import sys
+import errno
+import re
+import ctypes
 from collections import defaultdict
 
 # --- 配置部分 ---
@@ -24,6 +27,12 @@ BUILD_DIR = os.path.join(PROJECT_DIR, "build")
 SIMPLEFS_EXEC = os.path.join(BUILD_DIR, "simplefs")
 # mkfs.simplefs 可执行文件路径
 MKFS_EXEC = os.path.join(BUILD_DIR, "mkfs.simplefs")
+# simplefsctl 可执行文件路径
+SIMPLEFSCTL_EXEC = os.path.join(BUILD_DIR, "simplefsctl")
+# dedup.simplefs 可执行文件路径
+DEDUP_EXEC = os.path.join(BUILD_DIR, "dedup.simplefs")
+# fsck.simplefs 可执行文件路径
+FSCK_EXEC = os.path.join(BUILD_DIR, "fsck.simplefs")
 
 # 测试环境配置
 TEST_DIR = os.path.join(PROJECT_DIR, "simplefs_test_environment") # 测试环境的主目录
@@ -39,10 +48,61 @@ LARGE_FILE_PATH = os.path.join(MOUNT_POINT, "large_file.dat")
 MANY_FILES_COUNT = 1024  # 创建的文件数量
 MANY_FILES_DIR = os.path.join(MOUNT_POINT, "many_files_test")
 
+# 持久化模式基准测试配置
+DURABILITY_MODES = ["sync", "ordered", "writeback"]
+BENCH_FSYNC_ITERATIONS = 200   # 4KB写入+fsync的次数
+BENCH_SMALL_FILES = 200        # 创建的小文件数量
+BENCH_SEQ_WRITE_MB = 32        # 顺序写入大小 (MB)
+BENCH_FSYNC_THREADS = 8        # 并发fsync的线程数
+BENCH_CSUM_FILES = 500         # 元数据校验和基准测试的文件数量
+BENCH_CSUM_ROUNDS = 3          # 每种格式重复的轮数，取最快的一轮
+BENCH_CSUM_MAX_OVERHEAD_PCT = 5.0  # 元数据校验和允许的额外开销 (%)
+BENCH_COMPRESS_MB = 32         # 压缩基准测试写入的数据量 (MB)
+BENCH_COMPRESS_MIN_RATIO = 1.5 # 文本数据的最低压缩比（原始块数/占用块数）
+BENCH_REFLINK_MB = 64          # reflink测试的源文件大小 (MB)
+BENCH_REFLINK_MAX_CLONE_MS = 100.0  # 整文件克隆允许的最长耗时 (ms，含simplefsctl进程启动)
+BENCH_DEDUP_MB = 32            # 去重测试中每份重复数据的大小 (MB)
+BENCH_DEDUP_COPIES = 3         # 重复数据的份数
+BENCH_SNAPSHOT_MB = 64         # 快照测试的文件大小 (MB)
+BENCH_SNAPSHOT_MAX_CREATE_MS = 100.0  # 创建快照允许的最长耗时 (ms，含simplefsctl进程启动)
+BENCH_DEFRAG_MB = 32           # 碎片整理测试的文件大小 (MB)
+BENCH_DEFRAG_CHUNK_KB = 64     # 制造碎片时倒序写入的块大小 (KB)
+BENCH_DISCARD_MB = 32          # discard测试删除的文件大小 (MB)
+BENCH_FREE_MB = 64             # 截断和删除释放块测试的文件大小 (MB)
+BENCH_UNLINK_MB = 128          # 延迟删除测试的文件大小 (MB)
+BENCH_UNLINK_MAX_MS = 100.0    # 删除大文件允许的最长耗时 (ms)，块由后台回收
+BENCH_DELALLOC_FILES = 8       # 延迟分配测试交替写入的文件数量
+BENCH_DELALLOC_FILE_MB = 1     # 延迟分配测试中每个文件的大小 (MB)
+BENCH_RSV_FILE_MB = 8          # 预留窗口测试中每个文件的大小 (MB)
+BENCH_RSV_CHUNK_KB = 128       # 预留窗口测试每次追加并fsync的大小 (KB)
+BENCH_RSV_MAX_EXTENTS = 12     # 交替追加的文件允许的最多段数
+BENCH_FALLOC_MB = 8            # fallocate测试预分配的大小 (MB)
+BENCH_RW_FILE_MB = 16          # 随机偏移读写测试的文件大小 (MB)
+BENCH_RW_OPS = 300             # 随机偏移读写测试的操作次数
+BENCH_REUSE_FILE_MB = 8        # 并发读与块重用测试的文件大小 (MB)
+BENCH_REUSE_ROUNDS = 40        # 并发读与块重用测试中截断并重写的轮数
+INODES_PER_GROUP = 1024        # mkfs.simplefs 默认的每组inode数
+BENCH_ORLOV_DIRS = 8           # inode分布测试在根目录下创建的目录数
+BENCH_FILL_FILE_KB = 192       # 填满文件系统时每个文件的大小 (KB)，文件数不超过默认格式的inode数
+BENCH_FILL_DIR_FILES = 500     # 填满文件系统时每个目录的文件数
+BENCH_CONTIG_MB = 32           # 连续分配测试的文件大小 (MB)
+BENCH_CONTIG_MAX_EXTENTS = 4   # 连续分配测试允许的最多段数
+INODE_SIZES = [128, 256, 512]  # mkfs.simplefs -I 支持的inode大小
+BLOCK_SIZES = [1024, 2048, 4096, 8192, 16384, 32768, 65536]  # mkfs.simplefs -b 支持的块大小
+BENCH_FLEX_GROUPS = 16         # flex_bg测试中 mkfs -G 的每个flex组的块组数
+BENCH_FLEX_FILE_MB = 32        # flex_bg测试中跨越多个块组的文件大小 (MB)
+BENCH_GROUPS_FILL_MB = 128     # 块组元数据加载测试写入的数据量 (MB)
+FREE_BLOCKS_SLACK = 16         # 比较空闲块数时允许的误差（间接块、目录块等元数据）
+
 # 权限测试配置
 TEST_USER_NAME = "testuser"
 TEST_GROUP_NAME = "testgroup"
 
+# fallocate(2) 的模式位 (linux/falloc.h)
+FALLOC_FL_KEEP_SIZE = 0x01
+FALLOC_FL_PUNCH_HOLE = 0x02
+FALLOC_FL_ZERO_RANGE = 0x10
+
 # --- 日志和颜色 ---
 
 class Colors:
@@ -69,6 +129,10 @@ def log_error(message):
     print(f"{Colors.FAIL}[ERROR] {message}{Colors.ENDC}")
     sys.exit(1) # 发生错误时直接退出
 
+def log_failure(message):
+    """记录失败但不退出，用于需要先恢复环境再报告失败的测试"""
+    print(f"{Colors.FAIL}[ERROR] {message}{Colors.ENDC}")
+
 def log_header(message):
     print(f"\n{Colors.HEADER}{Colors.BOLD}===== {message} ====={Colors.ENDC}")
 
@@ -151,7 +215,7 @@ def compile_project():
         log_error("编译失败，未找到可执行文件。")
     log_success("项目编译成功。")
 
-def create_and_format_disk():
+def create_and_format_disk(mkfs_options=None):
     """创建并格式化磁盘镜像"""
     log_header("创建和格式化磁盘镜像")
     # 创建一个稀疏文件作为磁盘镜像
@@ -159,14 +223,15 @@ def create_and_format_disk():
     log_success(f"创建了 {DISK_SIZE_MB}MB 的磁盘镜像: {DISK_IMAGE}")
 
     # 格式化磁盘
-    run_command([MKFS_EXEC, DISK_IMAGE])
+    run_command([MKFS_EXEC] + (mkfs_options or []) + [DISK_IMAGE])
     log_success("磁盘镜像格式化成功。")
 
-def mount_fs():
+def mount_fs(extra_options=None):
     """挂载文件系统"""
     log_header("挂载文件系统")
     # 使用 -f 在前台运行，便于调试，但这里我们需要后台运行
-    command = [SIMPLEFS_EXEC, DISK_IMAGE, MOUNT_POINT, '-o', 'allow_other']
+    options = 'allow_other' + (',' + extra_options if extra_options else '')
+    command = [SIMPLEFS_EXEC, DISK_IMAGE, MOUNT_POINT, '-o', options]
     # 在后台启动 simplefs 进程
     fs_process = subprocess.Popen(command)
     time.sleep(2) # 等待 FUSE 挂载完成
@@ -198,6 +263,26 @@ def unmount_fs(fs_process):
     else:
         log_success("文件系统已成功卸载。")
 
+def with_formatted_fs(fs_process, mkfs_options, body, mount_options=None):
+    """
+    卸载后以 mkfs_options 重新格式化并挂载（挂载选项 mount_options），运行 body(fs_process)，
+    最后恢复默认格式的镜像并重新挂载；body 失败或抛出异常时同样恢复。
+    body 返回 (fs_process, passed)，其中重新挂载过时返回新的进程。
+    返回 (恢复后的 simplefs 进程, passed)。
+    """
+    unmount_fs(fs_process)
+    create_and_format_disk(mkfs_options)
+    fs_process = mount_fs(mount_options)
+    passed = False
+    try:
+        fs_process, passed = body(fs_process)
+    finally:
+        if os.path.ismount(MOUNT_POINT):
+            unmount_fs(fs_process)
+        create_and_format_disk()
+        fs_process = mount_fs()
+    return fs_process, passed
+
 
 def cleanup_environment():
     """清理测试环境"""
@@ -563,6 +648,1450 @@ def test_links():
     os.remove(source_file_sym)
     log_success("符号链接测试清理完毕。")
 
+def wait_for_free_blocks(min_free_blocks, timeout=10.0):
+    """等待空闲块数回升到 min_free_blocks 以上（后台回收的块），返回最后一次读到的空闲块数"""
+    free_blocks = os.statvfs(MOUNT_POINT).f_bfree
+    deadline = time.time() + timeout
+    while free_blocks < min_free_blocks and time.time() < deadline:
+        time.sleep(0.1)
+        free_blocks = os.statvfs(MOUNT_POINT).f_bfree
+    return free_blocks
+
+def test_batched_free():
+    """
+    写入 BENCH_FREE_MB 的文件后截断到 1MB，确认截掉部分的块全部归还且前 1MB 不变；
+    删除文件后空闲块数回到写入之前。
+    """
+    log_header("开始截断和删除释放块测试")
+    path = os.path.join(MOUNT_POINT, "batched_free.dat")
+    keep = 1024 * 1024
+    base = os.statvfs(MOUNT_POINT)
+    data = os.urandom(BENCH_FREE_MB * 1024 * 1024)
+    with open(path, "wb") as f:
+        f.write(data)
+        f.flush()
+        os.fsync(f.fileno())
+
+    start = time.perf_counter()
+    os.truncate(path, keep)
+    elapsed_ms = (time.perf_counter() - start) * 1000
+    free_blocks = os.statvfs(MOUNT_POINT).f_bfree
+    log_success(f"截断 {BENCH_FREE_MB}MB -> 1MB: {elapsed_ms:.1f} ms")
+    if free_blocks < base.f_bfree - keep // base.f_frsize - FREE_BLOCKS_SLACK:
+        log_error(f"截断后空闲块数为 {free_blocks}，截掉的块没有全部归还！")
+    if os.stat(path).st_size != keep:
+        log_error("截断后文件大小不正确！")
+    with open(path, "rb") as f:
+        if f.read() != data[:keep]:
+            log_error("截断后保留部分的内容改变！")
+
+    os.remove(path)
+    free_blocks = wait_for_free_blocks(base.f_bfree - FREE_BLOCKS_SLACK)
+    if free_blocks < base.f_bfree - FREE_BLOCKS_SLACK:
+        log_error(f"删除文件后空闲块数为 {free_blocks}，写入前为 {base.f_bfree}！")
+    log_success("截断和删除释放块验证通过。")
+
+def test_deferred_unlink(fs_process):
+    """
+    删除 BENCH_UNLINK_MB 的文件应当立即返回（超过 BENCH_UNLINK_MAX_MS 时测试失败），块由后台回收；
+    删除后立即卸载，重新挂载时孤儿链表中的inode继续回收，空闲块数回到写入之前。
+    返回重新挂载后的 simplefs 进程。
+    """
+    log_header("开始大文件延迟删除测试")
+    path = os.path.join(MOUNT_POINT, "deferred_unlink.dat")
+    base = os.statvfs(MOUNT_POINT).f_bfree
+    with open(path, "wb") as f:
+        for _ in range(BENCH_UNLINK_MB):
+            f.write(os.urandom(1024 * 1024))
+        f.flush()
+        os.fsync(f.fileno())
+
+    start = time.perf_counter()
+    os.remove(path)
+    elapsed_ms = (time.perf_counter() - start) * 1000
+    log_success(f"删除 {BENCH_UNLINK_MB}MB 文件: {elapsed_ms:.1f} ms")
+    if elapsed_ms > BENCH_UNLINK_MAX_MS:
+        log_error(f"删除大文件耗时超过 {BENCH_UNLINK_MAX_MS} ms！")
+
+    # 后台回收可能尚未完成，卸载后重新挂载时继续回收
+    unmount_fs(fs_process)
+    fs_process = mount_fs()
+    if os.path.exists(path):
+        log_error("重新挂载后已删除的文件仍然存在！")
+    free_blocks = wait_for_free_blocks(base - FREE_BLOCKS_SLACK)
+    if free_blocks < base - FREE_BLOCKS_SLACK:
+        log_error(f"重新挂载后空闲块数为 {free_blocks}，写入前为 {base}，孤儿inode的块没有回收！")
+    log_success("延迟删除验证通过。")
+    return fs_process
+
+def count_extents(path):
+    """用 simplefsctl defrag -n 统计文件的物理连续段数"""
+    extents, _, _ = parse_defrag_summary(run_command([SIMPLEFSCTL_EXEC, "defrag", "-n", path]).stdout)
+    return extents
+
+def test_delalloc():
+    """
+    以 4KB 为单位轮流写入 BENCH_DELALLOC_FILES 个文件且不fsync：写入后空闲块数应已扣除预留，
+    回写前可以读回数据；fsync后每个文件都按逻辑顺序分配为连续的块（不超过2段）。
+    最后写入后立即删除一个文件，预留的块应全部归还。
+    """
+    log_header("开始延迟分配测试")
+    chunk = 4096
+    size = BENCH_DELALLOC_FILE_MB * 1024 * 1024
+    base = os.statvfs(MOUNT_POINT)
+    paths = [os.path.join(MOUNT_POINT, f"delalloc_{i}.dat") for i in range(BENCH_DELALLOC_FILES)]
+    datas = [os.urandom(size) for _ in paths]
+    fds = [os.open(path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644) for path in paths]
+    try:
+        for offset in range(0, size, chunk):
+            for fd, data in zip(fds, datas):
+                os.pwrite(fd, data[offset:offset + chunk], offset)
+
+        free_blocks = os.statvfs(MOUNT_POINT).f_bfree
+        if free_blocks > base.f_bfree - BENCH_DELALLOC_FILES * size // base.f_frsize:
+            log_error(f"写入后空闲块数为 {free_blocks}，没有扣除缓存数据预留的块！")
+        for path, data in zip(paths, datas):
+            with open(path, "rb") as f:
+                if f.read() != data:
+                    log_error(f"回写前读回 {path} 的内容不一致！")
+        for fd in fds:
+            os.fsync(fd)
+    finally:
+        for fd in fds:
+            os.close(fd)
+
+    for path, data in zip(paths, datas):
+        with open(path, "rb") as f:
+            if f.read() != data:
+                log_error(f"回写后 {path} 的内容不一致！")
+        extents = count_extents(path)
+        if extents > 2:
+            log_error(f"交替写入的 {path} 回写后有 {extents} 段，没有连续分配！")
+        os.remove(path)
+    log_success("交替写入的文件回写后均连续分配。")
+
+    path = os.path.join(MOUNT_POINT, "delalloc_drop.dat")
+    with open(path, "wb") as f:
+        f.write(os.urandom(4 * 1024 * 1024))
+    os.remove(path)
+    free_blocks = wait_for_free_blocks(base.f_bfree - FREE_BLOCKS_SLACK)
+    if free_blocks < base.f_bfree - FREE_BLOCKS_SLACK:
+        log_error(f"删除未回写的文件后空闲块数为 {free_blocks}，写入前为 {base.f_bfree}！")
+    log_success("延迟分配验证通过。")
+
+def test_reservation_windows():
+    """
+    两个文件轮流追加 BENCH_RSV_CHUNK_KB 并逐次fsync，每次回写都要分配块；
+    预留窗口使两个文件各自在自己的窗口内增长，段数应远少于追加次数（不超过 BENCH_RSV_MAX_EXTENTS）。
+    """
+    log_header("开始预留窗口测试")
+    chunk = BENCH_RSV_CHUNK_KB * 1024
+    size = BENCH_RSV_FILE_MB * 1024 * 1024
+    paths = [os.path.join(MOUNT_POINT, f"rsv_{i}.dat") for i in range(2)]
+    datas = [os.urandom(size) for _ in paths]
+    files = [open(path, "wb") for path in paths]
+    try:
+        for offset in range(0, size, chunk):
+            for f, data in zip(files, datas):
+                f.write(data[offset:offset + chunk])
+                f.flush()
+                os.fsync(f.fileno())
+    finally:
+        for f in files:
+            f.close()
+
+    for path, data in zip(paths, datas):
+        with open(path, "rb") as f:
+            if f.read() != data:
+                log_error(f"{path} 的内容不一致！")
+        extents = count_extents(path)
+        log_info(f"{path}: {size // chunk} 次追加，{extents} 段")
+        if extents > BENCH_RSV_MAX_EXTENTS:
+            log_error(f"交替追加的文件有 {extents} 段，超过 {BENCH_RSV_MAX_EXTENTS}！")
+        os.remove(path)
+    log_success("预留窗口验证通过。")
+
+def fallocate(fd, mode, offset, length):
+    """调用 fallocate(2)（os.posix_fallocate 不支持模式位），失败时抛出 OSError"""
+    libc = ctypes.CDLL(None, use_errno=True)
+    libc.fallocate.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_longlong, ctypes.c_longlong]
+    if libc.fallocate(fd, mode, offset, length) != 0:
+        err = ctypes.get_errno()
+        raise OSError(err, os.strerror(err))
+
+def test_fallocate():
+    """
+    预分配 BENCH_FALLOC_MB 后空闲块数减少、大小增长且读取为零；部分写入只改变写入的字节；
+    打洞归还块、清零区间读为零，KEEP_SIZE 预分配不改变大小；超过剩余空间的预分配返回 ENOSPC。
+    """
+    log_header("开始fallocate测试")
+    path = os.path.join(MOUNT_POINT, "fallocate.dat")
+    size = BENCH_FALLOC_MB * 1024 * 1024
+    mb = 1024 * 1024
+    base = os.statvfs(MOUNT_POINT)
+    fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0o644)
+    try:
+        os.posix_fallocate(fd, 0, size)
+        free_blocks = os.statvfs(MOUNT_POINT).f_bfree
+        if os.fstat(fd).st_size != size:
+            log_error("预分配后文件大小不正确！")
+        if free_blocks > base.f_bfree - size // base.f_frsize:
+            log_error(f"预分配后空闲块数为 {free_blocks}，块没有分配！")
+        expected = bytearray(size)
+        if os.pread(fd, size, 0) != expected:
+            log_error("未写入的预分配块读取结果不是零！")
+        log_success("预分配验证通过。")
+
+        # 部分写入一个未写入块，块内其余部分仍为零
+        patch = b"a" * 4096
+        os.pwrite(fd, patch, mb + 100)
+        expected[mb + 100:mb + 100 + len(patch)] = patch
+        os.fsync(fd)
+        if os.pread(fd, size, 0) != expected:
+            log_error("部分写入预分配区间后内容不正确！")
+
+        os.pwrite(fd, b"b" * mb, 3 * mb)
+        before_punch = os.statvfs(MOUNT_POINT).f_bfree
+        fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 2 * mb, 2 * mb)
+        expected[2 * mb:4 * mb] = bytes(2 * mb)
+        free_blocks = os.statvfs(MOUNT_POINT).f_bfree
+        if free_blocks < before_punch + 2 * mb // base.f_frsize:
+            log_error(f"打洞后空闲块数为 {free_blocks}，打洞前为 {before_punch}，块没有归还！")
+        fallocate(fd, FALLOC_FL_ZERO_RANGE, mb, mb)
+        expected[mb:2 * mb] = bytes(mb)
+        if os.fstat(fd).st_size != size or os.pread(fd, size, 0) != expected:
+            log_error("打洞和清零之后文件内容或大小不正确！")
+        log_success("打洞和清零验证通过。")
+
+        before_keep = os.statvfs(MOUNT_POINT).f_bfree
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, size, mb)
+        if os.fstat(fd).st_size != size:
+            log_error("KEEP_SIZE 预分配改变了文件大小！")
+        if os.statvfs(MOUNT_POINT).f_bfree > before_keep - mb // base.f_frsize:
+            log_error("KEEP_SIZE 预分配没有分配块！")
+    finally:
+        os.close(fd)
+    os.remove(path)
+
+    path = os.path.join(MOUNT_POINT, "fallocate_enospc.dat")
+    fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0o644)
+    try:
+        os.posix_fallocate(fd, 0, DISK_SIZE_MB * 2 * mb)
+        log_error("超过剩余空间的预分配没有报错！")
+    except OSError as e:
+        if e.errno != errno.ENOSPC:
+            log_error(f"超过剩余空间的预分配返回了意外的错误: {e}")
+    finally:
+        os.close(fd)
+    os.remove(path)
+    free_blocks = wait_for_free_blocks(base.f_bfree - FREE_BLOCKS_SLACK)
+    if free_blocks < base.f_bfree - FREE_BLOCKS_SLACK:
+        log_error(f"删除预分配的文件后空闲块数为 {free_blocks}，测试前为 {base.f_bfree}！")
+    log_success("fallocate验证通过。")
+
+def seek_offset(path, whence, offset):
+    """用 simplefsctl seek 查找 offset 之后的数据（whence="data"）或空洞（"hole"），ENXIO 时返回 None"""
+    process = run_command([SIMPLEFSCTL_EXEC, "seek", path, whence, str(offset)], check=False)
+    if process.stdout.strip() == "ENXIO":
+        return None
+    if process.returncode != 0:
+        log_error(f"simplefsctl seek 失败: {process.stderr}")
+    return int(process.stdout.strip())
+
+def test_seek_and_copy():
+    """
+    在 8MB 的稀疏文件中写入两段 64KB 数据，检查 SEEK_DATA/SEEK_HOLE 的结果（含尚未回写的缓存数据和文件末尾），
+    再用 simplefsctl copy 复制：内容一致，源文件的空洞在目标中仍是空洞，只为数据段分配块。
+    """
+    log_header("开始SEEK_DATA/SEEK_HOLE和稀疏复制测试")
+    src = os.path.join(MOUNT_POINT, "sparse_src.dat")
+    dst = os.path.join(MOUNT_POINT, "sparse_dst.dat")
+    seg = 64 * 1024
+    mb = 1024 * 1024
+    size = 8 * mb
+    data = bytearray(size)
+    with open(src, "wb") as f:
+        for offset in [0, 4 * mb]:
+            chunk = os.urandom(seg)
+            data[offset:offset + seg] = chunk
+            f.seek(offset)
+            f.write(chunk)
+        f.truncate(size)
+        f.flush()
+        os.fsync(f.fileno())
+
+    expected = [
+        ("data", 0, 0), ("hole", 0, seg), ("data", seg, 4 * mb), ("hole", 4 * mb, 4 * mb + seg),
+        ("data", 4 * mb + seg, None), ("hole", 4 * mb + seg, 4 * mb + seg), ("data", size, None),
+    ]
+    for whence, offset, want in expected:
+        got = seek_offset(src, whence, offset)
+        if got != want:
+            log_error(f"seek {whence} {offset}: 期望 {want}，实际 {got}")
+    log_success("SEEK_DATA/SEEK_HOLE 验证通过。")
+
+    # 尚未回写的缓存数据同样是数据
+    with open(src, "r+b") as f:
+        chunk = os.urandom(seg)
+        data[6 * mb:6 * mb + seg] = chunk
+        f.seek(6 * mb)
+        f.write(chunk)
+        f.flush()
+        if seek_offset(src, "data", 4 * mb + seg) != 6 * mb:
+            log_error("SEEK_DATA 没有找到尚未回写的数据！")
+        os.fsync(f.fileno())
+
+    before = os.statvfs(MOUNT_POINT)
+    run_command([SIMPLEFSCTL_EXEC, "copy", src, dst])
+    used_blocks = before.f_bfree - os.statvfs(MOUNT_POINT).f_bfree
+    with open(dst, "rb") as f:
+        if f.read() != data:
+            log_error("复制得到的文件内容与源文件不一致！")
+    log_success(f"复制 {size // mb}MB 稀疏文件占用 {used_blocks} 块")
+    if used_blocks > 3 * seg // before.f_frsize + FREE_BLOCKS_SLACK:
+        log_error("复制没有保留源文件的空洞！")
+    if seek_offset(dst, "hole", 0) != seg:
+        log_error("目标文件中对应源文件空洞的位置不是空洞！")
+    os.remove(src)
+    os.remove(dst)
+    log_success("稀疏复制验证通过。")
+
+def test_unaligned_io():
+    """
+    在 BENCH_RW_FILE_MB 的文件上以随机偏移和长度（跨块边界、不对齐、最长 1MB）交替读写，
+    每次读取都与内存中的副本比较；最后用 sendfile 整文件复制到本地并比较哈希。
+    """
+    log_header("开始随机偏移读写测试")
+    path = os.path.join(MOUNT_POINT, "unaligned_io.dat")
+    local_copy = os.path.join(TEST_DIR, "unaligned_io_copy.dat")
+    size = BENCH_RW_FILE_MB * 1024 * 1024
+    model = bytearray(os.urandom(size))
+    rng = random.Random(32)
+    fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0o644)
+    try:
+        os.pwrite(fd, model, 0)
+        for i in range(BENCH_RW_OPS):
+            length = rng.choice([1, 511, 4095, 4097, 65536 + 7, 1024 * 1024])
+            offset = rng.randrange(0, size - length)
+            if i % 2 == 0:
+                chunk = os.urandom(length)
+                if os.pwrite(fd, chunk, offset) != length:
+                    log_error(f"在偏移 {offset} 写入 {length} 字节时写入不完整！")
+                model[offset:offset + length] = chunk
+            elif os.pread(fd, length, offset) != model[offset:offset + length]:
+                log_error(f"在偏移 {offset} 读取 {length} 字节的内容不正确！")
+        os.fsync(fd)
+        if os.pread(fd, size, 0) != model:
+            log_error("随机读写后整文件内容不正确！")
+    finally:
+        os.close(fd)
+
+    with open(path, "rb") as src, open(local_copy, "wb") as dst:
+        copied = 0
+        while copied < size:
+            sent = os.sendfile(dst.fileno(), src.fileno(), copied, size - copied)
+            if sent == 0:
+                break
+            copied += sent
+    if get_file_hash(local_copy) != hashlib.sha256(model).hexdigest():
+        log_error("sendfile 复制的文件哈希不一致！")
+    os.remove(local_copy)
+    os.remove(path)
+    log_success("随机偏移读写验证通过。")
+
+def test_read_block_reuse():
+    """
+    多个线程对文件 A 反复做大块读取，同时另一线程把 A 截断后重写，第三个线程重写文件 B 并 fsync，
+    使 A 刚释放的块被 B 重新分配。A 和 B 用不同的字节填充，读到的 A 的内容只能是 A 的填充字节。
+    """
+    log_header("开始并发读与块重用测试")
+    path_a = os.path.join(MOUNT_POINT, "reuse_a.dat")
+    path_b = os.path.join(MOUNT_POINT, "reuse_b.dat")
+    size = BENCH_REUSE_FILE_MB * 1024 * 1024
+    data_a = b"\xaa" * size
+    data_b = b"\xbb" * size
+
+    def rewrite(path, data):
+        fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0o644)
+        try:
+            os.pwrite(fd, data, 0)
+            os.fsync(fd)
+        finally:
+            os.close(fd)
+
+    rewrite(path_a, data_a)
+    stop = threading.Event()
+    bad_reads = []
+
+    def reader():
+        fd = os.open(path_a, os.O_RDONLY)
+        try:
+            while not stop.is_set():
+                chunk = os.pread(fd, size, 0)
+                if chunk.strip(b"\xaa"):
+                    bad_reads.append(len(chunk) - chunk.count(b"\xaa"))
+        finally:
+            os.close(fd)
+
+    def other_writer():
+        while not stop.is_set():
+            rewrite(path_b, data_b)
+
+    threads = [threading.Thread(target=reader) for _ in range(4)] + [threading.Thread(target=other_writer)]
+    for t in threads:
+        t.start()
+    try:
+        for _ in range(BENCH_REUSE_ROUNDS):
+            rewrite(path_a, data_a)
+    finally:
+        stop.set()
+        for t in threads:
+            t.join()
+
+    if bad_reads:
+        log_error(f"{len(bad_reads)} 次读取 A 时读到了不属于 A 的数据（最多 {max(bad_reads)} 字节）！")
+    os.remove(path_a)
+    os.remove(path_b)
+    log_success("并发读与块重用验证通过。")
+
+def test_inode_placement(fs_process):
+    """
+    以 1K 块格式化（多个块组），以 use_ino 挂载使 st_ino 为SimpleFS的inode号：
+    根目录下的子目录应分散到不同的块组，目录中的文件和下级目录留在该目录所在的组。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始inode分布测试")
+
+    def inode_group(path):
+        return (os.stat(path).st_ino - 1) // INODES_PER_GROUP
+
+    def body(fs_process):
+        top_groups = set()
+        for i in range(BENCH_ORLOV_DIRS):
+            top = os.path.join(MOUNT_POINT, f"orlov_{i}")
+            os.makedirs(os.path.join(top, "sub"))
+            group = inode_group(top)
+            top_groups.add(group)
+            for j in range(20):
+                with open(os.path.join(top, f"file_{j}.txt"), "w") as f:
+                    f.write("x" * 100)
+                if inode_group(os.path.join(top, f"file_{j}.txt")) != group:
+                    log_failure(f"{top} 中的文件没有分配在目录所在的块组 {group}！")
+                    return fs_process, False
+            if inode_group(os.path.join(top, "sub")) != group:
+                log_failure(f"{top} 的下级目录没有留在目录所在的块组 {group}！")
+                return fs_process, False
+        log_info(f"{BENCH_ORLOV_DIRS} 个顶层目录分布在 {len(top_groups)} 个块组: {sorted(top_groups)}")
+        if len(top_groups) < BENCH_ORLOV_DIRS // 2:
+            log_failure("根目录下的子目录没有分散到不同的块组！")
+            return fs_process, False
+        log_success("inode分布验证通过。")
+        return fs_process, True
+
+    fs_process, passed = with_formatted_fs(fs_process, ['-b', '1024'], body, "use_ino")
+    if not passed:
+        log_error("inode分布测试失败！")
+    return fs_process
+
+def test_fragmented_alloc(fs_process):
+    """
+    用 BENCH_FILL_FILE_KB 的文件填满文件系统直到 ENOSPC，确认几乎所有空闲块都能分配出去；
+    删除一半文件使空闲空间只剩小段，再写入 4MB 文件：分配应整段使用这些空闲段，内容正确；
+    重新挂载后空闲块数不变（块组的空闲空间索引由位图重建），全部删除后空间归还。
+    返回重新挂载后的 simplefs 进程。
+    """
+    log_header("开始碎片化空间分配测试")
+    fill_dir = os.path.join(MOUNT_POINT, "fill")
+    file_size = BENCH_FILL_FILE_KB * 1024
+    base = os.statvfs(MOUNT_POINT)
+    data = os.urandom(file_size)
+    paths = []
+    while True:
+        sub_dir = os.path.join(fill_dir, f"d{len(paths) // BENCH_FILL_DIR_FILES}")
+        path = os.path.join(sub_dir, f"f{len(paths)}")
+        try:
+            os.makedirs(sub_dir, exist_ok=True)
+            fd = os.open(path, os.O_WRONLY | os.O_CREAT, 0o644)
+            try:
+                os.write(fd, data)
+                os.fsync(fd)
+            finally:
+                os.close(fd)
+        except OSError as e:
+            if e.errno != errno.ENOSPC:
+                raise
+            if os.path.exists(path):
+                os.remove(path)
+            break
+        paths.append(path)
+    filled_blocks = len(paths) * file_size // base.f_frsize
+    log_info(f"写入 {len(paths)} 个文件后 ENOSPC，剩余 {os.statvfs(MOUNT_POINT).f_bfree} 块")
+    if filled_blocks < base.f_bfree * 0.9:
+        log_error(f"只分配出 {filled_blocks} 块，填充前有 {base.f_bfree} 块空闲！")
+
+    for path in paths[::2]:
+        os.remove(path)
+    # 删除的文件有间接块，由后台回收
+    freed_blocks = len(paths[::2]) * file_size // base.f_frsize
+    if wait_for_free_blocks(freed_blocks) < freed_blocks:
+        log_error("删除一半文件后空间没有归还！")
+
+    big = os.path.join(MOUNT_POINT, "fragmented.dat")
+    big_data = os.urandom(4 * 1024 * 1024)
+    with open(big, "wb") as f:
+        f.write(big_data)
+        f.flush()
+        os.fsync(f.fileno())
+    with open(big, "rb") as f:
+        if f.read() != big_data:
+            log_error("在碎片化的空间中写入的文件内容不正确！")
+    extents = count_extents(big)
+    max_extents = len(big_data) // file_size + 8
+    log_info(f"碎片化空间中的 4MB 文件: {extents} 段")
+    if extents > max_extents:
+        log_error(f"4MB 文件有 {extents} 段，超过 {max_extents}，没有整段使用空闲段！")
+
+    free_blocks = os.statvfs(MOUNT_POINT).f_bfree
+    unmount_fs(fs_process)
+    fs_process = mount_fs()
+    if os.statvfs(MOUNT_POINT).f_bfree != free_blocks:
+        log_error(f"重新挂载后空闲块数由 {free_blocks} 变为 {os.statvfs(MOUNT_POINT).f_bfree}！")
+
+    os.remove(big)
+    shutil.rmtree(fill_dir)
+    free_blocks = wait_for_free_blocks(base.f_bfree - FREE_BLOCKS_SLACK)
+    if free_blocks < base.f_bfree - FREE_BLOCKS_SLACK:
+        log_error(f"删除全部文件后空闲块数为 {free_blocks}，填充前为 {base.f_bfree}！")
+    log_success("碎片化空间分配验证通过。")
+    return fs_process
+
+def test_contiguous_alloc():
+    """
+    空闲空间充足时多块分配应一次取得整段连续的块：顺序写入 BENCH_CONTIG_MB 并fsync的文件
+    和一次预分配 BENCH_CONTIG_MB 后写满的文件段数都不超过 BENCH_CONTIG_MAX_EXTENTS（定时回写可能把写入分成几次分配）。
+    """
+    log_header("开始连续分配测试")
+    size = BENCH_CONTIG_MB * 1024 * 1024
+    written = os.path.join(MOUNT_POINT, "contig_write.dat")
+    data = os.urandom(size)
+    with open(written, "wb") as f:
+        for offset in range(0, size, 1024 * 1024):
+            f.write(data[offset:offset + 1024 * 1024])
+        f.flush()
+        os.fsync(f.fileno())
+    with open(written, "rb") as f:
+        if f.read() != data:
+            log_error("顺序写入的文件内容不正确！")
+
+    preallocated = os.path.join(MOUNT_POINT, "contig_falloc.dat")
+    fd = os.open(preallocated, os.O_RDWR | os.O_CREAT | os.O_TRUNC, 0o644)
+    try:
+        os.posix_fallocate(fd, 0, size)
+        # 未写入的预分配块不计入段数，写满后再统计
+        os.pwrite(fd, data, 0)
+        os.fsync(fd)
+    finally:
+        os.close(fd)
+
+    for path in [written, preallocated]:
+        extents = count_extents(path)
+        log_info(f"{path}: {extents} 段")
+        if extents > BENCH_CONTIG_MAX_EXTENTS:
+            log_error(f"{path} 有 {extents} 段，没有连续分配！")
+        os.remove(path)
+    log_success("连续分配验证通过。")
+
+def test_inline_data(fs_process):
+    """
+    在 -O inline_data 格式的镜像上：小文件和小目录存放在inode中，不占用数据块；
+    文件经写入、截断扩展和预分配超出内联容量时转为块存储，内容不变；目录项放不下时目录转为目录块。
+    重新挂载后内联文件的内容不变。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始内联数据测试")
+
+    def check_file(path, expected, want_inline):
+        # 转为块存储的数据经延迟分配缓存，fsync后st_blocks才反映分配的块
+        with open(path, "rb") as f:
+            os.fsync(f.fileno())
+            if f.read() != expected:
+                log_failure(f"{path} 的内容不正确！")
+                return False
+        if (os.stat(path).st_blocks == 0) != want_inline:
+            log_failure(f"{path} 的存储方式不正确：期望{'内联' if want_inline else '数据块'}，st_blocks={os.stat(path).st_blocks}")
+            return False
+        return True
+
+    def body(fs_process):
+        base = os.statvfs(MOUNT_POINT).f_bfree
+        small = b"inline data " * 4
+        paths = {name: os.path.join(MOUNT_POINT, f"inline_{name}.txt") for name in ["keep", "write", "truncate", "falloc"]}
+        for path in paths.values():
+            with open(path, "wb") as f:
+                f.write(small)
+        inline_dir = os.path.join(MOUNT_POINT, "inline_dir")
+        os.mkdir(inline_dir)
+        for name in ["a", "b"]:
+            with open(os.path.join(inline_dir, name), "wb") as f:
+                f.write(small)
+        if os.statvfs(MOUNT_POINT).f_bfree != base:
+            log_failure("创建小文件和小目录占用了数据块！")
+            return fs_process, False
+        if not all(check_file(path, small, True) for path in paths.values()) or os.stat(inline_dir).st_blocks != 0:
+            return fs_process, False
+        log_success("小文件和小目录内联存储验证通过。")
+
+        # 写入、截断扩展、预分配都会转为块存储
+        tail = os.urandom(8192)
+        with open(paths["write"], "ab") as f:
+            f.write(tail)
+        os.truncate(paths["truncate"], 10000)
+        fd = os.open(paths["falloc"], os.O_RDWR)
+        try:
+            os.posix_fallocate(fd, 0, 8192)
+        finally:
+            os.close(fd)
+        if not (check_file(paths["write"], small + tail, False) and
+                check_file(paths["truncate"], small + bytes(10000 - len(small)), False) and
+                check_file(paths["falloc"], small + bytes(8192 - len(small)), False)):
+            return fs_process, False
+        log_success("内联文件转为块存储验证通过。")
+
+        names = [f"long_entry_name_{i:03d}" for i in range(40)]
+        for name in names:
+            with open(os.path.join(inline_dir, name), "wb"):
+                pass
+        if os.stat(inline_dir).st_blocks == 0 or sorted(os.listdir(inline_dir)) != sorted(["a", "b"] + names):
+            log_failure("目录项超出内联容量后目录没有正确转为目录块！")
+            return fs_process, False
+        log_success("内联目录转为目录块验证通过。")
+
+        unmount_fs(fs_process)
+        fs_process = mount_fs()
+        if not check_file(paths["keep"], small, True):
+            return fs_process, False
+        shutil.rmtree(inline_dir)
+        for path in paths.values():
+            os.remove(path)
+        if wait_for_free_blocks(base) < base:
+            log_failure("删除内联测试的文件后空间没有全部归还！")
+            return fs_process, False
+        log_success("内联数据验证通过。")
+        return fs_process, True
+
+    fs_process, passed = with_formatted_fs(fs_process, ['-O', 'inline_data'], body)
+    if not passed:
+        log_error("内联数据测试失败！")
+    return fs_process
+
+def test_inode_sizes(fs_process):
+    """
+    以 -I 128/256/512 分别格式化，设置带纳秒的时间戳后重新挂载：
+    256 和 512 字节的inode保留纳秒，128 字节的inode只保留秒；各种inode大小下文件读写正常。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始inode大小和纳秒时间戳测试")
+    atime_ns = 1600000000 * 10**9 + 123456789
+    mtime_ns = 1700000000 * 10**9 + 987654321
+
+    for inode_size in INODE_SIZES:
+        def body(fs_process, inode_size=inode_size):
+            path = os.path.join(MOUNT_POINT, "timestamps.dat")
+            data = os.urandom(256 * 1024)
+            with open(path, "wb") as f:
+                f.write(data)
+                f.flush()
+                os.fsync(f.fileno())
+            os.utime(path, ns=(atime_ns, mtime_ns))
+            unmount_fs(fs_process)
+            fs_process = mount_fs()
+
+            st = os.stat(path)
+            keep_nsec = inode_size > 128
+            want_mtime = mtime_ns if keep_nsec else mtime_ns // 10**9 * 10**9
+            want_atime = atime_ns if keep_nsec else atime_ns // 10**9 * 10**9
+            if st.st_mtime_ns != want_mtime or st.st_atime_ns != want_atime:
+                log_failure(f"-I {inode_size}: 时间戳为 atime={st.st_atime_ns} mtime={st.st_mtime_ns}，"
+                            f"期望 atime={want_atime} mtime={want_mtime}")
+                return fs_process, False
+            with open(path, "rb") as f:
+                if f.read() != data:
+                    log_failure(f"-I {inode_size}: 文件内容不正确！")
+                    return fs_process, False
+            log_success(f"-I {inode_size}: 时间戳和文件内容验证通过。")
+            return fs_process, True
+
+        fs_process, passed = with_formatted_fs(fs_process, ['-I', str(inode_size)], body)
+        if not passed:
+            log_error(f"-I {inode_size} 的inode大小测试失败！")
+    return fs_process
+
+def test_block_sizes(fs_process):
+    """
+    以 -b 1024 到 65536 的各种块大小格式化：statvfs 报告的块大小和总容量正确，
+    顺序写入的 8MB 文件、远处偏移的稀疏写入和小文件在重新挂载后内容正确，删除后空间归还。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始块大小测试")
+    mb = 1024 * 1024
+
+    for block_size in BLOCK_SIZES:
+        def body(fs_process, block_size=block_size):
+            st = os.statvfs(MOUNT_POINT)
+            if st.f_bsize != block_size or st.f_frsize != block_size:
+                log_failure(f"-b {block_size}: statvfs 报告的块大小为 {st.f_bsize}/{st.f_frsize}")
+                return fs_process, False
+            if abs(st.f_blocks * st.f_frsize - DISK_SIZE_MB * mb) > block_size * 8:
+                log_failure(f"-b {block_size}: 总容量为 {st.f_blocks * st.f_frsize} 字节，与镜像大小不符")
+                return fs_process, False
+
+            files = {
+                "seq.dat": (0, os.urandom(8 * mb)),
+                "sparse.dat": (20 * mb + 123, os.urandom(100000)),
+                "small.txt": (0, b"small file\n"),
+            }
+            for name, (offset, data) in files.items():
+                with open(os.path.join(MOUNT_POINT, name), "wb") as f:
+                    f.seek(offset)
+                    f.write(data)
+            unmount_fs(fs_process)
+            fs_process = mount_fs()
+
+            for name, (offset, data) in files.items():
+                with open(os.path.join(MOUNT_POINT, name), "rb") as f:
+                    content = f.read()
+                if content != bytes(offset) + data:
+                    log_failure(f"-b {block_size}: 重新挂载后 {name} 的内容不正确！")
+                    return fs_process, False
+                os.remove(os.path.join(MOUNT_POINT, name))
+            if wait_for_free_blocks(st.f_bfree - FREE_BLOCKS_SLACK) < st.f_bfree - FREE_BLOCKS_SLACK:
+                log_failure(f"-b {block_size}: 删除文件后空间没有全部归还！")
+                return fs_process, False
+            log_success(f"-b {block_size}: 验证通过。")
+            return fs_process, True
+
+        fs_process, passed = with_formatted_fs(fs_process, ['-b', str(block_size)], body)
+        if not passed:
+            log_error(f"-b {block_size} 的块大小测试失败！")
+    return fs_process
+
+def check_fsck_clean():
+    """对已卸载的镜像运行 fsck.simplefs，除快照数和孤儿链表的提示外有任何输出都视为不一致"""
+    process = run_command([FSCK_EXEC, DISK_IMAGE], check=False)
+    problems = [line for line in process.stdout.splitlines()
+                if line and line != "fsck检查完成" and not line.startswith("快照数:") and not line.startswith("孤儿链表中有")]
+    if process.returncode != 0 or problems:
+        log_failure(f"fsck 发现不一致: {problems}")
+        return False
+    return True
+
+def test_flex_bg(fs_process):
+    """
+    以 1K 块和 -G BENCH_FLEX_GROUPS 格式化：组元数据集中在每个flex组的第一个组，
+    其余块组整组可用于数据，跨越多个块组的大文件应保持连续（不超过 4 段）；
+    在多个目录中创建文件后重新挂载，内容正确且 fsck 没有发现不一致。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始flex_bg布局测试")
+
+    def body(fs_process):
+        big = os.path.join(MOUNT_POINT, "flex_big.dat")
+        big_data = os.urandom(BENCH_FLEX_FILE_MB * 1024 * 1024)
+        with open(big, "wb") as f:
+            f.write(big_data)
+            f.flush()
+            os.fsync(f.fileno())
+        extents = count_extents(big)
+        log_info(f"跨越多个块组的 {BENCH_FLEX_FILE_MB}MB 文件: {extents} 段")
+        if extents > 4:
+            log_failure(f"{BENCH_FLEX_FILE_MB}MB 文件有 {extents} 段，块组之间没有连续的数据空间！")
+            return fs_process, False
+
+        small_files = {}
+        for d in range(8):
+            os.mkdir(os.path.join(MOUNT_POINT, f"flex_dir_{d}"))
+            for i in range(50):
+                path = os.path.join(MOUNT_POINT, f"flex_dir_{d}", f"file_{i}.dat")
+                small_files[path] = os.urandom(random.randint(1, 20000))
+                with open(path, "wb") as f:
+                    f.write(small_files[path])
+
+        unmount_fs(fs_process)
+        if not check_fsck_clean():
+            return mount_fs(), False
+        fs_process = mount_fs()
+        with open(big, "rb") as f:
+            if f.read() != big_data:
+                log_failure("重新挂载后大文件内容不正确！")
+                return fs_process, False
+        for path, data in small_files.items():
+            with open(path, "rb") as f:
+                if f.read() != data:
+                    log_failure(f"重新挂载后 {path} 的内容不正确！")
+                    return fs_process, False
+        log_success("flex_bg布局验证通过。")
+        return fs_process, True
+
+    fs_process, passed = with_formatted_fs(fs_process, ['-b', '1024', '-G', str(BENCH_FLEX_GROUPS)], body)
+    if not passed:
+        log_error("flex_bg布局测试失败！")
+    return fs_process
+
+def test_group_loading(fs_process):
+    """
+    以 1K 块格式化（32 个块组，未使用的组标记为 BLOCK_UNINIT），在多个目录中写入 BENCH_GROUPS_FILL_MB，
+    使数据分布到多数块组；重新挂载（并行加载块组元数据）前后空闲块数和空闲inode数一致，内容正确，
+    fsck 没有发现不一致；全部删除并重新挂载后空闲块数回到格式化之后。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始块组元数据加载测试")
+
+    def body(fs_process):
+        fresh = os.statvfs(MOUNT_POINT)
+        files = {}
+        for d in range(BENCH_GROUPS_FILL_MB // 8):
+            dir_path = os.path.join(MOUNT_POINT, f"groups_{d}")
+            os.mkdir(dir_path)
+            for i in range(2):
+                path = os.path.join(dir_path, f"file_{i}.dat")
+                files[path] = os.urandom(4 * 1024 * 1024)
+                with open(path, "wb") as f:
+                    f.write(files[path])
+                    f.flush()
+                    os.fsync(f.fileno())
+        before = os.statvfs(MOUNT_POINT)
+
+        unmount_fs(fs_process)
+        if not check_fsck_clean():
+            return mount_fs(), False
+        fs_process = mount_fs()
+        after = os.statvfs(MOUNT_POINT)
+        if (after.f_bfree, after.f_ffree) != (before.f_bfree, before.f_ffree):
+            log_failure(f"重新挂载后空闲块/inode数由 {before.f_bfree}/{before.f_ffree} 变为 {after.f_bfree}/{after.f_ffree}！")
+            return fs_process, False
+        for path, data in files.items():
+            with open(path, "rb") as f:
+                if f.read() != data:
+                    log_failure(f"重新挂载后 {path} 的内容不正确！")
+                    return fs_process, False
+        log_success("重新挂载后块组元数据和文件内容验证通过。")
+
+        for d in range(BENCH_GROUPS_FILL_MB // 8):
+            shutil.rmtree(os.path.join(MOUNT_POINT, f"groups_{d}"))
+        wait_for_free_blocks(fresh.f_bfree)
+        unmount_fs(fs_process)
+        fs_process = mount_fs()
+        if os.statvfs(MOUNT_POINT).f_bfree != fresh.f_bfree:
+            log_failure(f"全部删除后空闲块数为 {os.statvfs(MOUNT_POINT).f_bfree}，格式化之后为 {fresh.f_bfree}！")
+            return fs_process, False
+        log_success("块组元数据加载验证通过。")
+        return fs_process, True
+
+    fs_process, passed = with_formatted_fs(fs_process, ['-b', '1024'], body)
+    if not passed:
+        log_error("块组元数据加载测试失败！")
+    return fs_process
+
+def test_rename(fs_process):
+    """
+    重命名的各种情形：覆盖已有文件、--noreplace 目标存在时失败、--exchange 交换文件和目录、
+    目录移入自己的子树失败、覆盖非空目录返回 ENOTEMPTY、跨目录移动子目录时两个父目录的链接数随之变化；
+    重新挂载后目录结构不变。
+    返回重新挂载后的 simplefs 进程。
+    """
+    log_header("开始重命名测试")
+    # simplefsctl rename 经ioctl绕过内核，关闭目录项和属性缓存，使之后的查找看到新的目录结构
+    unmount_fs(fs_process)
+    fs_process = mount_fs("entry_timeout=0,attr_timeout=0")
+    root = os.path.join(MOUNT_POINT, "rename_test")
+    os.makedirs(os.path.join(root, "d1", "moved", "inner"))
+    os.makedirs(os.path.join(root, "d2"))
+    a = os.path.join(root, "a.txt")
+    b = os.path.join(root, "b.txt")
+
+    def write(path, content):
+        with open(path, "w") as f:
+            f.write(content)
+
+    def read(path):
+        with open(path) as f:
+            return f.read()
+
+    write(a, "content a")
+    write(b, "content b")
+    os.rename(a, b)
+    if os.path.exists(a) or read(b) != "content a":
+        log_error("覆盖已有文件的重命名结果不正确！")
+
+    write(a, "content a2")
+    if run_command([SIMPLEFSCTL_EXEC, "rename", "--noreplace", a, b], check=False).returncode == 0:
+        log_error("--noreplace 在目标存在时没有失败！")
+    if read(a) != "content a2" or read(b) != "content a":
+        log_error("--noreplace 失败后源或目标被修改！")
+    c = os.path.join(root, "c.txt")
+    run_command([SIMPLEFSCTL_EXEC, "rename", "--noreplace", a, c])
+    if os.path.exists(a) or read(c) != "content a2":
+        log_error("--noreplace 重命名到不存在的目标失败！")
+    log_success("覆盖和 --noreplace 验证通过。")
+
+    run_command([SIMPLEFSCTL_EXEC, "rename", "--exchange", b, c])
+    if read(b) != "content a2" or read(c) != "content a":
+        log_error("--exchange 没有交换两个文件！")
+    d2 = os.path.join(root, "d2")
+    run_command([SIMPLEFSCTL_EXEC, "rename", "--exchange", c, d2])
+    if not os.path.isdir(c) or read(d2) != "content a":
+        log_error("--exchange 没有交换文件和目录！")
+    run_command([SIMPLEFSCTL_EXEC, "rename", "--exchange", c, d2])
+    log_success("--exchange 验证通过。")
+
+    d1 = os.path.join(root, "d1")
+    moved = os.path.join(d1, "moved")
+    # 内核会先拦截移入子树的 rename(2)，经 simplefsctl 直接检查文件系统自身的判断
+    if run_command([SIMPLEFSCTL_EXEC, "rename", moved, os.path.join(moved, "inner", "x")], check=False).returncode == 0:
+        log_error("目录移入自己的子树没有失败！")
+    if not os.path.isdir(os.path.join(moved, "inner")):
+        log_error("目录移入自己的子树失败后目录结构被修改！")
+    d3 = os.path.join(root, "d3")
+    os.mkdir(d3)
+    write(os.path.join(d3, "f.txt"), "f")
+    try:
+        os.rename(moved, d3)
+        log_error("覆盖非空目录的重命名没有报错！")
+    except OSError as e:
+        if e.errno not in (errno.ENOTEMPTY, errno.EEXIST):
+            log_error(f"覆盖非空目录的重命名返回了意外的错误: {e}")
+    shutil.rmtree(d3)
+
+    nlink_d1, nlink_d2 = os.stat(d1).st_nlink, os.stat(d2).st_nlink
+    os.rename(moved, os.path.join(d2, "moved"))
+    if os.stat(d1).st_nlink != nlink_d1 - 1 or os.stat(d2).st_nlink != nlink_d2 + 1:
+        log_error("跨目录移动子目录后父目录的链接数不正确！")
+    log_success("目录重命名验证通过。")
+
+    unmount_fs(fs_process)
+    fs_process = mount_fs()
+    if sorted(os.listdir(root)) != ["b.txt", "c.txt", "d1", "d2"] or os.listdir(d1) != [] or \
+       os.listdir(os.path.join(d2, "moved")) != ["inner"] or read(b) != "content a2":
+        log_error("重新挂载后目录结构不正确！")
+    if os.stat(d1).st_nlink != nlink_d1 - 1 or os.stat(d2).st_nlink != nlink_d2 + 1:
+        log_error("重新挂载后父目录的链接数不正确！")
+    shutil.rmtree(root)
+    log_success("重命名验证通过。")
+    return fs_process
+
+def test_fsync_durability(fs_process):
+    """
+    BENCH_FSYNC_THREADS 个线程并发写入并 fsync/fdatasync（分组提交合并设备刷新），
+    在新目录中创建文件后 fsync 文件和目录（fsyncdir），随后强制杀死 simplefs 进程：
+    重新挂载后 fsync 过的数据和目录项都在，且内容正确。
+    返回重新挂载后的 simplefs 进程。
+    """
+    log_header("开始fsync持久性测试")
+    root = os.path.join(MOUNT_POINT, "fsync_test")
+    os.mkdir(root)
+    writes_per_thread = 25
+    expected = {}
+    errors = []
+
+    def fsync_worker(index):
+        path = os.path.join(root, f"thread_{index}.dat")
+        data = os.urandom(4096 * writes_per_thread)
+        fd = os.open(path, os.O_WRONLY | os.O_CREAT, 0o644)
+        try:
+            for i in range(writes_per_thread):
+                os.pwrite(fd, data[i * 4096:(i + 1) * 4096], i * 4096)
+                if index % 2 == 0:
+                    os.fsync(fd)
+                else:
+                    os.fdatasync(fd)
+        except OSError as e:
+            errors.append(e)
+        finally:
+            os.close(fd)
+        expected[path] = data
+
+    threads = [threading.Thread(target=fsync_worker, args=(t,)) for t in range(BENCH_FSYNC_THREADS)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    if errors:
+        log_error(f"并发fsync失败: {errors[0]}")
+
+    sub_dir = os.path.join(root, "new_dir")
+    os.mkdir(sub_dir)
+    path = os.path.join(sub_dir, "file.dat")
+    expected[path] = os.urandom(100000)
+    with open(path, "wb") as f:
+        f.write(expected[path])
+        f.flush()
+        os.fsync(f.fileno())
+    for dir_path in [sub_dir, root]:
+        dir_fd = os.open(dir_path, os.O_RDONLY | os.O_DIRECTORY)
+        try:
+            os.fsync(dir_fd)
+        finally:
+            os.close(dir_fd)
+    log_success("并发fsync、fdatasync和fsyncdir均已成功返回。")
+
+    # 不经正常卸载直接杀死进程，只有fsync过的数据保证持久
+    fs_process.kill()
+    fs_process.wait()
+    run_command(['fusermount', '-u', MOUNT_POINT], check=False)
+    fs_process = mount_fs()
+    for path, data in expected.items():
+        if not os.path.exists(path):
+            log_error(f"进程被杀死后 fsync 过的 {path} 丢失！")
+        with open(path, "rb") as f:
+            if f.read() != data:
+                log_error(f"进程被杀死后 fsync 过的 {path} 内容不正确！")
+    shutil.rmtree(root)
+    log_success("fsync持久性验证通过。")
+    return fs_process
+
+def run_durability_benchmark():
+    """在当前挂载上测量各类操作的延迟和吞吐，返回结果字典"""
+    bench_dir = os.path.join(MOUNT_POINT, "durability_bench")
+    os.makedirs(bench_dir, exist_ok=True)
+    results = {}
+
+    # 1. 4KB写入+fsync的延迟
+    block = os.urandom(4096)
+    latencies = []
+    fd = os.open(os.path.join(bench_dir, "fsync.dat"), os.O_WRONLY | os.O_CREAT, 0o644)
+    try:
+        for i in range(BENCH_FSYNC_ITERATIONS):
+            start = time.perf_counter()
+            os.pwrite(fd, block, i * 4096)
+            os.fsync(fd)
+            latencies.append(time.perf_counter() - start)
+    finally:
+        os.close(fd)
+    latencies.sort()
+    results["fsync_avg_ms"] = sum(latencies) / len(latencies) * 1000
+    results["fsync_p99_ms"] = latencies[int(len(latencies) * 0.99) - 1] * 1000
+
+    # 2. 多线程并发写入+fsync（分组提交合并设备刷新）
+    def fsync_worker(index):
+        path = os.path.join(bench_dir, f"fsync_mt_{index}.dat")
+        wfd = os.open(path, os.O_WRONLY | os.O_CREAT, 0o644)
+        try:
+            for i in range(BENCH_FSYNC_ITERATIONS // BENCH_FSYNC_THREADS):
+                os.pwrite(wfd, block, i * 4096)
+                os.fsync(wfd)
+        finally:
+            os.close(wfd)
+    threads = [threading.Thread(target=fsync_worker, args=(t,)) for t in range(BENCH_FSYNC_THREADS)]
+    start = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+    results["fsync_mt_ops"] = (BENCH_FSYNC_ITERATIONS // BENCH_FSYNC_THREADS) * BENCH_FSYNC_THREADS / elapsed
+
+    # 3. 小文件创建（元数据操作）
+    start = time.perf_counter()
+    for i in range(BENCH_SMALL_FILES):
+        with open(os.path.join(bench_dir, f"small_{i}.txt"), "wb") as f:
+            f.write(b"x" * 100)
+    elapsed = time.perf_counter() - start
+    results["create_avg_ms"] = elapsed / BENCH_SMALL_FILES * 1000
+
+    # 4. 顺序写入吞吐（含最后一次fsync）
+    chunk = os.urandom(1024 * 1024)
+    start = time.perf_counter()
+    with open(os.path.join(bench_dir, "seq.dat"), "wb") as f:
+        for _ in range(BENCH_SEQ_WRITE_MB):
+            f.write(chunk)
+        f.flush()
+        os.fsync(f.fileno())
+    elapsed = time.perf_counter() - start
+    results["seq_mb_s"] = BENCH_SEQ_WRITE_MB / elapsed
+
+    shutil.rmtree(bench_dir)
+    return results
+
+def test_durability_modes(fs_process):
+    """
+    比较 -o durability=sync/ordered/writeback 三种持久化模式。
+    每种模式重新挂载一次，运行相同的基准测试，最后以默认选项重新挂载。
+    返回新的 simplefs 进程。
+    """
+    log_header("开始持久化模式基准测试")
+    all_results = {}
+    for mode in DURABILITY_MODES:
+        unmount_fs(fs_process)
+        fs_process = mount_fs(f"durability={mode}")
+        all_results[mode] = run_durability_benchmark()
+        log_success(f"模式 {mode} 测试完成。")
+
+    log_info(f"{'模式':<10}{'fsync平均(ms)':>16}{'fsync p99(ms)':>16}{'并发fsync(次/秒)':>20}{'创建文件(ms)':>16}{'顺序写(MB/s)':>16}")
+    for mode in DURABILITY_MODES:
+        r = all_results[mode]
+        log_info(f"{mode:<10}{r['fsync_avg_ms']:>16.3f}{r['fsync_p99_ms']:>16.3f}{r['fsync_mt_ops']:>20.1f}"
+                 f"{r['create_avg_ms']:>16.3f}{r['seq_mb_s']:>16.1f}")
+    if all_results["sync"]["create_avg_ms"] < all_results["writeback"]["create_avg_ms"]:
+        log_warning("sync模式的小文件创建快于writeback模式，结果可能受缓存影响。")
+
+    unmount_fs(fs_process)
+    return mount_fs()
+
+def run_metadata_benchmark():
+    """元数据密集的操作序列（创建、stat、列目录、改名、删除），返回每个操作的平均耗时（微秒）"""
+    bench_dir = os.path.join(MOUNT_POINT, "csum_bench")
+    os.makedirs(bench_dir)
+    names = [os.path.join(bench_dir, f"f_{i}") for i in range(BENCH_CSUM_FILES)]
+    start = time.perf_counter()
+    for name in names:
+        with open(name, "wb") as f:
+            f.write(b"m" * 64)
+    for name in names:
+        os.stat(name)
+    for _ in range(10):
+        os.listdir(bench_dir)
+    for name in names:
+        os.rename(name, name + ".r")
+    for name in names:
+        os.unlink(name + ".r")
+    elapsed = time.perf_counter() - start
+    os.rmdir(bench_dir)
+    return elapsed / (BENCH_CSUM_FILES * 4 + 10) * 1e6
+
+def test_metadata_csum_overhead(fs_process):
+    """
+    比较未启用和启用 -O metadata_csum 的镜像上元数据操作的耗时。
+    校验和计算应只占操作耗时的很小一部分，超过 BENCH_CSUM_MAX_OVERHEAD_PCT 时测试失败。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始元数据校验和开销测试")
+    best = {}
+    for label, mkfs_options in [("plain", []), ("metadata_csum", ['-O', 'metadata_csum'])]:
+        def body(fs_process, label=label):
+            best[label] = min(run_metadata_benchmark() for _ in range(BENCH_CSUM_ROUNDS))
+            log_success(f"格式 {label}: 每个元数据操作 {best[label]:.1f} us")
+            return fs_process, True
+        fs_process, _ = with_formatted_fs(fs_process, mkfs_options, body)
+
+    overhead = (best["metadata_csum"] - best["plain"]) / best["plain"] * 100
+    log_info(f"元数据校验和开销: {overhead:+.2f}%")
+    if overhead > BENCH_CSUM_MAX_OVERHEAD_PCT:
+        log_error(f"元数据校验和开销超过 {BENCH_CSUM_MAX_OVERHEAD_PCT}%！")
+    return fs_process
+
+def compressible_text(size_bytes):
+    """生成类似日志文本的可压缩数据"""
+    rng = random.Random(45)
+    words = [b"INFO ", b"WARN ", b"request ", b"served ", b"in ", b"ms\n", b"user=", b"path=/api/v1/items "]
+    chunks, total = [], 0
+    while total < size_bytes:
+        piece = rng.choice(words) + str(rng.randrange(10000)).encode() + b" "
+        chunks.append(piece)
+        total += len(piece)
+    return b"".join(chunks)[:size_bytes]
+
+def run_compression_benchmark(data):
+    """写入并回读一个文件，返回 (占用的块数, 写入MB/s, 读取MB/s)"""
+    path = os.path.join(MOUNT_POINT, "compress_bench.dat")
+    before = os.statvfs(MOUNT_POINT)
+    start = time.perf_counter()
+    with open(path, "wb") as f:
+        f.write(data)
+        f.flush()
+        os.fsync(f.fileno())
+    write_elapsed = time.perf_counter() - start
+    after = os.statvfs(MOUNT_POINT)
+    start = time.perf_counter()
+    with open(path, "rb") as f:
+        read_back = f.read()
+    read_elapsed = time.perf_counter() - start
+    if read_back != data:
+        log_error("压缩基准测试回读的数据不一致！")
+    os.unlink(path)
+    size_mb = len(data) / (1024 * 1024)
+    return before.f_bfree - after.f_bfree, size_mb / write_elapsed, size_mb / read_elapsed
+
+def test_compression(fs_process):
+    """
+    比较未启用和启用 -O compression（以 -o compress 挂载）时写入可压缩文本占用的块数和读写吞吐。
+    压缩比低于 BENCH_COMPRESS_MIN_RATIO 时测试失败。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始透明压缩测试")
+    data = compressible_text(BENCH_COMPRESS_MB * 1024 * 1024)
+    used = {}
+    for label, mkfs_options, mount_options in [("plain", [], None), ("compression", ['-O', 'compression'], 'compress')]:
+        def body(fs_process, label=label):
+            used[label], write_mbps, read_mbps = run_compression_benchmark(data)
+            log_success(f"格式 {label}: 占用 {used[label]} 块, 写入 {write_mbps:.1f} MB/s, 读取 {read_mbps:.1f} MB/s")
+            return fs_process, True
+        fs_process, _ = with_formatted_fs(fs_process, mkfs_options, body, mount_options)
+
+    ratio = used["plain"] / max(used["compression"], 1)
+    log_info(f"压缩比: {ratio:.2f}")
+    if ratio < BENCH_COMPRESS_MIN_RATIO:
+        log_error(f"压缩比低于 {BENCH_COMPRESS_MIN_RATIO}！")
+    return fs_process
+
+def test_reflink(fs_process):
+    """
+    在 -O reflink 格式的镜像上比较 simplefsctl clone 和 simplefsctl copy 的耗时和占用的块数。
+    克隆只共享块映射，耗时应与文件大小无关，超过 BENCH_REFLINK_MAX_CLONE_MS 时测试失败；
+    之后修改克隆，确认源文件不受影响。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始reflink克隆测试")
+
+    def body(fs_process):
+        src = os.path.join(MOUNT_POINT, "reflink_src.dat")
+        data = os.urandom(BENCH_REFLINK_MB * 1024 * 1024)
+        with open(src, "wb") as f:
+            f.write(data)
+            f.flush()
+            os.fsync(f.fileno())
+
+        results = {}
+        for mode in ["copy", "clone"]:
+            dst = os.path.join(MOUNT_POINT, f"reflink_{mode}.dat")
+            before = os.statvfs(MOUNT_POINT)
+            start = time.perf_counter()
+            run_command([SIMPLEFSCTL_EXEC, mode, src, dst])
+            elapsed_ms = (time.perf_counter() - start) * 1000
+            after = os.statvfs(MOUNT_POINT)
+            with open(dst, "rb") as f:
+                if f.read() != data:
+                    log_error(f"{mode} 得到的文件内容与源文件不一致！")
+            results[mode] = (elapsed_ms, before.f_bfree - after.f_bfree)
+            log_success(f"{mode}: {elapsed_ms:.1f} ms, 占用 {results[mode][1]} 块")
+
+        if results["clone"][0] > BENCH_REFLINK_MAX_CLONE_MS:
+            log_failure(f"克隆 {BENCH_REFLINK_MB}MB 文件耗时超过 {BENCH_REFLINK_MAX_CLONE_MS} ms！")
+            return fs_process, False
+
+        # 写时复制：修改克隆不影响源文件
+        clone_path = os.path.join(MOUNT_POINT, "reflink_clone.dat")
+        with open(clone_path, "r+b") as f:
+            f.seek(len(data) // 2 + 123)
+            f.write(b"x" * 10000)
+        with open(src, "rb") as f:
+            if f.read() != data:
+                log_error("修改克隆后源文件内容改变！")
+        log_success("写时复制验证通过。")
+        return fs_process, True
+
+    fs_process, passed = with_formatted_fs(fs_process, ['-O', 'reflink'], body)
+    if not passed:
+        log_error("reflink克隆测试失败！")
+    return fs_process
+
+def test_dedup(fs_process):
+    """
+    在 -O reflink 格式的镜像上写入 BENCH_DEDUP_COPIES 份相同的数据，卸载后运行 dedup.simplefs，
+    确认回收的块数、去重后的文件内容，以及修改其中一份不影响其他几份。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始离线去重测试")
+
+    def body(fs_process):
+        data = os.urandom(BENCH_DEDUP_MB * 1024 * 1024)
+        paths = [os.path.join(MOUNT_POINT, f"dedup_{i}.dat") for i in range(BENCH_DEDUP_COPIES)]
+        for path in paths:
+            with open(path, "wb") as f:
+                f.write(data)
+        before = os.statvfs(MOUNT_POINT)
+        unmount_fs(fs_process)
+
+        start = time.perf_counter()
+        run_command([DEDUP_EXEC, DISK_IMAGE])
+        elapsed_ms = (time.perf_counter() - start) * 1000
+
+        fs_process = mount_fs()
+        after = os.statvfs(MOUNT_POINT)
+        reclaimed_mb = (after.f_bfree - before.f_bfree) * after.f_frsize / (1024 * 1024)
+        log_success(f"去重耗时 {elapsed_ms:.1f} ms, 回收 {reclaimed_mb:.1f} MB")
+        if reclaimed_mb < BENCH_DEDUP_MB * (BENCH_DEDUP_COPIES - 1) * 0.99:
+            log_failure(f"回收的空间少于预期的 {BENCH_DEDUP_MB * (BENCH_DEDUP_COPIES - 1)} MB！")
+            return fs_process, False
+        for path in paths:
+            with open(path, "rb") as f:
+                if f.read() != data:
+                    log_failure(f"去重后 {path} 的内容不一致！")
+                    return fs_process, False
+
+        # 去重后的块是共享的：修改一份不影响其他几份
+        with open(paths[0], "r+b") as f:
+            f.seek(len(data) // 3)
+            f.write(b"y" * 10000)
+        for path in paths[1:]:
+            with open(path, "rb") as f:
+                if f.read() != data:
+                    log_failure("修改一份去重后的文件后其他文件内容改变！")
+                    return fs_process, False
+        log_success("去重后的写时复制验证通过。")
+        return fs_process, True
+
+    fs_process, passed = with_formatted_fs(fs_process, ['-O', 'reflink'], body)
+    if not passed:
+        log_error("离线去重测试失败！")
+    return fs_process
+
+def test_snapshot(fs_process):
+    """
+    在 -O snapshot 格式的镜像上写入文件后创建快照，创建只写入少量元数据，超过 BENCH_SNAPSHOT_MAX_CREATE_MS 时测试失败；
+    之后覆盖和删除文件，确认 .snapshots 下仍是快照时刻的内容且不可写，删除快照后空间全部归还。
+    返回以默认格式重新格式化并挂载后的 simplefs 进程。
+    """
+    log_header("开始快照测试")
+
+    def body(fs_process):
+        path = os.path.join(MOUNT_POINT, "snapshot_src.dat")
+        data = os.urandom(BENCH_SNAPSHOT_MB * 1024 * 1024)
+        with open(path, "wb") as f:
+            f.write(data)
+            f.flush()
+            os.fsync(f.fileno())
+        # 第一次创建时为快照目录分配目录块，之后再记录空闲块数
+        run_command([SIMPLEFSCTL_EXEC, "snapshot", "create", MOUNT_POINT, "warmup"])
+        run_command([SIMPLEFSCTL_EXEC, "snapshot", "delete", MOUNT_POINT, "warmup"])
+        before = os.statvfs(MOUNT_POINT)
+
+        start = time.perf_counter()
+        run_command([SIMPLEFSCTL_EXEC, "snapshot", "create", MOUNT_POINT, "snap1"])
+        elapsed_ms = (time.perf_counter() - start) * 1000
+        log_success(f"创建快照: {elapsed_ms:.1f} ms")
+        if elapsed_ms > BENCH_SNAPSHOT_MAX_CREATE_MS:
+            log_failure(f"创建快照耗时超过 {BENCH_SNAPSHOT_MAX_CREATE_MS} ms！")
+            return fs_process, False
+
+        # 覆盖前半部分后删除文件，快照中仍是原来的内容
+        with open(path, "r+b") as f:
+            f.write(b"z" * (len(data) // 2))
+            f.flush()
+            os.fsync(f.fileno())
+        os.remove(path)
+        snapshot_path = os.path.join(MOUNT_POINT, ".snapshots", "snap1", "snapshot_src.dat")
+        with open(snapshot_path, "rb") as f:
+            if f.read() != data:
+                log_error("快照中的文件内容与创建快照时不一致！")
+        try:
+            with open(snapshot_path, "r+b"):
+                log_error("快照中的文件可以写入！")
+        except OSError as e:
+            if e.errno != errno.EROFS:
+                log_error(f"写入快照中的文件返回了意外的错误: {e}")
+        log_success("快照内容验证通过。")
+
+        used_mb = (before.f_bfree - os.statvfs(MOUNT_POINT).f_bfree) * before.f_frsize / (1024 * 1024)
+        log_info(f"覆盖和删除后快照占用 {used_mb:.1f} MB")
+        run_command([SIMPLEFSCTL_EXEC, "snapshot", "delete", MOUNT_POINT, "snap1"])
+        # 删除文件后的块由后台回收，快照删除后应全部归还
+        reclaimed = False
+        for _ in range(100):
+            after = os.statvfs(MOUNT_POINT)
+            if after.f_bfree >= before.f_bfree + BENCH_SNAPSHOT_MB * 1024 * 1024 // after.f_frsize:
+                reclaimed = True
+                break
+            time.sleep(0.1)
+        if not reclaimed:
+            log_failure("删除快照后空间未全部归还！")
+            return fs_process, False
+        log_success("删除快照后空间已归还。")
+        return fs_process, True
+
+    fs_process, passed = with_formatted_fs(fs_process, ['-O', 'snapshot'], body)
+    if not passed:
+        log_error("快照测试失败！")
+    return fs_process
+
+def parse_defrag_summary(output):
+    """从 simplefsctl defrag 的汇总行中取出整理前后的段数和迁移的块数"""
+    match = re.search(r"段数 (\d+) -> (\d+)，迁移 (\d+) 块", output)
+    if not match:
+        log_error(f"无法解析碎片整理输出: {output}")
+    return tuple(int(x) for x in match.groups())
+
+def test_defrag():
+    """
+    倒序分块写入并逐块fsync制造碎片，-n 统计段数后在线整理，确认段数减少且内容不变，
+    整理后再次运行不再迁移。
+    """
+    log_header("开始在线碎片整理测试")
+    path = os.path.join(MOUNT_POINT, "defrag_src.dat")
+    chunk = BENCH_DEFRAG_CHUNK_KB * 1024
+    data = os.urandom(BENCH_DEFRAG_MB * 1024 * 1024)
+    with open(path, "wb") as f:
+        for offset in range(len(data) - chunk, -1, -chunk):
+            f.seek(offset)
+            f.write(data[offset:offset + chunk])
+            f.flush()
+            os.fsync(f.fileno())
+
+    before, _, moved = parse_defrag_summary(run_command([SIMPLEFSCTL_EXEC, "defrag", "-n", path]).stdout)
+    if before <= 1 or moved != 0:
+        log_error(f"预期文件有碎片且 -n 不迁移，实际 {before} 段，迁移 {moved} 块")
+
+    start = time.perf_counter()
+    before, after, moved = parse_defrag_summary(run_command([SIMPLEFSCTL_EXEC, "defrag", path]).stdout)
+    elapsed = time.perf_counter() - start
+    log_success(f"碎片整理: {before} -> {after} 段，迁移 {moved} 块，{BENCH_DEFRAG_MB / elapsed:.2f} MB/s")
+    if after >= before:
+        log_error("碎片整理后段数没有减少！")
+
+    with open(path, "rb") as f:
+        if f.read() != data:
+            log_error("碎片整理后文件内容改变！")
+    _, _, moved = parse_defrag_summary(run_command([SIMPLEFSCTL_EXEC, "defrag", path]).stdout)
+    if moved != 0:
+        log_warning(f"整理过的文件再次整理时迁移了 {moved} 块。")
+    log_success("碎片整理验证通过。")
+    os.remove(path)
+
+def image_allocated_mb():
+    """镜像文件实际占用的空间 (MB)"""
+    return os.stat(DISK_IMAGE).st_blocks * 512 / (1024 * 1024)
+
+def write_and_remove(name, size_mb):
+    """写入并fsync一个文件后删除，返回删除前镜像占用的空间 (MB)"""
+    path = os.path.join(MOUNT_POINT, name)
+    with open(path, "wb") as f:
+        f.write(os.urandom(size_mb * 1024 * 1024))
+        f.flush()
+        os.fsync(f.fileno())
+    allocated = image_allocated_mb()
+    os.remove(path)
+    return allocated
+
+def test_discard(fs_process):
+    """
+    删除文件后镜像文件的占用应当缩小：先用 simplefsctl trim（FITRIM）批量下发，
+    再以 -o discard 挂载，确认后台线程自动打洞。
+    返回以默认选项重新挂载后的 simplefs 进程。
+    """
+    log_header("开始discard测试")
+    before = write_and_remove("discard_trim.dat", BENCH_DISCARD_MB)
+    run_command([SIMPLEFSCTL_EXEC, "trim", MOUNT_POINT])
+    after = image_allocated_mb()
+    log_success(f"FITRIM: 镜像占用 {before:.1f} MB -> {after:.1f} MB")
+    if after > before - BENCH_DISCARD_MB / 2:
+        log_error("FITRIM之后镜像占用没有缩小！")
+
+    unmount_fs(fs_process)
+    fs_process = mount_fs("discard")
+    before = write_and_remove("discard_online.dat", BENCH_DISCARD_MB)
+    # 删除的块由后台回收，再由discard线程批量下发
+    after = before
+    for _ in range(100):
+        after = image_allocated_mb()
+        if after <= before - BENCH_DISCARD_MB / 2:
+            break
+        time.sleep(0.1)
+    log_success(f"-o discard: 镜像占用 {before:.1f} MB -> {after:.1f} MB")
+    if after > before - BENCH_DISCARD_MB / 2:
+        log_error("-o discard 挂载时删除文件后镜像占用没有缩小！")
+
+    unmount_fs(fs_process)
+    return mount_fs()
+
 # --- 主函数 ---
 
 def main():
@@ -579,6 +2108,32 @@ def main():
         test_many_files_io()
         test_permission_system()
         test_links()
+        test_batched_free()
+        fs_process = test_deferred_unlink(fs_process)
+        test_delalloc()
+        test_reservation_windows()
+        test_fallocate()
+        test_seek_and_copy()
+        test_unaligned_io()
+        test_read_block_reuse()
+        fs_process = test_inode_placement(fs_process)
+        fs_process = test_fragmented_alloc(fs_process)
+        test_contiguous_alloc()
+        fs_process = test_inline_data(fs_process)
+        fs_process = test_inode_sizes(fs_process)
+        fs_process = test_block_sizes(fs_process)
+        fs_process = test_flex_bg(fs_process)
+        fs_process = test_group_loading(fs_process)
+        fs_process = test_rename(fs_process)
+        fs_process = test_fsync_durability(fs_process)
+        fs_process = test_durability_modes(fs_process)
+        fs_process = test_metadata_csum_overhead(fs_process)
+        fs_process = test_compression(fs_process)
+        fs_process = test_reflink(fs_process)
+        fs_process = test_dedup(fs_process)
+        fs_process = test_snapshot(fs_process)
+        test_defrag()
+        fs_process = test_discard(fs_process)
         
         log_header("所有测试已成功完成！")
 
@@ -0,0 +1,551 @@
+#include "simplefs.h"
+#include "disk_io.h"
+#include "utils.h"
+#include "checksum.h"
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+// 离线块级去重，必须在文件系统未挂载时运行
+// 遍历所有普通文件的块树，并行计算数据块的128位哈希，逐字节确认内容相同的块重映射到同一个块，
+// 共享关系记录在reflink引用计数表（inode 3）中；挂载后对这些块的写入和释放按写时复制处理。
+// 去重以块指针为单位：一个间接块被多个文件共享时，其中的指针只修改一次，对所有共享者都成立。
+
+static void print_usage(const char* prog) {
+    std::cerr << "用法: " << prog << " [-n] [-j 线程数] <设备文件>" << std::endl;
+    std::cerr << "  -n: 只统计可回收的空间，不修改文件系统" << std::endl;
+    std::cerr << "  -j: 计算哈希的线程数，默认为CPU核数" << std::endl;
+    std::cerr << "  去重后的块通过引用计数表共享，文件系统须启用reflink特性（mkfs.simplefs -O reflink）" << std::endl;
+}
+
+// MurmurHash3 x64 128位版本（公有领域算法），对块内容计算指纹
+struct BlockHash {
+    uint64_t h1, h2;
+    bool operator<(const BlockHash& o) const { return h1 != o.h1 ? h1 < o.h1 : h2 < o.h2; }
+    bool operator==(const BlockHash& o) const { return h1 == o.h1 && h2 == o.h2; }
+};
+
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33; k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33; k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// 块大小是16的倍数，没有尾部字节
+static BlockHash murmur3_128(const uint8_t* data, size_t length) {
+    const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0, h2 = 0;
+    for (size_t i = 0; i + 16 <= length; i += 16) {
+        uint64_t k1, k2;
+        std::memcpy(&k1, data + i, 8);
+        std::memcpy(&k2, data + i + 8, 8);
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    h1 ^= length; h2 ^= length;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1); h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+    return {h1, h2};
+}
+
+struct DedupFs {
+    int fd = -1;
+    SimpleFS_SuperBlock sb{};
+    std::vector<SimpleFS_GroupDesc> gdt;
+    uint32_t block_size = 0;
+    uint32_t num_groups = 0;
+    uint32_t gdt_blocks = 0;
+    uint32_t inode_table_blocks = 0;
+    std::vector<uint8_t> block_bitmaps;          // 所有块组的块位图，每组block_size字节
+    std::set<uint32_t> dirty_bitmap_groups;      // 块位图被修改的组
+    std::unordered_map<uint32_t, uint32_t> extra_refs; // 引用计数表：块号 -> 额外引用数
+    bool reflink = false;                         // 已启用reflink，inode 3是引用计数表
+};
+
+// 数据块的引用情况：块指针个数，以及是否有指针带未写入标志（内容无意义，不参与去重）
+struct BlockUse {
+    uint32_t slots = 0;
+    bool unwritten = false;
+};
+
+static int read_inode(DedupFs& fs, uint32_t ino, SimpleFS_Inode* inode) {
+    uint32_t grp = (ino - 1) / fs.sb.s_inodes_per_group, idx = (ino - 1) % fs.sb.s_inodes_per_group;
+    uint32_t inodes_per_block = fs.block_size / fs.sb.s_inode_size;
+    std::vector<uint8_t> block(fs.block_size);
+    if (read_block(fs.fd, fs.gdt[grp].bg_inode_table + idx / inodes_per_block, block.data()) != 0) return -1;
+    std::memset(inode, 0, sizeof(SimpleFS_Inode));
+    std::memcpy(inode, block.data() + (idx % inodes_per_block) * fs.sb.s_inode_size, fs.sb.s_inode_size);
+    return 0;
+}
+
+static int write_inode(DedupFs& fs, uint32_t ino, SimpleFS_Inode* inode) {
+    uint32_t grp = (ino - 1) / fs.sb.s_inodes_per_group, idx = (ino - 1) % fs.sb.s_inodes_per_group;
+    uint32_t inodes_per_block = fs.block_size / fs.sb.s_inode_size;
+    uint32_t table_block = fs.gdt[grp].bg_inode_table + idx / inodes_per_block;
+    std::vector<uint8_t> block(fs.block_size);
+    if (read_block(fs.fd, table_block, block.data()) != 0) return -1;
+    if (has_metadata_csum(fs.sb)) {
+        inode->i_checksum = inode_checksum(ino, inode, fs.sb.s_inode_size);
+    }
+    std::memcpy(block.data() + (idx % inodes_per_block) * fs.sb.s_inode_size, inode, fs.sb.s_inode_size);
+    return write_block(fs.fd, table_block, block.data());
+}
+
+// 从位图中分配一个块（离线运行，不需要预留窗口等策略），失败返回0
+static uint32_t alloc_block(DedupFs& fs) {
+    for (uint32_t grp = 0; grp < fs.num_groups; ++grp) {
+        // BLOCK_UNINIT组的位图由挂载时的摘要推导，不在这里修改
+        if (fs.gdt[grp].bg_free_blocks_count == 0 || (fs.gdt[grp].bg_flags & SIMPLEFS_BG_BLOCK_UNINIT)) continue;
+        std::vector<uint8_t> bitmap(fs.block_bitmaps.begin() + (size_t)grp * fs.block_size,
+                                    fs.block_bitmaps.begin() + (size_t)(grp + 1) * fs.block_size);
+        uint32_t group_bits = std::min(fs.sb.s_blocks_per_group, fs.sb.s_blocks_count - grp * fs.sb.s_blocks_per_group);
+        uint32_t bit = find_next_clear_bit(bitmap, 0, group_bits);
+        if (bit >= group_bits) continue;
+        fs.block_bitmaps[(size_t)grp * fs.block_size + bit / 8] |= static_cast<uint8_t>(1u << (bit % 8));
+        fs.gdt[grp].bg_free_blocks_count--;
+        fs.sb.s_free_blocks_count--;
+        fs.dirty_bitmap_groups.insert(grp);
+        return grp * fs.sb.s_blocks_per_group + bit;
+    }
+    return 0;
+}
+
+static void free_block(DedupFs& fs, uint32_t block_num) {
+    uint32_t grp = block_num / fs.sb.s_blocks_per_group, bit = block_num % fs.sb.s_blocks_per_group;
+    fs.block_bitmaps[(size_t)grp * fs.block_size + bit / 8] &= static_cast<uint8_t>(~(1u << (bit % 8)));
+    fs.gdt[grp].bg_free_blocks_count++;
+    fs.sb.s_free_blocks_count++;
+    fs.dirty_bitmap_groups.insert(grp);
+}
+
+// 写回被修改的块位图、GDT和超级块（含备份），并等待落盘
+static int write_allocation_state(DedupFs& fs) {
+    const bool csum = has_metadata_csum(fs.sb);
+    for (uint32_t grp : fs.dirty_bitmap_groups) {
+        const uint8_t* bitmap = fs.block_bitmaps.data() + (size_t)grp * fs.block_size;
+        if (write_block(fs.fd, fs.gdt[grp].bg_block_bitmap, bitmap) != 0) return -1;
+        if (csum) fs.gdt[grp].bg_block_bitmap_csum = bitmap_checksum(bitmap, fs.block_size);
+    }
+    fs.dirty_bitmap_groups.clear();
+    if (csum) {
+        for (uint32_t grp = 0; grp < fs.num_groups; ++grp) fs.gdt[grp].bg_checksum = group_desc_checksum(grp, &fs.gdt[grp]);
+        fs.sb.s_checksum = superblock_checksum(&fs.sb);
+    }
+    std::vector<uint8_t> sb_block(fs.block_size, 0), gdt_raw((size_t)fs.gdt_blocks * fs.block_size, 0);
+    std::memcpy(sb_block.data(), &fs.sb, sizeof(fs.sb));
+    std::memcpy(gdt_raw.data(), fs.gdt.data(), fs.num_groups * sizeof(SimpleFS_GroupDesc));
+    if (write_block(fs.fd, 1, sb_block.data()) != 0 || write_blocks(fs.fd, 2, fs.gdt_blocks, gdt_raw.data()) != 0) return -1;
+    for (uint32_t grp = 1; grp < fs.num_groups; ++grp) {
+        if (!is_backup_group(grp)) continue;
+        uint32_t grp_start = grp * fs.sb.s_blocks_per_group;
+        if (write_block(fs.fd, grp_start, sb_block.data()) != 0 ||
+            write_blocks(fs.fd, grp_start + 1, fs.gdt_blocks, gdt_raw.data()) != 0) return -1;
+    }
+    return fsync(fs.fd);
+}
+
+// 引用计数表中逻辑块的物理块号；allocate为true时按需分配表块和间接块，失败返回0
+static uint32_t refcount_table_block(DedupFs& fs, SimpleFS_Inode& table_inode, uint32_t lbn, bool allocate, bool* inode_changed) {
+    const uint64_t per_block = fs.block_size / sizeof(uint32_t);
+    std::vector<uint32_t> indirect(per_block);
+    auto fresh_block = [&]() -> uint32_t {
+        uint32_t block_num = alloc_block(fs);
+        if (block_num == 0) return 0;
+        std::vector<uint8_t> zeros(fs.block_size, 0);
+        if (write_block(fs.fd, block_num, zeros.data()) != 0) return 0;
+        table_inode.i_blocks += fs.block_size / 512;
+        *inode_changed = true;
+        return block_num;
+    };
+
+    uint32_t* p_slot;
+    uint64_t relative = 0, span = 1;
+    int level = 0;
+    if (lbn < SIMPLEFS_NUM_DIRECT_BLOCKS) {
+        p_slot = &table_inode.i_block[lbn];
+    } else {
+        relative = lbn - SIMPLEFS_NUM_DIRECT_BLOCKS;
+        span = per_block;
+        level = 1;
+        while (relative >= span) {
+            relative -= span;
+            span *= per_block;
+            if (++level > 3) return 0;
+        }
+        p_slot = &table_inode.i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + level - 1];
+    }
+    uint32_t parent_block = 0; // 0表示指针在inode中
+    for (;;) {
+        if (*p_slot == 0) {
+            if (!allocate) return 0;
+            uint32_t block_num = fresh_block();
+            if (block_num == 0) return 0;
+            *p_slot = block_num;
+            if (parent_block != 0 && write_block(fs.fd, parent_block, indirect.data()) != 0) return 0;
+        }
+        if (level == 0) return *p_slot & SIMPLEFS_BLOCK_PTR_MASK;
+        parent_block = *p_slot;
+        if (read_block(fs.fd, parent_block, indirect.data()) != 0) return 0;
+        span /= per_block;
+        p_slot = &indirect[relative / span];
+        relative %= span;
+        level--;
+    }
+}
+
+static int load_refcount_table(DedupFs& fs) {
+    SimpleFS_Inode table_inode;
+    if (read_inode(fs, SIMPLEFS_REFCOUNT_INODE_NUM, &table_inode) != 0) return -1;
+    const uint32_t per_block = fs.block_size / sizeof(uint32_t);
+    std::vector<uint32_t> table_block(per_block);
+    bool unused = false;
+    for (uint32_t lbn = 0; lbn < (fs.sb.s_blocks_count + per_block - 1) / per_block; ++lbn) {
+        uint32_t block_num = refcount_table_block(fs, table_inode, lbn, false, &unused);
+        if (block_num == 0) continue;
+        if (read_block(fs.fd, block_num, table_block.data()) != 0) return -1;
+        for (uint32_t i = 0; i < per_block; ++i) {
+            if (table_block[i] != 0) fs.extra_refs[lbn * per_block + i] = table_block[i];
+        }
+    }
+    return 0;
+}
+
+// 按内存中的计数重写引用计数表的若干块
+static int write_refcount_table(DedupFs& fs, const std::set<uint32_t>& table_lbns) {
+    SimpleFS_Inode table_inode;
+    if (read_inode(fs, SIMPLEFS_REFCOUNT_INODE_NUM, &table_inode) != 0) return -1;
+    const uint32_t per_block = fs.block_size / sizeof(uint32_t);
+    std::vector<uint32_t> table_block(per_block);
+    bool inode_changed = false;
+    for (uint32_t lbn : table_lbns) {
+        bool all_zero = true;
+        for (uint32_t i = 0; i < per_block; ++i) {
+            auto it = fs.extra_refs.find(lbn * per_block + i);
+            table_block[i] = (it == fs.extra_refs.end()) ? 0 : it->second;
+            all_zero = all_zero && table_block[i] == 0;
+        }
+        // 全零的表块保持原样（空洞或已分配的零块都表示未共享），挂载后修改时由文件系统释放
+        uint32_t block_num = refcount_table_block(fs, table_inode, lbn, !all_zero, &inode_changed);
+        if (block_num == 0) {
+            if (all_zero) continue;
+            std::cerr << "引用计数表块分配失败" << std::endl;
+            return -1;
+        }
+        if (write_block(fs.fd, block_num, table_block.data()) != 0) return -1;
+        uint64_t table_end = static_cast<uint64_t>(lbn + 1) * fs.block_size;
+        if (table_end > table_inode.i_size) {
+            table_inode.i_size = static_cast<uint32_t>(std::min<uint64_t>(table_end, UINT32_MAX));
+            inode_changed = true;
+        }
+    }
+    if (inode_changed && write_inode(fs, SIMPLEFS_REFCOUNT_INODE_NUM, &table_inode) != 0) return -1;
+    return 0;
+}
+
+// 遍历可以去重的普通文件的块树：对每个inode调用on_inode，对每个间接块调用on_indirect_block
+// 被多个文件共享的间接块只访问一次；压缩文件、内联数据和引用计数表本身不参与
+template <typename InodeFn, typename IndirectFn>
+static int walk_files(DedupFs& fs, InodeFn on_inode, IndirectFn on_indirect_block) {
+    const uint32_t inodes_per_table = fs.sb.s_inodes_per_group;
+    std::vector<uint8_t> table((size_t)fs.inode_table_blocks * fs.block_size), inode_bitmap_block(fs.block_size);
+    std::unordered_set<uint32_t> visited_indirect;
+    const uint32_t per_block = fs.block_size / sizeof(uint32_t);
+    std::vector<std::vector<uint32_t>> level_buffers(4, std::vector<uint32_t>(per_block));
+
+    // 递归访问间接块，level为其层级（1~3）
+    auto walk_indirect = [&](auto&& self, uint32_t block_num, int level) -> int {
+        if (block_num == 0 || block_num >= fs.sb.s_blocks_count || !visited_indirect.insert(block_num).second) return 0;
+        std::vector<uint32_t>& content = level_buffers[level];
+        if (read_block(fs.fd, block_num, content.data()) != 0) return -1;
+        if (level == 1) return on_indirect_block(block_num, content);
+        for (uint32_t i = 0; i < per_block; ++i) {
+            if (self(self, content[i], level - 1) != 0) return -1;
+        }
+        return 0;
+    };
+
+    for (uint32_t grp = 0; grp < fs.num_groups; ++grp) {
+        if (read_block(fs.fd, fs.gdt[grp].bg_inode_bitmap, inode_bitmap_block.data()) != 0 ||
+            read_blocks(fs.fd, fs.gdt[grp].bg_inode_table, fs.inode_table_blocks, table.data()) != 0) {
+            std::cerr << "组 " << grp << " 的inode读取失败" << std::endl;
+            return -1;
+        }
+        for (uint32_t idx = 0; idx < inodes_per_table; ++idx) {
+            uint32_t ino = grp * inodes_per_table + idx + 1;
+            if (ino > fs.sb.s_inodes_count || (fs.reflink && ino == SIMPLEFS_REFCOUNT_INODE_NUM) || !is_bitmap_bit_set(inode_bitmap_block, idx)) continue;
+            SimpleFS_Inode inode{};
+            std::memcpy(&inode, table.data() + (size_t)idx * fs.sb.s_inode_size, fs.sb.s_inode_size);
+            if (!S_ISREG(inode.i_mode) || (inode.i_flags & (SIMPLEFS_INODE_FL_INLINE_DATA | SIMPLEFS_INODE_FL_COMPRESS))) continue;
+            if (on_inode(ino, inode) != 0) return -1;
+            for (int level = 1; level <= 3; ++level) {
+                if (walk_indirect(walk_indirect, inode.i_block[SIMPLEFS_NUM_DIRECT_BLOCKS + level - 1], level) != 0) return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// 并行计算候选块的哈希：按块号排序后分段，每个线程读取物理连续的一段后逐块计算
+static std::vector<BlockHash> hash_blocks(DedupFs& fs, const std::vector<uint32_t>& blocks, unsigned thread_count) {
+    std::vector<BlockHash> hashes(blocks.size());
+    const size_t per_thread = (blocks.size() + thread_count - 1) / thread_count;
+    const uint32_t max_run = std::max<uint32_t>(1, (1u << 20) / fs.block_size);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < thread_count; ++t) {
+        size_t begin = t * per_thread, end = std::min(blocks.size(), begin + per_thread);
+        if (begin >= end) break;
+        workers.emplace_back([&, begin, end]() {
+            std::vector<uint8_t> buffer((size_t)max_run * fs.block_size);
+            size_t i = begin;
+            while (i < end) {
+                uint32_t run = 1;
+                while (i + run < end && run < max_run && blocks[i + run] == blocks[i] + run) run++;
+                if (read_blocks(fs.fd, blocks[i], run, buffer.data()) != 0) {
+                    // 读取失败的块给出互不相同的哈希，不参与去重
+                    for (uint32_t r = 0; r < run; ++r) hashes[i + r] = {~0ULL, blocks[i + r]};
+                } else {
+                    for (uint32_t r = 0; r < run; ++r) {
+                        hashes[i + r] = murmur3_128(buffer.data() + (size_t)r * fs.block_size, fs.block_size);
+                    }
+                }
+                i += run;
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    return hashes;
+}
+
+int main(int argc, char* argv[]) {
+    bool dry_run = false;
+    unsigned thread_count = std::max(1u, std::thread::hardware_concurrency());
+    const char* path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-n") == 0) {
+            dry_run = true;
+        } else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            thread_count = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    DedupFs fs;
+    fs.fd = open(path, dry_run ? O_RDONLY : O_RDWR);
+    if (fs.fd < 0) {
+        perror("打开设备文件失败");
+        return 1;
+    }
+    if (probe_superblock(fs.fd, &fs.sb) != 0) {
+        std::cerr << "未找到SimpleFS超级块" << std::endl;
+        close(fs.fd);
+        return 1;
+    }
+    if (fs.sb.s_feature_incompat & ~SIMPLEFS_FEATURE_INCOMPAT_SUPPORTED) {
+        std::cerr << "文件系统包含不支持的特性: 0x" << std::hex << fs.sb.s_feature_incompat << std::dec << std::endl;
+        close(fs.fd);
+        return 1;
+    }
+    fs.block_size = device_block_size();
+    fs.num_groups = static_cast<uint32_t>(std::ceil((double)fs.sb.s_blocks_count / fs.sb.s_blocks_per_group));
+    fs.gdt_blocks = static_cast<uint32_t>(std::ceil((double)fs.num_groups * sizeof(SimpleFS_GroupDesc) / fs.block_size));
+    fs.inode_table_blocks = static_cast<uint32_t>(std::ceil((double)fs.sb.s_inodes_per_group * fs.sb.s_inode_size / fs.block_size));
+    std::vector<uint8_t> gdt_raw((size_t)fs.gdt_blocks * fs.block_size);
+    if (read_blocks(fs.fd, 2, fs.gdt_blocks, gdt_raw.data()) != 0) {
+        std::cerr << "读取组描述符表失败" << std::endl;
+        close(fs.fd);
+        return 1;
+    }
+    fs.gdt.resize(fs.num_groups);
+    std::memcpy(fs.gdt.data(), gdt_raw.data(), fs.num_groups * sizeof(SimpleFS_GroupDesc));
+    fs.block_bitmaps.resize((size_t)fs.num_groups * fs.block_size);
+    for (uint32_t grp = 0; grp < fs.num_groups; ++grp) {
+        if (read_block(fs.fd, fs.gdt[grp].bg_block_bitmap, fs.block_bitmaps.data() + (size_t)grp * fs.block_size) != 0) {
+            std::cerr << "组 " << grp << " 块位图读取失败" << std::endl;
+            close(fs.fd);
+            return 1;
+        }
+    }
+    fs.reflink = (fs.sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_REFLINK) != 0;
+    if (!fs.reflink && !dry_run) {
+        // 未启用reflink时inode 3是普通inode，无法存放引用计数表；-n仍可统计重复数据
+        std::cerr << "文件系统未启用reflink特性，请用mkfs.simplefs -O reflink格式化，或以-n只统计" << std::endl;
+        close(fs.fd);
+        return 1;
+    }
+    if ((fs.sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_SNAPSHOT) && fs.sb.s_snapshot_count > 0) {
+        // 快照存储也是普通inode，离线改写块指针会绕过写时复制，破坏快照内容
+        std::cerr << "文件系统中有 " << fs.sb.s_snapshot_count << " 个快照，请先删除快照再去重" << std::endl;
+        close(fs.fd);
+        return 1;
+    }
+    if (fs.reflink && load_refcount_table(fs) != 0) {
+        std::cerr << "读取引用计数表失败" << std::endl;
+        close(fs.fd);
+        return 1;
+    }
+
+    // 第一遍：统计每个数据块的块指针个数
+    auto scan_start = std::chrono::steady_clock::now();
+    std::unordered_map<uint32_t, BlockUse> block_uses;
+    auto count_slot = [&](uint32_t ptr) {
+        if (ptr == 0 || ptr == SIMPLEFS_BLOCK_COMPRESSED) return;
+        BlockUse& use = block_uses[ptr & SIMPLEFS_BLOCK_PTR_MASK];
+        use.slots++;
+        use.unwritten = use.unwritten || (ptr & SIMPLEFS_BLOCK_UNWRITTEN);
+    };
+    int res = walk_files(fs,
+        [&](uint32_t, const SimpleFS_Inode& inode) {
+            for (uint32_t i = 0; i < SIMPLEFS_NUM_DIRECT_BLOCKS; ++i) count_slot(inode.i_block[i]);
+            return 0;
+        },
+        [&](uint32_t, const std::vector<uint32_t>& content) {
+            for (uint32_t ptr : content) count_slot(ptr);
+            return 0;
+        });
+    if (res != 0) {
+        close(fs.fd);
+        return 1;
+    }
+
+    // 块指针个数与引用计数表不一致的块（例如也被目录等其他结构引用）不动
+    std::vector<uint32_t> candidates;
+    uint32_t inconsistent = 0;
+    for (const auto& entry : block_uses) {
+        auto it = fs.extra_refs.find(entry.first);
+        uint32_t expected_slots = 1 + (it == fs.extra_refs.end() ? 0 : it->second);
+        if (entry.first >= fs.sb.s_blocks_count || entry.second.slots != expected_slots) {
+            inconsistent++;
+            continue;
+        }
+        if (!entry.second.unwritten) candidates.push_back(entry.first);
+    }
+    if (inconsistent > 0) {
+        std::cout << "警告: " << inconsistent << " 个块的引用数与引用计数表不一致，已跳过" << std::endl;
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<BlockHash> hashes = hash_blocks(fs, candidates, thread_count);
+    auto hash_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - scan_start);
+    std::cout << "已扫描 " << candidates.size() << " 个数据块，" << thread_count << " 个线程，耗时 "
+              << hash_elapsed.count() << " ms" << std::endl;
+
+    // 哈希相同的块逐字节确认后映射到块号最小的那个
+    std::vector<size_t> order(candidates.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return hashes[a] == hashes[b] ? candidates[a] < candidates[b] : hashes[a] < hashes[b];
+    });
+    std::map<uint32_t, uint32_t> remap; // 重复块 -> 保留的块
+    std::vector<uint8_t> keep_data(fs.block_size), dup_data(fs.block_size);
+    uint32_t collisions = 0;
+    for (size_t i = 0; i < order.size();) {
+        size_t j = i + 1;
+        while (j < order.size() && hashes[order[j]] == hashes[order[i]]) j++;
+        if (j - i > 1) {
+            uint32_t keep = candidates[order[i]];
+            if (read_block(fs.fd, keep, keep_data.data()) == 0) {
+                for (size_t k = i + 1; k < j; ++k) {
+                    uint32_t dup = candidates[order[k]];
+                    if (read_block(fs.fd, dup, dup_data.data()) != 0) continue;
+                    if (std::memcmp(keep_data.data(), dup_data.data(), fs.block_size) != 0) {
+                        collisions++;
+                        continue;
+                    }
+                    remap[dup] = keep;
+                }
+            }
+        }
+        i = j;
+    }
+    if (collisions > 0) std::cout << "哈希冲突 " << collisions << " 次，相应的块未合并" << std::endl;
+    std::cout << "重复块: " << remap.size() << " 个，可回收 "
+              << static_cast<uint64_t>(remap.size()) * fs.block_size / 1024 << " KB" << std::endl;
+    if (dry_run || remap.empty()) {
+        close(fs.fd);
+        return 0;
+    }
+
+
+    // 第一步：保留的块先增加引用并落盘，此后崩溃最多泄漏块，不会释放仍被引用的块
+    const uint32_t per_table_block = fs.block_size / sizeof(uint32_t);
+    std::set<uint32_t> table_lbns;
+    for (const auto& entry : remap) {
+        fs.extra_refs[entry.second] += block_uses[entry.first].slots;
+        table_lbns.insert(entry.second / per_table_block);
+    }
+    if (write_refcount_table(fs, table_lbns) != 0 || write_allocation_state(fs) != 0) {
+        std::cerr << "引用计数表写入失败" << std::endl;
+        close(fs.fd);
+        return 1;
+    }
+
+    // 第二步：改写指向重复块的块指针
+    auto remap_slot = [&](uint32_t& ptr) {
+        if (ptr == 0 || (ptr & SIMPLEFS_BLOCK_UNWRITTEN)) return false;
+        auto it = remap.find(ptr);
+        if (it == remap.end()) return false;
+        ptr = it->second;
+        return true;
+    };
+    res = walk_files(fs,
+        [&](uint32_t ino, const SimpleFS_Inode& inode) {
+            SimpleFS_Inode updated = inode;
+            bool changed = false;
+            for (uint32_t i = 0; i < SIMPLEFS_NUM_DIRECT_BLOCKS; ++i) changed = remap_slot(updated.i_block[i]) || changed;
+            return changed ? write_inode(fs, ino, &updated) : 0;
+        },
+        [&](uint32_t block_num, const std::vector<uint32_t>& content) {
+            std::vector<uint32_t> updated = content;
+            bool changed = false;
+            for (uint32_t& ptr : updated) changed = remap_slot(ptr) || changed;
+            return changed ? write_block(fs.fd, block_num, updated.data()) : 0;
+        });
+    if (res != 0 || fsync(fs.fd) != 0) {
+        std::cerr << "改写块指针失败" << std::endl;
+        close(fs.fd);
+        return 1;
+    }
+
+    // 第三步：释放重复块，清除它们原有的额外引用
+    table_lbns.clear();
+    for (const auto& entry : remap) {
+        if (fs.extra_refs.erase(entry.first) > 0) table_lbns.insert(entry.first / per_table_block);
+        free_block(fs, entry.first);
+    }
+    if (write_refcount_table(fs, table_lbns) != 0 || write_allocation_state(fs) != 0) {
+        std::cerr << "释放重复块失败" << std::endl;
+        close(fs.fd);
+        return 1;
+    }
+
+    std::cout << "去重完成: 释放 " << remap.size() << " 个块 ("
+              << static_cast<uint64_t>(remap.size()) * fs.block_size / 1024 << " KB)，空闲块 "
+              << fs.sb.s_free_blocks_count << std::endl;
+    close(fs.fd);
+    return 0;
+}
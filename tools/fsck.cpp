@@ -1,12 +1,15 @@
 #include "simplefs.h"
 #include "disk_io.h"
 #include "utils.h"
+#include "checksum.h"
 #include <iostream>
 #include <vector>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <cstring>
 #include <cmath>
+#include <algorithm>
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
@@ -20,26 +23,25 @@ int main(int argc, char* argv[]) {
         return 1; 
     }
 
-    std::vector<uint8_t> buf(SIMPLEFS_BLOCK_SIZE);
-    if (read_block(fd, 1, buf.data()) != 0) { 
-        std::cerr << "读取超级块失败" << std::endl; 
-        close(fd); 
-        return 1; 
+    SimpleFS_SuperBlock sb;
+    if (probe_superblock(fd, &sb) != 0) {
+        std::cerr << "未找到SimpleFS超级块" << std::endl;
+        close(fd);
+        return 1;
     }
-    SimpleFS_SuperBlock sb; 
-    std::memcpy(&sb, buf.data(), sizeof(sb));
-    if (sb.s_magic != SIMPLEFS_MAGIC) {
-        std::cerr << "魔数不匹配，不是SimpleFS镜像" << std::endl; 
-        close(fd); 
-        return 1; 
+    const uint32_t block_size = device_block_size();
+    if (!is_valid_inode_size(sb.s_inode_size)) {
+        std::cerr << "inode大小无效: " << sb.s_inode_size << std::endl;
+        close(fd);
+        return 1;
     }
 
     uint32_t num_groups = static_cast<uint32_t>(std::ceil((double)sb.s_blocks_count / sb.s_blocks_per_group));
     uint32_t gdt_size = num_groups * sizeof(SimpleFS_GroupDesc);
-    uint32_t gdt_blocks = static_cast<uint32_t>(std::ceil((double)gdt_size / SIMPLEFS_BLOCK_SIZE));
-    std::vector<uint8_t> gdt_raw(gdt_blocks * SIMPLEFS_BLOCK_SIZE);
+    uint32_t gdt_blocks = static_cast<uint32_t>(std::ceil((double)gdt_size / block_size));
+    std::vector<uint8_t> gdt_raw(gdt_blocks * block_size);
     for (uint32_t i=0;i<gdt_blocks;++i){
-        if (read_block(fd, 2 + i, gdt_raw.data()+i*SIMPLEFS_BLOCK_SIZE)!=0){ 
+        if (read_block(fd, 2 + i, gdt_raw.data()+i*block_size)!=0){ 
             std::cerr<<"读取组描述符表失败"<<std::endl; 
             close(fd); 
             return 1; 
@@ -47,18 +49,50 @@ int main(int argc, char* argv[]) {
     }
     std::vector<SimpleFS_GroupDesc> gdt(num_groups);
     std::memcpy(gdt.data(), gdt_raw.data(), gdt_size);
+    const bool csum=has_metadata_csum(sb);
+    if(csum){
+        if(sb.s_checksum!=superblock_checksum(&sb))
+            std::cout<<"超级块校验和不匹配"<<std::endl;
+        for(uint32_t grp=0; grp<num_groups; ++grp)
+            if(gdt[grp].bg_checksum!=group_desc_checksum(grp,&gdt[grp]))
+                std::cout<<"组 "<<grp<<" 描述符校验和不匹配"<<std::endl;
+    }
+
+    // 读取所有块组的某类位图；flex_bg布局下相邻块组的位图连续，合并为一次读取
+    auto load_bitmaps=[&](uint32_t SimpleFS_GroupDesc::*field){
+        std::vector<uint8_t> all((size_t)num_groups*block_size);
+        for(uint32_t grp=0; grp<num_groups;){
+            uint32_t first=gdt[grp].*field, n=1;
+            while(grp+n<num_groups && gdt[grp+n].*field==first+n) n++;
+            if(read_blocks(fd, first, n, all.data()+(size_t)grp*block_size)!=0)
+                std::cout<<"组 "<<grp<<" 位图读取失败"<<std::endl;
+            grp+=n;
+        }
+        return all;
+    };
+    std::vector<uint8_t> all_bb=load_bitmaps(&SimpleFS_GroupDesc::bg_block_bitmap);
+    std::vector<uint8_t> all_ib=load_bitmaps(&SimpleFS_GroupDesc::bg_inode_bitmap);
 
     uint64_t calc_free_blocks=0, calc_free_inodes=0;
     for(uint32_t grp=0; grp<num_groups; ++grp){
         const auto& gd=gdt[grp];
-        std::vector<uint8_t> bb(SIMPLEFS_BLOCK_SIZE), ib(SIMPLEFS_BLOCK_SIZE);
-        read_block(fd, gd.bg_block_bitmap, bb.data());
-        read_block(fd, gd.bg_inode_bitmap, ib.data());
+        std::vector<uint8_t> bb(all_bb.begin()+(size_t)grp*block_size, all_bb.begin()+(size_t)(grp+1)*block_size);
+        std::vector<uint8_t> ib(all_ib.begin()+(size_t)grp*block_size, all_ib.begin()+(size_t)(grp+1)*block_size);
+        if(csum && bitmap_checksum(bb.data(),block_size)!=gd.bg_block_bitmap_csum)
+            std::cout<<"组 "<<grp<<" 块位图校验和不匹配"<<std::endl;
+        if(csum && bitmap_checksum(ib.data(),block_size)!=gd.bg_inode_bitmap_csum)
+            std::cout<<"组 "<<grp<<" inode位图校验和不匹配"<<std::endl;
         uint32_t freeb=0, freei=0;
         for(uint32_t b=0;b<sb.s_blocks_per_group && (grp*sb.s_blocks_per_group+b)<sb.s_blocks_count;++b)
             if(!is_bitmap_bit_set(bb,b)) freeb++;
         for(uint32_t i=0;i<sb.s_inodes_per_group;++i)
             if(!is_bitmap_bit_set(ib,i)) freei++;
+        // BLOCK_UNINIT组的已用块须是组首的连续前缀，挂载时据此跳过读取位图
+        if((gd.bg_flags & SIMPLEFS_BG_BLOCK_UNINIT) && freeb>0){
+            uint32_t group_bits=std::min(sb.s_blocks_per_group, sb.s_blocks_count-grp*sb.s_blocks_per_group);
+            if(find_next_clear_bit(bb,0,group_bits)!=group_bits-freeb)
+                std::cout<<"组 "<<grp<<" 标记为BLOCK_UNINIT但位图已用块不是连续前缀"<<std::endl;
+        }
         if(freeb!=gd.bg_free_blocks_count)
             std::cout<<"组 "<<grp<<" 块计数不匹配: 位图="<<freeb<<" 描述符="<<gd.bg_free_blocks_count<<std::endl;
         if(freei!=gd.bg_free_inodes_count)
@@ -66,11 +100,97 @@ int main(int argc, char* argv[]) {
         calc_free_blocks+=freeb;
         calc_free_inodes+=freei;
     }
+    // 各组的位图和inode表须在其所在块组的位图中标记为已用（flex_bg下可能位于其他块组）
+    auto check_meta_used=[&](uint32_t grp, uint32_t blk, uint32_t count, const char* what){
+        for(uint32_t b=blk;b<blk+count;++b){
+            uint32_t owner=b/sb.s_blocks_per_group;
+            if(owner>=num_groups || !is_bitmap_bit_set(all_bb,owner*block_size*8+b%sb.s_blocks_per_group)){
+                std::cout<<"组 "<<grp<<" 的"<<what<<"块 "<<b<<" 未在位图中标记"<<std::endl;
+                return;
+            }
+        }
+    };
+    uint32_t inode_table_blocks=(uint32_t)std::ceil((double)sb.s_inodes_per_group*sb.s_inode_size/block_size);
+    for(uint32_t grp=0; grp<num_groups; ++grp){
+        check_meta_used(grp, gdt[grp].bg_block_bitmap, 1, "块位图");
+        check_meta_used(grp, gdt[grp].bg_inode_bitmap, 1, "inode位图");
+        check_meta_used(grp, gdt[grp].bg_inode_table, inode_table_blocks, "inode表");
+    }
     if(calc_free_blocks!=sb.s_free_blocks_count)
         std::cout<<"超级块空闲块计数不匹配: "<<calc_free_blocks<<" vs "<<sb.s_free_blocks_count<<std::endl;
     if(calc_free_inodes!=sb.s_free_inodes_count)
         std::cout<<"超级块空闲inode计数不匹配: "<<calc_free_inodes<<" vs "<<sb.s_free_inodes_count<<std::endl;
 
+    // 已用inode及目录直接块的校验和
+    if(csum){
+        uint32_t bad_inodes=0, bad_dir_blocks=0;
+        std::vector<uint8_t> table((size_t)inode_table_blocks*block_size), dir_block(block_size);
+        for(uint32_t grp=0; grp<num_groups; ++grp){
+            if(read_blocks(fd, gdt[grp].bg_inode_table, inode_table_blocks, table.data())!=0){
+                std::cout<<"组 "<<grp<<" inode表读取失败"<<std::endl;
+                continue;
+            }
+            for(uint32_t idx=0; idx<sb.s_inodes_per_group; ++idx){
+                uint32_t ino=grp*sb.s_inodes_per_group+idx+1;
+                if(ino>sb.s_inodes_count || !is_bitmap_bit_set(all_ib,grp*block_size*8+idx)) continue;
+                const uint8_t* raw=table.data()+(size_t)idx*sb.s_inode_size;
+                if(!verify_inode_checksum(ino,raw,sb.s_inode_size)){
+                    if(bad_inodes++<10) std::cout<<"inode "<<ino<<" 校验和不匹配"<<std::endl;
+                    continue;
+                }
+                SimpleFS_Inode inode{};
+                std::memcpy(&inode,raw,sb.s_inode_size);
+                // 内联目录的目录项在inode内，已由inode校验和覆盖
+                if(!S_ISDIR(inode.i_mode) || (inode.i_flags & SIMPLEFS_INODE_FL_INLINE_DATA)) continue;
+                for(uint32_t i=0;i<SIMPLEFS_NUM_DIRECT_BLOCKS;++i){
+                    uint32_t blk=inode.i_block[i];
+                    if(blk==0 || blk>=sb.s_blocks_count || read_block(fd,blk,dir_block.data())!=0) continue;
+                    if(!verify_dir_block_checksum(blk,dir_block.data(),block_size) && bad_dir_blocks++<10)
+                        std::cout<<"目录inode "<<ino<<" 的块 "<<blk<<" 校验和不匹配"<<std::endl;
+                }
+            }
+        }
+        if(bad_inodes+bad_dir_blocks>0)
+            std::cout<<"校验和不匹配: inode "<<bad_inodes<<" 个，目录块 "<<bad_dir_blocks<<" 个"<<std::endl;
+    }
+
+    // 快照：列表中的每个存储inode都应是普通文件
+    if(sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_SNAPSHOT){
+        if(sb.s_snapshot_count>SIMPLEFS_MAX_SNAPSHOTS){
+            std::cout<<"快照数无效: "<<sb.s_snapshot_count<<std::endl;
+        }else{
+            for(uint32_t i=0;i<sb.s_snapshot_count;++i){
+                uint32_t ino=sb.s_snapshot_inodes[i];
+                SimpleFS_Inode inode;
+                bool valid=ino>SIMPLEFS_SNAPSHOT_DIR_INODE_NUM && ino<=sb.s_inodes_count;
+                if(valid){
+                    uint32_t grp=(ino-1)/sb.s_inodes_per_group, idx=(ino-1)%sb.s_inodes_per_group;
+                    uint64_t off=(uint64_t)gdt[grp].bg_inode_table*block_size+(uint64_t)idx*sb.s_inode_size;
+                    valid=pread(fd,&inode,SIMPLEFS_INODE_SIZE,off)==(ssize_t)SIMPLEFS_INODE_SIZE &&
+                          S_ISREG(inode.i_mode) && inode.i_links_count!=0;
+                }
+                if(!valid) std::cout<<"快照 "<<i<<" 的存储inode "<<ino<<" 无效"<<std::endl;
+            }
+            std::cout<<"快照数: "<<sb.s_snapshot_count<<std::endl;
+        }
+    }
+
+    // 孤儿链表：挂载后由后台线程回收，这里只报告
+    uint32_t orphan_count=0;
+    for(uint32_t ino=sb.s_last_orphan; ino!=0 && orphan_count<=sb.s_inodes_count; ++orphan_count){
+        if(ino>sb.s_inodes_count){
+            std::cout<<"孤儿链表包含无效inode号: "<<ino<<std::endl;
+            break;
+        }
+        uint32_t grp=(ino-1)/sb.s_inodes_per_group, idx=(ino-1)%sb.s_inodes_per_group;
+        uint64_t off=(uint64_t)gdt[grp].bg_inode_table*block_size+(uint64_t)idx*sb.s_inode_size;
+        SimpleFS_Inode inode;
+        if(pread(fd,&inode,SIMPLEFS_INODE_SIZE,off)!=(ssize_t)SIMPLEFS_INODE_SIZE) break;
+        ino=inode.i_dtime;
+    }
+    if(orphan_count>0)
+        std::cout<<"孤儿链表中有 "<<orphan_count<<" 个待回收inode，将在下次挂载时释放"<<std::endl;
+
     std::cout<<"fsck检查完成"<<std::endl;
     close(fd); 
     return 0;
@@ -1,6 +1,7 @@
 #include "simplefs.h"
 #include "disk_io.h"
 #include "utils.h"    // 位图操作工具函数
+#include "checksum.h" // 元数据校验和
 // 如果位图工具在utils.h中，mkfs.cpp就不再直接需要metadata.h了
 
 #include <iostream>
@@ -8,6 +9,8 @@
 #include <vector>
 #include <string>
 #include <cstring> // 字符串操作
+#include <cstdlib>  // strtoul
+#include <ctime>    // clock_gettime
 #include <sys/stat.h> // stat, fstat
 #include <fcntl.h>    // open
 #include <unistd.h>   // close, ftruncate
@@ -19,15 +22,48 @@
 #include <linux/fs.h>   // BLKGETSIZE64
 
 // 默认参数(可通过选项覆盖)
-const uint32_t DEFAULT_BLOCKS_PER_GROUP = SIMPLEFS_BLOCK_SIZE * 8; // 位图中每位对应一个块
 const uint32_t DEFAULT_INODES_PER_GROUP = 1024; // 选定的默认值
 
 // 静态位图辅助函数已移至metadata.cpp
 
 void print_usage(const char* prog_name) {
-    std::cerr << "用法: " << prog_name << " <设备文件> [块数量]" << std::endl;
+    std::cerr << "用法: " << prog_name << " [-b 块大小] [-G flex组大小] [-O 特性[,特性...]] [-I inode大小] [-C 压缩簇大小] <设备文件> [块数量]" << std::endl;
     std::cerr << "  <设备文件>: 磁盘镜像文件或块设备路径" << std::endl;
     std::cerr << "  [块数量]: 可选，新镜像文件的总块数" << std::endl;
+    std::cerr << "  -b: 块大小（字节），1024到65536之间的2的幂，默认4096" << std::endl;
+    std::cerr << "  -G: 每个flex组的块组数（2的幂，默认1），同一flex组的位图和inode表集中存放" << std::endl;
+    std::cerr << "  -O: 启用特性，可选: inline_data（小文件数据存放在inode中）、metadata_csum（元数据CRC32C校验和）、" << std::endl;
+    std::cerr << "      compression（透明压缩，由挂载选项-o compress或simplefsctl compress为文件启用）、" << std::endl;
+    std::cerr << "      reflink（文件克隆共享数据块，由simplefsctl clone使用）、" << std::endl;
+    std::cerr << "      snapshot（写时复制快照，由simplefsctl snapshot创建，经/.snapshots浏览）" << std::endl;
+    std::cerr << "  -I: inode大小，128（默认）、256或512；大inode保存纳秒时间戳和创建时间" << std::endl;
+    std::cerr << "  -C: 压缩簇大小（字节），2的幂，至少2个块，最大262144，默认65536" << std::endl;
+}
+
+// 解析-O的特性列表，写入不兼容特性位，遇到未知特性返回false
+static bool parse_feature_list(const std::string& list, uint32_t& feature_incompat) {
+    size_t start = 0;
+    while (start <= list.length()) {
+        size_t comma = list.find(',', start);
+        std::string name = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (name == "inline_data") {
+            feature_incompat |= SIMPLEFS_FEATURE_INCOMPAT_INLINE_DATA;
+        } else if (name == "metadata_csum") {
+            feature_incompat |= SIMPLEFS_FEATURE_INCOMPAT_METADATA_CSUM;
+        } else if (name == "compression") {
+            feature_incompat |= SIMPLEFS_FEATURE_INCOMPAT_COMPRESSION;
+        } else if (name == "reflink") {
+            feature_incompat |= SIMPLEFS_FEATURE_INCOMPAT_REFLINK;
+        } else if (name == "snapshot") {
+            feature_incompat |= SIMPLEFS_FEATURE_INCOMPAT_SNAPSHOT;
+        } else if (!name.empty()) {
+            std::cerr << "未知特性: " << name << std::endl;
+            return false;
+        }
+        if (comma == std::string::npos) break;
+        start = comma + 1;
+    }
+    return true;
 }
 
 // 获取文件大小的函数
@@ -42,6 +78,73 @@ off_t get_file_size(int fd) {
 
 
 int main(int argc, char* argv[]) {
+    // 先取出选项，剩下的位置参数按原有方式处理
+    uint32_t feature_incompat = 0;
+    uint32_t inode_size = SIMPLEFS_INODE_SIZE;
+    uint32_t block_size = SIMPLEFS_BLOCK_SIZE;
+    uint32_t groups_per_flex = 1;
+    uint32_t cluster_size = 0; // 0表示默认
+    std::vector<char*> positional_args = {argv[0]};
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-O") == 0) {
+            if (i + 1 >= argc || !parse_feature_list(argv[i + 1], feature_incompat)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            ++i;
+        } else if (std::strcmp(argv[i], "-b") == 0) {
+            if (i + 1 >= argc || !is_valid_block_size(std::strtoul(argv[i + 1], nullptr, 10))) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            block_size = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "-G") == 0) {
+            unsigned long requested_groups = (i + 1 < argc) ? std::strtoul(argv[i + 1], nullptr, 10) : 0;
+            if (requested_groups == 0 || requested_groups > SIMPLEFS_MAX_GROUPS_PER_FLEX ||
+                (requested_groups & (requested_groups - 1)) != 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            groups_per_flex = static_cast<uint32_t>(requested_groups);
+            ++i;
+        } else if (std::strcmp(argv[i], "-I") == 0) {
+            if (i + 1 >= argc || !is_valid_inode_size(std::strtoul(argv[i + 1], nullptr, 10))) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            inode_size = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "-C") == 0) {
+            unsigned long requested_cluster = (i + 1 < argc) ? std::strtoul(argv[i + 1], nullptr, 10) : 0;
+            if (requested_cluster == 0 || requested_cluster > SIMPLEFS_MAX_CLUSTER_SIZE ||
+                (requested_cluster & (requested_cluster - 1)) != 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            cluster_size = static_cast<uint32_t>(requested_cluster);
+            ++i;
+        } else {
+            positional_args.push_back(argv[i]);
+        }
+    }
+    argc = static_cast<int>(positional_args.size());
+    positional_args.push_back(nullptr);
+    argv = positional_args.data();
+
+    set_device_block_size(block_size);
+
+    // 压缩簇至少2个块，否则压缩不可能省下块
+    if (cluster_size != 0 && !(feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_COMPRESSION)) {
+        std::cerr << "-C 需要同时指定 -O compression" << std::endl;
+        return 1;
+    }
+    if (cluster_size == 0) {
+        cluster_size = std::max(SIMPLEFS_DEFAULT_CLUSTER_SIZE, 2 * block_size);
+    }
+    if (cluster_size < 2 * block_size || cluster_size > SIMPLEFS_MAX_CLUSTER_SIZE) {
+        std::cerr << "压缩簇大小必须在 " << 2 * block_size << " 到 " << SIMPLEFS_MAX_CLUSTER_SIZE << " 字节之间" << std::endl;
+        return 1;
+    }
+
     if (argc < 2 || argc > 3) {
         print_usage(argv[0]);
         return 1;
@@ -71,7 +174,7 @@ int main(int argc, char* argv[]) {
                     unlink(device_path.c_str()); // 清理已创建的文件
                     return 1;
                 }
-                device_size_bytes = total_blocks_on_device * SIMPLEFS_BLOCK_SIZE;
+                device_size_bytes = total_blocks_on_device * block_size;
                 if (ftruncate(fd, device_size_bytes) == -1) {
                     perror("设置镜像大小失败");
                     close(fd);
@@ -103,11 +206,11 @@ int main(int argc, char* argv[]) {
             uint64_t size_from_ioctl = 0;
             if (ioctl(fd, BLKGETSIZE64, &size_from_ioctl) == 0) {
                  std::cout << "通过ioctl获取块设备大小: " << size_from_ioctl << " 字节" << std::endl;
-                 if (size_from_ioctl % SIMPLEFS_BLOCK_SIZE != 0) {
+                 if (size_from_ioctl % block_size != 0) {
                       std::cerr << "警告: 块设备大小不是文件系统块大小的整数倍" << std::endl;
                  }
                  device_size_bytes = size_from_ioctl;
-                 total_blocks_on_device = device_size_bytes / SIMPLEFS_BLOCK_SIZE;
+                 total_blocks_on_device = device_size_bytes / block_size;
                  if (argc == 3) {
                      std::cout << "注意: 忽略[num_blocks]参数，已自动检测设备大小" << std::endl;
                  }
@@ -126,7 +229,7 @@ int main(int argc, char* argv[]) {
                         close(fd);
                         return 1;
                     }
-                    device_size_bytes = total_blocks_on_device * SIMPLEFS_BLOCK_SIZE;
+                    device_size_bytes = total_blocks_on_device * block_size;
                 } catch (const std::exception& e) {
                     std::cerr << "块数量参数无效: " << e.what() << std::endl;
                     close(fd);
@@ -154,7 +257,7 @@ int main(int argc, char* argv[]) {
                             close(fd);
                             return 1;
                         }
-                        device_size_bytes = total_blocks_on_device * SIMPLEFS_BLOCK_SIZE;
+                        device_size_bytes = total_blocks_on_device * block_size;
                         if (ftruncate(fd, device_size_bytes) == -1) {
                             perror("设置镜像大小失败");
                             close(fd);
@@ -174,12 +277,12 @@ int main(int argc, char* argv[]) {
                     return 1;
                 }
             } else {
-                 if (existing_size % SIMPLEFS_BLOCK_SIZE != 0) {
+                 if (existing_size % block_size != 0) {
                     std::cerr << "警告: 设备/镜像大小 (" << existing_size
-                              << " 字节) 不是块大小 (" << SIMPLEFS_BLOCK_SIZE << " 字节) 的整数倍" << std::endl;
+                              << " 字节) 不是块大小 (" << block_size << " 字节) 的整数倍" << std::endl;
                 }
                 device_size_bytes = existing_size;
-                total_blocks_on_device = device_size_bytes / SIMPLEFS_BLOCK_SIZE;
+                total_blocks_on_device = device_size_bytes / block_size;
                 std::cout << "Opened existing image " << device_path << ". Total blocks: " << total_blocks_on_device
                           << " (" << device_size_bytes << " bytes)." << std::endl;
                 if (argc == 3 && !create_new_image) {
@@ -196,13 +299,21 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    // 块指针最高位用作未写入标志，超出部分不使用
+    if (total_blocks_on_device > SIMPLEFS_MAX_BLOCKS_COUNT) {
+        std::cout << "警告: 设备超过 " << SIMPLEFS_MAX_BLOCKS_COUNT << " 个块，只使用前 "
+                  << SIMPLEFS_MAX_BLOCKS_COUNT << " 个块" << std::endl;
+        total_blocks_on_device = SIMPLEFS_MAX_BLOCKS_COUNT;
+    }
+
     std::cout << "正在格式化 " << device_path << " 为 SimpleFS..." << std::endl;
 
-    uint32_t inodes_per_block = SIMPLEFS_BLOCK_SIZE / SIMPLEFS_INODE_SIZE;
-    uint32_t sb_blocks_per_group = DEFAULT_BLOCKS_PER_GROUP;
+    uint32_t inodes_per_block = block_size / inode_size;
+    // 块位图占一个块，每位对应一个块；组内空闲块计数为16位，大块时每组块数受此限制
+    uint32_t sb_blocks_per_group = std::min(block_size * 8, SIMPLEFS_MAX_BLOCKS_PER_GROUP);
     uint32_t sb_inodes_per_group = DEFAULT_INODES_PER_GROUP;
-    if (sb_inodes_per_group > SIMPLEFS_BLOCK_SIZE * 8) {
-        sb_inodes_per_group = SIMPLEFS_BLOCK_SIZE * 8;
+    if (sb_inodes_per_group > block_size * 8) {
+        sb_inodes_per_group = block_size * 8;
         std::cout << "警告: 请求的每组inode数超过inode位图最大容量，调整为 "
                   << sb_inodes_per_group << std::endl;
     }
@@ -216,6 +327,7 @@ int main(int argc, char* argv[]) {
     }
 
     std::cout << "文件系统布局:" << std::endl;
+    std::cout << "  块大小: " << block_size << std::endl;
     std::cout << "  总块数: " << total_blocks_on_device << std::endl;
     std::cout << "  每组inode数: " << sb_inodes_per_group << std::endl;
     std::cout << "  块组数: " << num_block_groups << std::endl;
@@ -226,10 +338,10 @@ int main(int argc, char* argv[]) {
     sb.s_magic = SIMPLEFS_MAGIC;
     sb.s_blocks_count = total_blocks_on_device;
     sb.s_inodes_count = static_cast<uint32_t>(total_inodes_fs);
-    sb.s_log_block_size = static_cast<uint32_t>(std::log2(SIMPLEFS_BLOCK_SIZE)) - 10;
+    sb.s_log_block_size = static_cast<uint32_t>(std::log2(block_size)) - 10;
     sb.s_blocks_per_group = sb_blocks_per_group;
     sb.s_inodes_per_group = sb_inodes_per_group;
-    sb.s_inode_size = SIMPLEFS_INODE_SIZE;
+    sb.s_inode_size = inode_size;
     sb.s_root_inode = SIMPLEFS_ROOT_INODE_NUM;
     sb.s_first_ino = 11;
     sb.s_state = 1;
@@ -238,9 +350,14 @@ int main(int argc, char* argv[]) {
     sb.s_mnt_count = 0;
     sb.s_wtime = time(nullptr);
     sb.s_block_group_nr = 0;
+    sb.s_feature_incompat = feature_incompat;
+    if (feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_COMPRESSION) {
+        sb.s_log_cluster_blocks = static_cast<uint8_t>(__builtin_ctz(cluster_size / block_size));
+        std::cout << "  压缩簇大小: " << cluster_size << " 字节" << std::endl;
+    }
 
     uint32_t gdt_size_bytes = num_block_groups * sizeof(SimpleFS_GroupDesc);
-    uint32_t gdt_blocks = static_cast<uint32_t>(std::ceil(static_cast<double>(gdt_size_bytes) / SIMPLEFS_BLOCK_SIZE));
+    uint32_t gdt_blocks = static_cast<uint32_t>(std::ceil(static_cast<double>(gdt_size_bytes) / block_size));
     std::cout << "  GDT size: " << gdt_size_bytes << " bytes, requiring " << gdt_blocks << " blocks." << std::endl;
 
     uint32_t superblock_location_block = 1;
@@ -249,72 +366,80 @@ int main(int argc, char* argv[]) {
     std::vector<SimpleFS_GroupDesc> gdt(num_block_groups);
     std::memset(gdt.data(), 0, gdt_size_bytes);
 
-    uint32_t running_total_free_blocks = total_blocks_on_device;
+    uint32_t running_total_free_blocks = 0;
     uint32_t running_total_free_inodes = sb.s_inodes_count;
 
-    if (superblock_location_block < total_blocks_on_device) running_total_free_blocks--; else { std::cerr << "No space for SB!" << std::endl; return 1; }
-    for(uint32_t i = 0; i < gdt_blocks; ++i) {
-        if ((gdt_start_block + i) < total_blocks_on_device) running_total_free_blocks--; else { std::cerr << "No space for GDT!" << std::endl; return 1; }
+    if (gdt_start_block + gdt_blocks > total_blocks_on_device) { std::cerr << "No space for SB/GDT!" << std::endl; return 1; }
+
+    uint32_t inode_table_size_blocks = static_cast<uint32_t>(std::ceil(static_cast<double>(sb.s_inodes_per_group) * inode_size / block_size));
+    uint32_t meta_blocks_per_group = 2 + inode_table_size_blocks; // 块位图、inode位图、inode表
+
+    // 块组i管理的块数（最后一组可能不满）
+    auto group_block_count = [&](uint32_t group_idx) -> uint32_t {
+        uint64_t group_start = static_cast<uint64_t>(group_idx) * sb.s_blocks_per_group;
+        return static_cast<uint32_t>(std::min<uint64_t>(sb.s_blocks_per_group, total_blocks_on_device - group_start));
+    };
+    // flex组的元数据从其首个块组的超级块/GDT（或备份）之后开始存放
+    auto flex_meta_start_block = [&](uint32_t first_group_in_flex) -> uint32_t {
+        if (first_group_in_flex == 0) return gdt_start_block + gdt_blocks;
+        uint32_t group_start = first_group_in_flex * sb.s_blocks_per_group;
+        return is_backup_group(first_group_in_flex) ? group_start + 1 + gdt_blocks : group_start;
+    };
+
+    // 整个flex组的位图和inode表必须放在首个块组内，放不下时减小flex组大小
+    while (groups_per_flex > 1) {
+        bool fits = true;
+        for (uint32_t first = 0; first < num_block_groups && fits; first += groups_per_flex) {
+            uint32_t groups_in_flex = std::min(groups_per_flex, num_block_groups - first);
+            uint64_t meta_end = static_cast<uint64_t>(flex_meta_start_block(first)) +
+                                static_cast<uint64_t>(groups_in_flex) * meta_blocks_per_group;
+            fits = meta_end <= static_cast<uint64_t>(first) * sb.s_blocks_per_group + group_block_count(first);
+        }
+        if (fits) break;
+        groups_per_flex /= 2;
+        std::cout << "警告: flex组元数据超出块组容量，每个flex组的块组数调整为 " << groups_per_flex << std::endl;
     }
-
-    uint32_t current_group_meta_start_block = gdt_start_block + gdt_blocks;
+    sb.s_log_groups_per_flex = static_cast<uint8_t>(__builtin_ctz(groups_per_flex));
+    std::cout << "  每个flex组块组数: " << groups_per_flex << std::endl;
 
     for (uint32_t i = 0; i < num_block_groups; ++i) {
         SimpleFS_GroupDesc& current_gd = gdt[i];
-        uint32_t group_abs_start_block_for_data = i * sb.s_blocks_per_group;
-        uint32_t inode_table_size_blocks = static_cast<uint32_t>(std::ceil(static_cast<double>(sb.s_inodes_per_group) * SIMPLEFS_INODE_SIZE / SIMPLEFS_BLOCK_SIZE));
+        uint32_t first_group_in_flex = i - i % groups_per_flex;
+        uint32_t groups_in_flex = std::min(groups_per_flex, num_block_groups - first_group_in_flex);
+        uint32_t index_in_flex = i - first_group_in_flex;
+        uint32_t meta_start_block = flex_meta_start_block(first_group_in_flex);
 
-        bool backup_here = is_backup_group(i);
-
-        if (i == 0) {
-            current_gd.bg_block_bitmap = current_group_meta_start_block;
-            current_gd.bg_inode_bitmap = current_gd.bg_block_bitmap + 1;
-            current_gd.bg_inode_table  = current_gd.bg_inode_bitmap + 1;
-            sb.s_first_data_block = current_gd.bg_inode_table + inode_table_size_blocks;
-        } else if (backup_here) {
-            current_gd.bg_block_bitmap = group_abs_start_block_for_data + 1 + gdt_blocks;
-            current_gd.bg_inode_bitmap = current_gd.bg_block_bitmap + 1;
-            current_gd.bg_inode_table  = current_gd.bg_inode_bitmap + 1;
-        } else {
-            current_gd.bg_block_bitmap = group_abs_start_block_for_data;
-            current_gd.bg_inode_bitmap = current_gd.bg_block_bitmap + 1;
-            current_gd.bg_inode_table  = current_gd.bg_inode_bitmap + 1;
-        }
+        // 同一flex组的块位图、inode位图、inode表各自连续存放
+        current_gd.bg_block_bitmap = meta_start_block + index_in_flex;
+        current_gd.bg_inode_bitmap = meta_start_block + groups_in_flex + index_in_flex;
+        current_gd.bg_inode_table  = meta_start_block + 2 * groups_in_flex + index_in_flex * inode_table_size_blocks;
 
         uint32_t last_meta_block_for_group = current_gd.bg_inode_table + inode_table_size_blocks -1;
         if (last_meta_block_for_group >= total_blocks_on_device || current_gd.bg_block_bitmap >= total_blocks_on_device) {
              std::cerr << "错误: 组 " << i << " 的元数据超出设备限制" << std::endl; close(fd); if(create_new_image) unlink(device_path.c_str()); return 1;
         }
 
-        running_total_free_blocks--;  // 块位图
-        running_total_free_blocks--;  // inode位图
-        running_total_free_blocks -= inode_table_size_blocks;  // inode表
-        // 注意：主组（组0）的超级块和GDT已在前面减去，这里不重复减去
-        if (backup_here && i != 0) {  // 只有备份组且不是组0才减去
-            running_total_free_blocks--; // 备份超级块
-            running_total_free_blocks -= gdt_blocks;  // 备份GDT
-        }
-
-        uint32_t blocks_in_this_group_range = (i == num_block_groups - 1) ?
-                                     (total_blocks_on_device - group_abs_start_block_for_data) :
-                                     sb.s_blocks_per_group;
-
-        current_gd.bg_free_blocks_count = blocks_in_this_group_range;
-        current_gd.bg_free_blocks_count -= 1;  // 块位图
-        current_gd.bg_free_blocks_count -= 1;  // inode位图
-        current_gd.bg_free_blocks_count -= inode_table_size_blocks;  // inode表
+        // 组内已用块：块0/超级块/GDT（或备份），flex组首个块组还包含整个flex组的位图和inode表
+        uint32_t used_blocks_in_group = 0;
         if (i == 0) {
-            current_gd.bg_free_blocks_count--; // 超级块
-            current_gd.bg_free_blocks_count -= gdt_blocks;  // GDT
-        } else if (backup_here) {
-            current_gd.bg_free_blocks_count--; // 备份超级块
-            current_gd.bg_free_blocks_count -= gdt_blocks;  // 备份GDT
+            used_blocks_in_group += gdt_start_block + gdt_blocks;
+        } else if (is_backup_group(i)) {
+            used_blocks_in_group += 1 + gdt_blocks;
+        }
+        if (index_in_flex == 0) {
+            used_blocks_in_group += groups_in_flex * meta_blocks_per_group;
+        }
+        if (used_blocks_in_group > group_block_count(i)) {
+             std::cerr << "错误: 组 " << i << " 的元数据超出设备限制" << std::endl; close(fd); if(create_new_image) unlink(device_path.c_str()); return 1;
         }
+        current_gd.bg_free_blocks_count = group_block_count(i) - used_blocks_in_group;
+        running_total_free_blocks += current_gd.bg_free_blocks_count;
 
-        // 主要SB/GDT的额外空闲块调整已在前面完成
         current_gd.bg_free_inodes_count = sb.s_inodes_per_group;
         current_gd.bg_used_dirs_count = 0;
+        current_gd.bg_flags = SIMPLEFS_BG_BLOCK_UNINIT; // 已用块都在组首（根目录块也紧接其后分配）
     }
+    sb.s_first_data_block = flex_meta_start_block(0) + std::min(groups_per_flex, num_block_groups) * meta_blocks_per_group;
 
     sb.s_free_blocks_count = running_total_free_blocks;
     sb.s_free_inodes_count = running_total_free_inodes;
@@ -328,8 +453,29 @@ int main(int argc, char* argv[]) {
     std::cout << "  空闲块数: " << sb.s_free_blocks_count << std::endl;
     std::cout << "  空闲inode数: " << sb.s_free_inodes_count << std::endl;
     std::cout << "  首个数据块(全局): " << sb.s_first_data_block << std::endl;
+    std::cout << "  inode大小: " << sb.s_inode_size << std::endl;
+    if (sb.s_feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_INLINE_DATA) {
+        std::cout << "  特性: inline_data" << std::endl;
+    }
+    if (has_metadata_csum(sb)) {
+        std::cout << "  特性: metadata_csum (CRC32C: " << crc32c_implementation_name() << ")" << std::endl;
+    }
 
-    std::vector<uint8_t> fs_block_buffer(SIMPLEFS_BLOCK_SIZE, 0);
+    // 每次写出超级块和GDT前更新它们的校验和
+    auto update_sb_gdt_checksums = [&]() {
+        if (!has_metadata_csum(sb)) return;
+        for (uint32_t group_idx = 0; group_idx < num_block_groups; ++group_idx) {
+            gdt[group_idx].bg_checksum = group_desc_checksum(group_idx, &gdt[group_idx]);
+        }
+        sb.s_checksum = superblock_checksum(&sb);
+    };
+
+    std::vector<uint8_t> fs_block_buffer(block_size, 0);
+    // 清零块0：挂载时按块大小探测超级块，块0中可能残留以较小块大小格式化时的旧超级块
+    if (write_zero_blocks(fd, 0, 1) != 0) {
+        std::cerr << "块0清零失败" << std::endl; close(fd); if (create_new_image) unlink(device_path.c_str()); return 1;
+    }
+    update_sb_gdt_checksums();
     std::memcpy(fs_block_buffer.data(), &sb, sizeof(sb));
     if (write_block(fd, superblock_location_block, fs_block_buffer.data()) != 0) {
         std::cerr << "超级块写入失败" << std::endl; close(fd); if (create_new_image) unlink(device_path.c_str()); return 1;
@@ -339,94 +485,105 @@ int main(int argc, char* argv[]) {
     uint8_t* gdt_write_ptr = reinterpret_cast<uint8_t*>(gdt.data());
     for (uint32_t i = 0; i < gdt_blocks; ++i) {
         std::fill(fs_block_buffer.begin(), fs_block_buffer.end(), 0);
-        uint32_t bytes_to_copy_this_block = (gdt_size_bytes - (i * SIMPLEFS_BLOCK_SIZE) < SIMPLEFS_BLOCK_SIZE) ?
-                                            (gdt_size_bytes % SIMPLEFS_BLOCK_SIZE == 0 && gdt_size_bytes > 0 ? SIMPLEFS_BLOCK_SIZE : gdt_size_bytes % SIMPLEFS_BLOCK_SIZE)
-                                            : SIMPLEFS_BLOCK_SIZE;
+        uint32_t bytes_to_copy_this_block = (gdt_size_bytes - (i * block_size) < block_size) ?
+                                            (gdt_size_bytes % block_size == 0 && gdt_size_bytes > 0 ? block_size : gdt_size_bytes % block_size)
+                                            : block_size;
         if (gdt_size_bytes == 0 && i==0) bytes_to_copy_this_block = 0;
 
-        std::memcpy(fs_block_buffer.data(), gdt_write_ptr + (i * SIMPLEFS_BLOCK_SIZE), bytes_to_copy_this_block);
+        std::memcpy(fs_block_buffer.data(), gdt_write_ptr + (i * block_size), bytes_to_copy_this_block);
         if (write_block(fd, gdt_start_block + i, fs_block_buffer.data()) != 0) {
             std::cerr << "GDT块 " << (gdt_start_block + i) << " 写入失败" << std::endl; close(fd); if (create_new_image) unlink(device_path.c_str()); return 1;
         }
     }
     std::cout << "GDT已写入块 " << gdt_start_block << " 到 " << (gdt_start_block + gdt_blocks - 1) << std::endl;
 
-    std::vector<uint8_t> group_block_bitmap_buffer(SIMPLEFS_BLOCK_SIZE, 0);
-    std::vector<uint8_t> group_inode_bitmap_buffer(SIMPLEFS_BLOCK_SIZE, 0);
+    std::vector<uint8_t> group_block_bitmap_buffer(block_size, 0);
+    std::vector<uint8_t> group_inode_bitmap_buffer(block_size, 0);
 
-    for (uint32_t i = 0; i < num_block_groups; ++i) {
-        SimpleFS_GroupDesc& current_gd_ref = gdt[i];
-        uint32_t group_abs_data_start_block = i * sb.s_blocks_per_group; // 这是该组位图中位0的块号
-        uint32_t inode_table_size_blocks = static_cast<uint32_t>(std::ceil(static_cast<double>(sb.s_inodes_per_group) * SIMPLEFS_INODE_SIZE / SIMPLEFS_BLOCK_SIZE));
-
-        std::cout << "Processing Group " << i << ":" << std::endl;
-        std::cout << "  BB@" << current_gd_ref.bg_block_bitmap << ", IB@" << current_gd_ref.bg_inode_bitmap << ", IT@" << current_gd_ref.bg_inode_table << " (" << inode_table_size_blocks << " blocks)" << std::endl;
-
-        std::fill(group_block_bitmap_buffer.begin(), group_block_bitmap_buffer.end(), 0);
-        std::fill(group_inode_bitmap_buffer.begin(), group_inode_bitmap_buffer.end(), 0);
-
-        // 在其块位图中将组自己的元数据块标记为已使用
-        // 组位图中的位索引相对于该组管理的块起始位置
-        set_bitmap_bit(group_block_bitmap_buffer, current_gd_ref.bg_block_bitmap - group_abs_data_start_block);
-        set_bitmap_bit(group_block_bitmap_buffer, current_gd_ref.bg_inode_bitmap - group_abs_data_start_block);
-        for (uint32_t j = 0; j < inode_table_size_blocks; ++j) {
-            set_bitmap_bit(group_block_bitmap_buffer, (current_gd_ref.bg_inode_table + j) - group_abs_data_start_block);
-        }
+    // 按flex组写入：同一flex组的位图和inode表是连续的，各用一次大的顺序写完成
+    for (uint32_t first_group_in_flex = 0; first_group_in_flex < num_block_groups; first_group_in_flex += groups_per_flex) {
+        uint32_t groups_in_flex = std::min(groups_per_flex, num_block_groups - first_group_in_flex);
+        std::vector<uint8_t> flex_block_bitmaps(static_cast<size_t>(groups_in_flex) * block_size, 0);
+        std::vector<uint8_t> flex_inode_bitmaps(static_cast<size_t>(groups_in_flex) * block_size, 0);
 
-        bool backup_here = is_backup_group(i);
-        if (backup_here) {
-            uint32_t sb_blk = (i == 0) ? superblock_location_block : group_abs_data_start_block;
-            set_bitmap_bit(group_block_bitmap_buffer, sb_blk - group_abs_data_start_block);
-            for (uint32_t gdt_idx = 0; gdt_idx < gdt_blocks; ++gdt_idx) {
-                uint32_t abs_gdt_block = (i == 0) ? (gdt_start_block + gdt_idx)
-                                                 : (group_abs_data_start_block + 1 + gdt_idx);
-                set_bitmap_bit(group_block_bitmap_buffer, abs_gdt_block - group_abs_data_start_block);
-            }
+        for (uint32_t index_in_flex = 0; index_in_flex < groups_in_flex; ++index_in_flex) {
+            uint32_t i = first_group_in_flex + index_in_flex;
+            SimpleFS_GroupDesc& current_gd_ref = gdt[i];
+            uint32_t group_abs_data_start_block = i * sb.s_blocks_per_group; // 这是该组位图中位0的块号
 
+            std::cout << "Processing Group " << i << ":" << std::endl;
+            std::cout << "  BB@" << current_gd_ref.bg_block_bitmap << ", IB@" << current_gd_ref.bg_inode_bitmap << ", IT@" << current_gd_ref.bg_inode_table << " (" << inode_table_size_blocks << " blocks)" << std::endl;
 
-        }
-        if (i == 0) {
-            if (!is_bitmap_bit_set(group_block_bitmap_buffer, 0)) {
-                set_bitmap_bit(group_block_bitmap_buffer, 0);
-                bool block0_was_sb = (superblock_location_block == 0);
-                bool block0_was_gdt = false;
-                for(uint32_t gdt_idx=0; gdt_idx < gdt_blocks; ++gdt_idx) if((gdt_start_block + gdt_idx) == 0) block0_was_gdt = true;
-                bool block0_was_group0_bb = (current_gd_ref.bg_block_bitmap == 0);
-                bool block0_was_group0_ib = (current_gd_ref.bg_inode_bitmap == 0);
-                bool block0_was_group0_it = (current_gd_ref.bg_inode_table == 0);
-                if (!block0_was_sb && !block0_was_gdt && !block0_was_group0_bb && !block0_was_group0_ib && !block0_was_group0_it) {
-                    if (current_gd_ref.bg_free_blocks_count > 0) current_gd_ref.bg_free_blocks_count--;
-                    if (sb.s_free_blocks_count > 0) sb.s_free_blocks_count--;
+            std::fill(group_block_bitmap_buffer.begin(), group_block_bitmap_buffer.end(), 0);
+            std::fill(group_inode_bitmap_buffer.begin(), group_inode_bitmap_buffer.end(), 0);
+
+            // 组位图中的位索引相对于该组管理的块起始位置
+            if (i == 0) {
+                // 块0、超级块和GDT
+                for (uint32_t blk = 0; blk < gdt_start_block + gdt_blocks; ++blk) {
+                    set_bitmap_bit(group_block_bitmap_buffer, blk);
+                }
+            } else if (is_backup_group(i)) {
+                // 备份超级块和备份GDT
+                for (uint32_t blk = 0; blk < 1 + gdt_blocks; ++blk) {
+                    set_bitmap_bit(group_block_bitmap_buffer, blk);
                 }
             }
-            set_bitmap_bit(group_inode_bitmap_buffer, 0);
-            set_bitmap_bit(group_inode_bitmap_buffer, 1);
-            if (current_gd_ref.bg_free_inodes_count >= 2) current_gd_ref.bg_free_inodes_count -= 2; else current_gd_ref.bg_free_inodes_count = 0;
-            if (sb.s_free_inodes_count >= 2) sb.s_free_inodes_count -= 2; else sb.s_free_inodes_count = 0;
-        }
-
-        if (write_block(fd, current_gd_ref.bg_block_bitmap, group_block_bitmap_buffer.data()) != 0) { /* error */ return 1; }
-        std::cout << "    Written Block Bitmap. Group free blocks: " << current_gd_ref.bg_free_blocks_count << std::endl;
+            // 整个flex组的元数据都位于首个块组内
+            if (index_in_flex == 0) {
+                uint32_t meta_start_block = current_gd_ref.bg_block_bitmap;
+                for (uint32_t j = 0; j < groups_in_flex * meta_blocks_per_group; ++j) {
+                    set_bitmap_bit(group_block_bitmap_buffer, meta_start_block + j - group_abs_data_start_block);
+                }
+            }
+            if (i == 0) {
+                // inode 1、根inode，以及reflink的引用计数表inode和快照目录inode
+                uint32_t reserved_inodes = (feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_SNAPSHOT) ? 4 :
+                                           (feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_REFLINK) ? 3 : 2;
+                for (uint32_t bit = 0; bit < reserved_inodes; ++bit) {
+                    set_bitmap_bit(group_inode_bitmap_buffer, bit);
+                }
+                if (current_gd_ref.bg_free_inodes_count >= reserved_inodes) current_gd_ref.bg_free_inodes_count -= reserved_inodes; else current_gd_ref.bg_free_inodes_count = 0;
+                if (sb.s_free_inodes_count >= reserved_inodes) sb.s_free_inodes_count -= reserved_inodes; else sb.s_free_inodes_count = 0;
+            }
 
-        if (write_block(fd, current_gd_ref.bg_inode_bitmap, group_inode_bitmap_buffer.data()) != 0) { /* error */ return 1; }
-        std::cout << "    Written Inode Bitmap. Group free inodes: " << current_gd_ref.bg_free_inodes_count << std::endl;
+            if (has_metadata_csum(sb)) {
+                current_gd_ref.bg_block_bitmap_csum = bitmap_checksum(group_block_bitmap_buffer.data(), block_size);
+                current_gd_ref.bg_inode_bitmap_csum = bitmap_checksum(group_inode_bitmap_buffer.data(), block_size);
+            }
+            std::memcpy(flex_block_bitmaps.data() + static_cast<size_t>(index_in_flex) * block_size, group_block_bitmap_buffer.data(), block_size);
+            std::memcpy(flex_inode_bitmaps.data() + static_cast<size_t>(index_in_flex) * block_size, group_inode_bitmap_buffer.data(), block_size);
+            std::cout << "    Group free blocks: " << current_gd_ref.bg_free_blocks_count
+                      << ", free inodes: " << current_gd_ref.bg_free_inodes_count << std::endl;
+        }
 
-        if (write_zero_blocks(fd, current_gd_ref.bg_inode_table, inode_table_size_blocks) != 0) { /* error */ return 1; }
-        std::cout << "    Zeroed Inode Table." << std::endl;
+        const SimpleFS_GroupDesc& first_gd = gdt[first_group_in_flex];
+        if (write_blocks(fd, first_gd.bg_block_bitmap, groups_in_flex, flex_block_bitmaps.data()) != 0) {
+            std::cerr << "块位图写入失败" << std::endl; return 1;
+        }
+        if (write_blocks(fd, first_gd.bg_inode_bitmap, groups_in_flex, flex_inode_bitmaps.data()) != 0) {
+            std::cerr << "inode位图写入失败" << std::endl; return 1;
+        }
+        if (write_zero_blocks(fd, first_gd.bg_inode_table, groups_in_flex * inode_table_size_blocks) != 0) {
+            std::cerr << "inode表清零失败" << std::endl; return 1;
+        }
+        std::cout << "    Written bitmaps and zeroed inode tables for groups " << first_group_in_flex << "-"
+                  << (first_group_in_flex + groups_in_flex - 1) << std::endl;
     }
 
     std::cout << "Re-writing Superblock and GDT (final pre-root dir)..." << std::endl;
+    update_sb_gdt_checksums();
     std::memcpy(fs_block_buffer.data(), &sb, sizeof(sb));
     if (write_block(fd, superblock_location_block, fs_block_buffer.data()) != 0) { /* error */ return 1;}
 
     gdt_write_ptr = reinterpret_cast<uint8_t*>(gdt.data());
     for (uint32_t i = 0; i < gdt_blocks; ++i) {
         std::fill(fs_block_buffer.begin(), fs_block_buffer.end(), 0);
-        uint32_t bytes_to_copy_this_block = (gdt_size_bytes - (i * SIMPLEFS_BLOCK_SIZE) < SIMPLEFS_BLOCK_SIZE) ?
-                                            (gdt_size_bytes % SIMPLEFS_BLOCK_SIZE == 0 && gdt_size_bytes > 0 ? SIMPLEFS_BLOCK_SIZE : gdt_size_bytes % SIMPLEFS_BLOCK_SIZE)
-                                            : SIMPLEFS_BLOCK_SIZE;
+        uint32_t bytes_to_copy_this_block = (gdt_size_bytes - (i * block_size) < block_size) ?
+                                            (gdt_size_bytes % block_size == 0 && gdt_size_bytes > 0 ? block_size : gdt_size_bytes % block_size)
+                                            : block_size;
         if (gdt_size_bytes == 0 && i==0) bytes_to_copy_this_block = 0;
-        std::memcpy(fs_block_buffer.data(), gdt_write_ptr + (i * SIMPLEFS_BLOCK_SIZE), bytes_to_copy_this_block);
+        std::memcpy(fs_block_buffer.data(), gdt_write_ptr + (i * block_size), bytes_to_copy_this_block);
         if (write_block(fd, gdt_start_block + i, fs_block_buffer.data()) != 0) { /* error */ return 1; }
     }
 
@@ -438,11 +595,11 @@ int main(int argc, char* argv[]) {
         if (write_block(fd, grp_start, fs_block_buffer.data()) != 0) { /* error */ return 1; }
         for (uint32_t i = 0; i < gdt_blocks; ++i) {
             std::fill(fs_block_buffer.begin(), fs_block_buffer.end(), 0);
-            uint32_t bytes_to_copy_this_block = (gdt_size_bytes - (i * SIMPLEFS_BLOCK_SIZE) < SIMPLEFS_BLOCK_SIZE) ?
-                                                (gdt_size_bytes % SIMPLEFS_BLOCK_SIZE == 0 && gdt_size_bytes > 0 ? SIMPLEFS_BLOCK_SIZE : gdt_size_bytes % SIMPLEFS_BLOCK_SIZE)
-                                                : SIMPLEFS_BLOCK_SIZE;
+            uint32_t bytes_to_copy_this_block = (gdt_size_bytes - (i * block_size) < block_size) ?
+                                                (gdt_size_bytes % block_size == 0 && gdt_size_bytes > 0 ? block_size : gdt_size_bytes % block_size)
+                                                : block_size;
             if (gdt_size_bytes == 0 && i==0) bytes_to_copy_this_block = 0;
-            std::memcpy(fs_block_buffer.data(), gdt_write_ptr + (i * SIMPLEFS_BLOCK_SIZE), bytes_to_copy_this_block);
+            std::memcpy(fs_block_buffer.data(), gdt_write_ptr + (i * block_size), bytes_to_copy_this_block);
             if (write_block(fd, grp_start + 1 + i, fs_block_buffer.data()) != 0) { /* error */ return 1; }
         }
     }
@@ -477,7 +634,7 @@ int main(int argc, char* argv[]) {
     if (sb.s_first_data_block >= group0_abs_start_block && sb.s_first_data_block < (group0_abs_start_block + sb.s_blocks_per_group) ) {
         search_start_offset_in_group0 = sb.s_first_data_block - group0_abs_start_block;
     } else if (sb.s_first_data_block < group0_abs_start_block) {
-         search_start_offset_in_group0 = (gdt[0].bg_inode_table + static_cast<uint32_t>(std::ceil(static_cast<double>(sb.s_inodes_per_group) * SIMPLEFS_INODE_SIZE / SIMPLEFS_BLOCK_SIZE))) - group0_abs_start_block;
+         search_start_offset_in_group0 = (gdt[0].bg_inode_table + static_cast<uint32_t>(std::ceil(static_cast<double>(sb.s_inodes_per_group) * inode_size / block_size))) - group0_abs_start_block;
     }
 
     for (uint32_t block_offset_in_group = search_start_offset_in_group0;
@@ -497,27 +654,35 @@ int main(int argc, char* argv[]) {
     if (write_block(fd, group0_gd.bg_block_bitmap, group_block_bitmap_buffer.data()) != 0) {
         std::cerr << "组0块位图更新失败" << std::endl; return 1;
     }
+    if (has_metadata_csum(sb)) {
+        group0_gd.bg_block_bitmap_csum = bitmap_checksum(group_block_bitmap_buffer.data(), block_size);
+    }
     std::cout << "  已为根目录分配数据块 " << root_dir_data_block_num << std::endl;
 
-    std::vector<uint8_t> root_dir_data_buffer(SIMPLEFS_BLOCK_SIZE, 0);
-    uint16_t current_offset = 0;
+    std::vector<uint8_t> root_dir_data_buffer(block_size, 0);
+    uint32_t current_offset = 0;
 
     SimpleFS_DirEntry dot_entry;
     dot_entry.inode = SIMPLEFS_ROOT_INODE_NUM;
     dot_entry.name_len = 1;
     dot_entry.file_type = S_IFDIR >> 12;
     std::strncpy(dot_entry.name, ".", 1);
-    dot_entry.rec_len = calculate_dir_entry_len(dot_entry.name_len);
+    set_dir_entry_rec_len(&dot_entry, calculate_dir_entry_len(dot_entry.name_len));
     std::memcpy(root_dir_data_buffer.data() + current_offset, &dot_entry, (size_t)8 + dot_entry.name_len);
-    current_offset += dot_entry.rec_len;
+    current_offset += dir_entry_rec_len(&dot_entry);
 
     SimpleFS_DirEntry dotdot_entry;
     dotdot_entry.inode = SIMPLEFS_ROOT_INODE_NUM;
     dotdot_entry.name_len = 2;
     dotdot_entry.file_type = S_IFDIR >> 12;
     std::strncpy(dotdot_entry.name, "..", 2);
-    dotdot_entry.rec_len = SIMPLEFS_BLOCK_SIZE - current_offset;
+    // 启用元数据校验和时目录项链止于块尾部之前
+    uint32_t dir_entries_end = has_metadata_csum(sb) ? block_size - sizeof(SimpleFS_DirEntryTail) : block_size;
+    set_dir_entry_rec_len(&dotdot_entry, dir_entries_end - current_offset);
     std::memcpy(root_dir_data_buffer.data() + current_offset, &dotdot_entry, (size_t)8 + dotdot_entry.name_len);
+    if (has_metadata_csum(sb)) {
+        set_dir_block_checksum(root_dir_data_block_num, root_dir_data_buffer.data(), block_size);
+    }
 
     if (write_block(fd, root_dir_data_block_num, root_dir_data_buffer.data()) != 0) {
         std::cerr << "根目录数据块写入失败" << std::endl; return 1;
@@ -529,39 +694,104 @@ int main(int argc, char* argv[]) {
     root_inode.i_mode = S_IFDIR | 0777; // 从0755改为0777便于测试
     root_inode.i_uid = 0;
     root_inode.i_gid = 0;
-    root_inode.i_size = SIMPLEFS_BLOCK_SIZE;
+    root_inode.i_size = block_size;
     root_inode.i_links_count = 2;
-    root_inode.i_blocks = SIMPLEFS_BLOCK_SIZE / 512;
-    root_inode.i_atime = root_inode.i_ctime = root_inode.i_mtime = time(nullptr);
+    root_inode.i_blocks = block_size / 512;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    root_inode.i_atime = root_inode.i_ctime = root_inode.i_mtime = root_inode.i_crtime = now.tv_sec;
+    root_inode.i_atime_nsec = root_inode.i_ctime_nsec = root_inode.i_mtime_nsec = root_inode.i_crtime_nsec = now.tv_nsec;
+    if (inode_size > SIMPLEFS_INODE_SIZE) {
+        root_inode.i_extra_isize = SIMPLEFS_INODE_EXTRA_ISIZE;
+    }
     root_inode.i_block[0] = root_dir_data_block_num;
+    if (has_metadata_csum(sb)) {
+        root_inode.i_checksum = inode_checksum(SIMPLEFS_ROOT_INODE_NUM, &root_inode, inode_size);
+    }
 
     // 基于1的inode编号的修正计算
     uint32_t root_inode_idx_in_group = SIMPLEFS_ROOT_INODE_NUM - 1; 
     uint32_t root_inode_block_in_table = group0_gd.bg_inode_table + (root_inode_idx_in_group / inodes_per_block);
-    uint32_t root_inode_offset_in_block = (root_inode_idx_in_group % inodes_per_block) * SIMPLEFS_INODE_SIZE;
+    uint32_t root_inode_offset_in_block = (root_inode_idx_in_group % inodes_per_block) * inode_size;
 
-    std::vector<uint8_t> inode_table_block_buffer(SIMPLEFS_BLOCK_SIZE);
+    std::vector<uint8_t> inode_table_block_buffer(block_size);
     if (read_block(fd, root_inode_block_in_table, inode_table_block_buffer.data()) != 0) {
         std::cerr << "根inode的inode表块读取失败" << std::endl; return 1;
     }
-    std::memcpy(inode_table_block_buffer.data() + root_inode_offset_in_block, &root_inode, sizeof(SimpleFS_Inode));
+    std::memcpy(inode_table_block_buffer.data() + root_inode_offset_in_block, &root_inode, inode_size);
     if (write_block(fd, root_inode_block_in_table, inode_table_block_buffer.data()) != 0) {
         std::cerr << "根inode写入inode表失败" << std::endl; return 1;
     }
     std::cout << "  Initialized and written root inode (inode " << SIMPLEFS_ROOT_INODE_NUM << ")." << std::endl;
 
+    if (feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_REFLINK) {
+        // 引用计数表：初始为空的普通文件，共享块出现时按需分配
+        SimpleFS_Inode refcount_inode;
+        std::memset(&refcount_inode, 0, sizeof(SimpleFS_Inode));
+        refcount_inode.i_mode = S_IFREG | 0600;
+        refcount_inode.i_links_count = 1;
+        refcount_inode.i_atime = refcount_inode.i_ctime = refcount_inode.i_mtime = refcount_inode.i_crtime = now.tv_sec;
+        refcount_inode.i_atime_nsec = refcount_inode.i_ctime_nsec = refcount_inode.i_mtime_nsec = refcount_inode.i_crtime_nsec = now.tv_nsec;
+        if (inode_size > SIMPLEFS_INODE_SIZE) {
+            refcount_inode.i_extra_isize = SIMPLEFS_INODE_EXTRA_ISIZE;
+        }
+        if (has_metadata_csum(sb)) {
+            refcount_inode.i_checksum = inode_checksum(SIMPLEFS_REFCOUNT_INODE_NUM, &refcount_inode, inode_size);
+        }
+        uint32_t refcount_inode_idx_in_group = SIMPLEFS_REFCOUNT_INODE_NUM - 1;
+        uint32_t refcount_inode_block_in_table = group0_gd.bg_inode_table + (refcount_inode_idx_in_group / inodes_per_block);
+        uint32_t refcount_inode_offset_in_block = (refcount_inode_idx_in_group % inodes_per_block) * inode_size;
+        if (read_block(fd, refcount_inode_block_in_table, inode_table_block_buffer.data()) != 0) {
+            std::cerr << "引用计数表inode的inode表块读取失败" << std::endl; return 1;
+        }
+        std::memcpy(inode_table_block_buffer.data() + refcount_inode_offset_in_block, &refcount_inode, inode_size);
+        if (write_block(fd, refcount_inode_block_in_table, inode_table_block_buffer.data()) != 0) {
+            std::cerr << "引用计数表inode写入inode表失败" << std::endl; return 1;
+        }
+        std::cout << "  已初始化引用计数表inode " << SIMPLEFS_REFCOUNT_INODE_NUM << std::endl;
+    }
+
+    if (feature_incompat & SIMPLEFS_FEATURE_INCOMPAT_SNAPSHOT) {
+        // 快照目录：每个快照一项，指向保存快照副本的inode；初始为空，不含"."和".."
+        SimpleFS_Inode snapshot_dir_inode;
+        std::memset(&snapshot_dir_inode, 0, sizeof(SimpleFS_Inode));
+        snapshot_dir_inode.i_mode = S_IFDIR | 0555;
+        snapshot_dir_inode.i_links_count = 2;
+        snapshot_dir_inode.i_atime = snapshot_dir_inode.i_ctime = snapshot_dir_inode.i_mtime = snapshot_dir_inode.i_crtime = now.tv_sec;
+        snapshot_dir_inode.i_atime_nsec = snapshot_dir_inode.i_ctime_nsec = snapshot_dir_inode.i_mtime_nsec = snapshot_dir_inode.i_crtime_nsec = now.tv_nsec;
+        if (inode_size > SIMPLEFS_INODE_SIZE) {
+            snapshot_dir_inode.i_extra_isize = SIMPLEFS_INODE_EXTRA_ISIZE;
+        }
+        if (has_metadata_csum(sb)) {
+            snapshot_dir_inode.i_checksum = inode_checksum(SIMPLEFS_SNAPSHOT_DIR_INODE_NUM, &snapshot_dir_inode, inode_size);
+        }
+        uint32_t snapshot_dir_inode_idx_in_group = SIMPLEFS_SNAPSHOT_DIR_INODE_NUM - 1;
+        uint32_t snapshot_dir_inode_block_in_table = group0_gd.bg_inode_table + (snapshot_dir_inode_idx_in_group / inodes_per_block);
+        uint32_t snapshot_dir_inode_offset_in_block = (snapshot_dir_inode_idx_in_group % inodes_per_block) * inode_size;
+        if (read_block(fd, snapshot_dir_inode_block_in_table, inode_table_block_buffer.data()) != 0) {
+            std::cerr << "快照目录inode的inode表块读取失败" << std::endl; return 1;
+        }
+        std::memcpy(inode_table_block_buffer.data() + snapshot_dir_inode_offset_in_block, &snapshot_dir_inode, inode_size);
+        if (write_block(fd, snapshot_dir_inode_block_in_table, inode_table_block_buffer.data()) != 0) {
+            std::cerr << "快照目录inode写入inode表失败" << std::endl; return 1;
+        }
+        group0_gd.bg_used_dirs_count++;
+        std::cout << "  已初始化快照目录inode " << SIMPLEFS_SNAPSHOT_DIR_INODE_NUM << std::endl;
+    }
+
     std::cout << "Finalizing Superblock and GDT..." << std::endl;
+    update_sb_gdt_checksums();
     std::memcpy(fs_block_buffer.data(), &sb, sizeof(sb));
     if (write_block(fd, superblock_location_block, fs_block_buffer.data()) != 0) { /* error */ return 1;}
 
     gdt_write_ptr = reinterpret_cast<uint8_t*>(gdt.data());
     for (uint32_t i = 0; i < gdt_blocks; ++i) {
         std::fill(fs_block_buffer.begin(), fs_block_buffer.end(), 0);
-        uint32_t bytes_to_copy_this_block = (gdt_size_bytes - (i * SIMPLEFS_BLOCK_SIZE) < SIMPLEFS_BLOCK_SIZE) ?
-                                            (gdt_size_bytes % SIMPLEFS_BLOCK_SIZE == 0 && gdt_size_bytes > 0 ? SIMPLEFS_BLOCK_SIZE : gdt_size_bytes % SIMPLEFS_BLOCK_SIZE)
-                                            : SIMPLEFS_BLOCK_SIZE;
+        uint32_t bytes_to_copy_this_block = (gdt_size_bytes - (i * block_size) < block_size) ?
+                                            (gdt_size_bytes % block_size == 0 && gdt_size_bytes > 0 ? block_size : gdt_size_bytes % block_size)
+                                            : block_size;
         if (gdt_size_bytes == 0 && i==0) bytes_to_copy_this_block = 0;
-        std::memcpy(fs_block_buffer.data(), gdt_write_ptr + (i * SIMPLEFS_BLOCK_SIZE), bytes_to_copy_this_block);
+        std::memcpy(fs_block_buffer.data(), gdt_write_ptr + (i * block_size), bytes_to_copy_this_block);
         if (write_block(fd, gdt_start_block + i, fs_block_buffer.data()) != 0) { /* error */ return 1; }
     }
     std::cout << "超级块和GDT已完成" << std::endl;
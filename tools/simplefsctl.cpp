@@ -0,0 +1,384 @@
+#include "simplefs_ioctl.h"
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <ftw.h>
+#include <linux/fs.h> // FITRIM
+
+static void print_usage(const char* prog) {
+    std::cerr << "用法: " << prog << " seek <文件> <data|hole> <偏移>" << std::endl;
+    std::cerr << "      " << prog << " copy <源文件> <目标文件> [源偏移 目标偏移 长度]" << std::endl;
+    std::cerr << "      " << prog << " clone <源文件> <目标文件> [源偏移 目标偏移 长度]" << std::endl;
+    std::cerr << "      " << prog << " rename [--noreplace|--exchange] <源路径> <目标路径>" << std::endl;
+    std::cerr << "      " << prog << " compress <文件或目录> [on|off]" << std::endl;
+    std::cerr << "      " << prog << " snapshot <create|delete> <挂载点> <快照名>" << std::endl;
+    std::cerr << "      " << prog << " defrag [-n] [-r 限速KB/s] <文件或目录>..." << std::endl;
+    std::cerr << "      " << prog << " trim [-m 最短空闲段KB] <挂载点>" << std::endl;
+}
+
+// 查找文件所在的挂载点根目录：沿父目录向上，直到设备号改变
+static bool find_mount_root(const std::string& abs_path, std::string& mount_root) {
+    struct stat st;
+    if (stat(abs_path.c_str(), &st) != 0) return false;
+    dev_t dev = st.st_dev;
+    std::string current = abs_path;
+    while (current != "/") {
+        size_t slash = current.find_last_of('/');
+        std::string parent = (slash == 0) ? "/" : current.substr(0, slash);
+        struct stat parent_st;
+        if (stat(parent.c_str(), &parent_st) != 0 || parent_st.st_dev != dev) break;
+        current = parent;
+    }
+    mount_root = current;
+    return true;
+}
+
+static int do_seek(int argc, char* argv[]) {
+    if (argc != 5) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    SimpleFS_SeekArgs args{};
+    if (std::strcmp(argv[3], "data") == 0) {
+        args.whence = SEEK_DATA;
+    } else if (std::strcmp(argv[3], "hole") == 0) {
+        args.whence = SEEK_HOLE;
+    } else {
+        print_usage(argv[0]);
+        return 1;
+    }
+    args.offset = std::strtoull(argv[4], nullptr, 0);
+
+    int fd = open(argv[2], O_RDONLY);
+    if (fd < 0) {
+        perror("打开文件失败");
+        return 1;
+    }
+    if (ioctl(fd, SIMPLEFS_IOC_SEEK, &args) != 0) {
+        if (errno == ENXIO) {
+            std::cout << "ENXIO" << std::endl;
+        } else {
+            perror("SIMPLEFS_IOC_SEEK失败");
+        }
+        close(fd);
+        return 1;
+    }
+    std::cout << args.offset << std::endl;
+    close(fd);
+    return 0;
+}
+
+// copy和clone共用：clone使用SIMPLEFS_IOC_CLONE_RANGE，与源文件共享数据块
+static int do_copy(int argc, char* argv[], bool clone) {
+    if (argc != 4 && argc != 7) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    char src_real[PATH_MAX];
+    if (!realpath(argv[2], src_real)) {
+        perror("解析源文件路径失败");
+        return 1;
+    }
+    std::string mount_root;
+    if (!find_mount_root(src_real, mount_root)) {
+        perror("查找挂载点失败");
+        return 1;
+    }
+
+    SimpleFS_CopyRangeArgs args{};
+    std::string src_in_fs = (mount_root == "/") ? std::string(src_real) : std::string(src_real).substr(mount_root.length());
+    if (src_in_fs.empty()) src_in_fs = "/";
+    if (src_in_fs.length() >= SIMPLEFS_IOC_PATH_MAX) {
+        std::cerr << "源文件路径过长" << std::endl;
+        return 1;
+    }
+    std::strncpy(args.src_path, src_in_fs.c_str(), SIMPLEFS_IOC_PATH_MAX - 1);
+    if (argc == 7) {
+        args.src_offset = std::strtoull(argv[4], nullptr, 0);
+        args.dst_offset = std::strtoull(argv[5], nullptr, 0);
+        args.length = std::strtoull(argv[6], nullptr, 0);
+    } else {
+        args.length = UINT64_MAX; // 复制到源文件末尾
+    }
+
+    int fd = open(argv[3], O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("打开目标文件失败");
+        return 1;
+    }
+    // 源和目标必须位于同一文件系统
+    struct stat src_st, dst_st;
+    if (stat(src_real, &src_st) != 0 || fstat(fd, &dst_st) != 0 || src_st.st_dev != dst_st.st_dev) {
+        std::cerr << "源文件和目标文件不在同一个SimpleFS挂载点" << std::endl;
+        close(fd);
+        return 1;
+    }
+    if (ioctl(fd, clone ? SIMPLEFS_IOC_CLONE_RANGE : SIMPLEFS_IOC_COPY_RANGE, &args) != 0) {
+        perror(clone ? "SIMPLEFS_IOC_CLONE_RANGE失败" : "SIMPLEFS_IOC_COPY_RANGE失败");
+        close(fd);
+        return 1;
+    }
+    std::cout << (clone ? "已克隆 " : "已复制 ") << args.bytes_copied << " 字节" << std::endl;
+    close(fd);
+    return 0;
+}
+
+// 将路径转换为挂载点内的绝对路径，最后一级不跟随符号链接（目标可以不存在）
+static bool path_in_mount(const char* path, std::string& mount_root, std::string& path_in_fs) {
+    std::string path_str(path);
+    while (path_str.length() > 1 && path_str.back() == '/') path_str.pop_back();
+    size_t slash = path_str.find_last_of('/');
+    std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path_str.substr(0, slash));
+    std::string base = (slash == std::string::npos) ? path_str : path_str.substr(slash + 1);
+    char dir_real[PATH_MAX];
+    if (!realpath(dir.c_str(), dir_real) || !find_mount_root(dir_real, mount_root)) {
+        return false;
+    }
+    std::string dir_in_fs = (mount_root == "/") ? std::string(dir_real) : std::string(dir_real).substr(mount_root.length());
+    if (dir_in_fs.empty() || dir_in_fs.back() != '/') dir_in_fs += '/';
+    path_in_fs = dir_in_fs + base;
+    return path_in_fs.length() < SIMPLEFS_IOC_PATH_MAX;
+}
+
+static int do_rename(int argc, char* argv[]) {
+    SimpleFS_RenameArgs args{};
+    int arg_idx = 2;
+    if (argc == 5 && std::strcmp(argv[2], "--noreplace") == 0) {
+        args.flags = SIMPLEFS_RENAME_NOREPLACE;
+        arg_idx++;
+    } else if (argc == 5 && std::strcmp(argv[2], "--exchange") == 0) {
+        args.flags = SIMPLEFS_RENAME_EXCHANGE;
+        arg_idx++;
+    } else if (argc != 4) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::string src_root, dst_root, src_in_fs, dst_in_fs;
+    if (!path_in_mount(argv[arg_idx], src_root, src_in_fs) || !path_in_mount(argv[arg_idx + 1], dst_root, dst_in_fs)) {
+        perror("解析路径失败");
+        return 1;
+    }
+    if (src_root != dst_root) {
+        std::cerr << "源和目标不在同一个SimpleFS挂载点" << std::endl;
+        return 1;
+    }
+    std::strncpy(args.src_path, src_in_fs.c_str(), SIMPLEFS_IOC_PATH_MAX - 1);
+    std::strncpy(args.dst_path, dst_in_fs.c_str(), SIMPLEFS_IOC_PATH_MAX - 1);
+
+    // ioctl作用于挂载点根目录
+    int fd = open(src_root.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        perror("打开挂载点失败");
+        return 1;
+    }
+    if (ioctl(fd, SIMPLEFS_IOC_RENAME, &args) != 0) {
+        perror("SIMPLEFS_IOC_RENAME失败");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+// 不带on/off时显示当前的压缩标志
+static int do_compress(int argc, char* argv[]) {
+    uint32_t enable = 0;
+    if (argc == 4 && std::strcmp(argv[3], "on") == 0) {
+        enable = 1;
+    } else if (argc == 4 && std::strcmp(argv[3], "off") == 0) {
+        enable = 0;
+    } else if (argc != 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    int fd = open(argv[2], O_RDONLY);
+    if (fd < 0) {
+        perror("打开文件失败");
+        return 1;
+    }
+    if (argc == 3) {
+        uint32_t compressed = 0;
+        if (ioctl(fd, SIMPLEFS_IOC_GET_COMPRESS, &compressed) != 0) {
+            perror("SIMPLEFS_IOC_GET_COMPRESS失败");
+            close(fd);
+            return 1;
+        }
+        std::cout << (compressed ? "on" : "off") << std::endl;
+    } else if (ioctl(fd, SIMPLEFS_IOC_SET_COMPRESS, &enable) != 0) {
+        perror("SIMPLEFS_IOC_SET_COMPRESS失败");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+// 快照在 <挂载点>/.snapshots/<快照名> 下浏览，创建和删除需要root
+static int do_snapshot(int argc, char* argv[]) {
+    if (argc != 5) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    unsigned long request;
+    if (std::strcmp(argv[2], "create") == 0) {
+        request = SIMPLEFS_IOC_SNAPSHOT_CREATE;
+    } else if (std::strcmp(argv[2], "delete") == 0) {
+        request = SIMPLEFS_IOC_SNAPSHOT_DELETE;
+    } else {
+        print_usage(argv[0]);
+        return 1;
+    }
+    SimpleFS_SnapshotArgs args{};
+    if (std::strlen(argv[4]) >= sizeof(args.name)) {
+        std::cerr << "快照名过长" << std::endl;
+        return 1;
+    }
+    std::strncpy(args.name, argv[4], sizeof(args.name) - 1);
+
+    char dir_real[PATH_MAX];
+    std::string mount_root;
+    if (!realpath(argv[3], dir_real) || !find_mount_root(dir_real, mount_root)) {
+        perror("查找挂载点失败");
+        return 1;
+    }
+    int fd = open(mount_root.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        perror("打开挂载点失败");
+        return 1;
+    }
+    if (ioctl(fd, request, &args) != 0) {
+        perror(request == SIMPLEFS_IOC_SNAPSHOT_CREATE ? "SIMPLEFS_IOC_SNAPSHOT_CREATE失败" : "SIMPLEFS_IOC_SNAPSHOT_DELETE失败");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+// 碎片整理的参数和统计，nftw回调只能通过全局变量访问
+static SimpleFS_DefragArgs defrag_template{};
+static uint64_t defrag_files = 0, defrag_fragmented = 0, defrag_extents_before = 0, defrag_extents_after = 0, defrag_blocks_moved = 0;
+static int defrag_errors = 0;
+
+static int defrag_one(const char* fpath, const struct stat* sb, int typeflag, struct FTW* ftwbuf) {
+    (void)ftwbuf;
+    if (typeflag != FTW_F && typeflag != FTW_D) return FTW_CONTINUE;
+    if (!S_ISREG(sb->st_mode) && !S_ISDIR(sb->st_mode)) return FTW_CONTINUE;
+    int fd = open(fpath, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) {
+        perror(fpath);
+        defrag_errors++;
+        return FTW_CONTINUE;
+    }
+    SimpleFS_DefragArgs args = defrag_template;
+    int res = ioctl(fd, SIMPLEFS_IOC_DEFRAG, &args);
+    int saved_errno = errno;
+    close(fd);
+    if (res != 0) {
+        // 快照目录只读，跳过整个子树；压缩文件不整理
+        if (saved_errno == EROFS) return typeflag == FTW_D ? FTW_SKIP_SUBTREE : FTW_CONTINUE;
+        if (saved_errno == EOPNOTSUPP) return FTW_CONTINUE;
+        errno = saved_errno;
+        perror(fpath);
+        defrag_errors++;
+        return FTW_CONTINUE;
+    }
+    defrag_files++;
+    defrag_extents_before += args.extents_before;
+    defrag_extents_after += args.extents_after;
+    defrag_blocks_moved += args.blocks_moved;
+    if (args.extents_before > 1) {
+        defrag_fragmented++;
+        std::cout << fpath << ": " << args.extents_before << " -> " << args.extents_after << " 段，迁移 "
+                  << args.blocks_moved << " 块" << std::endl;
+    }
+    return FTW_CONTINUE;
+}
+
+// 递归整理，不跨越挂载点，不跟随符号链接
+static int do_defrag(int argc, char* argv[]) {
+    int arg_idx = 2;
+    while (arg_idx < argc && argv[arg_idx][0] == '-') {
+        if (std::strcmp(argv[arg_idx], "-n") == 0) {
+            defrag_template.flags |= SIMPLEFS_DEFRAG_DRY_RUN;
+            arg_idx++;
+        } else if (std::strcmp(argv[arg_idx], "-r") == 0 && arg_idx + 1 < argc) {
+            defrag_template.max_kb_per_sec = static_cast<uint32_t>(std::strtoul(argv[arg_idx + 1], nullptr, 0));
+            arg_idx += 2;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (arg_idx >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    for (; arg_idx < argc; ++arg_idx) {
+        if (nftw(argv[arg_idx], defrag_one, 16, FTW_PHYS | FTW_MOUNT | FTW_ACTIONRETVAL) != 0) {
+            perror(argv[arg_idx]);
+            defrag_errors++;
+        }
+    }
+    std::cout << "文件 " << defrag_files << " 个，有碎片 " << defrag_fragmented << " 个，段数 "
+              << defrag_extents_before << " -> " << defrag_extents_after << "，迁移 " << defrag_blocks_moved << " 块" << std::endl;
+    return defrag_errors == 0 ? 0 : 1;
+}
+
+// 对整个文件系统下发FITRIM（同fstrim）
+static int do_trim(int argc, char* argv[]) {
+    struct fstrim_range range{};
+    range.len = UINT64_MAX;
+    int arg_idx = 2;
+    if (arg_idx + 1 < argc && std::strcmp(argv[arg_idx], "-m") == 0) {
+        range.minlen = std::strtoull(argv[arg_idx + 1], nullptr, 0) * 1024;
+        arg_idx += 2;
+    }
+    if (arg_idx + 1 != argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    char dir_real[PATH_MAX];
+    std::string mount_root;
+    if (!realpath(argv[arg_idx], dir_real) || !find_mount_root(dir_real, mount_root)) {
+        perror("查找挂载点失败");
+        return 1;
+    }
+    int fd = open(mount_root.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        perror("打开挂载点失败");
+        return 1;
+    }
+    if (ioctl(fd, FITRIM, &range) != 0) {
+        perror("FITRIM失败");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    std::cout << mount_root << ": 已discard " << range.len << " 字节" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (std::strcmp(argv[1], "seek") == 0) return do_seek(argc, argv);
+    if (std::strcmp(argv[1], "copy") == 0) return do_copy(argc, argv, false);
+    if (std::strcmp(argv[1], "clone") == 0) return do_copy(argc, argv, true);
+    if (std::strcmp(argv[1], "rename") == 0) return do_rename(argc, argv);
+    if (std::strcmp(argv[1], "compress") == 0) return do_compress(argc, argv);
+    if (std::strcmp(argv[1], "snapshot") == 0) return do_snapshot(argc, argv);
+    if (std::strcmp(argv[1], "defrag") == 0) return do_defrag(argc, argv);
+    if (std::strcmp(argv[1], "trim") == 0) return do_trim(argc, argv);
+    print_usage(argv[0]);
+    return 1;
+}